@@ -4374,6 +4374,7 @@ gum_quick_core_setup_atoms (GumQuickCore * self)
   GUM_SETUP_ATOM (address);
   GUM_SETUP_ATOM (autoClose);
   GUM_SETUP_ATOM (base);
+  GUM_SETUP_ATOM (bytesRead);
   GUM_SETUP_ATOM_NAMED (cachedInput, "$i");
   GUM_SETUP_ATOM_NAMED (cachedOutput, "$o");
   GUM_SETUP_ATOM (context);
@@ -4392,6 +4393,7 @@ gum_quick_core_setup_atoms (GumQuickCore * self)
   GUM_SETUP_ATOM (offset);
   GUM_SETUP_ATOM (operation);
   GUM_SETUP_ATOM (path);
+  GUM_SETUP_ATOM (pattern);
   GUM_SETUP_ATOM (pc);
   GUM_SETUP_ATOM (port);
   GUM_SETUP_ATOM (protection);
@@ -4446,6 +4448,7 @@ gum_quick_core_teardown_atoms (GumQuickCore * self)
   GUM_TEARDOWN_ATOM (address);
   GUM_TEARDOWN_ATOM (autoClose);
   GUM_TEARDOWN_ATOM (base);
+  GUM_TEARDOWN_ATOM (bytesRead);
   GUM_TEARDOWN_ATOM (cachedInput);
   GUM_TEARDOWN_ATOM (cachedOutput);
   GUM_TEARDOWN_ATOM (context);
@@ -4464,6 +4467,7 @@ gum_quick_core_teardown_atoms (GumQuickCore * self)
   GUM_TEARDOWN_ATOM (offset);
   GUM_TEARDOWN_ATOM (operation);
   GUM_TEARDOWN_ATOM (path);
+  GUM_TEARDOWN_ATOM (pattern);
   GUM_TEARDOWN_ATOM (pc);
   GUM_TEARDOWN_ATOM (port);
   GUM_TEARDOWN_ATOM (protection);
@@ -117,6 +117,7 @@ struct _GumQuickCore
   GUM_DECLARE_ATOM (address);
   GUM_DECLARE_ATOM (autoClose);
   GUM_DECLARE_ATOM (base);
+  GUM_DECLARE_ATOM (bytesRead);
   GUM_DECLARE_ATOM (cachedInput);
   GUM_DECLARE_ATOM (cachedOutput);
   GUM_DECLARE_ATOM (context);
@@ -135,6 +136,7 @@ struct _GumQuickCore
   GUM_DECLARE_ATOM (offset);
   GUM_DECLARE_ATOM (operation);
   GUM_DECLARE_ATOM (path);
+  GUM_DECLARE_ATOM (pattern);
   GUM_DECLARE_ATOM (pc);
   GUM_DECLARE_ATOM (port);
   GUM_DECLARE_ATOM (protection);
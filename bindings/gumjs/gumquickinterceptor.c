@@ -169,6 +169,8 @@ static void gum_quick_replace_entry_revert_and_free (
     GumQuickReplaceEntry * entry);
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_revert)
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_flush)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_set_stats_enabled)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_get_stats)
 
 GUMJS_DECLARE_FUNCTION (gumjs_invocation_listener_detach)
 static void gum_quick_invocation_listener_dispose (GObject * object);
@@ -286,6 +288,8 @@ static const JSCFunctionListEntry gumjs_interceptor_entries[] =
   JS_CFUNC_DEF ("_replace", 0, gumjs_interceptor_replace),
   JS_CFUNC_DEF ("revert", 0, gumjs_interceptor_revert),
   JS_CFUNC_DEF ("flush", 0, gumjs_interceptor_flush),
+  JS_CFUNC_DEF ("setStatsEnabled", 0, gumjs_interceptor_set_stats_enabled),
+  JS_CFUNC_DEF ("getStats", 0, gumjs_interceptor_get_stats),
 };
 
 static const JSClassDef gumjs_invocation_listener_def =
@@ -732,6 +736,47 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_flush)
   return JS_UNDEFINED;
 }
 
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_set_stats_enabled)
+{
+  GumQuickInterceptor * self;
+  gboolean enabled;
+
+  self = gumjs_get_parent_module (core);
+
+  if (!_gum_quick_args_parse (args, "t", &enabled))
+    return JS_EXCEPTION;
+
+  gum_interceptor_set_stats_enabled (self->interceptor, enabled);
+
+  return JS_UNDEFINED;
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_get_stats)
+{
+  GumQuickInterceptor * self;
+  gpointer target;
+  GumHookStats stats;
+  JSValue result;
+
+  self = gumjs_get_parent_module (core);
+
+  if (!_gum_quick_args_parse (args, "p", &target))
+    return JS_EXCEPTION;
+
+  if (!gum_interceptor_query_stats (self->interceptor, target, &stats))
+    return JS_NULL;
+
+  result = JS_NewObject (ctx);
+  JS_DefinePropertyValueStr (ctx, result, "hits",
+      JS_NewInt64 (ctx, stats.hits), JS_PROP_C_W_E);
+  JS_DefinePropertyValueStr (ctx, result, "listenerTime",
+      JS_NewInt64 (ctx, stats.listener_time), JS_PROP_C_W_E);
+  JS_DefinePropertyValueStr (ctx, result, "replacementTime",
+      JS_NewInt64 (ctx, stats.replacement_time), JS_PROP_C_W_E);
+
+  return result;
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_invocation_listener_detach)
 {
   GumQuickInterceptor * parent;
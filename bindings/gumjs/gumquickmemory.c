@@ -54,7 +54,9 @@ struct _GumMemoryPatchContext
 struct _GumMemoryScanContext
 {
   GumMemoryRange range;
+  GArray * ranges;
   GumMatchPattern * pattern;
+  GPtrArray * patterns;
   JSValue on_match;
   JSValue on_error;
   JSValue on_complete;
@@ -80,6 +82,7 @@ GUMJS_DECLARE_FUNCTION (gumjs_memory_patch_code)
 static void gum_memory_patch_context_apply (gpointer mem,
     GumMemoryPatchContext * self);
 GUMJS_DECLARE_FUNCTION (gumjs_memory_check_code_pointer)
+GUMJS_DECLARE_FUNCTION (gumjs_memory_read_batch)
 
 static JSValue gum_quick_memory_read (JSContext * ctx, GumMemoryValueType type,
     GumQuickArgs * args, GumQuickCore * core);
@@ -144,9 +147,22 @@ static void gum_memory_scan_context_free (GumMemoryScanContext * ctx);
 static void gum_memory_scan_context_run (GumMemoryScanContext * self);
 static gboolean gum_memory_scan_context_emit_match (GumAddress address,
     gsize size, GumMemoryScanContext * self);
+static gboolean gum_memory_scan_context_emit_multi_match (GumAddress address,
+    gsize size, guint pattern_index, GumMemoryScanContext * self);
+static gboolean gum_memory_scan_context_emit (GumMemoryScanContext * self,
+    GumAddress address, gsize size, gint pattern_index);
 GUMJS_DECLARE_FUNCTION (gumjs_memory_scan_sync)
 static gboolean gum_append_match (GumAddress address, gsize size,
     GumMemoryScanSyncContext * sc);
+static gboolean gum_append_multi_match (GumAddress address, gsize size,
+    guint pattern_index, GumMemoryScanSyncContext * sc);
+static gboolean gum_append_scan_match (GumMemoryScanSyncContext * sc,
+    GumAddress address, gsize size, gint pattern_index);
+static gboolean gum_quick_match_patterns_get (JSContext * ctx,
+    JSValueConst val, GumQuickCore * core, GumMatchPattern ** pattern,
+    GPtrArray ** patterns);
+GUMJS_DECLARE_FUNCTION (gumjs_memory_scan_ranges)
+GUMJS_DECLARE_FUNCTION (gumjs_memory_scan_ranges_sync)
 
 GUMJS_DECLARE_FUNCTION (gumjs_memory_access_monitor_enable)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_access_monitor_disable)
@@ -168,6 +184,7 @@ static const JSCFunctionListEntry gumjs_memory_entries[] =
   JS_CFUNC_DEF ("protect", 0, gumjs_memory_protect),
   JS_CFUNC_DEF ("_patchCode", 0, gumjs_memory_patch_code),
   JS_CFUNC_DEF ("_checkCodePointer", 0, gumjs_memory_check_code_pointer),
+  JS_CFUNC_DEF ("readBatch", 0, gumjs_memory_read_batch),
 
   GUMJS_EXPORT_MEMORY_READ_WRITE ("Pointer", POINTER),
   GUMJS_EXPORT_MEMORY_READ_WRITE ("S8", S8),
@@ -198,6 +215,8 @@ static const JSCFunctionListEntry gumjs_memory_entries[] =
 
   JS_CFUNC_DEF ("scan", 0, gumjs_memory_scan),
   JS_CFUNC_DEF ("scanSync", 0, gumjs_memory_scan_sync),
+  JS_CFUNC_DEF ("scanRanges", 0, gumjs_memory_scan_ranges),
+  JS_CFUNC_DEF ("scanRangesSync", 0, gumjs_memory_scan_ranges_sync),
 };
 
 static const JSCFunctionListEntry gumjs_memory_access_monitor_entries[] =
@@ -414,6 +433,50 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_check_code_pointer)
   return result;
 }
 
+GUMJS_DEFINE_FUNCTION (gumjs_memory_read_batch)
+{
+  JSValue result, bytes_read;
+  GArray * ranges;
+  gsize total_size, * n_bytes_read;
+  guint i;
+  guint8 * buffer_data;
+
+  if (!_gum_quick_args_parse (args, "R", &ranges))
+    return JS_EXCEPTION;
+
+  total_size = 0;
+  for (i = 0; i != ranges->len; i++)
+  {
+    const GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, i);
+
+    if (r->size > G_MAXSIZE - total_size)
+      return _gum_quick_throw_literal (ctx, "ranges are too large");
+    total_size += r->size;
+  }
+
+  buffer_data = g_malloc (total_size);
+  n_bytes_read = g_new (gsize, ranges->len);
+
+  gum_memory_read_batch ((const GumMemoryRange *) ranges->data, ranges->len,
+      buffer_data, n_bytes_read);
+
+  result = JS_NewArrayBuffer (ctx, buffer_data, total_size,
+      _gum_quick_array_buffer_free, buffer_data, FALSE);
+
+  bytes_read = JS_NewArray (ctx);
+  for (i = 0; i != ranges->len; i++)
+  {
+    JS_DefinePropertyValueUint32 (ctx, bytes_read, i,
+        JS_NewInt64 (ctx, n_bytes_read[i]), JS_PROP_C_W_E);
+  }
+  JS_DefinePropertyValue (ctx, result, GUM_QUICK_CORE_ATOM (core, bytesRead),
+      bytes_read, JS_PROP_C_W_E);
+
+  g_free (n_bytes_read);
+
+  return result;
+}
+
 static JSValue
 gum_quick_memory_read (JSContext * ctx,
                        GumMemoryValueType type,
@@ -907,20 +970,22 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_scan)
   GumMemoryScanContext sc;
   gpointer address;
   gsize size;
-  const gchar * match_str;
+  JSValue pattern_val;
 
-  if (!_gum_quick_args_parse (args, "pZsF{onMatch,onError?,onComplete}",
-      &address, &size, &match_str, &sc.on_match, &sc.on_error, &sc.on_complete))
+  if (!_gum_quick_args_parse (args, "pZVF{onMatch,onError?,onComplete}",
+      &address, &size, &pattern_val, &sc.on_match, &sc.on_error,
+      &sc.on_complete))
     return JS_EXCEPTION;
   sc.range.base_address = GUM_ADDRESS (address);
   sc.range.size = size;
-  sc.pattern = gum_match_pattern_new_from_string (match_str);
+  sc.ranges = NULL;
   sc.result = GUM_QUICK_MATCH_CONTINUE;
   sc.ctx = ctx;
   sc.core = core;
 
-  if (sc.pattern == NULL)
-    return _gum_quick_throw_literal (ctx, "invalid match pattern");
+  if (!gum_quick_match_patterns_get (ctx, pattern_val, core, &sc.pattern,
+      &sc.patterns))
+    return JS_EXCEPTION;
 
   JS_DupValue (ctx, sc.on_match);
   JS_DupValue (ctx, sc.on_error);
@@ -951,7 +1016,12 @@ gum_memory_scan_context_free (GumMemoryScanContext * self)
   _gum_quick_core_unpin (core);
   _gum_quick_scope_leave (&scope);
 
-  gum_match_pattern_free (self->pattern);
+  if (self->pattern != NULL)
+    gum_match_pattern_free (self->pattern);
+  if (self->patterns != NULL)
+    g_ptr_array_unref (self->patterns);
+  if (self->ranges != NULL)
+    g_array_free (self->ranges, TRUE);
 
   g_slice_free (GumMemoryScanContext, self);
 }
@@ -964,29 +1034,64 @@ gum_memory_scan_context_run (GumMemoryScanContext * self)
   GumExceptor * exceptor = core->exceptor;
   GumExceptorScope exceptor_scope;
   GumQuickScope script_scope;
+  gchar * error_message = NULL;
+
+  if (self->ranges != NULL)
+  {
+    GError * error = NULL;
 
-  if (gum_exceptor_try (exceptor, &exceptor_scope))
+    if (!gum_memory_scan_ranges ((const GumMemoryRange *) self->ranges->data,
+        self->ranges->len, self->pattern,
+        (GumMemoryScanMatchFunc) gum_memory_scan_context_emit_match, self,
+        &error))
+    {
+      error_message = g_strdup (error->message);
+      g_error_free (error);
+    }
+  }
+  else
   {
-    gum_memory_scan (&self->range, self->pattern,
-        (GumMemoryScanMatchFunc) gum_memory_scan_context_emit_match, self);
+    if (gum_exceptor_try (exceptor, &exceptor_scope))
+    {
+      if (self->patterns != NULL)
+      {
+        gum_memory_scan_multi (&self->range,
+            (const GumMatchPattern * const *) self->patterns->pdata,
+            self->patterns->len,
+            (GumMemoryScanMultiMatchFunc)
+                gum_memory_scan_context_emit_multi_match,
+            self);
+      }
+      else
+      {
+        gum_memory_scan (&self->range, self->pattern,
+            (GumMemoryScanMatchFunc) gum_memory_scan_context_emit_match,
+            self);
+      }
+    }
+
+    if (gum_exceptor_catch (exceptor, &exceptor_scope))
+    {
+      error_message =
+          gum_exception_details_to_string (&exceptor_scope.exception);
+    }
   }
 
   _gum_quick_scope_enter (&script_scope, core);
 
-  if (gum_exceptor_catch (exceptor, &exceptor_scope))
+  if (error_message != NULL)
   {
     if (!JS_IsNull (self->on_error))
     {
-      gchar * message;
       JSValue message_val;
 
-      message = gum_exception_details_to_string (&exceptor_scope.exception);
-      message_val = JS_NewString (ctx, message);
-      g_free (message);
+      message_val = JS_NewString (ctx, error_message);
 
       _gum_quick_scope_call_void (&script_scope, self->on_error, JS_UNDEFINED,
           1, &message_val);
     }
+
+    g_free (error_message);
   }
 
   if (self->result != GUM_QUICK_MATCH_ERROR)
@@ -1002,12 +1107,30 @@ static gboolean
 gum_memory_scan_context_emit_match (GumAddress address,
                                     gsize size,
                                     GumMemoryScanContext * self)
+{
+  return gum_memory_scan_context_emit (self, address, size, -1);
+}
+
+static gboolean
+gum_memory_scan_context_emit_multi_match (GumAddress address,
+                                          gsize size,
+                                          guint pattern_index,
+                                          GumMemoryScanContext * self)
+{
+  return gum_memory_scan_context_emit (self, address, size, pattern_index);
+}
+
+static gboolean
+gum_memory_scan_context_emit (GumMemoryScanContext * self,
+                              GumAddress address,
+                              gsize size,
+                              gint pattern_index)
 {
   gboolean proceed;
   JSContext * ctx = self->ctx;
   GumQuickCore * core = self->core;
   GumQuickScope scope;
-  JSValue argv[2];
+  JSValue argv[3];
   JSValue result;
 
   _gum_quick_scope_enter (&scope, core);
@@ -1015,9 +1138,10 @@ gum_memory_scan_context_emit_match (GumAddress address,
   argv[0] = _gum_quick_native_pointer_new (ctx, GSIZE_TO_POINTER (address),
       core);
   argv[1] = JS_NewUint32 (ctx, size);
+  argv[2] = JS_NewInt32 (ctx, pattern_index);
 
   result = _gum_quick_scope_call (&scope, self->on_match, JS_UNDEFINED,
-      G_N_ELEMENTS (argv), argv);
+      (pattern_index != -1) ? 3 : 2, argv);
 
   JS_FreeValue (ctx, argv[0]);
 
@@ -1033,20 +1157,21 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_sync)
   JSValue result;
   gpointer address;
   gsize size;
-  const gchar * match_str;
+  JSValue pattern_val;
   GumMemoryRange range;
   GumMatchPattern * pattern;
+  GPtrArray * patterns;
   GumExceptorScope scope;
 
-  if (!_gum_quick_args_parse (args, "pZs", &address, &size, &match_str))
+  if (!_gum_quick_args_parse (args, "pZV", &address, &size, &pattern_val))
     return JS_EXCEPTION;
 
   range.base_address = GUM_ADDRESS (address);
   range.size = size;
 
-  pattern = gum_match_pattern_new_from_string (match_str);
-  if (pattern == NULL)
-    return _gum_quick_throw_literal (ctx, "invalid match pattern");
+  if (!gum_quick_match_patterns_get (ctx, pattern_val, core, &pattern,
+      &patterns))
+    return JS_EXCEPTION;
 
   result = JS_NewArray (ctx);
 
@@ -1059,11 +1184,23 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_sync)
     sc.ctx = ctx;
     sc.core = core;
 
-    gum_memory_scan (&range, pattern, (GumMemoryScanMatchFunc) gum_append_match,
-        &sc);
+    if (patterns != NULL)
+    {
+      gum_memory_scan_multi (&range,
+          (const GumMatchPattern * const *) patterns->pdata, patterns->len,
+          (GumMemoryScanMultiMatchFunc) gum_append_multi_match, &sc);
+    }
+    else
+    {
+      gum_memory_scan (&range, pattern,
+          (GumMemoryScanMatchFunc) gum_append_match, &sc);
+    }
   }
 
-  gum_match_pattern_free (pattern);
+  if (patterns != NULL)
+    g_ptr_array_unref (patterns);
+  else
+    gum_match_pattern_free (pattern);
 
   if (gum_exceptor_catch (core->exceptor, &scope))
   {
@@ -1078,6 +1215,24 @@ static gboolean
 gum_append_match (GumAddress address,
                   gsize size,
                   GumMemoryScanSyncContext * sc)
+{
+  return gum_append_scan_match (sc, address, size, -1);
+}
+
+static gboolean
+gum_append_multi_match (GumAddress address,
+                        gsize size,
+                        guint pattern_index,
+                        GumMemoryScanSyncContext * sc)
+{
+  return gum_append_scan_match (sc, address, size, pattern_index);
+}
+
+static gboolean
+gum_append_scan_match (GumMemoryScanSyncContext * sc,
+                       GumAddress address,
+                       gsize size,
+                       gint pattern_index)
 {
   JSContext * ctx = sc->ctx;
   GumQuickCore * core = sc->core;
@@ -1090,6 +1245,12 @@ gum_append_match (GumAddress address,
   JS_DefinePropertyValue (ctx, m, GUM_QUICK_CORE_ATOM (core, size),
       JS_NewUint32 (ctx, size),
       JS_PROP_C_W_E);
+  if (pattern_index != -1)
+  {
+    JS_DefinePropertyValue (ctx, m, GUM_QUICK_CORE_ATOM (core, pattern),
+        JS_NewInt32 (ctx, pattern_index),
+        JS_PROP_C_W_E);
+  }
 
   JS_DefinePropertyValueUint32 (ctx, sc->matches, sc->index, m, JS_PROP_C_W_E);
   sc->index++;
@@ -1097,6 +1258,167 @@ gum_append_match (GumAddress address,
   return TRUE;
 }
 
+/*
+ * Accepts either a single pattern string, or an array of them to be matched
+ * in a single pass. In the latter case each match also reports the index of
+ * the pattern that it belongs to.
+ */
+static gboolean
+gum_quick_match_patterns_get (JSContext * ctx,
+                              JSValueConst val,
+                              GumQuickCore * core,
+                              GumMatchPattern ** pattern,
+                              GPtrArray ** patterns)
+{
+  GPtrArray * result;
+  guint n, i;
+
+  *pattern = NULL;
+  *patterns = NULL;
+
+  if (JS_IsString (val))
+  {
+    const char * str;
+
+    str = JS_ToCString (ctx, val);
+    *pattern = gum_match_pattern_new_from_string (str);
+    JS_FreeCString (ctx, str);
+
+    if (*pattern == NULL)
+      goto invalid_pattern;
+
+    return TRUE;
+  }
+
+  if (!JS_IsArray (ctx, val))
+    goto expected_patterns;
+
+  if (!_gum_quick_array_get_length (ctx, val, core, &n))
+    return FALSE;
+  if (n == 0)
+    goto expected_patterns;
+
+  result = g_ptr_array_new_full (n, (GDestroyNotify) gum_match_pattern_free);
+
+  for (i = 0; i != n; i++)
+  {
+    JSValue element;
+    const char * str;
+    GumMatchPattern * p;
+
+    element = JS_GetPropertyUint32 (ctx, val, i);
+    if (!JS_IsString (element))
+    {
+      JS_FreeValue (ctx, element);
+      g_ptr_array_unref (result);
+      goto expected_patterns;
+    }
+
+    str = JS_ToCString (ctx, element);
+    p = gum_match_pattern_new_from_string (str);
+    JS_FreeCString (ctx, str);
+    JS_FreeValue (ctx, element);
+
+    if (p == NULL)
+    {
+      g_ptr_array_unref (result);
+      goto invalid_pattern;
+    }
+
+    g_ptr_array_add (result, p);
+  }
+
+  *patterns = result;
+
+  return TRUE;
+
+expected_patterns:
+  {
+    _gum_quick_throw_literal (ctx,
+        "expected a match pattern or an array of them");
+    return FALSE;
+  }
+invalid_pattern:
+  {
+    _gum_quick_throw_literal (ctx, "invalid match pattern");
+    return FALSE;
+  }
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_ranges)
+{
+  GumMemoryScanContext sc;
+  GArray * ranges;
+  const gchar * match_str;
+
+  if (!_gum_quick_args_parse (args, "RsF{onMatch,onError?,onComplete}",
+      &ranges, &match_str, &sc.on_match, &sc.on_error, &sc.on_complete))
+    return JS_EXCEPTION;
+  sc.range.base_address = 0;
+  sc.range.size = 0;
+  sc.pattern = gum_match_pattern_new_from_string (match_str);
+  sc.patterns = NULL;
+  sc.result = GUM_QUICK_MATCH_CONTINUE;
+  sc.ctx = ctx;
+  sc.core = core;
+
+  if (sc.pattern == NULL)
+    return _gum_quick_throw_literal (ctx, "invalid match pattern");
+
+  sc.ranges = g_array_sized_new (FALSE, FALSE, sizeof (GumMemoryRange),
+      ranges->len);
+  g_array_append_vals (sc.ranges, ranges->data, ranges->len);
+
+  JS_DupValue (ctx, sc.on_match);
+  JS_DupValue (ctx, sc.on_error);
+  JS_DupValue (ctx, sc.on_complete);
+
+  _gum_quick_core_pin (core);
+  _gum_quick_core_push_job (core,
+      (GumScriptJobFunc) gum_memory_scan_context_run,
+      g_slice_dup (GumMemoryScanContext, &sc),
+      (GDestroyNotify) gum_memory_scan_context_free);
+
+  return JS_UNDEFINED;
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_ranges_sync)
+{
+  JSValue result;
+  GArray * ranges;
+  const gchar * match_str;
+  GumMatchPattern * pattern;
+  GumMemoryScanSyncContext sc;
+  GError * error = NULL;
+
+  if (!_gum_quick_args_parse (args, "Rs", &ranges, &match_str))
+    return JS_EXCEPTION;
+
+  pattern = gum_match_pattern_new_from_string (match_str);
+  if (pattern == NULL)
+    return _gum_quick_throw_literal (ctx, "invalid match pattern");
+
+  result = JS_NewArray (ctx);
+
+  sc.matches = result;
+  sc.index = 0;
+  sc.ctx = ctx;
+  sc.core = core;
+
+  gum_memory_scan_ranges ((const GumMemoryRange *) ranges->data, ranges->len,
+      pattern, (GumMemoryScanMatchFunc) gum_append_match, &sc, &error);
+
+  gum_match_pattern_free (pattern);
+
+  if (error != NULL)
+  {
+    JS_FreeValue (ctx, result);
+    result = _gum_quick_throw_error (ctx, &error);
+  }
+
+  return result;
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_memory_access_monitor_enable)
 {
   GumQuickMemory * self;
@@ -79,6 +79,8 @@ static gboolean gum_quick_stalker_on_flush_timer_tick (GumQuickStalker * self);
 
 GUMJS_DECLARE_GETTER (gumjs_stalker_get_trust_threshold)
 GUMJS_DECLARE_SETTER (gumjs_stalker_set_trust_threshold)
+GUMJS_DECLARE_GETTER (gumjs_stalker_get_ic_entries)
+GUMJS_DECLARE_SETTER (gumjs_stalker_set_ic_entries)
 
 GUMJS_DECLARE_GETTER (gumjs_stalker_get_queue_capacity)
 GUMJS_DECLARE_SETTER (gumjs_stalker_set_queue_capacity)
@@ -95,6 +97,10 @@ GUMJS_DECLARE_FUNCTION (gumjs_stalker_add_call_probe)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_remove_call_probe)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_parse)
 
+static gboolean gum_quick_rule_transformer_get (JSContext * ctx,
+    JSValueConst rules, GumQuickCore * core,
+    GumStalkerTransformer ** transformer);
+
 static void gum_quick_transformer_iface_init (gpointer g_iface,
     gpointer iface_data);
 static void gum_quick_transformer_dispose (GObject * object);
@@ -169,6 +175,8 @@ static const JSCFunctionListEntry gumjs_stalker_entries[] =
 {
   JS_CGETSET_DEF ("trustThreshold", gumjs_stalker_get_trust_threshold,
       gumjs_stalker_set_trust_threshold),
+  JS_CGETSET_DEF ("icEntries", gumjs_stalker_get_ic_entries,
+      gumjs_stalker_set_ic_entries),
   JS_CGETSET_DEF ("queueCapacity", gumjs_stalker_get_queue_capacity,
       gumjs_stalker_set_queue_capacity),
   JS_CGETSET_DEF ("queueDrainInterval", gumjs_stalker_get_queue_drain_interval,
@@ -428,6 +436,29 @@ GUMJS_DEFINE_SETTER (gumjs_stalker_set_trust_threshold)
   return JS_UNDEFINED;
 }
 
+GUMJS_DEFINE_GETTER (gumjs_stalker_get_ic_entries)
+{
+  GumStalker * stalker =
+      _gum_quick_stalker_get (gumjs_get_parent_module (core));
+
+  return JS_NewUint32 (ctx, gum_stalker_get_ic_entries (stalker));
+}
+
+GUMJS_DEFINE_SETTER (gumjs_stalker_set_ic_entries)
+{
+  GumStalker * stalker;
+  guint ic_entries;
+
+  stalker = _gum_quick_stalker_get (gumjs_get_parent_module (core));
+
+  if (!_gum_quick_uint_get (ctx, val, &ic_entries))
+    return JS_EXCEPTION;
+
+  gum_stalker_set_ic_entries (stalker, ic_entries);
+
+  return JS_UNDEFINED;
+}
+
 GUMJS_DEFINE_GETTER (gumjs_stalker_get_queue_capacity)
 {
   GumQuickStalker * self = gumjs_get_parent_module (core);
@@ -509,6 +540,7 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
   GumThreadId thread_id;
   JSValue transformer_callback_js;
   GumStalkerTransformerCallback transformer_callback_c;
+  JSValue transformer_rules;
   GumQuickEventSinkOptions so;
   gpointer user_data;
   GumStalkerTransformer * transformer;
@@ -522,14 +554,21 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
   so.queue_capacity = parent->queue_capacity;
   so.queue_drain_interval = parent->queue_drain_interval;
 
-  if (!_gum_quick_args_parse (args, "ZF*?uF?F?pp", &thread_id,
-      &transformer_callback_js, &transformer_callback_c, &so.event_mask,
-      &so.on_receive, &so.on_call_summary, &so.on_event, &user_data))
+  if (!_gum_quick_args_parse (args, "ZF*?A?uF?F?pp", &thread_id,
+      &transformer_callback_js, &transformer_callback_c, &transformer_rules,
+      &so.event_mask, &so.on_receive, &so.on_call_summary, &so.on_event,
+      &user_data))
     return JS_EXCEPTION;
 
   so.user_data = user_data;
 
-  if (!JS_IsNull (transformer_callback_js))
+  if (!JS_IsNull (transformer_rules))
+  {
+    if (!gum_quick_rule_transformer_get (ctx, transformer_rules, core,
+        &transformer))
+      return JS_EXCEPTION;
+  }
+  else if (!JS_IsNull (transformer_callback_js))
   {
     GumQuickTransformer * cbt;
 
@@ -573,6 +612,119 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
   return JS_UNDEFINED;
 }
 
+static gboolean
+gum_quick_rule_transformer_get (JSContext * ctx,
+                                JSValueConst rules,
+                                GumQuickCore * core,
+                                GumStalkerTransformer ** transformer)
+{
+  GumRuleStalkerTransformer * rt;
+  guint n, i;
+  JSValue rule = JS_NULL;
+  JSValue kind_val = JS_NULL;
+  JSValue val = JS_NULL;
+  const char * kind = NULL;
+  const char * mnemonic = NULL;
+
+  rt = gum_rule_stalker_transformer_new ();
+
+  if (!_gum_quick_array_get_length (ctx, rules, core, &n))
+    goto propagate_exception;
+
+  for (i = 0; i != n; i++)
+  {
+    GumMemoryRange range;
+
+    rule = JS_GetPropertyUint32 (ctx, rules, i);
+    kind_val = JS_GetPropertyUint32 (ctx, rule, 0);
+    if (!_gum_quick_string_get (ctx, kind_val, &kind))
+      goto propagate_exception;
+
+    if (strcmp (kind, "callout") == 0)
+    {
+      gpointer callout, data;
+
+      val = JS_GetPropertyUint32 (ctx, rule, 1);
+      if (!_gum_quick_string_get (ctx, val, &mnemonic))
+        goto propagate_exception;
+      JS_FreeValue (ctx, val);
+
+      val = JS_GetPropertyUint32 (ctx, rule, 2);
+      if (!_gum_quick_native_pointer_get (ctx, val, core, &callout))
+        goto propagate_exception;
+      JS_FreeValue (ctx, val);
+
+      val = JS_GetPropertyUint32 (ctx, rule, 3);
+      if (!_gum_quick_native_pointer_get (ctx, val, core, &data))
+        goto propagate_exception;
+      JS_FreeValue (ctx, val);
+      val = JS_NULL;
+
+      gum_rule_stalker_transformer_add_callout (rt, mnemonic,
+          GUM_POINTER_TO_FUNCPTR (GumStalkerCallout, callout), data, NULL);
+
+      JS_FreeCString (ctx, mnemonic);
+      mnemonic = NULL;
+    }
+    else if (strcmp (kind, "drop") == 0)
+    {
+      val = JS_GetPropertyUint32 (ctx, rule, 1);
+      if (!_gum_quick_memory_range_get (ctx, val, core, &range))
+        goto propagate_exception;
+      JS_FreeValue (ctx, val);
+      val = JS_NULL;
+
+      gum_rule_stalker_transformer_add_drop (rt, &range);
+    }
+    else if (strcmp (kind, "count") == 0)
+    {
+      gpointer counter;
+
+      val = JS_GetPropertyUint32 (ctx, rule, 1);
+      if (!_gum_quick_memory_range_get (ctx, val, core, &range))
+        goto propagate_exception;
+      JS_FreeValue (ctx, val);
+
+      val = JS_GetPropertyUint32 (ctx, rule, 2);
+      if (!_gum_quick_native_pointer_get (ctx, val, core, &counter))
+        goto propagate_exception;
+      JS_FreeValue (ctx, val);
+      val = JS_NULL;
+
+      gum_rule_stalker_transformer_add_block_counter (rt, &range, counter);
+    }
+    else
+    {
+      _gum_quick_throw_literal (ctx, "invalid transform rule");
+      goto propagate_exception;
+    }
+
+    JS_FreeCString (ctx, kind);
+    kind = NULL;
+    JS_FreeValue (ctx, kind_val);
+    kind_val = JS_NULL;
+    JS_FreeValue (ctx, rule);
+    rule = JS_NULL;
+  }
+
+  *transformer = GUM_STALKER_TRANSFORMER (rt);
+
+  return TRUE;
+
+propagate_exception:
+  {
+    JS_FreeCString (ctx, mnemonic);
+    JS_FreeCString (ctx, kind);
+    JS_FreeValue (ctx, val);
+    JS_FreeValue (ctx, kind_val);
+    JS_FreeValue (ctx, rule);
+
+    g_object_unref (rt);
+
+    return FALSE;
+  }
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_stalker_unfollow)
 {
   GumQuickStalker * parent;
@@ -748,6 +900,20 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse)
 
         break;
       }
+      case GUM_MEMORY:
+      {
+        const GumMemoryEvent * memory = &ev->memory;
+
+        if (annotate)
+          GUM_APPEND_STR ("memory");
+        GUM_APPEND_PTR (memory->location);
+        GUM_APPEND_PTR (memory->address);
+        GUM_APPEND_INT (memory->size);
+        GUM_APPEND_VAL (_gum_quick_memory_operation_new (ctx,
+            memory->operation));
+
+        break;
+      }
       default:
         goto invalid_event_type;
     }
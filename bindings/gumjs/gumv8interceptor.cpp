@@ -148,6 +148,8 @@ GUMJS_DECLARE_FUNCTION (gumjs_interceptor_replace)
 static void gum_v8_replace_entry_free (GumV8ReplaceEntry * entry);
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_revert)
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_flush)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_set_stats_enabled)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_get_stats)
 
 GUMJS_DECLARE_FUNCTION (gumjs_invocation_listener_detach)
 static void gum_v8_invocation_listener_dispose (GObject * object);
@@ -269,6 +271,8 @@ static const GumV8Function gumjs_interceptor_functions[] =
   { "_replace", gumjs_interceptor_replace },
   { "revert", gumjs_interceptor_revert },
   { "flush", gumjs_interceptor_flush },
+  { "setStatsEnabled", gumjs_interceptor_set_stats_enabled },
+  { "getStats", gumjs_interceptor_get_stats },
 
   { NULL, NULL }
 };
@@ -767,6 +771,38 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_flush)
   gum_interceptor_begin_transaction (interceptor);
 }
 
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_set_stats_enabled)
+{
+  gboolean enabled;
+  if (!_gum_v8_args_parse (args, "t", &enabled))
+    return;
+
+  gum_interceptor_set_stats_enabled (module->interceptor, enabled);
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_get_stats)
+{
+  gpointer target;
+  if (!_gum_v8_args_parse (args, "p", &target))
+    return;
+
+  GumHookStats stats;
+  if (!gum_interceptor_query_stats (module->interceptor, target, &stats))
+  {
+    info.GetReturnValue ().SetNull ();
+    return;
+  }
+
+  auto result = Object::New (isolate);
+  _gum_v8_object_set (result, "hits",
+      Number::New (isolate, (double) stats.hits), core);
+  _gum_v8_object_set (result, "listenerTime",
+      Number::New (isolate, (double) stats.listener_time), core);
+  _gum_v8_object_set (result, "replacementTime",
+      Number::New (isolate, (double) stats.replacement_time), core);
+  info.GetReturnValue ().Set (result);
+}
+
 GUMJS_DEFINE_CLASS_METHOD (gumjs_invocation_listener_detach,
                            GumV8InvocationListener)
 {
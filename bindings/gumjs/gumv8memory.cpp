@@ -55,7 +55,9 @@ struct GumMemoryPatchContext
 struct GumMemoryScanContext
 {
   GumMemoryRange range;
+  GArray * ranges;
   GumMatchPattern * pattern;
+  GPtrArray * patterns;
   GumPersistent<Function>::type * on_match;
   GumPersistent<Function>::type * on_error;
   GumPersistent<Function>::type * on_complete;
@@ -77,6 +79,7 @@ GUMJS_DECLARE_FUNCTION (gumjs_memory_patch_code)
 static void gum_memory_patch_context_apply (gpointer mem,
     GumMemoryPatchContext * self);
 GUMJS_DECLARE_FUNCTION (gumjs_memory_check_code_pointer)
+GUMJS_DECLARE_FUNCTION (gumjs_memory_read_batch)
 
 static void gum_v8_memory_read (GumMemoryValueType type,
     const GumV8Args * args, ReturnValue<Value> return_value);
@@ -138,9 +141,21 @@ static void gum_memory_scan_context_free (GumMemoryScanContext * self);
 static void gum_memory_scan_context_run (GumMemoryScanContext * self);
 static gboolean gum_memory_scan_context_emit_match (GumAddress address,
     gsize size, GumMemoryScanContext * self);
+static gboolean gum_memory_scan_context_emit_multi_match (GumAddress address,
+    gsize size, guint pattern_index, GumMemoryScanContext * self);
+static gboolean gum_memory_scan_context_emit (GumMemoryScanContext * self,
+    GumAddress address, gsize size, gint pattern_index);
 GUMJS_DECLARE_FUNCTION (gumjs_memory_scan_sync)
 static gboolean gum_append_match (GumAddress address, gsize size,
     GumMemoryScanSyncContext * ctx);
+static gboolean gum_append_multi_match (GumAddress address, gsize size,
+    guint pattern_index, GumMemoryScanSyncContext * ctx);
+static gboolean gum_append_scan_match (GumMemoryScanSyncContext * ctx,
+    GumAddress address, gsize size, gint pattern_index);
+static gboolean gum_v8_match_patterns_get (Local<Value> value,
+    GumMatchPattern ** pattern, GPtrArray ** patterns, GumV8Core * core);
+GUMJS_DECLARE_FUNCTION (gumjs_memory_scan_ranges)
+GUMJS_DECLARE_FUNCTION (gumjs_memory_scan_ranges_sync)
 
 GUMJS_DECLARE_FUNCTION (gumjs_memory_access_monitor_enable)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_access_monitor_disable)
@@ -155,6 +170,7 @@ static const GumV8Function gumjs_memory_functions[] =
   { "protect", gumjs_memory_protect },
   { "_patchCode", gumjs_memory_patch_code },
   { "_checkCodePointer", gumjs_memory_check_code_pointer },
+  { "readBatch", gumjs_memory_read_batch },
 
   GUMJS_EXPORT_MEMORY_READ_WRITE ("Pointer", POINTER),
   GUMJS_EXPORT_MEMORY_READ_WRITE ("S8", S8),
@@ -185,6 +201,8 @@ static const GumV8Function gumjs_memory_functions[] =
 
   { "scan", gumjs_memory_scan },
   { "scanSync", gumjs_memory_scan_sync },
+  { "scanRanges", gumjs_memory_scan_ranges },
+  { "scanRangesSync", gumjs_memory_scan_ranges_sync },
 
   { NULL, NULL }
 };
@@ -379,6 +397,46 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_check_code_pointer)
   }
 }
 
+GUMJS_DEFINE_FUNCTION (gumjs_memory_read_batch)
+{
+  GArray * ranges;
+  if (!_gum_v8_args_parse (args, "R", &ranges))
+    return;
+
+  gsize total_size = 0;
+  for (guint i = 0; i != ranges->len; i++)
+  {
+    auto r = &g_array_index (ranges, GumMemoryRange, i);
+
+    if (r->size > G_MAXSIZE - total_size)
+    {
+      _gum_v8_throw_ascii_literal (isolate, "ranges are too large");
+      return;
+    }
+    total_size += r->size;
+  }
+
+  auto buffer = ArrayBuffer::New (isolate, total_size);
+  auto store = buffer->GetBackingStore ();
+  auto n_bytes_read = g_new (gsize, ranges->len);
+
+  gum_memory_read_batch ((const GumMemoryRange *) ranges->data, ranges->len,
+      (guint8 *) store->Data (), n_bytes_read);
+
+  auto context = isolate->GetCurrentContext ();
+  auto bytes_read = Array::New (isolate, ranges->len);
+  for (guint i = 0; i != ranges->len; i++)
+  {
+    bytes_read->Set (context, i,
+        Number::New (isolate, (double) n_bytes_read[i])).Check ();
+  }
+  _gum_v8_object_set (buffer, "bytesRead", bytes_read, core);
+
+  g_free (n_bytes_read);
+
+  info.GetReturnValue ().Set (buffer);
+}
+
 static void
 gum_v8_memory_read (GumMemoryValueType type,
                     const GumV8Args * args,
@@ -886,39 +944,34 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_scan)
 {
   gpointer address;
   gsize size;
-  gchar * match_str;
+  Local<Value> pattern_value;
   Local<Function> on_match, on_error, on_complete;
-  if (!_gum_v8_args_parse (args, "pZsF{onMatch,onError?,onComplete}",
-      &address, &size, &match_str, &on_match, &on_error, &on_complete))
+  if (!_gum_v8_args_parse (args, "pZVF{onMatch,onError?,onComplete}",
+      &address, &size, &pattern_value, &on_match, &on_error, &on_complete))
     return;
 
   GumMemoryRange range;
   range.base_address = GUM_ADDRESS (address);
   range.size = size;
 
-  auto pattern = gum_match_pattern_new_from_string (match_str);
-
-  g_free (match_str);
-
-  if (pattern != NULL)
-  {
-    auto ctx = g_slice_new0 (GumMemoryScanContext);
-    ctx->range = range;
-    ctx->pattern = pattern;
-    ctx->on_match = new GumPersistent<Function>::type (isolate, on_match);
-    if (!on_error.IsEmpty ())
-      ctx->on_error = new GumPersistent<Function>::type (isolate, on_error);
-    ctx->on_complete = new GumPersistent<Function>::type (isolate, on_complete);
-    ctx->core = core;
+  GumMatchPattern * pattern;
+  GPtrArray * patterns;
+  if (!gum_v8_match_patterns_get (pattern_value, &pattern, &patterns, core))
+    return;
 
-    _gum_v8_core_pin (core);
-    _gum_v8_core_push_job (core, (GumScriptJobFunc) gum_memory_scan_context_run,
-        ctx, (GDestroyNotify) gum_memory_scan_context_free);
-  }
-  else
-  {
-    _gum_v8_throw_ascii_literal (isolate, "invalid match pattern");
-  }
+  auto ctx = g_slice_new0 (GumMemoryScanContext);
+  ctx->range = range;
+  ctx->pattern = pattern;
+  ctx->patterns = patterns;
+  ctx->on_match = new GumPersistent<Function>::type (isolate, on_match);
+  if (!on_error.IsEmpty ())
+    ctx->on_error = new GumPersistent<Function>::type (isolate, on_error);
+  ctx->on_complete = new GumPersistent<Function>::type (isolate, on_complete);
+  ctx->core = core;
+
+  _gum_v8_core_pin (core);
+  _gum_v8_core_push_job (core, (GumScriptJobFunc) gum_memory_scan_context_run,
+      ctx, (GDestroyNotify) gum_memory_scan_context_free);
 }
 
 static void
@@ -926,7 +979,12 @@ gum_memory_scan_context_free (GumMemoryScanContext * self)
 {
   auto core = self->core;
 
-  gum_match_pattern_free (self->pattern);
+  if (self->pattern != NULL)
+    gum_match_pattern_free (self->pattern);
+  if (self->patterns != NULL)
+    g_ptr_array_unref (self->patterns);
+  if (self->ranges != NULL)
+    g_array_free (self->ranges, TRUE);
 
   {
     ScriptScope script_scope (core->script);
@@ -953,20 +1011,51 @@ gum_memory_scan_context_run (GumMemoryScanContext * self)
   auto exceptor = core->exceptor;
   auto isolate = core->isolate;
   GumExceptorScope scope;
+  gchar * message = NULL;
 
-  if (gum_exceptor_try (exceptor, &scope))
+  if (self->ranges != NULL)
   {
-    gum_memory_scan (&self->range, self->pattern,
-        (GumMemoryScanMatchFunc) gum_memory_scan_context_emit_match, self);
+    GError * error = NULL;
+
+    if (!gum_memory_scan_ranges ((const GumMemoryRange *) self->ranges->data,
+        self->ranges->len, self->pattern,
+        (GumMemoryScanMatchFunc) gum_memory_scan_context_emit_match, self,
+        &error))
+    {
+      message = g_strdup (error->message);
+      g_error_free (error);
+    }
+  }
+  else
+  {
+    if (gum_exceptor_try (exceptor, &scope))
+    {
+      if (self->patterns != NULL)
+      {
+        gum_memory_scan_multi (&self->range,
+            (const GumMatchPattern * const *) self->patterns->pdata,
+            self->patterns->len,
+            (GumMemoryScanMultiMatchFunc)
+                gum_memory_scan_context_emit_multi_match,
+            self);
+      }
+      else
+      {
+        gum_memory_scan (&self->range, self->pattern,
+            (GumMemoryScanMatchFunc) gum_memory_scan_context_emit_match,
+            self);
+      }
+    }
+
+    if (gum_exceptor_catch (exceptor, &scope))
+      message = gum_exception_details_to_string (&scope.exception);
   }
 
-  if (gum_exceptor_catch (exceptor, &scope) && self->on_error != nullptr)
+  if (message != NULL && self->on_error != nullptr)
   {
     ScriptScope script_scope (core->script);
     auto context = isolate->GetCurrentContext ();
 
-    auto message = gum_exception_details_to_string (&scope.exception);
-
     auto on_error = Local<Function>::New (isolate, *self->on_error);
     auto recv = Undefined (isolate);
     Local<Value> argv[] = {
@@ -974,10 +1063,10 @@ gum_memory_scan_context_run (GumMemoryScanContext * self)
     };
     auto result = on_error->Call (context, recv, G_N_ELEMENTS (argv), argv);
     _gum_v8_ignore_result (result);
-
-    g_free (message);
   }
 
+  g_free (message);
+
   {
     ScriptScope script_scope (core->script);
     auto context = isolate->GetCurrentContext ();
@@ -993,6 +1082,24 @@ static gboolean
 gum_memory_scan_context_emit_match (GumAddress address,
                                     gsize size,
                                     GumMemoryScanContext * self)
+{
+  return gum_memory_scan_context_emit (self, address, size, -1);
+}
+
+static gboolean
+gum_memory_scan_context_emit_multi_match (GumAddress address,
+                                          gsize size,
+                                          guint pattern_index,
+                                          GumMemoryScanContext * self)
+{
+  return gum_memory_scan_context_emit (self, address, size, pattern_index);
+}
+
+static gboolean
+gum_memory_scan_context_emit (GumMemoryScanContext * self,
+                              GumAddress address,
+                              gsize size,
+                              gint pattern_index)
 {
   ScriptScope scope (self->core->script);
   auto isolate = self->core->isolate;
@@ -1003,10 +1110,11 @@ gum_memory_scan_context_emit_match (GumAddress address,
   auto recv = Undefined (isolate);
   Local<Value> argv[] = {
     _gum_v8_native_pointer_new (GSIZE_TO_POINTER (address), self->core),
-    Integer::NewFromUnsigned (isolate, size)
+    Integer::NewFromUnsigned (isolate, size),
+    Integer::New (isolate, pattern_index)
   };
   Local<Value> result;
-  if (on_match->Call (context, recv, G_N_ELEMENTS (argv), argv)
+  if (on_match->Call (context, recv, (pattern_index != -1) ? 3 : 2, argv)
       .ToLocal (&result) && result->IsString ())
   {
     String::Utf8Value str (isolate, result);
@@ -1020,23 +1128,18 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_sync)
 {
   gpointer address;
   gsize size;
-  gchar * match_str;
-  if (!_gum_v8_args_parse (args, "pZs", &address, &size, &match_str))
+  Local<Value> pattern_value;
+  if (!_gum_v8_args_parse (args, "pZV", &address, &size, &pattern_value))
     return;
 
   GumMemoryRange range;
   range.base_address = GUM_ADDRESS (address);
   range.size = size;
 
-  auto pattern = gum_match_pattern_new_from_string (match_str);
-
-  g_free (match_str);
-
-  if (pattern == NULL)
-  {
-    _gum_v8_throw_ascii_literal (isolate, "invalid match pattern");
+  GumMatchPattern * pattern;
+  GPtrArray * patterns;
+  if (!gum_v8_match_patterns_get (pattern_value, &pattern, &patterns, core))
     return;
-  }
 
   GumMemoryScanSyncContext ctx;
   ctx.matches = Array::New (isolate);
@@ -1046,11 +1149,23 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_sync)
 
   if (gum_exceptor_try (core->exceptor, &scope))
   {
-    gum_memory_scan (&range, pattern, (GumMemoryScanMatchFunc) gum_append_match,
-        &ctx);
+    if (patterns != NULL)
+    {
+      gum_memory_scan_multi (&range,
+          (const GumMatchPattern * const *) patterns->pdata, patterns->len,
+          (GumMemoryScanMultiMatchFunc) gum_append_multi_match, &ctx);
+    }
+    else
+    {
+      gum_memory_scan (&range, pattern,
+          (GumMemoryScanMatchFunc) gum_append_match, &ctx);
+    }
   }
 
-  gum_match_pattern_free (pattern);
+  if (patterns != NULL)
+    g_ptr_array_unref (patterns);
+  else
+    gum_match_pattern_free (pattern);
 
   if (gum_exceptor_catch (core->exceptor, &scope))
   {
@@ -1066,18 +1181,181 @@ static gboolean
 gum_append_match (GumAddress address,
                   gsize size,
                   GumMemoryScanSyncContext * ctx)
+{
+  return gum_append_scan_match (ctx, address, size, -1);
+}
+
+static gboolean
+gum_append_multi_match (GumAddress address,
+                        gsize size,
+                        guint pattern_index,
+                        GumMemoryScanSyncContext * ctx)
+{
+  return gum_append_scan_match (ctx, address, size, pattern_index);
+}
+
+static gboolean
+gum_append_scan_match (GumMemoryScanSyncContext * ctx,
+                       GumAddress address,
+                       gsize size,
+                       gint pattern_index)
 {
   GumV8Core * core = ctx->core;
 
   auto match = Object::New (core->isolate);
   _gum_v8_object_set_pointer (match, "address", address, core);
   _gum_v8_object_set_uint (match, "size", size, core);
+  if (pattern_index != -1)
+    _gum_v8_object_set_uint (match, "pattern", pattern_index, core);
   ctx->matches->Set (core->isolate->GetCurrentContext (),
       ctx->matches->Length (), match).ToChecked ();
 
   return TRUE;
 }
 
+/*
+ * Accepts either a single pattern string, or an array of them to be matched
+ * in a single pass. In the latter case each match also reports the index of
+ * the pattern that it belongs to.
+ */
+static gboolean
+gum_v8_match_patterns_get (Local<Value> value,
+                           GumMatchPattern ** pattern,
+                           GPtrArray ** patterns,
+                           GumV8Core * core)
+{
+  auto isolate = core->isolate;
+
+  *pattern = NULL;
+  *patterns = NULL;
+
+  if (value->IsString ())
+  {
+    String::Utf8Value str (isolate, value);
+
+    *pattern = gum_match_pattern_new_from_string (*str);
+    if (*pattern == NULL)
+    {
+      _gum_v8_throw_ascii_literal (isolate, "invalid match pattern");
+      return FALSE;
+    }
+
+    return TRUE;
+  }
+
+  if (!value->IsArray () || value.As<Array> ()->Length () == 0)
+  {
+    _gum_v8_throw_ascii_literal (isolate,
+        "expected a match pattern or an array of them");
+    return FALSE;
+  }
+
+  auto elements = value.As<Array> ();
+  guint n = elements->Length ();
+  auto context = isolate->GetCurrentContext ();
+
+  auto result = g_ptr_array_new_full (n,
+      (GDestroyNotify) gum_match_pattern_free);
+
+  for (guint i = 0; i != n; i++)
+  {
+    Local<Value> element;
+    if (!elements->Get (context, i).ToLocal (&element) ||
+        !element->IsString ())
+    {
+      g_ptr_array_unref (result);
+      _gum_v8_throw_ascii_literal (isolate,
+          "expected a match pattern or an array of them");
+      return FALSE;
+    }
+
+    String::Utf8Value str (isolate, element);
+
+    auto p = gum_match_pattern_new_from_string (*str);
+    if (p == NULL)
+    {
+      g_ptr_array_unref (result);
+      _gum_v8_throw_ascii_literal (isolate, "invalid match pattern");
+      return FALSE;
+    }
+
+    g_ptr_array_add (result, p);
+  }
+
+  *patterns = result;
+
+  return TRUE;
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_ranges)
+{
+  GArray * ranges;
+  gchar * match_str;
+  Local<Function> on_match, on_error, on_complete;
+  if (!_gum_v8_args_parse (args, "RsF{onMatch,onError?,onComplete}",
+      &ranges, &match_str, &on_match, &on_error, &on_complete))
+    return;
+
+  auto pattern = gum_match_pattern_new_from_string (match_str);
+
+  g_free (match_str);
+
+  if (pattern != NULL)
+  {
+    auto ctx = g_slice_new0 (GumMemoryScanContext);
+    ctx->ranges = g_array_sized_new (FALSE, FALSE, sizeof (GumMemoryRange),
+        ranges->len);
+    g_array_append_vals (ctx->ranges, ranges->data, ranges->len);
+    ctx->pattern = pattern;
+    ctx->on_match = new GumPersistent<Function>::type (isolate, on_match);
+    if (!on_error.IsEmpty ())
+      ctx->on_error = new GumPersistent<Function>::type (isolate, on_error);
+    ctx->on_complete = new GumPersistent<Function>::type (isolate, on_complete);
+    ctx->core = core;
+
+    _gum_v8_core_pin (core);
+    _gum_v8_core_push_job (core, (GumScriptJobFunc) gum_memory_scan_context_run,
+        ctx, (GDestroyNotify) gum_memory_scan_context_free);
+  }
+  else
+  {
+    _gum_v8_throw_ascii_literal (isolate, "invalid match pattern");
+  }
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_ranges_sync)
+{
+  GArray * ranges;
+  gchar * match_str;
+  if (!_gum_v8_args_parse (args, "Rs", &ranges, &match_str))
+    return;
+
+  auto pattern = gum_match_pattern_new_from_string (match_str);
+
+  g_free (match_str);
+
+  if (pattern == NULL)
+  {
+    _gum_v8_throw_ascii_literal (isolate, "invalid match pattern");
+    return;
+  }
+
+  GumMemoryScanSyncContext ctx;
+  ctx.matches = Array::New (isolate);
+  ctx.core = core;
+
+  GError * error = NULL;
+  gum_memory_scan_ranges ((const GumMemoryRange *) ranges->data, ranges->len,
+      pattern, (GumMemoryScanMatchFunc) gum_append_match, &ctx, &error);
+
+  gum_match_pattern_free (pattern);
+
+  if (_gum_v8_maybe_throw (isolate, &error))
+    return;
+
+  info.GetReturnValue ().Set (ctx.matches);
+}
+
 #ifdef _MSC_VER
 # pragma warning (pop)
 #endif
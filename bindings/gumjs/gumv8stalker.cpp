@@ -89,6 +89,8 @@ static gboolean gum_v8_stalker_on_flush_timer_tick (GumV8Stalker * self);
 
 GUMJS_DECLARE_GETTER (gumjs_stalker_get_trust_threshold)
 GUMJS_DECLARE_SETTER (gumjs_stalker_set_trust_threshold)
+GUMJS_DECLARE_GETTER (gumjs_stalker_get_ic_entries)
+GUMJS_DECLARE_SETTER (gumjs_stalker_set_ic_entries)
 
 GUMJS_DECLARE_GETTER (gumjs_stalker_get_queue_capacity)
 GUMJS_DECLARE_SETTER (gumjs_stalker_set_queue_capacity)
@@ -105,6 +107,9 @@ GUMJS_DECLARE_FUNCTION (gumjs_stalker_add_call_probe)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_remove_call_probe)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_parse)
 
+static GumStalkerTransformer * gum_v8_rule_transformer_new (
+    Local<Array> rules, GumV8Core * core);
+
 static void gum_v8_callback_transformer_iface_init (gpointer g_iface,
     gpointer iface_data);
 static void gum_v8_callback_transformer_dispose (GObject * object);
@@ -181,6 +186,11 @@ static const GumV8Property gumjs_stalker_values[] =
     gumjs_stalker_get_trust_threshold,
     gumjs_stalker_set_trust_threshold
   },
+  {
+    "icEntries",
+    gumjs_stalker_get_ic_entries,
+    gumjs_stalker_set_ic_entries
+  },
   {
     "queueCapacity",
     gumjs_stalker_get_queue_capacity,
@@ -476,6 +486,24 @@ GUMJS_DEFINE_SETTER (gumjs_stalker_set_trust_threshold)
   gum_stalker_set_trust_threshold (stalker, threshold);
 }
 
+GUMJS_DEFINE_GETTER (gumjs_stalker_get_ic_entries)
+{
+  auto stalker = _gum_v8_stalker_get (module);
+
+  info.GetReturnValue ().Set (gum_stalker_get_ic_entries (stalker));
+}
+
+GUMJS_DEFINE_SETTER (gumjs_stalker_set_ic_entries)
+{
+  auto stalker = _gum_v8_stalker_get (module);
+
+  guint ic_entries;
+  if (!_gum_v8_uint_get (value, &ic_entries, core))
+    return;
+
+  gum_stalker_set_ic_entries (stalker, ic_entries);
+}
+
 GUMJS_DEFINE_GETTER (gumjs_stalker_get_queue_capacity)
 {
   info.GetReturnValue ().Set (module->queue_capacity);
@@ -542,6 +570,7 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
 
   Local<Function> transformer_callback_js;
   GumStalkerTransformerCallback transformer_callback_c;
+  Local<Array> transformer_rules;
 
   GumV8EventSinkOptions so;
   so.core = core;
@@ -551,8 +580,8 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
 
   gpointer user_data;
 
-  if (!_gum_v8_args_parse (args, "ZF*?uF?F?pp", &thread_id,
-      &transformer_callback_js, &transformer_callback_c,
+  if (!_gum_v8_args_parse (args, "ZF*?A?uF?F?pp", &thread_id,
+      &transformer_callback_js, &transformer_callback_c, &transformer_rules,
       &so.event_mask, &so.on_receive, &so.on_call_summary,
       &so.on_event, &user_data))
     return;
@@ -561,7 +590,13 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
 
   GumStalkerTransformer * transformer = NULL;
 
-  if (!transformer_callback_js.IsEmpty ())
+  if (!transformer_rules.IsEmpty ())
+  {
+    transformer = gum_v8_rule_transformer_new (transformer_rules, core);
+    if (transformer == NULL)
+      return;
+  }
+  else if (!transformer_callback_js.IsEmpty ())
   {
     auto cbt = (GumV8CallbackTransformer *)
         g_object_new (GUM_V8_TYPE_CALLBACK_TRANSFORMER, NULL);
@@ -598,6 +633,90 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
   }
 }
 
+static GumStalkerTransformer *
+gum_v8_rule_transformer_new (Local<Array> rules,
+                             GumV8Core * core)
+{
+  auto isolate = core->isolate;
+  auto context = isolate->GetCurrentContext ();
+
+  auto transformer = gum_rule_stalker_transformer_new ();
+
+  uint32_t n = rules->Length ();
+  for (uint32_t i = 0; i != n; i++)
+  {
+    Local<Value> rule_val;
+    if (!rules->Get (context, i).ToLocal (&rule_val) || !rule_val->IsArray ())
+      goto invalid_rule;
+    auto rule = rule_val.As<Array> ();
+
+    Local<Value> kind_val, val;
+    if (!rule->Get (context, 0).ToLocal (&kind_val))
+      goto propagate_exception;
+
+    String::Utf8Value kind (isolate, kind_val);
+    if (strcmp (*kind, "callout") == 0)
+    {
+      if (!rule->Get (context, 1).ToLocal (&val))
+        goto propagate_exception;
+      String::Utf8Value mnemonic (isolate, val);
+
+      gpointer callout, data;
+      if (!rule->Get (context, 2).ToLocal (&val) ||
+          !_gum_v8_native_pointer_get (val, &callout, core))
+        goto propagate_exception;
+      if (!rule->Get (context, 3).ToLocal (&val) ||
+          !_gum_v8_native_pointer_get (val, &data, core))
+        goto propagate_exception;
+
+      gum_rule_stalker_transformer_add_callout (transformer, *mnemonic,
+          GUM_POINTER_TO_FUNCPTR (GumStalkerCallout, callout), data, NULL);
+    }
+    else if (strcmp (*kind, "drop") == 0)
+    {
+      GumMemoryRange range;
+      if (!rule->Get (context, 1).ToLocal (&val) ||
+          !_gum_v8_memory_range_get (val, &range, core))
+        goto propagate_exception;
+
+      gum_rule_stalker_transformer_add_drop (transformer, &range);
+    }
+    else if (strcmp (*kind, "count") == 0)
+    {
+      GumMemoryRange range;
+      if (!rule->Get (context, 1).ToLocal (&val) ||
+          !_gum_v8_memory_range_get (val, &range, core))
+        goto propagate_exception;
+
+      gpointer counter;
+      if (!rule->Get (context, 2).ToLocal (&val) ||
+          !_gum_v8_native_pointer_get (val, &counter, core))
+        goto propagate_exception;
+
+      gum_rule_stalker_transformer_add_block_counter (transformer, &range,
+          (gsize *) counter);
+    }
+    else
+    {
+      goto invalid_rule;
+    }
+  }
+
+  return GUM_STALKER_TRANSFORMER (transformer);
+
+invalid_rule:
+  {
+    _gum_v8_throw_ascii_literal (isolate, "invalid transform rule");
+    goto propagate_exception;
+  }
+propagate_exception:
+  {
+    g_object_unref (transformer);
+
+    return NULL;
+  }
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_stalker_unfollow)
 {
   GumStalker * stalker;
@@ -807,6 +926,34 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse)
 
         break;
       }
+      case GUM_MEMORY:
+      {
+        const GumMemoryEvent * memory = &ev->memory;
+
+        if (annotate)
+        {
+          row = Array::New (isolate, 5);
+          row->Set (context, column_index++,
+              _gum_v8_string_new_ascii (isolate, "memory")).Check ();
+        }
+        else
+        {
+          row = Array::New (isolate, 4);
+        }
+
+        row->Set (context, column_index++,
+            gum_make_pointer (memory->location, stringify, core)).Check ();
+        row->Set (context, column_index++,
+            gum_make_pointer (memory->address, stringify, core)).Check ();
+        row->Set (context, column_index++,
+            Integer::NewFromUnsigned (isolate, memory->size)).Check ();
+        row->Set (context, column_index++,
+            _gum_v8_string_new_ascii (isolate,
+                _gum_v8_memory_operation_to_string (memory->operation)))
+            .Check ();
+
+        break;
+      }
       default:
         _gum_v8_throw_ascii_literal (isolate, "invalid event type");
         return;
@@ -4,6 +4,7 @@
 #include "gumdefs.h"
 
 typedef guint GumPtrauthSupport;
+typedef guint GumMemoryOperation;
 
 enum _GumPtrauthSupport
 {
@@ -12,6 +13,14 @@ enum _GumPtrauthSupport
   GUM_PTRAUTH_SUPPORTED
 };
 
+enum _GumMemoryOperation
+{
+  GUM_MEMOP_INVALID,
+  GUM_MEMOP_READ,
+  GUM_MEMOP_WRITE,
+  GUM_MEMOP_EXECUTE
+};
+
 gpointer gum_sign_code_pointer (gpointer value);
 gpointer gum_strip_code_pointer (gpointer value);
 GumAddress gum_sign_code_address (GumAddress value);
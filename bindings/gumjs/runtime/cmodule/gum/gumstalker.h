@@ -2,6 +2,7 @@
 #define __GUM_STALKER_H__
 
 #include "gumdefs.h"
+#include "gummemory.h"
 #if defined (HAVE_I386)
 # include "arch-x86/gumx86writer.h"
 #elif defined (HAVE_ARM)
@@ -35,6 +36,7 @@ typedef struct _GumRetEvent     GumRetEvent;
 typedef struct _GumExecEvent    GumExecEvent;
 typedef struct _GumBlockEvent   GumBlockEvent;
 typedef struct _GumCompileEvent GumCompileEvent;
+typedef struct _GumMemoryEvent  GumMemoryEvent;
 
 union _GumStalkerWriter
 {
@@ -71,6 +73,7 @@ enum _GumEventType
   GUM_EXEC        = 1 << 2,
   GUM_BLOCK       = 1 << 3,
   GUM_COMPILE     = 1 << 4,
+  GUM_MEMORY      = 1 << 5,
 };
 
 struct _GumAnyEvent
@@ -119,6 +122,16 @@ struct _GumCompileEvent
   gpointer end;
 };
 
+struct _GumMemoryEvent
+{
+  GumEventType type;
+
+  gpointer location;
+  gpointer address;
+  guint size;
+  GumMemoryOperation operation;
+};
+
 union _GumEvent
 {
   GumEventType type;
@@ -129,6 +142,7 @@ union _GumEvent
   GumExecEvent exec;
   GumBlockEvent block;
   GumCompileEvent compile;
+  GumMemoryEvent memory;
 };
 
 gboolean gum_stalker_iterator_next (GumStalkerIterator * self,
@@ -136,5 +150,7 @@ gboolean gum_stalker_iterator_next (GumStalkerIterator * self,
 void gum_stalker_iterator_keep (GumStalkerIterator * self);
 void gum_stalker_iterator_put_callout (GumStalkerIterator * self,
     GumStalkerCallout callout, gpointer data, GDestroyNotify data_destroy);
+void gum_stalker_iterator_put_gpr_callout (GumStalkerIterator * self,
+    GumStalkerCallout callout, gpointer data, GDestroyNotify data_destroy);
 
 #endif
@@ -392,6 +392,7 @@ const stalkerEventType = {
   exec: 4,
   block: 8,
   compile: 16,
+  memory: 32,
 };
 
 Object.defineProperties(Stalker, {
@@ -447,7 +448,14 @@ Object.defineProperties(Stalker, {
         return enabled ? (result | value) : result;
       }, 0);
 
-      Stalker._follow(threadId, transform, eventMask, onReceive, onCallSummary, onEvent, data);
+      let transformCallback = transform;
+      let transformRules = null;
+      if (transform !== null && typeof transform === 'object' && !(transform instanceof NativePointer)) {
+        transformCallback = null;
+        transformRules = parseStalkerTransformRules(transform);
+      }
+
+      Stalker._follow(threadId, transformCallback, transformRules, eventMask, onReceive, onCallSummary, onEvent, data);
     }
   },
   parse: {
@@ -719,6 +727,39 @@ Object.defineProperties(SqliteDatabase, {
   }
 });
 
+const stalkerTransformRuleKinds = ['callouts', 'drop', 'blockCounters'];
+
+function parseStalkerTransformRules(rules) {
+  for (const name of Object.keys(rules)) {
+    if (!stalkerTransformRuleKinds.includes(name))
+      throw new Error(`unknown transform rule kind: ${name}`);
+    if (!Array.isArray(rules[name]))
+      throw new Error('transform rules must be specified as arrays');
+  }
+
+  const {
+    callouts = [],
+    drop = [],
+    blockCounters = [],
+  } = rules;
+
+  const result = [];
+
+  for (const { mnemonic, callout, data = NULL } of callouts) {
+    if (typeof mnemonic !== 'string')
+      throw new Error('callout mnemonic must be a string');
+    result.push(['callout', mnemonic, callout, data]);
+  }
+
+  for (const range of drop)
+    result.push(['drop', range]);
+
+  for (const { base, size, counter } of blockCounters)
+    result.push(['count', { base, size }, counter]);
+
+  return result;
+}
+
 function makeEnumerateApi(mod, name, arity) {
   const impl = mod['_' + name];
 
@@ -0,0 +1,17 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_X86_PRIV_H__
+#define __GUM_X86_PRIV_H__
+
+/*
+ * Extended state components that we preserve with XSAVEC: x87, SSE, AVX and
+ * the three AVX-512 components. Anything else, e.g. AMX tile data, is left
+ * alone so the save area stays small enough to live on the stack.
+ */
+#define GUM_XSAVE_COMPONENTS_MASK 0xe7
+
+#endif
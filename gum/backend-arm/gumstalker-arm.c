@@ -578,6 +578,18 @@ gum_stalker_set_trust_threshold (GumStalker * self,
   self->trust_threshold = trust_threshold;
 }
 
+guint
+gum_stalker_get_ic_entries (GumStalker * self)
+{
+  return 0;
+}
+
+void
+gum_stalker_set_ic_entries (GumStalker * self,
+                            guint ic_entries)
+{
+}
+
 void
 gum_stalker_flush (GumStalker * self)
 {
@@ -2285,6 +2297,15 @@ gum_stalker_iterator_put_callout (GumStalkerIterator * self,
   gum_spinlock_release (&ec->callout_lock);
 }
 
+void
+gum_stalker_iterator_put_gpr_callout (GumStalkerIterator * self,
+                                      GumStalkerCallout callout,
+                                      gpointer data,
+                                      GDestroyNotify data_destroy)
+{
+  gum_stalker_iterator_put_callout (self, callout, data, data_destroy);
+}
+
 static void
 gum_stalker_invoke_callout (GumCpuContext * cpu_context,
                             GumCalloutEntry * entry)
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumcodesegment.h"
+
+#include "gumcloak.h"
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define GUM_MFD_CLOEXEC 0x0001U
+
+struct _GumCodeSegment
+{
+  gpointer data;
+  gsize size;
+  gsize virtual_size;
+
+  gint fd;
+};
+
+static gint gum_memfd_create (const gchar * name, guint flags);
+
+gboolean
+gum_code_segment_is_supported (void)
+{
+  static gsize supported = 0;
+
+  if (g_once_init_enter (&supported))
+  {
+    gint fd;
+
+    fd = gum_memfd_create ("frida-probe", GUM_MFD_CLOEXEC);
+    if (fd != -1)
+      close (fd);
+
+    g_once_init_leave (&supported, (fd != -1) + 1);
+  }
+
+  return supported - 1;
+}
+
+GumCodeSegment *
+gum_code_segment_new (gsize size,
+                      const GumAddressSpec * spec)
+{
+  GumCodeSegment * segment;
+  gsize page_size, size_in_pages, virtual_size;
+  gpointer data;
+  gint fd;
+  GumMemoryRange range;
+
+  page_size = gum_query_page_size ();
+  size_in_pages = size / page_size;
+  if (size % page_size != 0)
+    size_in_pages++;
+  virtual_size = size_in_pages * page_size;
+
+  /*
+   * Back the writable view with a memfd so that it can later be mapped
+   * executable elsewhere without the kernel ever seeing an RWX mapping.
+   */
+  fd = gum_memfd_create ("frida-code", GUM_MFD_CLOEXEC);
+  if (fd == -1)
+    return NULL;
+  if (ftruncate (fd, virtual_size) != 0)
+    goto propagate_error;
+
+  if (spec == NULL)
+  {
+    data = gum_alloc_n_pages (size_in_pages, GUM_PAGE_RW);
+  }
+  else
+  {
+    data = gum_try_alloc_n_pages_near (size_in_pages, GUM_PAGE_RW, spec);
+    if (data == NULL)
+      goto propagate_error;
+  }
+
+  if (mmap (data, virtual_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+  {
+    gum_free_pages (data);
+    goto propagate_error;
+  }
+
+  segment = g_slice_new (GumCodeSegment);
+
+  segment->data = data;
+  segment->size = size;
+  segment->virtual_size = virtual_size;
+
+  segment->fd = fd;
+
+  gum_query_page_allocation_range (segment->data, segment->virtual_size,
+      &range);
+  gum_cloak_add_range (&range);
+
+  return segment;
+
+propagate_error:
+  {
+    close (fd);
+
+    return NULL;
+  }
+}
+
+void
+gum_code_segment_free (GumCodeSegment * segment)
+{
+  GumMemoryRange range;
+
+  close (segment->fd);
+
+  gum_query_page_allocation_range (segment->data, segment->virtual_size,
+      &range);
+  gum_cloak_remove_range (&range);
+
+  gum_free_pages (segment->data);
+
+  g_slice_free (GumCodeSegment, segment);
+}
+
+gpointer
+gum_code_segment_get_address (GumCodeSegment * self)
+{
+  return self->data;
+}
+
+gsize
+gum_code_segment_get_size (GumCodeSegment * self)
+{
+  return self->size;
+}
+
+gsize
+gum_code_segment_get_virtual_size (GumCodeSegment * self)
+{
+  return self->virtual_size;
+}
+
+void
+gum_code_segment_realize (GumCodeSegment * self)
+{
+  /* The memfd already holds what was written through the RW view. */
+}
+
+void
+gum_code_segment_map (GumCodeSegment * self,
+                      gsize source_offset,
+                      gsize source_size,
+                      gpointer target_address)
+{
+  gboolean mapped_successfully;
+
+  mapped_successfully = mmap (target_address, source_size,
+      PROT_READ | PROT_EXEC, MAP_SHARED | MAP_FIXED, self->fd,
+      source_offset) != MAP_FAILED;
+
+  g_assert (mapped_successfully);
+}
+
+gboolean
+gum_code_segment_mark (gpointer code,
+                       gsize size,
+                       GError ** error)
+{
+  if (!gum_try_mprotect (code, size, GUM_PAGE_RX))
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+        "Invalid address");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gint
+gum_memfd_create (const gchar * name,
+                  guint flags)
+{
+#ifdef __NR_memfd_create
+  return syscall (__NR_memfd_create, name, flags);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
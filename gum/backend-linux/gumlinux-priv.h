@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_LINUX_PRIV_H__
+#define __GUM_LINUX_PRIV_H__
+
+#include "gumlinux.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GumProcMapsIter GumProcMapsIter;
+typedef struct _GumProcMapsEntry GumProcMapsEntry;
+
+struct _GumProcMapsIter
+{
+  gint fd;
+  gchar * buffer;
+  gsize capacity;
+  gchar * read_cursor;
+  gchar * write_cursor;
+};
+
+/*
+ * Points into the iterator's buffer, and is only valid until the next call to
+ * gum_proc_maps_iter_next(). The perms are not NUL-terminated, and path is
+ * empty for anonymous mappings.
+ */
+struct _GumProcMapsEntry
+{
+  GumAddress start;
+  GumAddress end;
+  const gchar * perms;
+  guint64 offset;
+  guint64 inode;
+  gchar * path;
+};
+
+G_GNUC_INTERNAL void gum_proc_maps_iter_init_for_self (GumProcMapsIter * iter);
+G_GNUC_INTERNAL void gum_proc_maps_iter_init_for_pid (GumProcMapsIter * iter,
+    pid_t pid);
+G_GNUC_INTERNAL void gum_proc_maps_iter_destroy (GumProcMapsIter * iter);
+G_GNUC_INTERNAL gboolean gum_proc_maps_iter_next (GumProcMapsIter * iter,
+    GumProcMapsEntry * entry);
+
+/*
+ * Makes maps iterators read @path instead of the file in /proc, so that tests
+ * can feed the parser. Pass NULL to go back to /proc.
+ */
+G_GNUC_INTERNAL void _gum_linux_override_proc_maps_path (const gchar * path);
+
+G_END_DECLS
+
+#endif
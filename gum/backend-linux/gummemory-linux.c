@@ -6,23 +6,40 @@
 
 #include "gummemory.h"
 
+#include "gumlinux-priv.h"
 #include "gummemory-priv.h"
 #include "valgrind.h"
 
-#include <stdio.h>
+#include <errno.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#define GUM_MAX_IOVECS 64
+
+static gssize gum_memory_read_self (gconstpointer address, gpointer buffer,
+    gsize len);
+static gssize gum_memory_probe_self (gconstpointer address, gsize len);
+static gssize gum_process_vm_readv (const struct iovec * local_iov,
+    gulong liovcnt, const struct iovec * remote_iov, gulong riovcnt);
 static gboolean gum_memory_get_protection (gconstpointer address, gsize n,
     gsize * size, GumPageProtection * prot);
 
+static gboolean gum_vm_readv_unsupported = FALSE;
+
 gboolean
 gum_memory_is_readable (gconstpointer address,
                         gsize len)
 {
   gsize size;
   GumPageProtection prot;
+  gssize n;
+
+  n = gum_memory_probe_self (address, len);
+  if (n != -1)
+    return (gsize) n == len;
 
   if (!gum_memory_get_protection (address, len, &size, &prot))
     return FALSE;
@@ -52,12 +69,37 @@ gum_memory_read (gconstpointer address,
   gsize result_len = 0;
   gsize size;
   GumPageProtection prot;
+  guint8 first_byte;
+  gssize n;
+
+  /*
+   * Probe before allocating anything, so that a bogus address paired with a
+   * huge length fails instead of aborting the process on OOM.
+   */
+  n = gum_memory_read_self (address, &first_byte, MIN (len, 1));
+  if (n == 1)
+  {
+    result = g_try_malloc (len);
+    n = (result != NULL) ? gum_memory_read_self (address, result, len) : 0;
+  }
 
-  if (gum_memory_get_protection (address, len, &size, &prot)
-      && (prot & GUM_PAGE_READ) != 0)
+  if (n > 0)
   {
-    result_len = MIN (len, size);
-    result = g_memdup (address, result_len);
+    result_len = n;
+    if (result_len != len)
+      result = g_realloc (result, result_len);
+  }
+  else
+  {
+    g_free (result);
+    result = NULL;
+
+    if (n == -1 && gum_memory_get_protection (address, len, &size, &prot)
+        && (prot & GUM_PAGE_READ) != 0)
+    {
+      result_len = MIN (len, size);
+      result = g_memdup (address, result_len);
+    }
   }
 
   if (n_bytes_read != NULL)
@@ -118,6 +160,241 @@ gum_clear_cache (gpointer address,
   VALGRIND_DISCARD_TRANSLATIONS (address, size);
 }
 
+gboolean
+_gum_memory_try_read_batch_self (const GumMemoryRange * ranges,
+                                 guint n_ranges,
+                                 guint8 * buffer,
+                                 gsize * n_bytes_read)
+{
+  gsize page_size, entry_offset, buffer_offset;
+  guint i;
+  struct iovec local, remote[GUM_MAX_IOVECS];
+
+  page_size = gum_query_page_size ();
+
+  i = 0;
+  entry_offset = 0;
+  buffer_offset = 0;
+
+  while (i != n_ranges)
+  {
+    guint j;
+    gsize j_offset, batch_len, remaining;
+    gulong n;
+    gssize res;
+
+    /*
+     * Describe as many page-sized pieces as fit, spanning several entries.
+     * Their destinations are adjacent in buffer, so one local iovec will do.
+     */
+    j = i;
+    j_offset = entry_offset;
+    batch_len = 0;
+    n = 0;
+    while (j != n_ranges && n != GUM_MAX_IOVECS)
+    {
+      const GumMemoryRange * r = &ranges[j];
+      gsize cur;
+
+      if (j_offset == r->size)
+      {
+        j++;
+        j_offset = 0;
+        continue;
+      }
+
+      cur = r->base_address + j_offset;
+
+      remote[n].iov_base = GSIZE_TO_POINTER (cur);
+      remote[n].iov_len = MIN (page_size - (cur & (page_size - 1)),
+          r->size - j_offset);
+
+      j_offset += remote[n].iov_len;
+      batch_len += remote[n].iov_len;
+      n++;
+    }
+
+    res = 0;
+    if (n != 0)
+    {
+      local.iov_base = buffer + buffer_offset;
+      local.iov_len = batch_len;
+
+      res = gum_process_vm_readv (&local, 1, remote, n);
+      if (res == -1)
+      {
+        if (errno != EFAULT)
+          return FALSE;
+        res = 0;
+      }
+    }
+
+    remaining = res;
+    while (i != n_ranges)
+    {
+      gsize left = ranges[i].size - entry_offset;
+
+      if (left > remaining)
+      {
+        entry_offset += remaining;
+        buffer_offset += remaining;
+        break;
+      }
+
+      n_bytes_read[i] = ranges[i].size;
+      remaining -= left;
+      buffer_offset += left;
+      i++;
+      entry_offset = 0;
+    }
+
+    if ((gsize) res != batch_len)
+    {
+      gsize left = ranges[i].size - entry_offset;
+
+      /* Entry i faulted, so give up on the rest of it and move on. */
+      n_bytes_read[i] = entry_offset;
+      memset (buffer + buffer_offset, 0, left);
+
+      buffer_offset += left;
+      i++;
+      entry_offset = 0;
+    }
+  }
+
+  return TRUE;
+}
+
+/*
+ * Reads from our own address space without consulting /proc/self/maps,
+ * stopping at the first inaccessible page. Returns the number of bytes
+ * read, or -1 if process_vm_readv() is unavailable and the caller should
+ * fall back to checking protections first.
+ */
+static gssize
+gum_memory_read_self (gconstpointer address,
+                      gpointer buffer,
+                      gsize len)
+{
+  gsize page_size, offset;
+  struct iovec local, remote[GUM_MAX_IOVECS];
+
+  page_size = gum_query_page_size ();
+
+  offset = 0;
+  while (offset != len)
+  {
+    gsize batch_len, cur;
+    gulong n;
+    gssize res;
+
+    /* One remote iovec per page so that partial reads stop exactly there. */
+    batch_len = 0;
+    for (n = 0; n != GUM_MAX_IOVECS && offset + batch_len != len; n++)
+    {
+      cur = GPOINTER_TO_SIZE (address) + offset + batch_len;
+
+      remote[n].iov_base = GSIZE_TO_POINTER (cur);
+      remote[n].iov_len = MIN (page_size - (cur & (page_size - 1)),
+          len - offset - batch_len);
+
+      batch_len += remote[n].iov_len;
+    }
+
+    local.iov_base = (guint8 *) buffer + offset;
+    local.iov_len = batch_len;
+
+    res = gum_process_vm_readv (&local, 1, remote, n);
+    if (res == -1)
+    {
+      if (errno != EFAULT)
+        return (offset == 0) ? -1 : (gssize) offset;
+      break;
+    }
+
+    offset += res;
+    if ((gsize) res != batch_len)
+      break;
+  }
+
+  return offset;
+}
+
+/*
+ * Checks that every page touched by the range is readable by reading one
+ * byte from each of them. Returns the number of bytes known to be readable,
+ * or -1 if we have to fall back to /proc/self/maps.
+ */
+static gssize
+gum_memory_probe_self (gconstpointer address,
+                       gsize len)
+{
+  gsize page_size, start, end, cur;
+  guint8 scratch[GUM_MAX_IOVECS];
+  struct iovec local, remote[GUM_MAX_IOVECS];
+
+  if (len == 0)
+    return 0;
+
+  page_size = gum_query_page_size ();
+
+  start = GPOINTER_TO_SIZE (address);
+  end = start + len;
+
+  cur = start;
+  while (cur < end)
+  {
+    gulong n;
+    gssize res;
+
+    for (n = 0; n != GUM_MAX_IOVECS && cur < end; n++)
+    {
+      remote[n].iov_base = GSIZE_TO_POINTER (cur);
+      remote[n].iov_len = 1;
+
+      cur = (cur & ~(page_size - 1)) + page_size;
+    }
+
+    local.iov_base = scratch;
+    local.iov_len = n;
+
+    res = gum_process_vm_readv (&local, 1, remote, n);
+    if (res == -1 && errno != EFAULT)
+      return -1;
+    if (res != (gssize) n)
+      return 0;
+  }
+
+  return len;
+}
+
+static gssize
+gum_process_vm_readv (const struct iovec * local_iov,
+                      gulong liovcnt,
+                      const struct iovec * remote_iov,
+                      gulong riovcnt)
+{
+#ifdef __NR_process_vm_readv
+  gssize res;
+
+  if (gum_vm_readv_unsupported)
+  {
+    errno = ENOSYS;
+    return -1;
+  }
+
+  res = syscall (__NR_process_vm_readv, getpid (), local_iov, liovcnt,
+      remote_iov, riovcnt, 0UL);
+  if (res == -1 && (errno == ENOSYS || errno == EPERM))
+    gum_vm_readv_unsupported = TRUE;
+
+  return res;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
 static gboolean
 gum_memory_get_protection (gconstpointer address,
                            gsize n,
@@ -125,8 +402,9 @@ gum_memory_get_protection (gconstpointer address,
                            GumPageProtection * prot)
 {
   gboolean success;
-  FILE * fp;
-  gchar line[1024 + 1];
+  gsize start_address, end_address, cursor;
+  GumProcMapsIter iter;
+  GumProcMapsEntry entry;
 
   if (size == NULL || prot == NULL)
   {
@@ -138,75 +416,60 @@ gum_memory_get_protection (gconstpointer address,
         (prot != NULL) ? prot : &ignored_prot);
   }
 
-  if (n > 1)
-  {
-    gsize page_size, start_page, end_page, cur_page;
-
-    page_size = gum_query_page_size ();
-
-    start_page = GPOINTER_TO_SIZE (address) & ~(page_size - 1);
-    end_page = (GPOINTER_TO_SIZE (address) + n - 1) & ~(page_size - 1);
-
-    success = gum_memory_get_protection (GSIZE_TO_POINTER (start_page), 1, NULL,
-        prot);
-    if (success)
-    {
-      *size = page_size - (GPOINTER_TO_SIZE (address) - start_page);
-      for (cur_page = start_page + page_size;
-          cur_page != end_page + page_size;
-          cur_page += page_size)
-      {
-        GumPageProtection cur_prot;
-
-        if (gum_memory_get_protection (GSIZE_TO_POINTER (cur_page), 1, NULL,
-            &cur_prot) && (cur_prot != GUM_PAGE_NO_ACCESS ||
-            *prot == GUM_PAGE_NO_ACCESS))
-        {
-          *size += page_size;
-          *prot &= cur_prot;
-        }
-        else
-        {
-          break;
-        }
-      }
-      *size = MIN (*size, n);
-    }
-
-    return success;
-  }
-
   success = FALSE;
   *size = 0;
   *prot = GUM_PAGE_NO_ACCESS;
 
-  fp = fopen ("/proc/self/maps", "r");
-  g_assert (fp != NULL);
+  start_address = GPOINTER_TO_SIZE (address);
+  end_address = start_address + MAX (n, 1);
+  cursor = start_address;
 
-  while (fgets (line, sizeof (line), fp) != NULL)
-  {
-    gpointer start, end;
-    gchar protection[16];
+  gum_proc_maps_iter_init_for_self (&iter);
 
-    sscanf (line, "%p-%p %s ", &start, &end, protection);
+  /*
+   * Walk the mappings covering the range in a single pass, merging the
+   * protections of adjacent ones until we hit a gap or an inaccessible one.
+   */
+  while (gum_proc_maps_iter_next (&iter, &entry))
+  {
+    GumPageProtection cur_prot;
 
-    if (start > address)
+    if (entry.end <= cursor)
+      continue;
+    if (entry.start > cursor)
       break;
-    else if (address >= start && address + n - 1 < end)
+
+    cur_prot = GUM_PAGE_NO_ACCESS;
+    if (entry.perms[0] == 'r')
+      cur_prot |= GUM_PAGE_READ;
+    if (entry.perms[1] == 'w')
+      cur_prot |= GUM_PAGE_WRITE;
+    if (entry.perms[2] == 'x')
+      cur_prot |= GUM_PAGE_EXECUTE;
+
+    if (!success)
     {
       success = TRUE;
-      *size = 1;
-      if (protection[0] == 'r')
-        *prot |= GUM_PAGE_READ;
-      if (protection[1] == 'w')
-        *prot |= GUM_PAGE_WRITE;
-      if (protection[2] == 'x')
-        *prot |= GUM_PAGE_EXECUTE;
+      *prot = cur_prot;
+    }
+    else if (cur_prot != GUM_PAGE_NO_ACCESS || *prot == GUM_PAGE_NO_ACCESS)
+    {
+      *prot &= cur_prot;
+    }
+    else
+    {
       break;
     }
+
+    cursor = entry.end;
+    if (cursor >= end_address)
+      break;
   }
 
-  fclose (fp);
+  gum_proc_maps_iter_destroy (&iter);
+
+  if (success)
+    *size = MIN (cursor - start_address, n);
 
   return success;
 }
@@ -9,12 +9,13 @@
 #include "backend-elf/gumelfmodule.h"
 #include "gum-init.h"
 #include "gumandroid.h"
-#include "gumlinux.h"
+#include "gumlinux-priv.h"
 #include "gummodulemap.h"
 #include "valgrind.h"
 
 #include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,7 +42,7 @@
 # include <sys/user.h>
 #endif
 
-#define GUM_MAPS_LINE_SIZE (1024 + PATH_MAX)
+#define GUM_PROC_MAPS_BUFFER_SIZE (64 * 1024)
 #define GUM_PSR_THUMB 0x20
 
 #if defined (HAVE_I386)
@@ -235,7 +236,13 @@ static gboolean gum_emit_executable_module_by_name (
 #endif
 
 static void gum_linux_named_range_free (GumLinuxNamedRange * range);
-static gboolean gum_try_translate_vdso_name (gchar * name);
+static const gchar * gum_proc_maps_entry_get_module_path (
+    GumProcMapsEntry * entry);
+static void gum_proc_maps_iter_init_for_path (GumProcMapsIter * iter,
+    const gchar * path);
+static gboolean gum_proc_maps_iter_fill (GumProcMapsIter * self);
+static guint64 gum_proc_maps_parse_hex (gchar ** cursor);
+static guint64 gum_proc_maps_parse_dec (gchar ** cursor);
 static void * gum_module_get_handle (const gchar * module_name);
 static void * gum_module_get_symbol (void * module, const gchar * symbol_name);
 
@@ -288,6 +295,8 @@ static gchar * gum_libc_name;
 
 static gboolean gum_is_regset_supported = TRUE;
 
+static const gchar * gum_proc_maps_path_override = NULL;
+
 const gchar *
 gum_process_query_libc_name (void)
 {
@@ -996,98 +1005,79 @@ void
 gum_linux_enumerate_modules_using_proc_maps (GumFoundModuleFunc func,
                                              gpointer user_data)
 {
-  FILE * fp;
-  const guint line_size = GUM_MAPS_LINE_SIZE;
-  gchar * line, * path, * next_path;
+  GumProcMapsIter iter;
+  GumProcMapsEntry entry;
+  gchar * path;
   gboolean carry_on = TRUE;
-  gboolean got_line = FALSE;
+  gboolean got_entry = FALSE;
 
-  fp = fopen ("/proc/self/maps", "r");
-  g_assert (fp != NULL);
-
-  line = g_malloc (line_size);
+  gum_proc_maps_iter_init_for_self (&iter);
 
   path = g_malloc (PATH_MAX);
-  next_path = g_malloc (PATH_MAX);
 
   do
   {
     const guint8 elf_magic[] = { 0x7f, 'E', 'L', 'F' };
     GumModuleDetails details;
     GumMemoryRange range;
-    GumAddress end;
-    gchar perms[5] = { 0, };
-    gint n;
-    gboolean is_vdso, readable, shared;
+    const gchar * entry_path;
+    gboolean readable, shared;
     gchar * name;
 
-    if (!got_line)
+    if (!got_entry)
     {
-      if (fgets (line, line_size, fp) == NULL)
+      if (!gum_proc_maps_iter_next (&iter, &entry))
         break;
     }
     else
     {
-      got_line = FALSE;
+      got_entry = FALSE;
     }
 
-    n = sscanf (line,
-        "%" G_GINT64_MODIFIER "x-%" G_GINT64_MODIFIER "x "
-        "%4c "
-        "%*x %*s %*d "
-        "%s",
-        &range.base_address, &end,
-        perms,
-        path);
-    if (n == 3)
+    entry_path = gum_proc_maps_entry_get_module_path (&entry);
+    if (entry_path == NULL)
       continue;
-    g_assert (n == 4);
-
-    is_vdso = gum_try_translate_vdso_name (path);
 
-    readable = perms[0] == 'r';
-    shared = perms[3] == 's';
+    readable = entry.perms[0] == 'r';
+    shared = entry.perms[3] == 's';
     if (!readable || shared)
       continue;
-    else if ((path[0] != '/' && !is_vdso) || g_str_has_prefix (path, "/dev/"))
+    else if (g_str_has_prefix (entry_path, "/dev/"))
       continue;
-    else if (RUNNING_ON_VALGRIND && strstr (path, "/valgrind/") != NULL)
+    else if (RUNNING_ON_VALGRIND && strstr (entry_path, "/valgrind/") != NULL)
       continue;
-    else if (memcmp (GSIZE_TO_POINTER (range.base_address), elf_magic,
+    else if (memcmp (GSIZE_TO_POINTER (entry.start), elf_magic,
         sizeof (elf_magic)) != 0)
       continue;
 
+    g_strlcpy (path, entry_path, PATH_MAX);
     name = g_path_get_basename (path);
 
-    range.size = end - range.base_address;
+    range.base_address = entry.start;
+    range.size = entry.end - range.base_address;
 
     details.name = name;
     details.range = &range;
     details.path = path;
 
-    while (fgets (line, line_size, fp) != NULL)
+    while (gum_proc_maps_iter_next (&iter, &entry))
     {
-      n = sscanf (line,
-          "%*x-%" G_GINT64_MODIFIER "x %*c%*c%*c%*c %*x %*s %*d %s",
-          &end,
-          next_path);
-      if (n == 1)
-      {
+      const gchar * next_path;
+
+      if (entry.path[0] == '\0')
+        continue;
+
+      next_path = gum_proc_maps_entry_get_module_path (&entry);
+      if (next_path == NULL && entry.path[0] == '[')
         continue;
-      }
-      else if (n == 2 && next_path[0] == '[')
-      {
-        if (!gum_try_translate_vdso_name (next_path))
-          continue;
-      }
 
-      if (n == 2 && strcmp (next_path, path) == 0)
+      if (next_path != NULL && strcmp (next_path, path) == 0)
       {
-        range.size = end - range.base_address;
+        range.size = entry.end - range.base_address;
       }
       else
       {
-        got_line = TRUE;
+        got_entry = TRUE;
         break;
       }
     }
@@ -1099,89 +1089,70 @@ gum_linux_enumerate_modules_using_proc_maps (GumFoundModuleFunc func,
   while (carry_on);
 
   g_free (path);
-  g_free (next_path);
-
-  g_free (line);
 
-  fclose (fp);
+  gum_proc_maps_iter_destroy (&iter);
 }
 
 GHashTable *
 gum_linux_collect_named_ranges (void)
 {
   GHashTable * result;
-  FILE * fp;
-  const guint line_size = GUM_MAPS_LINE_SIZE;
-  gchar * line, * name, * next_name;
-  gboolean carry_on = TRUE;
-  gboolean got_line = FALSE;
+  GumProcMapsIter iter;
+  GumProcMapsEntry entry;
+  gchar * name;
+  gboolean got_entry = FALSE;
 
   result = g_hash_table_new_full (NULL, NULL, NULL,
       (GDestroyNotify) gum_linux_named_range_free);
 
-  fp = fopen ("/proc/self/maps", "r");
-  g_assert (fp != NULL);
-
-  line = g_malloc (line_size);
+  gum_proc_maps_iter_init_for_self (&iter);
 
   name = g_malloc (PATH_MAX);
-  next_name = g_malloc (PATH_MAX);
 
-  do
+  while (TRUE)
   {
-    GumAddress start, end;
+    GumAddress start;
     gsize size;
-    gint n;
+    const gchar * entry_name;
     GumLinuxNamedRange * range;
 
-    if (!got_line)
+    if (!got_entry)
     {
-      if (fgets (line, line_size, fp) == NULL)
+      if (!gum_proc_maps_iter_next (&iter, &entry))
         break;
     }
     else
     {
-      got_line = FALSE;
+      got_entry = FALSE;
     }
 
-    n = sscanf (line,
-        "%" G_GINT64_MODIFIER "x-%" G_GINT64_MODIFIER "x "
-        "%*4c "
-        "%*x %*s %*d "
-        "%s",
-        &start, &end,
-        name);
-    if (n == 2)
+    if (entry.path[0] == '\0')
       continue;
-    g_assert (n == 3);
 
-    gum_try_translate_vdso_name (name);
+    entry_name = gum_proc_maps_entry_get_module_path (&entry);
+    g_strlcpy (name, (entry_name != NULL) ? entry_name : entry.path, PATH_MAX);
 
-    size = end - start;
+    start = entry.start;
+    size = entry.end - start;
 
-    while (fgets (line, line_size, fp) != NULL)
+    while (gum_proc_maps_iter_next (&iter, &entry))
     {
-      n = sscanf (line,
-          "%*x-%" G_GINT64_MODIFIER "x %*c%*c%*c%*c %*x %*s %*d %s",
-          &end,
-          next_name);
-      if (n == 1)
-      {
+      const gchar * next_name;
+
+      if (entry.path[0] == '\0')
+        continue;
+
+      next_name = gum_proc_maps_entry_get_module_path (&entry);
+      if (next_name == NULL && entry.path[0] == '[')
         continue;
-      }
-      else if (n == 2 && next_name[0] == '[')
-      {
-        if (!gum_try_translate_vdso_name (next_name))
-          continue;
-      }
 
-      if (n == 2 && strcmp (next_name, name) == 0)
+      if (strcmp ((next_name != NULL) ? next_name : entry.path, name) == 0)
       {
-        size = end - start;
+        size = entry.end - start;
       }
       else
       {
-        got_line = TRUE;
+        got_entry = TRUE;
         break;
       }
     }
@@ -1194,14 +1165,10 @@ gum_linux_collect_named_ranges (void)
 
     g_hash_table_insert (result, range->base, range);
   }
-  while (carry_on);
 
   g_free (name);
-  g_free (next_name);
 
-  g_free (line);
-
-  fclose (fp);
+  gum_proc_maps_iter_destroy (&iter);
 
   return result;
 }
@@ -1214,16 +1181,28 @@ gum_linux_named_range_free (GumLinuxNamedRange * range)
   g_slice_free (GumLinuxNamedRange, range);
 }
 
-static gboolean
-gum_try_translate_vdso_name (gchar * name)
+/*
+ * Returns the path of the file backing the mapping, with anything after the
+ * first space, like " (deleted)", cut off. The vdso gets its soname, and
+ * other special mappings and anonymous ones yield NULL.
+ */
+static const gchar *
+gum_proc_maps_entry_get_module_path (GumProcMapsEntry * entry)
 {
-  if (strcmp (name, "[vdso]") == 0)
-  {
-    strcpy (name, "linux-vdso.so.1");
-    return TRUE;
-  }
+  gchar * path = entry->path;
+  gchar * space;
 
-  return FALSE;
+  if (path[0] == '[')
+    return (strcmp (path, "[vdso]") == 0) ? "linux-vdso.so.1" : NULL;
+
+  if (path[0] != '/')
+    return NULL;
+
+  space = strchr (path, ' ');
+  if (space != NULL)
+    *space = '\0';
+
+  return path;
 }
 
 void
@@ -1240,60 +1219,36 @@ gum_linux_enumerate_ranges (pid_t pid,
                             GumFoundRangeFunc func,
                             gpointer user_data)
 {
-  gchar * maps_path;
-  FILE * fp;
-  const guint line_size = GUM_MAPS_LINE_SIZE;
-  gchar * line;
+  GumProcMapsIter iter;
+  GumProcMapsEntry entry;
   gboolean carry_on = TRUE;
 
-  maps_path = g_strdup_printf ("/proc/%d/maps", pid);
+  gum_proc_maps_iter_init_for_pid (&iter, pid);
 
-  fp = fopen (maps_path, "r");
-  g_assert (fp != NULL);
-
-  g_free (maps_path);
-
-  line = g_malloc (line_size);
-
-  while (carry_on && fgets (line, line_size, fp) != NULL)
+  while (carry_on && gum_proc_maps_iter_next (&iter, &entry))
   {
     GumRangeDetails details;
     GumMemoryRange range;
     GumFileMapping file;
-    GumAddress end;
-    gchar perms[5] = { 0, };
-    guint64 inode;
-    gint length;
-
-    sscanf (line,
-        "%" G_GINT64_MODIFIER "x-%" G_GINT64_MODIFIER "x "
-        "%4c "
-        "%" G_GINT64_MODIFIER "x %*s %" G_GINT64_MODIFIER "d"
-        "%n",
-        &range.base_address, &end,
-        perms,
-        &file.offset, &inode,
-        &length);
-
-    range.size = end - range.base_address;
+
+    range.base_address = entry.start;
+    range.size = entry.end - entry.start;
 
     details.file = NULL;
-    if (inode != 0)
+    if (entry.inode != 0 && entry.path[0] == '/')
     {
-      file.path = strchr (line + length, '/');
-      if (file.path != NULL)
-      {
-        *strchr (file.path, '\n') = '\0';
-        details.file = &file;
-        file.size = 0; /* TODO */
+      file.path = entry.path;
+      file.offset = entry.offset;
+      file.size = 0; /* TODO */
+      details.file = &file;
 
-        if (RUNNING_ON_VALGRIND && strstr (file.path, "/valgrind/") != NULL)
-          continue;
-      }
+      if (RUNNING_ON_VALGRIND && strstr (file.path, "/valgrind/") != NULL)
+        continue;
     }
 
     details.range = &range;
-    details.protection = gum_page_protection_from_proc_perms_string (perms);
+    details.protection =
+        gum_page_protection_from_proc_perms_string (entry.perms);
 
     if ((details.protection & prot) == prot)
     {
@@ -1301,9 +1256,186 @@ gum_linux_enumerate_ranges (pid_t pid,
     }
   }
 
-  g_free (line);
+  gum_proc_maps_iter_destroy (&iter);
+}
+
+void
+gum_proc_maps_iter_init_for_self (GumProcMapsIter * iter)
+{
+  gum_proc_maps_iter_init_for_path (iter, "/proc/self/maps");
+}
+
+void
+gum_proc_maps_iter_init_for_pid (GumProcMapsIter * iter,
+                                 pid_t pid)
+{
+  gchar path[64];
+
+  g_snprintf (path, sizeof (path), "/proc/%d/maps", pid);
+
+  gum_proc_maps_iter_init_for_path (iter, path);
+}
+
+static void
+gum_proc_maps_iter_init_for_path (GumProcMapsIter * iter,
+                                  const gchar * path)
+{
+  if (gum_proc_maps_path_override != NULL)
+    path = gum_proc_maps_path_override;
+
+  iter->fd = open (path, O_RDONLY | O_CLOEXEC);
+  g_assert (iter->fd != -1);
+
+  iter->capacity = GUM_PROC_MAPS_BUFFER_SIZE;
+  iter->buffer = g_malloc (iter->capacity + 1);
+  iter->read_cursor = iter->buffer;
+  iter->write_cursor = iter->buffer;
+}
+
+void
+_gum_linux_override_proc_maps_path (const gchar * path)
+{
+  gum_proc_maps_path_override = path;
+}
+
+void
+gum_proc_maps_iter_destroy (GumProcMapsIter * iter)
+{
+  g_free (iter->buffer);
+
+  close (iter->fd);
+}
+
+/*
+ * Parses one line per call straight out of a large buffer that is refilled
+ * with read() as needed, without any per-line allocations or copies.
+ */
+gboolean
+gum_proc_maps_iter_next (GumProcMapsIter * iter,
+                         GumProcMapsEntry * entry)
+{
+  gchar * line, * newline, * cursor;
+
+  newline = memchr (iter->read_cursor, '\n',
+      iter->write_cursor - iter->read_cursor);
+  while (newline == NULL)
+  {
+    gsize scanned = iter->write_cursor - iter->read_cursor;
+
+    if (!gum_proc_maps_iter_fill (iter))
+    {
+      if (iter->read_cursor == iter->write_cursor)
+        return FALSE;
+      newline = iter->write_cursor;
+      break;
+    }
+
+    newline = memchr (iter->read_cursor + scanned, '\n',
+        iter->write_cursor - iter->read_cursor - scanned);
+  }
+
+  line = iter->read_cursor;
+  *newline = '\0';
+  iter->read_cursor = MIN (newline + 1, iter->write_cursor);
+
+  cursor = line;
+
+  entry->start = gum_proc_maps_parse_hex (&cursor);
+  cursor++;
+  entry->end = gum_proc_maps_parse_hex (&cursor);
+  cursor++;
+
+  entry->perms = cursor;
+  cursor += 5;
+
+  entry->offset = gum_proc_maps_parse_hex (&cursor);
+  cursor++;
+
+  while (*cursor != ' ' && *cursor != '\0')
+    cursor++;
+  if (*cursor == ' ')
+    cursor++;
+
+  entry->inode = gum_proc_maps_parse_dec (&cursor);
+
+  while (*cursor == ' ')
+    cursor++;
+  entry->path = cursor;
+
+  return TRUE;
+}
+
+static gboolean
+gum_proc_maps_iter_fill (GumProcMapsIter * self)
+{
+  gsize pending;
+  gssize n;
+
+  pending = self->write_cursor - self->read_cursor;
+  if (self->read_cursor != self->buffer)
+  {
+    memmove (self->buffer, self->read_cursor, pending);
+    self->read_cursor = self->buffer;
+    self->write_cursor = self->buffer + pending;
+  }
+
+  if (pending == self->capacity)
+  {
+    self->capacity *= 2;
+    self->buffer = g_realloc (self->buffer, self->capacity + 1);
+    self->read_cursor = self->buffer;
+    self->write_cursor = self->buffer + pending;
+  }
+
+  do
+  {
+    n = read (self->fd, self->write_cursor, self->capacity - pending);
+  }
+  while (n == -1 && errno == EINTR);
+
+  if (n <= 0)
+    return FALSE;
+
+  self->write_cursor += n;
+
+  return TRUE;
+}
+
+static guint64
+gum_proc_maps_parse_hex (gchar ** cursor)
+{
+  guint64 value = 0;
+  gchar * c;
+
+  for (c = *cursor; TRUE; c++)
+  {
+    gchar ch = *c;
+
+    if (ch >= '0' && ch <= '9')
+      value = (value << 4) | (ch - '0');
+    else if (ch >= 'a' && ch <= 'f')
+      value = (value << 4) | (10 + ch - 'a');
+    else
+      break;
+  }
+
+  *cursor = c;
+
+  return value;
+}
+
+static guint64
+gum_proc_maps_parse_dec (gchar ** cursor)
+{
+  guint64 value = 0;
+  gchar * c;
+
+  for (c = *cursor; *c >= '0' && *c <= '9'; c++)
+    value = (value * 10) + (*c - '0');
+
+  *cursor = c;
 
-  fclose (fp);
+  return value;
 }
 
 void
@@ -242,6 +242,21 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
   return TRUE;
 }
 
+gboolean
+_gum_interceptor_backend_create_probe_trampoline (GumInterceptorBackend * self,
+                                                  GumFunctionContext * ctx,
+                                                  GArray * probes)
+{
+  return FALSE;
+}
+
+gboolean
+_gum_interceptor_backend_create_fast_replacement (GumInterceptorBackend * self,
+                                                  GumFunctionContext * ctx)
+{
+  return FALSE;
+}
+
 void
 _gum_interceptor_backend_destroy_trampoline (GumInterceptorBackend * self,
                                              GumFunctionContext * ctx)
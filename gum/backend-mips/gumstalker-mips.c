@@ -53,6 +53,18 @@ gum_stalker_set_trust_threshold (GumStalker * self,
 {
 }
 
+guint
+gum_stalker_get_ic_entries (GumStalker * self)
+{
+  return 0;
+}
+
+void
+gum_stalker_set_ic_entries (GumStalker * self,
+                            guint ic_entries)
+{
+}
+
 void
 gum_stalker_flush (GumStalker * self)
 {
@@ -147,3 +159,11 @@ gum_stalker_iterator_put_callout (GumStalkerIterator * self,
                                   GDestroyNotify data_destroy)
 {
 }
+
+void
+gum_stalker_iterator_put_gpr_callout (GumStalkerIterator * self,
+                                      GumStalkerCallout callout,
+                                      gpointer data,
+                                      GDestroyNotify data_destroy)
+{
+}
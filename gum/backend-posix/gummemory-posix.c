@@ -24,17 +24,8 @@
 # error Unsupported OS
 #endif
 
-typedef struct _GumAllocNearContext GumAllocNearContext;
 typedef struct _GumEnumerateFreeRangesContext GumEnumerateFreeRangesContext;
 
-struct _GumAllocNearContext
-{
-  gpointer result;
-  gsize size;
-  gint posix_page_prot;
-  const GumAddressSpec * address_spec;
-};
-
 struct _GumEnumerateFreeRangesContext
 {
   GumFoundRangeFunc func;
@@ -42,8 +33,16 @@ struct _GumEnumerateFreeRangesContext
   GumAddress prev_end;
 };
 
-static gboolean gum_try_alloc_in_range_if_near_enough (
-    const GumRangeDetails * details, gpointer user_data);
+static gpointer gum_try_alloc_near_using_index (gsize size, gint posix_prot,
+    const GumAddressSpec * spec);
+static void gum_free_range_index_refresh (void);
+static gboolean gum_free_range_index_append (const GumRangeDetails * details,
+    gpointer user_data);
+static guint gum_free_range_index_find (GumAddress address);
+static void gum_free_range_index_take (guint index, GumAddress start,
+    gsize size);
+static void gum_free_range_index_take_any (GumAddress start, gsize size);
+static void gum_free_range_index_give (GumAddress start, gsize size);
 static gpointer gum_allocate_page_aligned (gpointer address, gsize size,
     gint prot);
 static void gum_enumerate_free_ranges (GumFoundRangeFunc func,
@@ -51,6 +50,18 @@ static void gum_enumerate_free_ranges (GumFoundRangeFunc func,
 static gboolean gum_emit_free_range (const GumRangeDetails * details,
     gpointer user_data);
 
+/*
+ * Sorted gaps between mappings, as last seen in the process' memory map, so
+ * near allocations don't have to parse it every time. It is kept up to date
+ * with our own allocations and frees, but not with anybody else's. This is
+ * safe because we only ever use it to pick a hint, and mark the index as
+ * stale when the kernel doesn't honor that hint. A stale index is still
+ * scanned to the end, but the next lookup rebuilds it first.
+ */
+G_LOCK_DEFINE_STATIC (gum_free_range_index);
+static GArray * gum_free_range_index = NULL;
+static gboolean gum_free_range_index_stale = FALSE;
+
 void
 _gum_memory_backend_init (void)
 {
@@ -59,6 +70,10 @@ _gum_memory_backend_init (void)
 void
 _gum_memory_backend_deinit (void)
 {
+  G_LOCK (gum_free_range_index);
+  g_clear_pointer (&gum_free_range_index, g_array_unref);
+  gum_free_range_index_stale = FALSE;
+  G_UNLOCK (gum_free_range_index);
 }
 
 guint
@@ -94,61 +109,278 @@ gum_try_alloc_n_pages_near (guint n_pages,
                             GumPageProtection page_prot,
                             const GumAddressSpec * address_spec)
 {
-  GumAllocNearContext ctx;
-  gsize page_size;
+  guint8 * result;
+  gsize page_size, size;
+  gint posix_prot;
 
   page_size = gum_query_page_size ();
+  size = (1 + n_pages) * page_size;
+  posix_prot = _gum_page_protection_to_posix (page_prot);
 
-  ctx.result = NULL;
-  ctx.size = (1 + n_pages) * page_size;
-  ctx.posix_page_prot = _gum_page_protection_to_posix (page_prot);
-  ctx.address_spec = address_spec;
+  result = gum_try_alloc_near_using_index (size, posix_prot, address_spec);
+  if (result == NULL)
+  {
+    gum_free_range_index_refresh ();
 
-  gum_enumerate_free_ranges (gum_try_alloc_in_range_if_near_enough, &ctx);
-  if (ctx.result == NULL)
-    return NULL;
+    result = gum_try_alloc_near_using_index (size, posix_prot, address_spec);
+    if (result == NULL)
+      return NULL;
+  }
 
   if ((page_prot & GUM_PAGE_WRITE) == 0)
-    gum_mprotect (ctx.result, page_size, GUM_PAGE_RW);
-  *((gsize *) ctx.result) = ctx.size;
-  gum_mprotect (ctx.result, page_size, GUM_PAGE_READ);
+    gum_mprotect (result, page_size, GUM_PAGE_RW);
+  *((gsize *) result) = size;
+  gum_mprotect (result, page_size, GUM_PAGE_READ);
+
+  return result + page_size;
+}
+
+static gpointer
+gum_try_alloc_near_using_index (gsize size,
+                                gint posix_prot,
+                                const GumAddressSpec * spec)
+{
+  gpointer result = NULL;
+  GumAddress near_address, lowest, highest;
+  guint i;
+
+  near_address = GUM_ADDRESS (spec->near_address);
+  lowest = (near_address > spec->max_distance)
+      ? near_address - spec->max_distance
+      : 0;
+  highest = (G_MAXUINT64 - near_address > spec->max_distance)
+      ? near_address + spec->max_distance
+      : G_MAXUINT64;
+
+  G_LOCK (gum_free_range_index);
+
+  if (gum_free_range_index == NULL || gum_free_range_index_stale)
+    goto beach;
+
+  for (i = gum_free_range_index_find (lowest);
+       i != gum_free_range_index->len;
+       i++)
+  {
+    const GumMemoryRange * range =
+        &g_array_index (gum_free_range_index, GumMemoryRange, i);
+    GumAddress base_address;
+    gsize distance;
+    gpointer mem;
+
+    if (range->base_address > highest)
+      break;
+
+    if (range->size < size)
+      continue;
+
+    base_address = range->base_address;
+    distance = ABS ((gssize) (near_address - base_address));
+    if (distance > spec->max_distance)
+    {
+      base_address = range->base_address + range->size - size;
+      distance = ABS ((gssize) (near_address - base_address));
+    }
+
+    if (distance > spec->max_distance)
+      continue;
+
+    mem = mmap (GSIZE_TO_POINTER (base_address), size, posix_prot,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+      continue;
+
+    if (mem != GSIZE_TO_POINTER (base_address))
+    {
+      munmap (mem, size);
+      gum_free_range_index_stale = TRUE;
+      continue;
+    }
+
+    gum_free_range_index_take (i, base_address, size);
 
-  return ctx.result + page_size;
+    result = mem;
+    break;
+  }
+
+beach:
+  G_UNLOCK (gum_free_range_index);
+
+  return result;
+}
+
+static void
+gum_free_range_index_refresh (void)
+{
+  GArray * index;
+
+  index = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
+  gum_enumerate_free_ranges (gum_free_range_index_append, index);
+
+  G_LOCK (gum_free_range_index);
+  g_clear_pointer (&gum_free_range_index, g_array_unref);
+  gum_free_range_index = index;
+  gum_free_range_index_stale = FALSE;
+  G_UNLOCK (gum_free_range_index);
 }
 
 static gboolean
-gum_try_alloc_in_range_if_near_enough (const GumRangeDetails * details,
-                                       gpointer user_data)
+gum_free_range_index_append (const GumRangeDetails * details,
+                             gpointer user_data)
 {
-  const GumMemoryRange * range = details->range;
-  GumAllocNearContext * ctx = user_data;
-  GumAddress base_address;
-  gsize distance;
+  GArray * index = user_data;
+
+  g_array_append_val (index, *details->range);
+
+  return TRUE;
+}
 
-  if (range->size < ctx->size)
-    return TRUE;
+/*
+ * Returns the index of the first free range that ends after @address.
+ */
+static guint
+gum_free_range_index_find (GumAddress address)
+{
+  guint lo, hi;
+
+  lo = 0;
+  hi = gum_free_range_index->len;
 
-  base_address = range->base_address;
-  distance = ABS (ctx->address_spec->near_address -
-      GSIZE_TO_POINTER (base_address));
-  if (distance > ctx->address_spec->max_distance)
+  while (lo != hi)
   {
-    base_address = range->base_address + range->size - ctx->size;
-    distance = ABS (ctx->address_spec->near_address -
-        GSIZE_TO_POINTER (base_address));
+    guint mid = lo + ((hi - lo) / 2);
+    const GumMemoryRange * range =
+        &g_array_index (gum_free_range_index, GumMemoryRange, mid);
+
+    if (range->base_address + range->size <= address)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
 
-  if (distance > ctx->address_spec->max_distance)
-    return TRUE;
+  return lo;
+}
 
-  ctx->result = mmap (GSIZE_TO_POINTER (base_address), ctx->size,
-      ctx->posix_page_prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
-  if (ctx->result == MAP_FAILED)
-    ctx->result = NULL;
+static void
+gum_free_range_index_take (guint index,
+                           GumAddress start,
+                           gsize size)
+{
+  GumMemoryRange * range =
+      &g_array_index (gum_free_range_index, GumMemoryRange, index);
+  GumAddress range_end = range->base_address + range->size;
+  GumAddress end = start + size;
+
+  if (start == range->base_address && end == range_end)
+  {
+    g_array_remove_index (gum_free_range_index, index);
+  }
+  else if (start == range->base_address)
+  {
+    range->base_address = end;
+    range->size = range_end - end;
+  }
+  else if (end == range_end)
+  {
+    range->size = start - range->base_address;
+  }
   else
-    return FALSE;
+  {
+    GumMemoryRange tail;
 
-  return TRUE;
+    tail.base_address = end;
+    tail.size = range_end - end;
+
+    range->size = start - range->base_address;
+
+    g_array_insert_val (gum_free_range_index, index + 1, tail);
+  }
+}
+
+static void
+gum_free_range_index_take_any (GumAddress start,
+                               gsize size)
+{
+  guint index;
+  const GumMemoryRange * range;
+
+  G_LOCK (gum_free_range_index);
+
+  if (gum_free_range_index == NULL)
+    goto beach;
+
+  index = gum_free_range_index_find (start);
+  if (index == gum_free_range_index->len)
+    goto beach;
+
+  range = &g_array_index (gum_free_range_index, GumMemoryRange, index);
+  if (range->base_address <= start &&
+      start + size <= range->base_address + range->size)
+  {
+    gum_free_range_index_take (index, start, size);
+  }
+  else if (range->base_address < start + size)
+  {
+    g_clear_pointer (&gum_free_range_index, g_array_unref);
+  }
+
+beach:
+  G_UNLOCK (gum_free_range_index);
+}
+
+static void
+gum_free_range_index_give (GumAddress start,
+                           gsize size)
+{
+  guint index;
+  GumMemoryRange * prev = NULL, * next = NULL;
+  GumAddress end = start + size;
+
+  G_LOCK (gum_free_range_index);
+
+  if (gum_free_range_index == NULL)
+    goto beach;
+
+  index = gum_free_range_index_find (start);
+
+  if (index != 0)
+    prev = &g_array_index (gum_free_range_index, GumMemoryRange, index - 1);
+  if (index != gum_free_range_index->len)
+    next = &g_array_index (gum_free_range_index, GumMemoryRange, index);
+
+  if (next != NULL && next->base_address < end)
+  {
+    /* Overlaps what we thought was free, so our view is out of date */
+    g_clear_pointer (&gum_free_range_index, g_array_unref);
+    goto beach;
+  }
+
+  if (prev != NULL && prev->base_address + prev->size == start)
+  {
+    prev->size += size;
+
+    if (next != NULL && next->base_address == end)
+    {
+      prev->size += next->size;
+      g_array_remove_index (gum_free_range_index, index);
+    }
+  }
+  else if (next != NULL && next->base_address == end)
+  {
+    next->base_address = start;
+    next->size += size;
+  }
+  else
+  {
+    GumMemoryRange range;
+
+    range.base_address = start;
+    range.size = size;
+
+    g_array_insert_val (gum_free_range_index, index, range);
+  }
+
+beach:
+  G_UNLOCK (gum_free_range_index);
 }
 
 void
@@ -223,15 +455,24 @@ gum_allocate_page_aligned (gpointer address,
   gpointer result;
 
   result = mmap (address, size, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (result == MAP_FAILED)
+    return NULL;
 
-  return (result != MAP_FAILED) ? result : NULL;
+  gum_free_range_index_take_any (GUM_ADDRESS (result), size);
+
+  return result;
 }
 
 gboolean
 gum_memory_free (gpointer address,
                  gsize size)
 {
-  return munmap (address, size) == 0;
+  if (munmap (address, size) != 0)
+    return FALSE;
+
+  gum_free_range_index_give (GUM_ADDRESS (address), size);
+
+  return TRUE;
 }
 
 gboolean
@@ -10,6 +10,7 @@
 #include "gumlibc.h"
 #include "gummemory.h"
 #include "gumsysinternals.h"
+#include "gumx86-priv.h"
 #include "gumx86reader.h"
 #include "gumx86relocator.h"
 
@@ -26,6 +27,13 @@
 #define GUM_FRAME_OFFSET_TOP \
     (GUM_FRAME_OFFSET_NEXT_HOP + sizeof (gpointer))
 
+/*
+ * The probe stub has pushed the flags, XAX and XCX, so XAX and XCX are ours
+ * to clobber, and the caller's return address sits right above them.
+ */
+#define GUM_PROBE_FRAME_OFFSET_SAVED_XCX 0
+#define GUM_PROBE_FRAME_OFFSET_RETURN_ADDRESS (3 * sizeof (gpointer))
+
 struct _GumInterceptorBackend
 {
   GumCodeAllocator * allocator;
@@ -34,20 +42,29 @@ struct _GumInterceptorBackend
   GumX86Relocator relocator;
 
   GumCodeSlice * enter_thunk;
+  GumCodeSlice * lite_enter_thunk;
   GumCodeSlice * leave_thunk;
 };
 
+static GumCodeSlice * gum_interceptor_backend_alloc_slice_near (
+    GumInterceptorBackend * self, GumFunctionContext * ctx);
 static void gum_interceptor_backend_create_thunks (
     GumInterceptorBackend * self);
 static void gum_interceptor_backend_destroy_thunks (
     GumInterceptorBackend * self);
 
-static void gum_emit_enter_thunk (GumX86Writer * cw);
+static void gum_emit_enter_thunk (GumX86Writer * cw, gboolean lite);
 static void gum_emit_leave_thunk (GumX86Writer * cw);
 
+static void gum_emit_count_calls_probe (GumX86Writer * cw,
+    volatile gint * counter);
+static void gum_emit_record_calls_probe (GumX86Writer * cw,
+    GumCallRecorder * recorder);
+
 static void gum_emit_prolog (GumX86Writer * cw,
-    gssize stack_displacement);
-static void gum_emit_epilog (GumX86Writer * cw);
+    gssize stack_displacement, gboolean lite);
+static void gum_emit_epilog (GumX86Writer * cw, gboolean lite);
+static void gum_emit_upper_ymm_transfer (GumX86Writer * cw, gboolean save);
 
 GumInterceptorBackend *
 _gum_interceptor_backend_create (GumCodeAllocator * allocator)
@@ -80,20 +97,26 @@ static gboolean
 gum_interceptor_backend_prepare_trampoline (GumInterceptorBackend * self,
                                             GumFunctionContext * ctx)
 {
-#if GLIB_SIZEOF_VOID_P == 4
-  ctx->trampoline_slice = gum_code_allocator_alloc_slice (self->allocator);
+  ctx->trampoline_slice = gum_interceptor_backend_alloc_slice_near (self, ctx);
 
-  return TRUE;
+  return ctx->trampoline_slice != NULL;
+}
+
+static GumCodeSlice *
+gum_interceptor_backend_alloc_slice_near (GumInterceptorBackend * self,
+                                          GumFunctionContext * ctx)
+{
+#if GLIB_SIZEOF_VOID_P == 4
+  return gum_code_allocator_alloc_slice (self->allocator);
 #else
   GumAddressSpec spec;
   gsize default_alignment = 0;
 
   spec.near_address = ctx->function_address;
   spec.max_distance = GUM_X86_JMP_MAX_DISTANCE;
-  ctx->trampoline_slice = gum_code_allocator_try_alloc_slice_near (
-      self->allocator, &spec, default_alignment);
 
-  return ctx->trampoline_slice != NULL;
+  return gum_code_allocator_try_alloc_slice_near (self->allocator, &spec,
+      default_alignment);
 #endif
 }
 
@@ -128,6 +151,12 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
   gum_x86_writer_put_push_near_ptr (cw, function_ctx_ptr);
   gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (self->leave_thunk->data));
 
+  ctx->on_lite_enter_trampoline = gum_x86_writer_cur (cw);
+
+  gum_x86_writer_put_push_near_ptr (cw, function_ctx_ptr);
+  gum_x86_writer_put_jmp_address (cw,
+      GUM_ADDRESS (self->lite_enter_thunk->data));
+
   gum_x86_writer_flush (cw);
   g_assert (gum_x86_writer_offset (cw) <= ctx->trampoline_slice->size);
 
@@ -157,6 +186,98 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
   return TRUE;
 }
 
+/*
+ * Emits a stub that applies the context's inline probes and then continues
+ * straight into the relocated prologue, without ever leaving generated code.
+ * Only used while the function has no listeners and no replacement, as
+ * otherwise the probes are applied by _gum_function_context_begin_invocation.
+ */
+gboolean
+_gum_interceptor_backend_create_probe_trampoline (GumInterceptorBackend * self,
+                                                  GumFunctionContext * ctx,
+                                                  GArray * probes)
+{
+  GumX86Writer * cw = &self->writer;
+  GumCodeSlice * slice;
+  guint i;
+
+  slice = gum_interceptor_backend_alloc_slice_near (self, ctx);
+  if (slice == NULL)
+    return FALSE;
+
+  gum_x86_writer_reset (cw, slice->data);
+
+  gum_x86_writer_put_pushfx (cw);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XAX);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XCX);
+
+  for (i = 0; i != probes->len; i++)
+  {
+    GumInlineProbe * probe = &g_array_index (probes, GumInlineProbe, i);
+
+    switch (probe->type)
+    {
+      case GUM_INLINE_PROBE_COUNT_CALLS:
+        gum_emit_count_calls_probe (cw, probe->data);
+        break;
+      case GUM_INLINE_PROBE_RECORD_CALLS:
+        gum_emit_record_calls_probe (cw, probe->data);
+        break;
+      default:
+        g_assert_not_reached ();
+    }
+  }
+
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XCX);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
+  gum_x86_writer_put_popfx (cw);
+
+  gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (ctx->on_invoke_trampoline));
+
+  gum_x86_writer_flush (cw);
+  g_assert (gum_x86_writer_offset (cw) <= slice->size);
+
+  ctx->probe_slice = slice;
+
+  return TRUE;
+}
+
+/*
+ * Lets the prologue jump straight to the replacement, going through a far
+ * jump in a nearby slice only if the replacement is out of rel32 range.
+ */
+gboolean
+_gum_interceptor_backend_create_fast_replacement (GumInterceptorBackend * self,
+                                                  GumFunctionContext * ctx)
+{
+  GumX86Writer * cw = &self->writer;
+  gssize distance;
+  GumCodeSlice * slice;
+
+  distance = (gssize) ctx->replacement_function -
+      ((gssize) ctx->function_address + GUM_INTERCEPTOR_REDIRECT_CODE_SIZE);
+  if (GUM_IS_WITHIN_INT32_RANGE (distance))
+  {
+    ctx->on_fast_replacement = ctx->replacement_function;
+    return TRUE;
+  }
+
+  slice = gum_interceptor_backend_alloc_slice_near (self, ctx);
+  if (slice == NULL)
+    return FALSE;
+
+  gum_x86_writer_reset (cw, slice->data);
+  gum_x86_writer_put_jmp_address (cw,
+      GUM_ADDRESS (ctx->replacement_function));
+  gum_x86_writer_flush (cw);
+  g_assert (gum_x86_writer_offset (cw) <= slice->size);
+
+  ctx->replacement_slice = slice;
+  ctx->on_fast_replacement = slice->data;
+
+  return TRUE;
+}
+
 void
 _gum_interceptor_backend_destroy_trampoline (GumInterceptorBackend * self,
                                              GumFunctionContext * ctx)
@@ -175,7 +296,10 @@ _gum_interceptor_backend_activate_trampoline (GumInterceptorBackend * self,
 
   gum_x86_writer_reset (cw, prologue);
   cw->pc = GPOINTER_TO_SIZE (ctx->function_address);
-  gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (ctx->on_enter_trampoline));
+  gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (
+      (ctx->redirect_target != NULL)
+          ? ctx->redirect_target
+          : ctx->on_enter_trampoline));
   gum_x86_writer_flush (cw);
   g_assert (gum_x86_writer_offset (cw) <= GUM_INTERCEPTOR_REDIRECT_CODE_SIZE);
 
@@ -220,10 +344,16 @@ gum_interceptor_backend_create_thunks (GumInterceptorBackend * self)
 
   self->enter_thunk = gum_code_allocator_alloc_slice (self->allocator);
   gum_x86_writer_reset (cw, self->enter_thunk->data);
-  gum_emit_enter_thunk (cw);
+  gum_emit_enter_thunk (cw, FALSE);
   gum_x86_writer_flush (cw);
   g_assert (gum_x86_writer_offset (cw) <= self->enter_thunk->size);
 
+  self->lite_enter_thunk = gum_code_allocator_alloc_slice (self->allocator);
+  gum_x86_writer_reset (cw, self->lite_enter_thunk->data);
+  gum_emit_enter_thunk (cw, TRUE);
+  gum_x86_writer_flush (cw);
+  g_assert (gum_x86_writer_offset (cw) <= self->lite_enter_thunk->size);
+
   self->leave_thunk = gum_code_allocator_alloc_slice (self->allocator);
   gum_x86_writer_reset (cw, self->leave_thunk->data);
   gum_emit_leave_thunk (cw);
@@ -236,15 +366,18 @@ gum_interceptor_backend_destroy_thunks (GumInterceptorBackend * self)
 {
   gum_code_slice_free (self->leave_thunk);
 
+  gum_code_slice_free (self->lite_enter_thunk);
+
   gum_code_slice_free (self->enter_thunk);
 }
 
 static void
-gum_emit_enter_thunk (GumX86Writer * cw)
+gum_emit_enter_thunk (GumX86Writer * cw,
+                      gboolean lite)
 {
   const gssize return_address_stack_displacement = 0;
 
-  gum_emit_prolog (cw, return_address_stack_displacement);
+  gum_emit_prolog (cw, return_address_stack_displacement, lite);
 
   gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSI,
       GUM_REG_XBP, GUM_FRAME_OFFSET_CPU_CONTEXT);
@@ -260,7 +393,7 @@ gum_emit_enter_thunk (GumX86Writer * cw)
       GUM_ARG_REGISTER, GUM_REG_XDX,
       GUM_ARG_REGISTER, GUM_REG_XCX);
 
-  gum_emit_epilog (cw);
+  gum_emit_epilog (cw, lite);
 }
 
 static void
@@ -268,7 +401,7 @@ gum_emit_leave_thunk (GumX86Writer * cw)
 {
   const gssize next_hop_stack_displacement = -((gssize) sizeof (gpointer));
 
-  gum_emit_prolog (cw, next_hop_stack_displacement);
+  gum_emit_prolog (cw, next_hop_stack_displacement, FALSE);
 
   gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSI,
       GUM_REG_XBP, GUM_FRAME_OFFSET_CPU_CONTEXT);
@@ -281,16 +414,103 @@ gum_emit_leave_thunk (GumX86Writer * cw)
       GUM_ARG_REGISTER, GUM_REG_XSI,
       GUM_ARG_REGISTER, GUM_REG_XDX);
 
-  gum_emit_epilog (cw);
+  gum_emit_epilog (cw, FALSE);
+}
+
+static void
+gum_emit_count_calls_probe (GumX86Writer * cw,
+                            volatile gint * counter)
+{
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX, GUM_ADDRESS (counter));
+  gum_x86_writer_put_mov_reg_u32 (cw, GUM_REG_ECX, 1);
+  gum_x86_writer_put_lock_xadd_reg_ptr_reg (cw, GUM_REG_XAX, GUM_REG_ECX);
+}
+
+static void
+gum_emit_record_calls_probe (GumX86Writer * cw,
+                             GumCallRecorder * recorder)
+{
+  gsize first_stack_arg_offset;
+  guint n_register_args, i;
+
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
+      GUM_ADDRESS (&recorder->head));
+  gum_x86_writer_put_mov_reg_u32 (cw, GUM_REG_ECX, 1);
+  gum_x86_writer_put_lock_xadd_reg_ptr_reg (cw, GUM_REG_XAX, GUM_REG_ECX);
+  gum_x86_writer_put_and_reg_u32 (cw, GUM_REG_ECX, recorder->mask);
+  gum_x86_writer_put_shl_reg_u8 (cw, GUM_REG_ECX,
+      g_bit_nth_lsf (sizeof (GumCallRecord), -1));
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
+      GUM_ADDRESS (recorder->records));
+  gum_x86_writer_put_add_reg_reg (cw, GUM_REG_XAX, GUM_REG_XCX);
+
+  gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XCX,
+      GUM_REG_XSP, GUM_PROBE_FRAME_OFFSET_RETURN_ADDRESS);
+  gum_x86_writer_put_mov_reg_offset_ptr_reg (cw,
+      GUM_REG_XAX, G_STRUCT_OFFSET (GumCallRecord, return_address),
+      GUM_REG_XCX);
+
+  n_register_args = 0;
+  first_stack_arg_offset =
+      GUM_PROBE_FRAME_OFFSET_RETURN_ADDRESS + sizeof (gpointer);
+  if (cw->target_cpu == GUM_CPU_AMD64)
+  {
+    if (cw->target_abi == GUM_ABI_WINDOWS)
+    {
+      n_register_args = 4;
+      first_stack_arg_offset += 4 * sizeof (gpointer);
+    }
+    else
+    {
+      n_register_args = 6;
+    }
+  }
+
+  for (i = 0; i != recorder->n_args; i++)
+  {
+    gssize dst_offset;
+    GumCpuReg arg_reg;
+
+    dst_offset = G_STRUCT_OFFSET (GumCallRecord, args) + i * sizeof (gpointer);
+
+    if (i < n_register_args)
+    {
+      arg_reg = gum_x86_writer_get_cpu_register_for_nth_argument (cw, i);
+      if (arg_reg == GUM_REG_RCX)
+      {
+        gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XCX,
+            GUM_REG_XSP, GUM_PROBE_FRAME_OFFSET_SAVED_XCX);
+      }
+      else
+      {
+        gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XAX,
+            dst_offset, arg_reg);
+        continue;
+      }
+    }
+    else
+    {
+      gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XCX,
+          GUM_REG_XSP, first_stack_arg_offset +
+          (i - n_register_args) * sizeof (gpointer));
+    }
+
+    gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XAX, dst_offset,
+        GUM_REG_XCX);
+  }
 }
 
 static void
 gum_emit_prolog (GumX86Writer * cw,
-                 gssize stack_displacement)
+                 gssize stack_displacement,
+                 gboolean lite)
 {
   guint8 fxsave[] = {
     0x0f, 0xae, 0x04, 0x24 /* fxsave [esp] */
   };
+  guint8 xsavec[] = {
+    0x0f, 0xc7, 0x24, 0x24 /* xsavec [esp] */
+  };
 
   /*
    * Set up our stack frame:
@@ -318,18 +538,71 @@ gum_emit_prolog (GumX86Writer * cw,
       GUM_FRAME_OFFSET_NEXT_HOP);
   gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XBP, GUM_REG_XSP);
   gum_x86_writer_put_and_reg_u32 (cw, GUM_REG_XSP, (guint32) ~(16 - 1));
-  gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP, 512);
-  gum_x86_writer_put_bytes (cw, fxsave, sizeof (fxsave));
+
+  if (lite && gum_query_cpu_xsave_area_size () != 0)
+  {
+    gssize offset;
+
+    /*
+     * The listener may run code that executes VZEROUPPER or changes MXCSR,
+     * so all of the vector state that can carry arguments has to survive,
+     * including the upper halves of ymm/zmm. XSAVEC only writes components
+     * that are not in their initial state, which keeps this cheaper than
+     * FXSAVE whenever AVX and AVX-512 are unused.
+     */
+    gum_x86_writer_put_and_reg_u32 (cw, GUM_REG_XSP, (guint32) ~(64 - 1));
+    gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP,
+        gum_query_cpu_xsave_area_size ());
+
+    /* Clear the XSAVE header, as XRSTOR faults on stale bytes in it */
+    gum_x86_writer_put_xor_reg_reg (cw, GUM_REG_EAX, GUM_REG_EAX);
+    for (offset = 512; offset != 512 + 64; offset += sizeof (gpointer))
+    {
+      gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XSP, offset,
+          GUM_REG_XAX);
+    }
+
+    gum_x86_writer_put_mov_reg_u32 (cw, GUM_REG_EAX,
+        GUM_XSAVE_COMPONENTS_MASK);
+    gum_x86_writer_put_xor_reg_reg (cw, GUM_REG_EDX, GUM_REG_EDX);
+    gum_x86_writer_put_bytes (cw, xsavec, sizeof (xsavec));
+  }
+  else
+  {
+    gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP, 512);
+    gum_x86_writer_put_bytes (cw, fxsave, sizeof (fxsave));
+
+    /* Without XSAVEC, the lite thunk spills the upper halves of ymm itself */
+    if (lite && (gum_query_cpu_features () & GUM_CPU_AVX2) != 0)
+      gum_emit_upper_ymm_transfer (cw, TRUE);
+  }
 }
 
 static void
-gum_emit_epilog (GumX86Writer * cw)
+gum_emit_epilog (GumX86Writer * cw,
+                 gboolean lite)
 {
   guint8 fxrstor[] = {
     0x0f, 0xae, 0x0c, 0x24 /* fxrstor [esp] */
   };
+  guint8 xrstor[] = {
+    0x0f, 0xae, 0x2c, 0x24 /* xrstor [esp] */
+  };
+
+  if (lite && gum_query_cpu_xsave_area_size () != 0)
+  {
+    gum_x86_writer_put_mov_reg_u32 (cw, GUM_REG_EAX,
+        GUM_XSAVE_COMPONENTS_MASK);
+    gum_x86_writer_put_xor_reg_reg (cw, GUM_REG_EDX, GUM_REG_EDX);
+    gum_x86_writer_put_bytes (cw, xrstor, sizeof (xrstor));
+  }
+  else
+  {
+    if (lite && (gum_query_cpu_features () & GUM_CPU_AVX2) != 0)
+      gum_emit_upper_ymm_transfer (cw, FALSE);
 
-  gum_x86_writer_put_bytes (cw, fxrstor, sizeof (fxrstor));
+    gum_x86_writer_put_bytes (cw, fxrstor, sizeof (fxrstor));
+  }
   gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XSP, GUM_REG_XBP);
 
   gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
@@ -339,3 +612,56 @@ gum_emit_epilog (GumX86Writer * cw)
   gum_x86_writer_put_popfx (cw);
   gum_x86_writer_put_ret (cw);
 }
+
+/*
+ * Saves the upper halves of ymm0-15 (ymm0-7 on ia32) below the stack pointer
+ * with VEXTRACTI128, or restores them with VINSERTI128 and pops them off.
+ */
+static void
+gum_emit_upper_ymm_transfer (GumX86Writer * cw,
+                             gboolean save)
+{
+  guint n, i;
+
+  n = (cw->target_cpu == GUM_CPU_AMD64) ? 16 : 8;
+
+  if (save)
+    gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP, n * 16);
+
+  for (i = 0; i != n; i++)
+  {
+    guint8 code[11];
+    guint len = 0, disp = i * 16;
+
+    code[len++] = 0xc4;
+    code[len++] = (i < 8) ? 0xe3 : 0x63;
+    code[len++] = save ? 0x7d : (((~i & 0xf) << 3) | 0x05);
+    code[len++] = save ? 0x39 : 0x38;
+    if (disp == 0)
+    {
+      code[len++] = 0x04 | ((i & 7) << 3);
+      code[len++] = 0x24;
+    }
+    else if (disp < 0x80)
+    {
+      code[len++] = 0x44 | ((i & 7) << 3);
+      code[len++] = 0x24;
+      code[len++] = disp;
+    }
+    else
+    {
+      code[len++] = 0x84 | ((i & 7) << 3);
+      code[len++] = 0x24;
+      code[len++] = disp & 0xff;
+      code[len++] = 0x00;
+      code[len++] = 0x00;
+      code[len++] = 0x00;
+    }
+    code[len++] = 0x01;
+
+    gum_x86_writer_put_bytes (cw, code, len);
+  }
+
+  if (!save)
+    gum_x86_writer_put_add_reg_imm (cw, GUM_REG_XSP, n * 16);
+}
@@ -6,9 +6,10 @@
  * Licence: wxWindows Library Licence, Version 3.1
  */
 
-#include "gumstalker.h"
+#include "gumstalker-priv.h"
 
 #include "gummetalhash.h"
+#include "gumx86-priv.h"
 #include "gumx86reader.h"
 #include "gumx86writer.h"
 #include "gummemory.h"
@@ -32,12 +33,45 @@
 #define GUM_DATA_ALIGNMENT                     8
 #define GUM_CODE_SLAB_SIZE_IN_PAGES         1024
 #define GUM_EXEC_BLOCK_MIN_SIZE             2048
+#define GUM_EXEC_FRAME_STACK_SIZE_IN_PAGES    16
+#define GUM_EXEC_FRAME_MAX_UNWIND_DEPTH       32
+#define GUM_MEMORY_EVENT_BUFFER_CAPACITY     256
+#define GUM_IC_DEFAULT_ENTRIES                 2
+#define GUM_IC_MAX_ENTRIES                    16
+#define GUM_IC_TABLE_SIZE                     64
+#define GUM_IC_TABLE_HASH_SHIFT                4
+#define GUM_IC_STATS_TOP_SITES                20
+
+/*
+ * The segment register used for thread-local storage, and the offset within
+ * it where the segment's own base address can be read.
+ */
+#if defined (HAVE_WINDOWS)
+# if GLIB_SIZEOF_VOID_P == 8
+#  define GUM_TLS_SEGMENT_REG                X86_REG_GS
+#  define GUM_TLS_SEGMENT_SELF_OFFSET              0x30
+# else
+#  define GUM_TLS_SEGMENT_REG                X86_REG_FS
+#  define GUM_TLS_SEGMENT_SELF_OFFSET              0x18
+# endif
+#elif !defined (HAVE_DARWIN)
+/* The ELF TLS ABI puts a pointer to the TCB itself at offset 0. */
+# if GLIB_SIZEOF_VOID_P == 8
+#  define GUM_TLS_SEGMENT_REG                X86_REG_FS
+# else
+#  define GUM_TLS_SEGMENT_REG                X86_REG_GS
+# endif
+# define GUM_TLS_SEGMENT_SELF_OFFSET                  0
+#endif
 
 typedef struct _GumInfectContext GumInfectContext;
 typedef struct _GumDisinfectContext GumDisinfectContext;
 
 typedef struct _GumCallProbe GumCallProbe;
 typedef struct _GumSlab GumSlab;
+typedef struct _GumIcEntry GumIcEntry;
+typedef struct _GumIcSite GumIcSite;
+typedef struct _GumIcStats GumIcStats;
 
 typedef struct _GumExecFrame GumExecFrame;
 typedef struct _GumExecCtx GumExecCtx;
@@ -71,6 +105,7 @@ struct _GumStalker
 
   guint page_size;
   GumCpuFeatures cpu_features;
+  guint xsave_area_size;
 
   GMutex mutex;
   GSList * contexts;
@@ -78,6 +113,7 @@ struct _GumStalker
 
   GArray * exclusions;
   gint trust_threshold;
+  guint ic_entries;
   volatile gboolean any_probes_attached;
   volatile gint last_probe_id;
   GumSpinlock probe_lock;
@@ -123,6 +159,29 @@ struct _GumSlab
   GumSlab * next;
 };
 
+struct _GumIcEntry
+{
+  gpointer real_start;
+  gpointer code_start;
+};
+
+struct _GumIcSite
+{
+  GumExecBlock * block;
+  GumIcEntry * entries;
+  guint num_entries;
+  GumIcEntry * table;
+  GumIcStats * stats;
+};
+
+struct _GumIcStats
+{
+  gpointer real_address;
+  gsize hits;
+  gsize misses;
+  gboolean is_megamorphic;
+};
+
 struct _GumExecFrame
 {
   gpointer real_address;
@@ -163,6 +222,9 @@ struct _GumExecCtx
   GumEventType sink_mask;
   void (* sink_process_impl) (GumEventSink * self, const GumEvent * event,
       GumCpuContext * cpu_context);
+  GumEvent * memory_events;
+  GumEvent * memory_events_cursor;
+  GumEvent * memory_events_end;
 
   gboolean unfollow_called_while_still_following;
   GumExecBlock * current_block;
@@ -189,6 +251,8 @@ struct _GumExecCtx
   gpointer last_stack_push;
   gpointer last_stack_pop_and_go;
   GumMetalHashTable * mappings;
+  GSList * ic_sites;
+  GSList * retired_ic_sites;
 };
 
 struct _GumExecBlock
@@ -313,6 +377,15 @@ enum _GumVirtualizationRequirements
 #define GUM_FULL_PROLOG_RETURN_OFFSET \
     (sizeof (GumCpuContext) + sizeof (gpointer))
 #define GUM_THUNK_ARGLIST_STACK_RESERVE 64 /* x64 ABI compatibility */
+#if GLIB_SIZEOF_VOID_P == 8
+# ifdef HAVE_WINDOWS
+#  define GUM_CALLER_SAVED_XMM_COUNT 6
+# else
+#  define GUM_CALLER_SAVED_XMM_COUNT 16
+# endif
+#else
+# define GUM_CALLER_SAVED_XMM_COUNT 8
+#endif
 
 static void gum_stalker_dispose (GObject * object);
 static void gum_stalker_finalize (GObject * object);
@@ -345,12 +418,18 @@ static gboolean gum_exec_ctx_maybe_unfollow (GumExecCtx * ctx,
 static void gum_exec_ctx_unfollow (GumExecCtx * ctx, gpointer resume_at);
 static gboolean gum_exec_ctx_has_executed (GumExecCtx * ctx);
 static gboolean gum_exec_ctx_contains (GumExecCtx * ctx, gconstpointer address);
+static void gum_exec_ctx_flush_memory_events (GumExecCtx * ctx);
 static gpointer GUM_THUNK gum_exec_ctx_replace_current_block_with (
     GumExecCtx * ctx, gpointer start_address);
 
+static void gum_exec_ctx_retire_ic_sites (GumExecCtx * ctx,
+    GumExecBlock * block);
+static void gum_exec_ctx_free_retired_ic_sites (GumExecCtx * ctx);
 static GumExecBlock * gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
     gpointer real_address, gpointer * code_address);
 
+static void gum_exec_ctx_write_caller_saved_xmm_transfer_code (
+    GumX86Writer * cw, gboolean save);
 static void gum_stalker_invoke_callout (GumCpuContext * cpu_context,
     GumCalloutEntry * entry);
 
@@ -409,6 +488,8 @@ static void gum_exec_block_backpatch_jmp (GumExecBlock * block,
     gpointer code_start, GumPrologType opened_prolog);
 static void gum_exec_block_backpatch_ret (GumExecBlock * block,
     gpointer code_start);
+static void gum_exec_block_backpatch_inline_cache (GumExecBlock * block,
+    GumIcSite * site);
 
 static GumVirtualizationRequirements gum_exec_block_virtualize_branch_insn (
     GumExecBlock * block, GumGeneratorContext * gc);
@@ -429,6 +510,16 @@ static void gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
     GumGeneratorContext * gc);
 static void gum_exec_block_write_ret_transfer_code (GumExecBlock * block,
     GumGeneratorContext * gc);
+static GumIcSite * gum_exec_block_write_inline_cache_entries (
+    GumExecBlock * block, gconstpointer look_in_cache,
+    GumGeneratorContext * gc);
+static void gum_exec_block_write_inline_cache_lookup_code (
+    GumExecBlock * block, GumIcSite * site, const GumBranchTarget * target,
+    GumGeneratorContext * gc);
+static void gum_exec_block_write_inline_cache_stats_increment (
+    GumExecBlock * block, gsize * counter, GumGeneratorContext * gc);
+static void gum_ic_site_free (GumIcSite * site);
+static gint gum_ic_stats_compare_by_misses (gconstpointer a, gconstpointer b);
 static void gum_exec_block_write_single_step_transfer_code (
     GumExecBlock * block, GumGeneratorContext * gc);
 #if GLIB_SIZEOF_VOID_P == 4 && !defined (HAVE_QNX)
@@ -445,6 +536,11 @@ static void gum_exec_block_write_exec_event_code (GumExecBlock * block,
     GumGeneratorContext * gc, GumCodeContext cc);
 static void gum_exec_block_write_block_event_code (GumExecBlock * block,
     GumGeneratorContext * gc, GumCodeContext cc);
+static void gum_exec_block_write_memory_event_code (GumExecBlock * block,
+    GumGeneratorContext * gc);
+static void gum_exec_block_write_memory_access_code (GumExecBlock * block,
+    const cs_x86_op * op, GumMemoryOperation operation,
+    GumGeneratorContext * gc);
 static void gum_exec_block_write_unfollow_check_code (GumExecBlock * block,
     GumGeneratorContext * gc, GumCodeContext cc);
 
@@ -509,6 +605,7 @@ gum_stalker_init (GumStalker * self)
 {
   self->exclusions = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
   self->trust_threshold = 1;
+  self->ic_entries = GUM_IC_DEFAULT_ENTRIES;
 
   gum_spinlock_init (&self->probe_lock);
   self->probe_target_by_id =
@@ -518,6 +615,7 @@ gum_stalker_init (GumStalker * self)
 
   self->page_size = gum_query_page_size ();
   self->cpu_features = gum_query_cpu_features ();
+  self->xsave_area_size = gum_query_cpu_xsave_area_size ();
   g_mutex_init (&self->mutex);
   self->contexts = NULL;
   self->exec_ctx = gum_tls_key_new ();
@@ -665,6 +763,19 @@ gum_stalker_set_trust_threshold (GumStalker * self,
   self->trust_threshold = trust_threshold;
 }
 
+guint
+gum_stalker_get_ic_entries (GumStalker * self)
+{
+  return self->ic_entries;
+}
+
+void
+gum_stalker_set_ic_entries (GumStalker * self,
+                            guint ic_entries)
+{
+  self->ic_entries = CLAMP (ic_entries, 1, GUM_IC_MAX_ENTRIES);
+}
+
 void
 gum_stalker_flush (GumStalker * self)
 {
@@ -1253,8 +1364,8 @@ gum_stalker_create_exec_ctx (GumStalker * self,
   base_size += thunk_size;
 
   ctx = (GumExecCtx *)
-      gum_alloc_n_pages (base_size + GUM_CODE_SLAB_SIZE_IN_PAGES + 1,
-          GUM_PAGE_RWX);
+      gum_alloc_n_pages (base_size + GUM_CODE_SLAB_SIZE_IN_PAGES +
+          GUM_EXEC_FRAME_STACK_SIZE_IN_PAGES, GUM_PAGE_RWX);
 
   ctx->state = GUM_EXEC_CTX_ACTIVE;
 
@@ -1281,6 +1392,14 @@ gum_stalker_create_exec_ctx (GumStalker * self,
   ctx->sink_mask = gum_event_sink_query_mask (ctx->sink);
   ctx->sink_process_impl = GUM_EVENT_SINK_GET_IFACE (ctx->sink)->process;
 
+  if ((ctx->sink_mask & GUM_MEMORY) != 0)
+  {
+    ctx->memory_events = g_new (GumEvent, GUM_MEMORY_EVENT_BUFFER_CAPACITY);
+    ctx->memory_events_cursor = ctx->memory_events;
+    ctx->memory_events_end =
+        ctx->memory_events + GUM_MEMORY_EVENT_BUFFER_CAPACITY;
+  }
+
   ctx->infect_thunk = (guint8 *) ctx +
       (base_size - thunk_size) * self->page_size;
 
@@ -1290,7 +1409,9 @@ gum_stalker_create_exec_ctx (GumStalker * self,
 
   ctx->frames = (GumExecFrame *) (ctx->code_slab->data + ctx->code_slab->size);
   ctx->first_frame = (GumExecFrame *) (ctx->code_slab->data +
-      ctx->code_slab->size + self->page_size - sizeof (GumExecFrame));
+      ctx->code_slab->size +
+      (GUM_EXEC_FRAME_STACK_SIZE_IN_PAGES * self->page_size) -
+      sizeof (GumExecFrame));
   ctx->current_frame = ctx->first_frame;
 
   ctx->mappings = gum_metal_hash_table_new (NULL, NULL);
@@ -1324,6 +1445,8 @@ gum_stalker_destroy_exec_ctx (GumStalker * self,
 
   if (ctx->sink_started)
   {
+    gum_exec_ctx_flush_memory_events (ctx);
+
     gum_event_sink_stop (ctx->sink);
 
     ctx->sink_started = FALSE;
@@ -1407,6 +1530,9 @@ gum_exec_ctx_free (GumExecCtx * ctx)
     slab = next;
   }
 
+  g_slist_free_full (ctx->ic_sites, (GDestroyNotify) gum_ic_site_free);
+  g_slist_free_full (ctx->retired_ic_sites, (GDestroyNotify) gum_ic_site_free);
+  g_free (ctx->memory_events);
   g_object_unref (ctx->sink);
   gum_exec_ctx_finalize_callouts (ctx);
   g_object_unref (ctx->transformer);
@@ -1442,6 +1568,8 @@ gum_exec_ctx_unfollow (GumExecCtx * ctx,
 
   ctx->resume_at = resume_at;
 
+  gum_exec_ctx_flush_memory_events (ctx);
+
   gum_tls_key_set_value (ctx->stalker->exec_ctx, NULL);
 
   ctx->destroy_pending_since = g_get_monotonic_time ();
@@ -1473,6 +1601,20 @@ gum_exec_ctx_contains (GumExecCtx * ctx,
   return FALSE;
 }
 
+static void
+gum_exec_ctx_flush_memory_events (GumExecCtx * ctx)
+{
+  GumEvent * ev;
+
+  if (ctx->memory_events == NULL)
+    return;
+
+  for (ev = ctx->memory_events; ev != ctx->memory_events_cursor; ev++)
+    ctx->sink_process_impl (ctx->sink, ev, NULL);
+
+  ctx->memory_events_cursor = ctx->memory_events;
+}
+
 static gboolean
 gum_exec_ctx_may_now_backpatch (GumExecCtx * ctx,
                                 GumExecBlock * target_block)
@@ -1491,6 +1633,8 @@ gum_exec_ctx_may_now_backpatch (GumExecCtx * ctx,
 
 static gboolean counters_enabled = FALSE;
 static guint total_transitions = 0;
+G_LOCK_DEFINE_STATIC (ic_stats);
+static GHashTable * ic_stats = NULL;
 
 #define GUM_ENTRYGATE(name) \
     gum_exec_ctx_replace_current_block_from_##name
@@ -1539,9 +1683,13 @@ gum_exec_ctx_replace_current_block_with (GumExecCtx * ctx,
   if (counters_enabled)
     total_transitions++;
 
+  if (ctx->retired_ic_sites != NULL && ctx->pending_calls == 0)
+    gum_exec_ctx_free_retired_ic_sites (ctx);
+
   if (ctx->invalidate_pending)
   {
     gum_metal_hash_table_remove_all (ctx->mappings);
+    gum_exec_ctx_retire_ic_sites (ctx, NULL);
 
     ctx->invalidate_pending = FALSE;
   }
@@ -1581,6 +1729,52 @@ gum_exec_ctx_replace_current_block_with (GumExecCtx * ctx,
   return ctx->resume_at;
 }
 
+/*
+ * Inline cache sites are referenced by the code of the block that owns them,
+ * so once that block has been dropped from the mappings they are parked here
+ * and only freed at the next transition. By then the block that was running
+ * when they were retired has finished its slow path, and any frame that could
+ * return into a retired block has been pointed at the slow path instead.
+ */
+static void
+gum_exec_ctx_retire_ic_sites (GumExecCtx * ctx,
+                              GumExecBlock * block)
+{
+  GSList * cur, * next;
+  GumExecFrame * frame;
+
+  for (cur = ctx->ic_sites; cur != NULL; cur = next)
+  {
+    GumIcSite * site = cur->data;
+
+    next = cur->next;
+
+    if (block == NULL || site->block == block)
+    {
+      ctx->ic_sites = g_slist_remove_link (ctx->ic_sites, cur);
+      ctx->retired_ic_sites = g_slist_concat (cur, ctx->retired_ic_sites);
+    }
+  }
+
+  for (frame = ctx->current_frame; frame != ctx->first_frame; frame++)
+  {
+    guint8 * code_address = frame->code_address;
+
+    if (block == NULL || (code_address >= block->code_begin &&
+        code_address < block->code_end))
+    {
+      frame->real_address = NULL;
+    }
+  }
+}
+
+static void
+gum_exec_ctx_free_retired_ic_sites (GumExecCtx * ctx)
+{
+  g_slist_free_full (ctx->retired_ic_sites, (GDestroyNotify) gum_ic_site_free);
+  ctx->retired_ic_sites = NULL;
+}
+
 static GumExecBlock *
 gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
                                gpointer real_address,
@@ -1609,6 +1803,7 @@ gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
       else
       {
         gum_metal_hash_table_remove (ctx->mappings, real_address);
+        gum_exec_ctx_retire_ic_sites (ctx, block);
       }
     }
   }
@@ -1679,6 +1874,8 @@ gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
   {
     GumEvent ev;
 
+    gum_exec_ctx_flush_memory_events (ctx);
+
     ev.type = GUM_COMPILE;
     ev.compile.begin = block->real_begin;
     ev.compile.end = block->real_end;
@@ -1760,6 +1957,9 @@ gum_stalker_iterator_keep (GumStalkerIterator * self)
     gum_exec_block_write_block_event_code (block, gc, GUM_CODE_INTERRUPTIBLE);
   }
 
+  if ((ec->sink_mask & GUM_MEMORY) != 0)
+    gum_exec_block_write_memory_event_code (block, gc);
+
   switch (insn->id)
   {
     case X86_INS_CALL:
@@ -1808,6 +2008,8 @@ gum_exec_ctx_emit_call_event (GumExecCtx * ctx,
   GumEvent ev;
   GumCallEvent * call = &ev.call;
 
+  gum_exec_ctx_flush_memory_events (ctx);
+
   ev.type = GUM_CALL;
 
   call->location = location;
@@ -1827,6 +2029,8 @@ gum_exec_ctx_emit_ret_event (GumExecCtx * ctx,
   GumEvent ev;
   GumRetEvent * ret = &ev.ret;
 
+  gum_exec_ctx_flush_memory_events (ctx);
+
   ev.type = GUM_RET;
 
   ret->location = location;
@@ -1846,6 +2050,8 @@ gum_exec_ctx_emit_exec_event (GumExecCtx * ctx,
   GumEvent ev;
   GumExecEvent * exec = &ev.exec;
 
+  gum_exec_ctx_flush_memory_events (ctx);
+
   ev.type = GUM_EXEC;
 
   exec->location = location;
@@ -1865,6 +2071,8 @@ gum_exec_ctx_emit_block_event (GumExecCtx * ctx,
   GumEvent ev;
   GumBlockEvent * block = &ev.block;
 
+  gum_exec_ctx_flush_memory_events (ctx);
+
   ev.type = GUM_BLOCK;
 
   block->begin = begin;
@@ -1908,6 +2116,102 @@ gum_stalker_iterator_put_callout (GumStalkerIterator * self,
   gum_spinlock_release (&ec->callout_lock);
 }
 
+void
+gum_stalker_iterator_put_gpr_callout (GumStalkerIterator * self,
+                                      GumStalkerCallout callout,
+                                      gpointer data,
+                                      GDestroyNotify data_destroy)
+{
+  GumCalloutEntry * entry;
+  GumExecCtx * ec = self->exec_context;
+  GumGeneratorContext * gc = self->generator_context;
+  GumX86Writer * cw = gc->code_writer;
+
+  if (gc->opened_prolog != GUM_PROLOG_NONE)
+  {
+    gum_stalker_iterator_put_callout (self, callout, data, data_destroy);
+    return;
+  }
+
+  entry = g_slice_new (GumCalloutEntry);
+  entry->callout = callout;
+  entry->data = data;
+  entry->data_destroy = data_destroy;
+  entry->pc = gc->instruction->begin;
+  entry->exec_context = ec;
+
+  /*
+   * Same GumCpuContext layout as the full prolog, but the callout promises
+   * not to touch any FPU/SIMD registers, so we skip saving extended state.
+   * The C code that dispatches to it may still clobber the caller-saved XMM
+   * registers though, so those are spilled around the call.
+   */
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, -GUM_RED_ZONE_SIZE);
+  gum_x86_writer_put_pushfx (cw);
+  gum_x86_writer_put_cld (cw);
+  gum_x86_writer_put_pushax (cw);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP, GUM_REG_XSP,
+      -((gint) sizeof (gpointer)));
+
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XAX, GUM_REG_XSP,
+      sizeof (GumCpuContext) + sizeof (gpointer) + GUM_RED_ZONE_SIZE);
+  gum_x86_writer_put_mov_reg_offset_ptr_reg (cw,
+      GUM_REG_XSP, GUM_CPU_CONTEXT_OFFSET_XSP,
+      GUM_REG_XAX);
+
+  gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XBX, GUM_REG_XSP);
+  gum_x86_writer_put_and_reg_u32 (cw, GUM_REG_XSP, (guint32) ~(16 - 1));
+  gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP,
+      GUM_CALLER_SAVED_XMM_COUNT * 16);
+  gum_exec_ctx_write_caller_saved_xmm_transfer_code (cw, TRUE);
+
+  gum_x86_writer_put_call_address_with_aligned_arguments (cw,
+      GUM_CALL_CAPI, GUM_ADDRESS (gum_stalker_invoke_callout), 2,
+      GUM_ARG_REGISTER, GUM_REG_XBX,
+      GUM_ARG_ADDRESS, GUM_ADDRESS (entry));
+
+  gum_exec_ctx_write_caller_saved_xmm_transfer_code (cw, FALSE);
+  gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XSP, GUM_REG_XBX);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX); /* Discard
+                                                   GumCpuContext.xip */
+  gum_x86_writer_put_popax (cw);
+  gum_x86_writer_put_popfx (cw);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, GUM_RED_ZONE_SIZE);
+
+  gum_spinlock_acquire (&ec->callout_lock);
+  g_queue_push_head (&ec->callout_entries, entry);
+  gum_spinlock_release (&ec->callout_lock);
+}
+
+static void
+gum_exec_ctx_write_caller_saved_xmm_transfer_code (GumX86Writer * cw,
+                                                   gboolean save)
+{
+  guint i;
+
+  for (i = 0; i != GUM_CALLER_SAVED_XMM_COUNT; i++)
+  {
+    guint8 code[10];
+    guint n = 0;
+    guint32 offset = GUINT32_TO_LE (i * 16);
+
+    /* movdqu [xsp + offset], xmmN or movdqu xmmN, [xsp + offset] */
+    code[n++] = 0xf3;
+    if (i >= 8)
+      code[n++] = 0x44;
+    code[n++] = 0x0f;
+    code[n++] = save ? 0x7f : 0x6f;
+    code[n++] = 0x84 | ((i & 7) << 3);
+    code[n++] = 0x24;
+    memcpy (code + n, &offset, sizeof (offset));
+    n += sizeof (offset);
+
+    gum_x86_writer_put_bytes (cw, code, n);
+  }
+}
+
 static void
 gum_stalker_invoke_callout (GumCpuContext * cpu_context,
                             GumCalloutEntry * entry)
@@ -2067,6 +2371,9 @@ gum_exec_ctx_write_prolog_helper (GumExecCtx * ctx,
   guint8 fxsave[] = {
     0x0f, 0xae, 0x04, 0x24 /* fxsave [esp] */
   };
+  guint8 xsavec[] = {
+    0x0f, 0xc7, 0x24, 0x24 /* xsavec [esp] */
+  };
   guint8 upper_ymm_saver[] = {
 #if GLIB_SIZEOF_VOID_P == 8
     /* vextracti128 ymm0..ymm15, [rsp+0x0]..[rsp+0xF0], 1 */
@@ -2142,14 +2449,47 @@ gum_exec_ctx_write_prolog_helper (GumExecCtx * ctx,
   }
 
   gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XBX, GUM_REG_XSP);
-  gum_x86_writer_put_and_reg_u32 (cw, GUM_REG_XSP, (guint32) ~(16 - 1));
-  gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP, 512);
-  gum_x86_writer_put_bytes (cw, fxsave, sizeof (fxsave));
 
-  if ((ctx->stalker->cpu_features & GUM_CPU_AVX2) != 0)
+  if (ctx->stalker->xsave_area_size != 0)
   {
-    gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP, 0x100);
-    gum_x86_writer_put_bytes (cw, upper_ymm_saver, sizeof (upper_ymm_saver));
+    gssize offset;
+
+    /*
+     * XSAVEC only writes the components that are not in their initial state,
+     * which is a big win when AVX-512 is enabled but rarely used. We stay
+     * away from XSAVEOPT as its modified optimization assumes that nobody
+     * touched the save area since the last XRSTOR, which does not hold for
+     * a save area that lives on the application's stack.
+     */
+    gum_x86_writer_put_and_reg_u32 (cw, GUM_REG_XSP, (guint32) ~(64 - 1));
+    gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP,
+        ctx->stalker->xsave_area_size);
+
+    /* XSAVEC leaves most of the header alone, and XRSTOR insists on zeros */
+    gum_x86_writer_put_xor_reg_reg (cw, GUM_REG_EAX, GUM_REG_EAX);
+    for (offset = 512; offset != 512 + 64; offset += sizeof (gpointer))
+    {
+      gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XSP, offset,
+          GUM_REG_XAX);
+    }
+
+    gum_x86_writer_put_mov_reg_u32 (cw, GUM_REG_EAX,
+        GUM_XSAVE_COMPONENTS_MASK);
+    gum_x86_writer_put_xor_reg_reg (cw, GUM_REG_EDX, GUM_REG_EDX);
+    gum_x86_writer_put_bytes (cw, xsavec, sizeof (xsavec));
+  }
+  else
+  {
+    gum_x86_writer_put_and_reg_u32 (cw, GUM_REG_XSP, (guint32) ~(16 - 1));
+    gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP, 512);
+    gum_x86_writer_put_bytes (cw, fxsave, sizeof (fxsave));
+
+    if ((ctx->stalker->cpu_features & GUM_CPU_AVX2) != 0)
+    {
+      gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP, 0x100);
+      gum_x86_writer_put_bytes (cw, upper_ymm_saver,
+          sizeof (upper_ymm_saver));
+    }
   }
 
   /* Jump to our caller but leave it on the stack */
@@ -2167,6 +2507,9 @@ gum_exec_ctx_write_epilog_helper (GumExecCtx * ctx,
   guint8 fxrstor[] = {
     0x0f, 0xae, 0x0c, 0x24 /* fxrstor [esp] */
   };
+  guint8 xrstor[] = {
+    0x0f, 0xae, 0x2c, 0x24 /* xrstor [esp] */
+  };
   guint8 upper_ymm_restorer[] = {
 #if GLIB_SIZEOF_VOID_P == 8
     /* vinserti128 ymm0..ymm15, ymm0..ymm15, [rsp+0x0]..[rsp+0xF0], 1 */
@@ -2207,14 +2550,25 @@ gum_exec_ctx_write_epilog_helper (GumExecCtx * ctx,
           : GUM_FULL_PROLOG_RETURN_OFFSET,
       GUM_REG_XAX);
 
-  if ((ctx->stalker->cpu_features & GUM_CPU_AVX2) != 0)
+  if (ctx->stalker->xsave_area_size != 0)
   {
-    gum_x86_writer_put_bytes (cw, upper_ymm_restorer,
-        sizeof (upper_ymm_restorer));
-    gum_x86_writer_put_add_reg_imm (cw, GUM_REG_XSP, 0x100);
+    gum_x86_writer_put_mov_reg_u32 (cw, GUM_REG_EAX,
+        GUM_XSAVE_COMPONENTS_MASK);
+    gum_x86_writer_put_xor_reg_reg (cw, GUM_REG_EDX, GUM_REG_EDX);
+    gum_x86_writer_put_bytes (cw, xrstor, sizeof (xrstor));
+  }
+  else
+  {
+    if ((ctx->stalker->cpu_features & GUM_CPU_AVX2) != 0)
+    {
+      gum_x86_writer_put_bytes (cw, upper_ymm_restorer,
+          sizeof (upper_ymm_restorer));
+      gum_x86_writer_put_add_reg_imm (cw, GUM_REG_XSP, 0x100);
+    }
+
+    gum_x86_writer_put_bytes (cw, fxrstor, sizeof (fxrstor));
   }
 
-  gum_x86_writer_put_bytes (cw, fxrstor, sizeof (fxrstor));
   gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XSP, GUM_REG_XBX);
 
   if (type == GUM_PROLOG_MINIMAL)
@@ -2255,8 +2609,11 @@ gum_exec_ctx_write_stack_push_helper (GumExecCtx * ctx,
   gum_x86_writer_put_push_reg (cw, GUM_REG_XAX);
 
   gum_x86_writer_put_mov_reg_reg_ptr (cw, GUM_REG_XAX, GUM_REG_XAX);
-  gum_x86_writer_put_test_reg_u32 (cw, GUM_REG_XAX,
-      ctx->stalker->page_size - 1);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XCX);
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XCX,
+      GUM_ADDRESS (ctx->frames));
+  gum_x86_writer_put_cmp_reg_reg (cw, GUM_REG_XAX, GUM_REG_XCX);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XCX);
   gum_x86_writer_put_jcc_short_label (cw, X86_INS_JE, skip_stack_push,
       GUM_UNLIKELY);
 
@@ -2280,6 +2637,9 @@ gum_exec_ctx_write_stack_pop_and_go_helper (GumExecCtx * ctx,
                                             GumX86Writer * cw)
 {
   gconstpointer resolve_dynamically = cw->code + 1;
+  gconstpointer found = cw->code + 2;
+  gconstpointer search_deeper = cw->code + 3;
+  gconstpointer try_next_frame = cw->code + 4;
   GumAddress return_at = GUM_ADDRESS (&ctx->return_at);
   guint stack_delta = GUM_RED_ZONE_SIZE + sizeof (gpointer);
 
@@ -2307,10 +2667,11 @@ gum_exec_ctx_write_stack_pop_and_go_helper (GumExecCtx * ctx,
   gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw,
       GUM_REG_XSP, stack_delta,
       GUM_REG_XCX);
-  gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE,
-      resolve_dynamically, GUM_UNLIKELY);
+  gum_x86_writer_put_jcc_near_label (cw, X86_INS_JNE,
+      search_deeper, GUM_UNLIKELY);
 
   /* Replace return address */
+  gum_x86_writer_put_label (cw, found);
   gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XCX,
       GUM_REG_XAX, G_STRUCT_OFFSET (GumExecFrame, code_address));
   gum_x86_writer_put_mov_reg_offset_ptr_reg (cw,
@@ -2331,7 +2692,43 @@ gum_exec_ctx_write_stack_pop_and_go_helper (GumExecCtx * ctx,
 
   gum_x86_writer_put_jmp_near_ptr (cw, return_at);
 
+  /*
+   * The top frame did not match, e.g. because of a longjmp() or an exception
+   * unwinding past frames we know about. Look a bounded number of frames
+   * further down, discarding the ones above if we find a match.
+   */
+  gum_x86_writer_put_label (cw, search_deeper);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XDX);
+  stack_delta += sizeof (gpointer);
+
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XDX, GUM_REG_XAX,
+      GUM_EXEC_FRAME_MAX_UNWIND_DEPTH * sizeof (GumExecFrame));
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XCX,
+      GUM_ADDRESS (ctx->first_frame));
+  gum_x86_writer_put_cmp_reg_reg (cw, GUM_REG_XDX, GUM_REG_XCX);
+  gum_x86_writer_put_jcc_short_label (cw, X86_INS_JBE, try_next_frame,
+      GUM_LIKELY);
+  gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XDX, GUM_REG_XCX);
+
+  gum_x86_writer_put_label (cw, try_next_frame);
+  gum_x86_writer_put_add_reg_imm (cw, GUM_REG_XAX, sizeof (GumExecFrame));
+  gum_x86_writer_put_cmp_reg_reg (cw, GUM_REG_XAX, GUM_REG_XDX);
+  gum_x86_writer_put_jcc_short_label (cw, X86_INS_JAE, resolve_dynamically,
+      GUM_UNLIKELY);
+  gum_x86_writer_put_mov_reg_reg_ptr (cw, GUM_REG_XCX, GUM_REG_XAX);
+  gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw,
+      GUM_REG_XSP, stack_delta,
+      GUM_REG_XCX);
+  gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, try_next_frame,
+      GUM_NO_HINT);
+
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XDX);
+  stack_delta -= sizeof (gpointer);
+  gum_x86_writer_put_jmp_near_label (cw, found);
+
   gum_x86_writer_put_label (cw, resolve_dynamically);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XDX);
+  stack_delta -= sizeof (gpointer);
 
   /* Clear our stack so we might resync later */
   gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XCX,
@@ -2693,6 +3090,8 @@ gum_exec_block_new (GumExecCtx * ctx)
 
   if (ctx->stalker->trust_threshold < 0)
   {
+    gum_exec_ctx_retire_ic_sites (ctx, NULL);
+
     ctx->code_slab->offset = 0;
 
     return gum_exec_block_new (ctx);
@@ -2863,10 +3262,12 @@ gum_exec_block_backpatch_ret (GumExecBlock * block,
 
 static void
 gum_exec_block_backpatch_inline_cache (GumExecBlock * block,
-                                       gpointer * ic_entries)
+                                       GumIcSite * site)
 {
   gboolean just_unfollowed;
   GumExecCtx * ctx;
+  guint i;
+  GumIcEntry * entry;
 
   just_unfollowed = block == NULL;
   if (just_unfollowed)
@@ -2874,18 +3275,41 @@ gum_exec_block_backpatch_inline_cache (GumExecBlock * block,
 
   ctx = block->ctx;
 
-  if (gum_exec_ctx_may_now_backpatch (ctx, block))
+  if (!gum_exec_ctx_may_now_backpatch (ctx, block))
+    return;
+
+  for (i = 0; i != site->num_entries; i++)
   {
-    guint offset;
+    entry = &site->entries[i];
 
-    offset = (ic_entries[0] == NULL) ? 0 : 2;
+    if (entry->real_start == block->real_begin)
+      return;
 
-    if (ic_entries[offset + 0] == NULL)
+    if (entry->real_start == NULL)
     {
-      ic_entries[offset + 0] = block->real_begin;
-      ic_entries[offset + 1] = block->code_begin;
+      entry->real_start = block->real_begin;
+      entry->code_start = block->code_begin;
+      return;
     }
   }
+
+  /*
+   * All inline entries are taken, so the site is megamorphic. Fall back to a
+   * direct-mapped table which the inline code probes before taking the slow
+   * path, evicting whichever target previously occupied the slot.
+   */
+  if (site->table == NULL)
+  {
+    site->table = g_new0 (GumIcEntry, GUM_IC_TABLE_SIZE);
+
+    if (site->stats != NULL)
+      site->stats->is_megamorphic = TRUE;
+  }
+
+  entry = &site->table[(GPOINTER_TO_SIZE (block->real_begin) >>
+      GUM_IC_TABLE_HASH_SHIFT) & (GUM_IC_TABLE_SIZE - 1)];
+  entry->real_start = block->real_begin;
+  entry->code_start = block->code_begin;
 }
 
 static GumVirtualizationRequirements
@@ -3228,14 +3652,12 @@ gum_exec_block_write_call_invoke_code (GumExecBlock * block,
   gpointer call_code_start;
   GumPrologType opened_prolog;
   gboolean can_backpatch_statically;
-  gpointer * ic_entries = NULL;
+  GumIcSite * ic_site = NULL;
   GumExecCtxReplaceCurrentBlockFunc entry_func;
   gconstpointer push_application_retaddr = cw->code + 1;
   gconstpointer perform_stack_push = cw->code + 2;
   gconstpointer look_in_cache = cw->code + 3;
-  gconstpointer try_second = cw->code + 4;
-  gconstpointer resolve_dynamically = cw->code + 5;
-  gconstpointer beach = cw->code + 6;
+  gconstpointer beach = cw->code + 4;
   gpointer ret_real_address, ret_code_address;
 
   call_code_start = cw->code;
@@ -3248,10 +3670,6 @@ gum_exec_block_write_call_invoke_code (GumExecBlock * block,
   if (block->ctx->stalker->trust_threshold >= 0 &&
       !can_backpatch_statically)
   {
-    gpointer null_ptr = NULL;
-    gpointer ic1_real, ic1_code;
-    gpointer ic2_real, ic2_code;
-
     if (opened_prolog == GUM_PROLOG_NONE)
     {
       gum_exec_block_open_prolog (block, GUM_PROLOG_IC, gc);
@@ -3276,49 +3694,15 @@ gum_exec_block_write_call_invoke_code (GumExecBlock * block,
       gc->accumulated_stack_delta += sizeof (gpointer);
     }
 
-    gum_x86_writer_put_jmp_short_label (cw, look_in_cache);
-
-    ic_entries = gum_x86_writer_cur (cw);
-    ic1_real = ic_entries;
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
-    ic1_code = gum_x86_writer_cur (cw);
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
-    ic2_real = gum_x86_writer_cur (cw);
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
-    ic2_code = gum_x86_writer_cur (cw);
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
-
-    gum_x86_writer_put_label (cw, look_in_cache);
-
-    gum_exec_ctx_write_push_branch_target_address (block->ctx, target, gc);
-
-    gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
-        GUM_ADDRESS (ic1_real));
-    gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw, GUM_REG_XSP, 0, GUM_REG_XAX);
-    gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, try_second,
-        GUM_NO_HINT);
-    gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
-    gum_exec_ctx_write_epilog (block->ctx, GUM_PROLOG_IC, cw);
-    gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (ic1_code));
-
-    gum_x86_writer_put_label (cw, try_second);
-    gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
-        GUM_ADDRESS (ic2_real));
-    gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw, GUM_REG_XSP, 0, GUM_REG_XAX);
-    gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, resolve_dynamically,
-        GUM_NO_HINT);
-    gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
-    gum_exec_ctx_write_epilog (block->ctx, GUM_PROLOG_IC, cw);
-    gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (ic2_code));
+    ic_site = gum_exec_block_write_inline_cache_entries (block, look_in_cache,
+        gc);
 
-    gum_x86_writer_put_label (cw, resolve_dynamically);
-    gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
-    gum_exec_block_close_prolog (block, gc);
+    gum_exec_block_write_inline_cache_lookup_code (block, ic_site, target, gc);
   }
 
   gum_exec_block_open_prolog (block, GUM_PROLOG_MINIMAL, gc);
 
-  if (ic_entries == NULL)
+  if (ic_site == NULL)
   {
     gum_x86_writer_put_call_near_label (cw, push_application_retaddr);
 
@@ -3425,12 +3809,12 @@ gum_exec_block_write_call_invoke_code (GumExecBlock * block,
         GUM_ARG_ADDRESS, GUM_ADDRESS (ret_code_address));
   }
 
-  if (ic_entries != NULL)
+  if (ic_site != NULL)
   {
     gum_x86_writer_put_call_address_with_aligned_arguments (cw, GUM_CALL_CAPI,
         GUM_ADDRESS (gum_exec_block_backpatch_inline_cache), 2,
         GUM_ARG_REGISTER, GUM_REG_XAX,
-        GUM_ARG_ADDRESS, GUM_ADDRESS (ic_entries));
+        GUM_ARG_ADDRESS, GUM_ADDRESS (ic_site));
   }
 
   /* Execute the generated code */
@@ -3449,10 +3833,8 @@ gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
   guint8 * code_start;
   GumPrologType opened_prolog;
   gboolean can_backpatch_statically;
-  gpointer * ic_entries = NULL;
+  GumIcSite * ic_site = NULL;
   gconstpointer look_in_cache = cw->code + 1;
-  gconstpointer try_second = cw->code + 2;
-  gconstpointer resolve_dynamically = cw->code + 3;
 
   code_start = cw->code;
   opened_prolog = gc->opened_prolog;
@@ -3464,51 +3846,14 @@ gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
   if (block->ctx->stalker->trust_threshold >= 0 &&
       !can_backpatch_statically)
   {
-    gpointer null_ptr = NULL;
-    gpointer ic1_real, ic1_code;
-    gpointer ic2_real, ic2_code;
-
     gum_exec_block_close_prolog (block, gc);
 
-    gum_x86_writer_put_jmp_short_label (cw, look_in_cache);
-
-    ic_entries = gum_x86_writer_cur (cw);
-    ic1_real = ic_entries;
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
-    ic1_code = gum_x86_writer_cur (cw);
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
-    ic2_real = gum_x86_writer_cur (cw);
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
-    ic2_code = gum_x86_writer_cur (cw);
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
+    ic_site = gum_exec_block_write_inline_cache_entries (block, look_in_cache,
+        gc);
 
-    gum_x86_writer_put_label (cw, look_in_cache);
     gum_exec_block_open_prolog (block, GUM_PROLOG_IC, gc);
 
-    gum_exec_ctx_write_push_branch_target_address (block->ctx, target, gc);
-
-    gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
-        GUM_ADDRESS (ic1_real));
-    gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw, GUM_REG_XSP, 0, GUM_REG_XAX);
-    gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, try_second,
-        GUM_NO_HINT);
-    gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
-    gum_exec_ctx_write_epilog (block->ctx, GUM_PROLOG_IC, cw);
-    gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (ic1_code));
-
-    gum_x86_writer_put_label (cw, try_second);
-    gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
-        GUM_ADDRESS (ic2_real));
-    gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw, GUM_REG_XSP, 0, GUM_REG_XAX);
-    gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, resolve_dynamically,
-        GUM_NO_HINT);
-    gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
-    gum_exec_ctx_write_epilog (block->ctx, GUM_PROLOG_IC, cw);
-    gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (ic2_code));
-
-    gum_x86_writer_put_label (cw, resolve_dynamically);
-    gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
-    gum_exec_block_close_prolog (block, gc);
+    gum_exec_block_write_inline_cache_lookup_code (block, ic_site, target, gc);
   }
 
   gum_exec_block_open_prolog (block, GUM_PROLOG_MINIMAL, gc);
@@ -3539,12 +3884,12 @@ gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
         GUM_ARG_ADDRESS, GUM_ADDRESS (opened_prolog));
   }
 
-  if (ic_entries != NULL)
+  if (ic_site != NULL)
   {
     gum_x86_writer_put_call_address_with_aligned_arguments (cw, GUM_CALL_CAPI,
         GUM_ADDRESS (gum_exec_block_backpatch_inline_cache), 2,
         GUM_ARG_REGISTER, GUM_REG_XAX,
-        GUM_ARG_ADDRESS, GUM_ADDRESS (ic_entries));
+        GUM_ARG_ADDRESS, GUM_ADDRESS (ic_site));
   }
 
   gum_exec_block_close_prolog (block, gc);
@@ -3569,6 +3914,152 @@ gum_exec_block_write_ret_transfer_code (GumExecBlock * block,
       GUM_ADDRESS (block->ctx->last_stack_pop_and_go));
 }
 
+static GumIcSite *
+gum_exec_block_write_inline_cache_entries (GumExecBlock * block,
+                                           gconstpointer look_in_cache,
+                                           GumGeneratorContext * gc)
+{
+  GumExecCtx * ctx = block->ctx;
+  GumX86Writer * cw = gc->code_writer;
+  GumIcSite * site;
+  GumIcEntry empty_entry = { NULL, NULL };
+  guint i;
+
+  site = g_slice_new (GumIcSite);
+  site->block = block;
+  site->num_entries = ctx->stalker->ic_entries;
+  site->table = NULL;
+  site->stats = NULL;
+
+  if (counters_enabled)
+  {
+    gpointer real_address = gc->instruction->begin;
+
+    G_LOCK (ic_stats);
+
+    if (ic_stats == NULL)
+      ic_stats = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+
+    site->stats = g_hash_table_lookup (ic_stats, real_address);
+    if (site->stats == NULL)
+    {
+      site->stats = g_new0 (GumIcStats, 1);
+      site->stats->real_address = real_address;
+      g_hash_table_insert (ic_stats, real_address, site->stats);
+    }
+
+    G_UNLOCK (ic_stats);
+  }
+
+  ctx->ic_sites = g_slist_prepend (ctx->ic_sites, site);
+
+  gum_x86_writer_put_jmp_near_label (cw, look_in_cache);
+
+  site->entries = gum_x86_writer_cur (cw);
+  for (i = 0; i != site->num_entries; i++)
+  {
+    gum_x86_writer_put_bytes (cw, (guint8 *) &empty_entry,
+        sizeof (empty_entry));
+  }
+
+  gum_x86_writer_put_label (cw, look_in_cache);
+
+  return site;
+}
+
+static void
+gum_exec_block_write_inline_cache_lookup_code (GumExecBlock * block,
+                                               GumIcSite * site,
+                                               const GumBranchTarget * target,
+                                               GumGeneratorContext * gc)
+{
+  GumExecCtx * ctx = block->ctx;
+  GumX86Writer * cw = gc->code_writer;
+  gconstpointer hit = cw->code + 1;
+  gconstpointer resolve_dynamically = cw->code + 2;
+  guint i;
+
+  gum_exec_ctx_write_push_branch_target_address (ctx, target, gc);
+
+  for (i = 0; i != site->num_entries; i++)
+  {
+    GumIcEntry * entry = &site->entries[i];
+    gconstpointer try_next = cw->code + 1;
+
+    gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
+        GUM_ADDRESS (&entry->real_start));
+    gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw, GUM_REG_XSP, 0,
+        GUM_REG_XAX);
+    gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, try_next,
+        GUM_NO_HINT);
+    gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
+        GUM_ADDRESS (&entry->code_start));
+    gum_x86_writer_put_jmp_near_label (cw, hit);
+
+    gum_x86_writer_put_label (cw, try_next);
+  }
+
+  /*
+   * Probe the megamorphic table, if the site has one. XBX is free to use as
+   * the IC frame has already been set up, and the epilog restores it.
+   */
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
+      GUM_ADDRESS (&site->table));
+  gum_x86_writer_put_mov_reg_reg_ptr (cw, GUM_REG_XAX, GUM_REG_XAX);
+  gum_x86_writer_put_test_reg_reg (cw, GUM_REG_XAX, GUM_REG_XAX);
+  gum_x86_writer_put_jcc_near_label (cw, X86_INS_JE, resolve_dynamically,
+      GUM_UNLIKELY);
+
+  gum_x86_writer_put_mov_reg_reg_ptr (cw, GUM_REG_XBX, GUM_REG_XSP);
+  gum_x86_writer_put_shr_reg_u8 (cw, GUM_REG_XBX, GUM_IC_TABLE_HASH_SHIFT);
+  gum_x86_writer_put_and_reg_u32 (cw, GUM_REG_XBX, GUM_IC_TABLE_SIZE - 1);
+  gum_x86_writer_put_shl_reg_u8 (cw, GUM_REG_XBX,
+      g_bit_nth_lsf (sizeof (GumIcEntry), -1));
+  gum_x86_writer_put_add_reg_reg (cw, GUM_REG_XAX, GUM_REG_XBX);
+
+  gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XBX, GUM_REG_XAX,
+      G_STRUCT_OFFSET (GumIcEntry, real_start));
+  gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw, GUM_REG_XSP, 0, GUM_REG_XBX);
+  gum_x86_writer_put_jcc_near_label (cw, X86_INS_JNE, resolve_dynamically,
+      GUM_UNLIKELY);
+  gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XAX, GUM_REG_XAX,
+      G_STRUCT_OFFSET (GumIcEntry, code_start));
+
+  gum_x86_writer_put_label (cw, hit);
+  gum_x86_writer_put_mov_near_ptr_reg (cw, GUM_ADDRESS (&ctx->resume_at),
+      GUM_REG_XAX);
+  if (site->stats != NULL)
+  {
+    gum_exec_block_write_inline_cache_stats_increment (block,
+        &site->stats->hits, gc);
+  }
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
+  gum_exec_ctx_write_epilog (ctx, GUM_PROLOG_IC, cw);
+  gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (&ctx->resume_at));
+
+  gum_x86_writer_put_label (cw, resolve_dynamically);
+  if (site->stats != NULL)
+  {
+    gum_exec_block_write_inline_cache_stats_increment (block,
+        &site->stats->misses, gc);
+  }
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
+  gum_exec_block_close_prolog (block, gc);
+}
+
+static void
+gum_exec_block_write_inline_cache_stats_increment (GumExecBlock * block,
+                                                   gsize * counter,
+                                                   GumGeneratorContext * gc)
+{
+  GumX86Writer * cw = gc->code_writer;
+
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX, GUM_ADDRESS (counter));
+  gum_x86_writer_put_u8 (cw, 0xf0); /* lock prefix, stats are shared */
+  gum_x86_writer_put_inc_reg_ptr (cw,
+      (sizeof (gsize) == 8) ? GUM_PTR_QWORD : GUM_PTR_DWORD, GUM_REG_XAX);
+}
+
 static void
 gum_exec_block_write_single_step_transfer_code (GumExecBlock * block,
                                                 GumGeneratorContext * gc)
@@ -3747,6 +4238,161 @@ gum_exec_block_write_block_event_code (GumExecBlock * block,
   gum_exec_block_write_unfollow_check_code (block, gc, cc);
 }
 
+static void
+gum_exec_block_write_memory_event_code (GumExecBlock * block,
+                                        GumGeneratorContext * gc)
+{
+  const cs_insn * insn = gc->instruction->ci;
+  cs_x86 * x86 = &insn->detail->x86;
+  guint8 i;
+
+  if (insn->id == X86_INS_LEA || insn->id == X86_INS_NOP)
+    return;
+
+  for (i = 0; i != x86->op_count; i++)
+  {
+    const cs_x86_op * op = &x86->operands[i];
+
+    if (op->type != X86_OP_MEM)
+      continue;
+
+    /*
+     * We can only resolve the segment used for TLS, through its self pointer.
+     * Accesses through any other segment, or any segment at all on Darwin,
+     * are not reported.
+     */
+    if (op->mem.segment == X86_REG_FS || op->mem.segment == X86_REG_GS)
+    {
+#ifdef GUM_TLS_SEGMENT_REG
+      if (op->mem.segment != GUM_TLS_SEGMENT_REG)
+        continue;
+#else
+      continue;
+#endif
+    }
+
+    if ((op->access & CS_AC_READ) != 0)
+      gum_exec_block_write_memory_access_code (block, op, GUM_MEMOP_READ, gc);
+
+    if ((op->access & CS_AC_WRITE) != 0)
+      gum_exec_block_write_memory_access_code (block, op, GUM_MEMOP_WRITE, gc);
+  }
+}
+
+static void
+gum_exec_block_write_memory_access_code (GumExecBlock * block,
+                                         const cs_x86_op * op,
+                                         GumMemoryOperation operation,
+                                         GumGeneratorContext * gc)
+{
+  GumExecCtx * ctx = block->ctx;
+  GumX86Writer * cw = gc->code_writer;
+  gconstpointer flush = cw->code + 1;
+  gconstpointer beach = cw->code + 2;
+  gpointer location = gc->instruction->begin;
+
+  /*
+   * Record the access straight into the thread's event buffer, only calling
+   * out to C when the buffer needs to be handed over to the sink.
+   */
+  gum_exec_block_close_prolog (block, gc);
+  gum_exec_block_open_prolog (block, GUM_PROLOG_IC, gc);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XCX);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XDX);
+
+  gum_exec_ctx_load_real_register_into (ctx, GUM_REG_XAX,
+      gum_cpu_reg_from_capstone (op->mem.base), gc->instruction->end, gc);
+  if (op->mem.index != X86_REG_INVALID)
+  {
+    gum_exec_ctx_load_real_register_into (ctx, GUM_REG_XDX,
+        gum_cpu_reg_from_capstone (op->mem.index), gc->instruction->end, gc);
+    if (op->mem.scale > 1)
+    {
+      gum_x86_writer_put_shl_reg_u8 (cw, GUM_REG_XDX,
+          g_bit_nth_lsf (op->mem.scale, -1));
+    }
+    gum_x86_writer_put_add_reg_reg (cw, GUM_REG_XAX, GUM_REG_XDX);
+  }
+  if (op->mem.disp != 0)
+  {
+    if (GUM_IS_WITHIN_INT32_RANGE (op->mem.disp))
+    {
+      gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XAX, GUM_REG_XAX,
+          op->mem.disp);
+    }
+    else
+    {
+      /* The 64-bit moffs operand of movabs. */
+      gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XDX,
+          (GumAddress) op->mem.disp);
+      gum_x86_writer_put_add_reg_reg (cw, GUM_REG_XAX, GUM_REG_XDX);
+    }
+  }
+#ifdef GUM_TLS_SEGMENT_REG
+  if (op->mem.segment == GUM_TLS_SEGMENT_REG)
+  {
+    const guint32 self_offset = GUINT32_TO_LE (GUM_TLS_SEGMENT_SELF_OFFSET);
+    const guint8 prefix = (GUM_TLS_SEGMENT_REG == X86_REG_FS) ? 0x64 : 0x65;
+# if GLIB_SIZEOF_VOID_P == 8
+    const guint8 load_base[] = { prefix, 0x48, 0x8b, 0x14, 0x25 };
+# else
+    const guint8 load_base[] = { prefix, 0x8b, 0x15 };
+# endif
+
+    /* mov xdx, seg:[self_offset] */
+    gum_x86_writer_put_bytes (cw, load_base, sizeof (load_base));
+    gum_x86_writer_put_bytes (cw, (const guint8 *) &self_offset,
+        sizeof (self_offset));
+    gum_x86_writer_put_add_reg_reg (cw, GUM_REG_XAX, GUM_REG_XDX);
+  }
+#endif
+
+  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XDX,
+      GUM_ADDRESS (&ctx->memory_events_cursor));
+  gum_x86_writer_put_mov_reg_offset_ptr_reg (cw,
+      GUM_REG_XDX, G_STRUCT_OFFSET (GumMemoryEvent, address),
+      GUM_REG_XAX);
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX, GUM_ADDRESS (location));
+  gum_x86_writer_put_mov_reg_offset_ptr_reg (cw,
+      GUM_REG_XDX, G_STRUCT_OFFSET (GumMemoryEvent, location),
+      GUM_REG_XAX);
+  gum_x86_writer_put_mov_reg_offset_ptr_u32 (cw,
+      GUM_REG_XDX, G_STRUCT_OFFSET (GumMemoryEvent, type),
+      GUM_MEMORY);
+  gum_x86_writer_put_mov_reg_offset_ptr_u32 (cw,
+      GUM_REG_XDX, G_STRUCT_OFFSET (GumMemoryEvent, size),
+      op->size);
+  gum_x86_writer_put_mov_reg_offset_ptr_u32 (cw,
+      GUM_REG_XDX, G_STRUCT_OFFSET (GumMemoryEvent, operation),
+      operation);
+  gum_x86_writer_put_add_reg_imm (cw, GUM_REG_XDX, sizeof (GumEvent));
+  gum_x86_writer_put_mov_near_ptr_reg (cw,
+      GUM_ADDRESS (&ctx->memory_events_cursor), GUM_REG_XDX);
+
+  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
+      GUM_ADDRESS (&ctx->memory_events_end));
+  gum_x86_writer_put_cmp_reg_reg (cw, GUM_REG_XDX, GUM_REG_XAX);
+  gum_x86_writer_put_jcc_near_label (cw, X86_INS_JAE, flush, GUM_UNLIKELY);
+
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XDX);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XCX);
+  gum_exec_block_close_prolog (block, gc);
+  gum_x86_writer_put_jmp_near_label (cw, beach);
+
+  gum_x86_writer_put_label (cw, flush);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XDX);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XCX);
+  gum_exec_ctx_write_epilog (ctx, GUM_PROLOG_IC, cw);
+
+  gum_exec_block_open_prolog (block, GUM_PROLOG_MINIMAL, gc);
+  gum_x86_writer_put_call_address_with_aligned_arguments (cw, GUM_CALL_CAPI,
+      GUM_ADDRESS (gum_exec_ctx_flush_memory_events), 1,
+      GUM_ARG_ADDRESS, GUM_ADDRESS (ctx));
+  gum_exec_block_close_prolog (block, gc);
+
+  gum_x86_writer_put_label (cw, beach);
+}
+
 static void
 gum_exec_block_write_unfollow_check_code (GumExecBlock * block,
                                           GumGeneratorContext * gc,
@@ -4265,6 +4911,102 @@ gum_stalker_dump_counters (void)
   g_printerr ("\n");
 
   GUM_PRINT_ENTRYGATE_COUNTER (jmp_continuation);
+
+  G_LOCK (ic_stats);
+
+  if (ic_stats != NULL)
+  {
+    GList * sites, * cur;
+    gsize total_hits = 0, total_misses = 0;
+    guint n;
+
+    sites = g_list_sort (g_hash_table_get_values (ic_stats),
+        gum_ic_stats_compare_by_misses);
+
+    for (cur = sites; cur != NULL; cur = cur->next)
+    {
+      GumIcStats * stats = cur->data;
+
+      total_hits += stats->hits;
+      total_misses += stats->misses;
+    }
+
+    g_printerr ("\ninline_cache_sites: %u\n",
+        g_hash_table_size (ic_stats));
+    g_printerr ("\tinline_cache_hits: %" G_GSIZE_FORMAT "\n", total_hits);
+    g_printerr ("\tinline_cache_misses: %" G_GSIZE_FORMAT "\n", total_misses);
+
+    for (cur = sites, n = 0;
+        cur != NULL && n != GUM_IC_STATS_TOP_SITES;
+        cur = cur->next, n++)
+    {
+      GumIcStats * stats = cur->data;
+
+      g_printerr ("\t\t%p: hits=%" G_GSIZE_FORMAT " misses=%" G_GSIZE_FORMAT
+          "%s\n", stats->real_address, stats->hits, stats->misses,
+          stats->is_megamorphic ? " (megamorphic)" : "");
+    }
+
+    g_list_free (sites);
+  }
+
+  G_UNLOCK (ic_stats);
+}
+
+gboolean
+_gum_stalker_query_ic_stats (gconstpointer real_address,
+                             gsize * hits,
+                             gsize * misses,
+                             gboolean * is_megamorphic)
+{
+  GumIcStats * stats = NULL;
+
+  G_LOCK (ic_stats);
+
+  if (ic_stats != NULL)
+    stats = g_hash_table_lookup (ic_stats, real_address);
+
+  if (stats != NULL)
+  {
+    *hits = stats->hits;
+    *misses = stats->misses;
+    *is_megamorphic = stats->is_megamorphic;
+  }
+
+  G_UNLOCK (ic_stats);
+
+  return stats != NULL;
+}
+
+/*
+ * Only counts while counters are enabled, i.e. returns that missed the shadow
+ * stack while gum_stalker_set_counters_enabled (TRUE) was in effect.
+ */
+guint
+_gum_stalker_query_ret_slow_path_count (void)
+{
+  return total_ret_slow_paths;
+}
+
+static gint
+gum_ic_stats_compare_by_misses (gconstpointer a,
+                                gconstpointer b)
+{
+  const GumIcStats * stats_a = a;
+  const GumIcStats * stats_b = b;
+
+  if (stats_a->misses == stats_b->misses)
+    return 0;
+
+  return (stats_a->misses > stats_b->misses) ? -1 : 1;
+}
+
+static void
+gum_ic_site_free (GumIcSite * site)
+{
+  g_free (site->table);
+
+  g_slice_free (GumIcSite, site);
 }
 
 static gpointer
@@ -12,6 +12,7 @@
 #include "gummemory-priv.h"
 #include "gumprintf.h"
 #include "gumtls-priv.h"
+#include "gumx86-priv.h"
 #include "valgrind.h"
 #ifdef HAVE_I386
 # ifdef _MSC_VER
@@ -633,26 +634,81 @@ gum_address_free (GumAddress * address)
 
 #if defined (HAVE_I386)
 
-static gboolean gum_get_cpuid (guint level, guint * a, guint * b, guint * c,
-    guint * d);
+static gboolean gum_get_cpuid (guint level, guint sublevel, guint * a,
+    guint * b, guint * c, guint * d);
+static guint64 gum_get_xcr0 (void);
 
 GumCpuFeatures
 gum_query_cpu_features (void)
 {
   GumCpuFeatures features = 0;
+  gboolean os_uses_xsave, os_saves_ymm;
   guint a, b, c, d;
 
-  if (gum_get_cpuid (7, &a, &b, &c, &d))
+  if (!gum_get_cpuid (1, 0, &a, &b, &c, &d))
+    return features;
+
+  os_uses_xsave = (c & (1 << 27)) != 0;
+
+  /*
+   * The CPU may support AVX while the kernel or hypervisor leaves YMM state
+   * disabled, in which case any AVX instruction raises #UD. XCR0 bits 1 and
+   * 2 tell us that XMM and YMM state are both enabled.
+   */
+  os_saves_ymm = os_uses_xsave && (c & (1 << 28)) != 0 &&
+      (gum_get_xcr0 () & 6) == 6;
+
+  if (os_saves_ymm && gum_get_cpuid (7, 0, &a, &b, &c, &d))
   {
     if ((b & (1 << 5)) != 0)
       features |= GUM_CPU_AVX2;
   }
 
+  if (os_uses_xsave)
+  {
+    if (gum_get_cpuid (0xd, 1, &a, &b, &c, &d) && (a & (1 << 1)) != 0)
+      features |= GUM_CPU_XSAVEC;
+  }
+
   return features;
 }
 
+guint
+gum_query_cpu_xsave_area_size (void)
+{
+  guint size, supported, i;
+  guint a, b, c, d;
+
+  if ((gum_query_cpu_features () & GUM_CPU_XSAVEC) == 0)
+    return 0;
+
+  if (!gum_get_cpuid (0xd, 0, &a, &b, &c, &d))
+    return 0;
+  supported = a & GUM_XSAVE_COMPONENTS_MASK;
+
+  /* Legacy region followed by the XSAVE header */
+  size = 512 + 64;
+
+  for (i = 2; i != 8; i++)
+  {
+    if ((supported & (1 << i)) == 0)
+      continue;
+
+    gum_get_cpuid (0xd, i, &a, &b, &c, &d);
+
+    /*
+     * The compacted layout depends on which components are enabled in XCR0,
+     * so assume worst case alignment padding for each of them.
+     */
+    size += a + 63;
+  }
+
+  return GUM_ALIGN_SIZE (size, 64);
+}
+
 static gboolean
 gum_get_cpuid (guint level,
+               guint sublevel,
                guint * a,
                guint * b,
                guint * c,
@@ -667,7 +723,7 @@ gum_get_cpuid (guint level,
   if (n < level)
     return FALSE;
 
-  __cpuid (info, level);
+  __cpuidex (info, level, sublevel);
 
   *a = info[0];
   *b = info[1];
@@ -682,12 +738,27 @@ gum_get_cpuid (guint level,
   if (n < level)
     return FALSE;
 
-  __cpuid_count (level, 0, *a, *b, *c, *d);
+  __cpuid_count (level, sublevel, *a, *b, *c, *d);
 
   return TRUE;
 #endif
 }
 
+/* Only valid to call once CPUID has reported OSXSAVE. */
+static guint64
+gum_get_xcr0 (void)
+{
+#ifdef _MSC_VER
+  return _xgetbv (0);
+#else
+  guint32 lo, hi;
+
+  asm volatile ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+
+  return ((guint64) hi << 32) | lo;
+#endif
+}
+
 #elif defined (HAVE_ARM64) && defined (HAVE_DARWIN)
 
 GumCpuFeatures
@@ -706,6 +777,12 @@ gum_query_cpu_features (void)
   return features;
 }
 
+guint
+gum_query_cpu_xsave_area_size (void)
+{
+  return 0;
+}
+
 #else
 
 GumCpuFeatures
@@ -714,6 +791,12 @@ gum_query_cpu_features (void)
   return 0;
 }
 
+guint
+gum_query_cpu_xsave_area_size (void)
+{
+  return 0;
+}
+
 #endif
 
 GType
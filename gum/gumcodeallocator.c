@@ -24,6 +24,8 @@
     ((GumCodeSliceElement *) (((guint8 *) (s)) - \
         G_STRUCT_OFFSET (GumCodeSliceElement, slice)))
 
+#define GUM_CODE_ARENA_MAX_BATCHES 64
+
 #if GLIB_SIZEOF_VOID_P == 8
 # define GUM_CODE_DEFLECTOR_CAVE_SIZE 24
 # define GUM_MAX_CODE_DEFLECTOR_THUNK_SIZE 128
@@ -33,6 +35,7 @@
 #endif
 
 typedef struct _GumCodePages GumCodePages;
+typedef struct _GumCodeArena GumCodeArena;
 typedef struct _GumCodeSliceElement GumCodeSliceElement;
 typedef struct _GumCodeDeflectorDispatcher GumCodeDeflectorDispatcher;
 typedef struct _GumCodeDeflectorImpl GumCodeDeflectorImpl;
@@ -50,6 +53,7 @@ struct _GumCodePages
   gint ref_count;
 
   GumCodeSegment * segment;
+  GumCodeArena * arena;
   gpointer data;
   gsize size;
 
@@ -58,6 +62,25 @@ struct _GumCodePages
   GumCodeSliceElement elements[1];
 };
 
+/*
+ * A reservation that batches are carved out of, so that hooking many
+ * functions doesn't need one fresh mapping per batch. Arenas reserved near
+ * some code are kept for near allocations, while allocations without a spec
+ * all share the same arena. Batches are handed back when all of their slices
+ * are gone, and the arena itself lives until the allocator is freed and it is
+ * empty.
+ */
+struct _GumCodeArena
+{
+  gpointer data;
+  gsize batch_size;
+  guint64 used_batches;
+  guint n_used_batches;
+  gboolean shared;
+
+  GumCodeAllocator * allocator;
+};
+
 struct _GumCodeDeflectorDispatcher
 {
   GSList * callers;
@@ -99,8 +122,18 @@ struct _GumInsertDeflectorContext
 static GumCodeSlice * gum_code_allocator_try_alloc_batch_near (
     GumCodeAllocator * self, const GumAddressSpec * spec);
 
+static gpointer gum_code_allocator_try_alloc_from_arena (
+    GumCodeAllocator * self, const GumAddressSpec * spec,
+    GumPageProtection protection, GumCodeArena ** arena);
 static void gum_code_pages_unref (GumCodePages * self);
 
+static GumCodeArena * gum_code_arena_try_new (GumCodeAllocator * allocator,
+    const GumAddressSpec * spec);
+static void gum_code_arena_free (GumCodeArena * self);
+static gpointer gum_code_arena_try_take_batch (GumCodeArena * self,
+    const GumAddressSpec * spec, GumPageProtection protection);
+static void gum_code_arena_give_batch (GumCodeArena * self, gpointer data);
+
 static gboolean gum_code_slice_is_near (const GumCodeSlice * self,
     const GumAddressSpec * spec);
 static gboolean gum_code_slice_is_aligned (const GumCodeSlice * slice,
@@ -138,12 +171,16 @@ gum_code_allocator_init (GumCodeAllocator * allocator,
   allocator->dirty_pages = g_hash_table_new (NULL, NULL);
   allocator->free_slices = NULL;
 
+  allocator->arenas = NULL;
+
   allocator->dispatchers = NULL;
 }
 
 void
 gum_code_allocator_free (GumCodeAllocator * allocator)
 {
+  GSList * cur;
+
   g_slist_foreach (allocator->dispatchers,
       (GFunc) gum_code_deflector_dispatcher_free, NULL);
   g_slist_free (allocator->dispatchers);
@@ -155,6 +192,18 @@ gum_code_allocator_free (GumCodeAllocator * allocator)
   allocator->uncommitted_pages = NULL;
   allocator->dirty_pages = NULL;
   allocator->free_slices = NULL;
+
+  for (cur = allocator->arenas; cur != NULL; cur = cur->next)
+  {
+    GumCodeArena * arena = cur->data;
+
+    if (arena->n_used_batches == 0)
+      gum_code_arena_free (arena);
+    else
+      arena->allocator = NULL;
+  }
+  g_slist_free (allocator->arenas);
+  allocator->arenas = NULL;
 }
 
 GumCodeSlice *
@@ -245,6 +294,7 @@ gum_code_allocator_try_alloc_batch_near (GumCodeAllocator * self,
   gboolean rwx_supported, code_segment_supported;
   gsize page_size, size_in_pages, size_in_bytes;
   GumCodeSegment * segment;
+  GumCodeArena * arena = NULL;
   gpointer data;
   GumCodePages * pages;
   guint i;
@@ -264,19 +314,23 @@ gum_code_allocator_try_alloc_batch_near (GumCodeAllocator * self,
     protection = rwx_supported ? GUM_PAGE_RWX : GUM_PAGE_RW;
 
     segment = NULL;
-    if (spec != NULL)
+    data = gum_code_allocator_try_alloc_from_arena (self, spec, protection,
+        &arena);
+    if (data == NULL)
     {
-      data = gum_try_alloc_n_pages_near (size_in_pages, protection, spec);
-      if (data == NULL)
-        return NULL;
+      if (spec != NULL)
+        data = gum_try_alloc_n_pages_near (size_in_pages, protection, spec);
+      else
+        data = gum_alloc_n_pages (size_in_pages, protection);
     }
-    else
+    if (data == NULL)
+      return NULL;
+
+    if (arena == NULL)
     {
-      data = gum_alloc_n_pages (size_in_pages, protection);
+      gum_query_page_allocation_range (data, size_in_bytes, &range);
+      gum_cloak_add_range (&range);
     }
-
-    gum_query_page_allocation_range (data, size_in_bytes, &range);
-    gum_cloak_add_range (&range);
   }
   else
   {
@@ -290,6 +344,7 @@ gum_code_allocator_try_alloc_batch_near (GumCodeAllocator * self,
   pages->ref_count = self->slices_per_batch;
 
   pages->segment = segment;
+  pages->arena = arena;
   pages->data = data;
   pages->size = size_in_bytes;
 
@@ -331,6 +386,53 @@ gum_code_allocator_try_alloc_batch_near (GumCodeAllocator * self,
   return result;
 }
 
+static gpointer
+gum_code_allocator_try_alloc_from_arena (GumCodeAllocator * self,
+                                         const GumAddressSpec * spec,
+                                         GumPageProtection protection,
+                                         GumCodeArena ** arena)
+{
+  GSList * cur;
+  GumCodeArena * a;
+  gpointer data;
+
+  for (cur = self->arenas; cur != NULL; cur = cur->next)
+  {
+    a = cur->data;
+
+    /* Don't use up space that was reserved near some other code. */
+    if (spec == NULL && !a->shared)
+      continue;
+
+    data = gum_code_arena_try_take_batch (a, spec, protection);
+    if (data != NULL)
+    {
+      *arena = a;
+      return data;
+    }
+  }
+
+  a = gum_code_arena_try_new (self, spec);
+  if (a == NULL)
+    return NULL;
+
+  /*
+   * The reservation may be near enough for the hint but not for any of its
+   * batches, so only keep it around once it has proven useful.
+   */
+  data = gum_code_arena_try_take_batch (a, spec, protection);
+  if (data == NULL)
+  {
+    gum_code_arena_free (a);
+    return NULL;
+  }
+
+  self->arenas = g_slist_prepend (self->arenas, a);
+  *arena = a;
+
+  return data;
+}
+
 static void
 gum_code_pages_unref (GumCodePages * self)
 {
@@ -341,6 +443,10 @@ gum_code_pages_unref (GumCodePages * self)
     {
       gum_code_segment_free (self->segment);
     }
+    else if (self->arena != NULL)
+    {
+      gum_code_arena_give_batch (self->arena, self->data);
+    }
     else
     {
       GumMemoryRange range;
@@ -355,6 +461,114 @@ gum_code_pages_unref (GumCodePages * self)
   }
 }
 
+static GumCodeArena *
+gum_code_arena_try_new (GumCodeAllocator * allocator,
+                        const GumAddressSpec * spec)
+{
+  GumCodeArena * arena;
+  gsize batch_size;
+  gpointer data;
+  GumMemoryRange range;
+
+  batch_size = allocator->pages_per_batch * gum_query_page_size ();
+
+  if (spec != NULL)
+  {
+    data = gum_try_alloc_n_pages_near (
+        GUM_CODE_ARENA_MAX_BATCHES * allocator->pages_per_batch,
+        GUM_PAGE_NO_ACCESS, spec);
+  }
+  else
+  {
+    data = gum_alloc_n_pages (
+        GUM_CODE_ARENA_MAX_BATCHES * allocator->pages_per_batch,
+        GUM_PAGE_NO_ACCESS);
+  }
+  if (data == NULL)
+    return NULL;
+
+  gum_query_page_allocation_range (data,
+      GUM_CODE_ARENA_MAX_BATCHES * batch_size, &range);
+  gum_cloak_add_range (&range);
+
+  arena = g_slice_new (GumCodeArena);
+  arena->data = data;
+  arena->batch_size = batch_size;
+  arena->used_batches = 0;
+  arena->n_used_batches = 0;
+  arena->shared = spec == NULL;
+  arena->allocator = allocator;
+
+  return arena;
+}
+
+static void
+gum_code_arena_free (GumCodeArena * self)
+{
+  GumMemoryRange range;
+
+  gum_query_page_allocation_range (self->data,
+      GUM_CODE_ARENA_MAX_BATCHES * self->batch_size, &range);
+  gum_cloak_remove_range (&range);
+
+  gum_free_pages (self->data);
+
+  g_slice_free (GumCodeArena, self);
+}
+
+static gpointer
+gum_code_arena_try_take_batch (GumCodeArena * self,
+                               const GumAddressSpec * spec,
+                               GumPageProtection protection)
+{
+  guint i;
+
+  if (self->n_used_batches == GUM_CODE_ARENA_MAX_BATCHES)
+    return NULL;
+
+  for (i = 0; i != GUM_CODE_ARENA_MAX_BATCHES; i++)
+  {
+    GumCodeSlice batch;
+
+    if ((self->used_batches & (G_GUINT64_CONSTANT (1) << i)) != 0)
+      continue;
+
+    batch.data = (guint8 *) self->data + (i * self->batch_size);
+    batch.size = self->batch_size;
+    if (!gum_code_slice_is_near (&batch, spec))
+      continue;
+
+    if (!gum_memory_commit (batch.data, batch.size, protection))
+      return NULL;
+    gum_mprotect (batch.data, batch.size, protection);
+
+    self->used_batches |= G_GUINT64_CONSTANT (1) << i;
+    self->n_used_batches++;
+
+    return batch.data;
+  }
+
+  return NULL;
+}
+
+static void
+gum_code_arena_give_batch (GumCodeArena * self,
+                           gpointer data)
+{
+  guint i;
+
+  i = ((guint8 *) data - (guint8 *) self->data) / self->batch_size;
+
+  gum_mprotect (data, self->batch_size, GUM_PAGE_NO_ACCESS);
+  gum_memory_decommit (data, self->batch_size);
+
+  self->used_batches &= ~(G_GUINT64_CONSTANT (1) << i);
+  self->n_used_batches--;
+
+  if (self->n_used_batches == 0 && self->allocator == NULL)
+    gum_code_arena_free (self);
+}
+
 void
 gum_code_slice_free (GumCodeSlice * slice)
 {
@@ -24,6 +24,8 @@ struct _GumCodeAllocator
   GHashTable * dirty_pages;
   GList * free_slices;
 
+  GSList * arenas;
+
   GSList * dispatchers;
 };
 
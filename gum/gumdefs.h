@@ -143,6 +143,7 @@ enum _GumCpuFeatures
 {
   GUM_CPU_AVX2    = 1 << 0,
   GUM_CPU_PTRAUTH = 1 << 1,
+  GUM_CPU_XSAVEC  = 1 << 2,
 };
 
 enum _GumInstructionEncoding
@@ -465,6 +466,7 @@ enum _GumRelocationScenario
      ((gint64) (i)) <= (gint64) G_MAXINT32)
 
 GUM_API GumCpuFeatures gum_query_cpu_features (void);
+GUM_API guint gum_query_cpu_xsave_area_size (void);
 
 GUM_API gpointer gum_cpu_context_get_nth_argument (GumCpuContext * self,
     guint n);
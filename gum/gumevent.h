@@ -9,6 +9,7 @@
 
 #include <glib-object.h>
 #include <gum/gumdefs.h>
+#include <gum/gummemory.h>
 
 G_BEGIN_DECLS
 
@@ -22,6 +23,7 @@ typedef struct _GumRetEvent     GumRetEvent;
 typedef struct _GumExecEvent    GumExecEvent;
 typedef struct _GumBlockEvent   GumBlockEvent;
 typedef struct _GumCompileEvent GumCompileEvent;
+typedef struct _GumMemoryEvent  GumMemoryEvent;
 
 enum _GumEventType
 {
@@ -31,6 +33,7 @@ enum _GumEventType
   GUM_EXEC        = 1 << 2,
   GUM_BLOCK       = 1 << 3,
   GUM_COMPILE     = 1 << 4,
+  GUM_MEMORY      = 1 << 5,
 };
 
 struct _GumAnyEvent
@@ -79,6 +82,16 @@ struct _GumCompileEvent
   gpointer end;
 };
 
+struct _GumMemoryEvent
+{
+  GumEventType type;
+
+  gpointer location;
+  gpointer address;
+  guint size;
+  GumMemoryOperation operation;
+};
+
 union _GumEvent
 {
   GumEventType type;
@@ -89,6 +102,7 @@ union _GumEvent
   GumExecEvent exec;
   GumBlockEvent block;
   GumCompileEvent compile;
+  GumMemoryEvent memory;
 };
 
 G_END_DECLS
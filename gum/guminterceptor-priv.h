@@ -17,6 +17,19 @@
 typedef struct _GumInterceptorBackend GumInterceptorBackend;
 typedef struct _GumFunctionContext GumFunctionContext;
 typedef struct _GumFunctionContextBackendData GumFunctionContextBackendData;
+typedef struct _GumInlineProbe GumInlineProbe;
+
+typedef enum
+{
+  GUM_INLINE_PROBE_COUNT_CALLS,
+  GUM_INLINE_PROBE_RECORD_CALLS
+} GumInlineProbeType;
+
+struct _GumInlineProbe
+{
+  GumInlineProbeType type;
+  gpointer data;
+};
 
 struct _GumFunctionContextBackendData
 {
@@ -30,6 +43,7 @@ struct _GumFunctionContext
   gboolean destroyed;
   gboolean activated;
   gboolean has_on_leave_listener;
+  gboolean has_thread_filter;
 
   GumCodeSlice * trampoline_slice;
   GumCodeDeflector * trampoline_deflector;
@@ -43,10 +57,34 @@ struct _GumFunctionContext
 
   gpointer on_leave_trampoline;
 
+  gpointer on_lite_enter_trampoline;
+
   volatile GPtrArray * listener_entries;
+  guint next_listener_data_slot;
+
+  /*
+   * Inline probes are applied by generated code in probe_slice while the
+   * function has no other hooks. Otherwise they are applied on the slow path.
+   */
+  volatile GArray * probes;
+  GumCodeSlice * probe_slice;
 
   gpointer replacement_function;
   gpointer replacement_data;
+  gboolean replacement_is_fast;
+  GumCodeSlice * replacement_slice;
+  gpointer on_fast_replacement;
+
+  /*
+   * Where the prologue jumps to when it should bypass on_enter_trampoline,
+   * i.e. the probe stub, a fast replacement or on_lite_enter_trampoline.
+   * Slices that the prologue no longer points at are kept in retired_slices
+   * until the context dies.
+   */
+  gpointer redirect_target;
+  GSList * retired_slices;
+
+  guint stats_slot;
 
   GumFunctionContextBackendData backend_data;
 
@@ -69,6 +107,10 @@ G_GNUC_INTERNAL void _gum_interceptor_backend_destroy (
     GumInterceptorBackend * backend);
 G_GNUC_INTERNAL gboolean _gum_interceptor_backend_create_trampoline (
     GumInterceptorBackend * self, GumFunctionContext * ctx);
+G_GNUC_INTERNAL gboolean _gum_interceptor_backend_create_probe_trampoline (
+    GumInterceptorBackend * self, GumFunctionContext * ctx, GArray * probes);
+G_GNUC_INTERNAL gboolean _gum_interceptor_backend_create_fast_replacement (
+    GumInterceptorBackend * self, GumFunctionContext * ctx);
 G_GNUC_INTERNAL void _gum_interceptor_backend_destroy_trampoline (
     GumInterceptorBackend * self, GumFunctionContext * ctx);
 G_GNUC_INTERNAL void _gum_interceptor_backend_activate_trampoline (
@@ -15,7 +15,13 @@
 #include "gumprocess.h"
 #include "gumtls.h"
 
+#include <stdlib.h>
 #include <string.h>
+#ifdef HAVE_WINDOWS
+# include <windows.h>
+#else
+# include <time.h>
+#endif
 
 #ifdef HAVE_MIPS
 #define GUM_INTERCEPTOR_CODE_SLICE_SIZE 1024
@@ -23,6 +29,23 @@
 #define GUM_INTERCEPTOR_CODE_SLICE_SIZE 256
 #endif
 
+#define GUM_INVOCATION_STACK_CHUNK_SIZE GUM_MAX_CALL_DEPTH
+
+/*
+ * The thread local is read before any recursion guard, so it must never
+ * allocate on first access. That rules out lazily allocated TLS, such as
+ * __tls_get_addr() with the dynamic models, Darwin's TLVs, emutls, and MinGW.
+ * The initial-exec model avoids that, but is only safe in a library that may
+ * be dlopen()ed when the libc reserves surplus static TLS for it, as glibc
+ * does and musl does not. Everywhere else we use the GPrivate lookup.
+ */
+#if defined (_MSC_VER)
+# define GUM_INTERCEPTOR_THREAD_LOCAL __declspec (thread)
+#elif defined (__GNUC__) && defined (__GLIBC__) && !defined (__UCLIBC__)
+# define GUM_INTERCEPTOR_THREAD_LOCAL \
+    __thread __attribute__ ((tls_model ("initial-exec")))
+#endif
+
 #define GUM_INTERCEPTOR_LOCK(o) g_rec_mutex_lock (&(o)->mutex)
 #define GUM_INTERCEPTOR_UNLOCK(o) g_rec_mutex_unlock (&(o)->mutex)
 
@@ -30,9 +53,12 @@ typedef struct _GumInterceptorTransaction GumInterceptorTransaction;
 typedef struct _GumDestroyTask GumDestroyTask;
 typedef struct _GumPrologueWrite GumPrologueWrite;
 typedef struct _ListenerEntry ListenerEntry;
+typedef struct _GumThreadFilter GumThreadFilter;
 typedef struct _InterceptorThreadContext InterceptorThreadContext;
+typedef struct _GumInvocationStackChunk GumInvocationStackChunk;
 typedef struct _GumInvocationStackEntry GumInvocationStackEntry;
 typedef struct _ListenerDataSlot ListenerDataSlot;
+typedef struct _ListenerInvocationData ListenerInvocationData;
 typedef struct _ListenerInvocationState ListenerInvocationState;
 
 typedef void (* GumPrologueWriteFunc) (GumInterceptor * self,
@@ -55,18 +81,22 @@ struct _GumInterceptor
   GRecMutex mutex;
 
   GHashTable * function_by_address;
+  GHashTable * thread_filter_by_listener;
 
   GumInterceptorBackend * backend;
   GumCodeAllocator allocator;
 
   volatile guint selected_thread_id;
 
+  volatile gboolean stats_enabled;
+
   GumInterceptorTransaction current_transaction;
 };
 
 struct _GumDestroyTask
 {
   GumFunctionContext * ctx;
+  guint epoch;
   GDestroyNotify notify;
   gpointer data;
 };
@@ -82,6 +112,15 @@ struct _ListenerEntry
   GumInvocationListenerInterface * listener_interface;
   GumInvocationListener * listener_instance;
   gpointer function_data;
+  gboolean lite;
+  GumThreadFilter * thread_filter;
+  guint data_slot;
+};
+
+struct _GumThreadFilter
+{
+  guint n_thread_ids;
+  GumThreadId thread_ids[1];
 };
 
 struct _InterceptorThreadContext
@@ -89,11 +128,36 @@ struct _InterceptorThreadContext
   GumInvocationBackend listener_backend;
   GumInvocationBackend replacement_backend;
 
+  GumInterceptor * guard;
   gint ignore_level;
+  GumThreadId thread_id;
+
+  volatile gint epoch;
+  guint epoch_nesting;
 
   GumInvocationStack * stack;
 
   GArray * listener_data_slots;
+
+  /*
+   * Indexed by GumFunctionContext.stats_slot. Only the owning thread updates
+   * the counters. It allocates a bigger array outside of the thread context
+   * lock, and only holds the lock while copying and publishing it, so that
+   * gum_interceptor_query_stats() can sum them up safely. Each update is
+   * bracketed by bumping hook_stats_sequence, so that readers can retry
+   * instead of seeing a torn 64-bit value on 32-bit targets.
+   */
+  GumHookStats * hook_stats;
+  guint n_hook_stats;
+  volatile gint hook_stats_sequence;
+};
+
+struct _GumInvocationStack
+{
+  guint len;
+  guint serial;
+  GumInvocationStackChunk * first_chunk;
+  GumInvocationStackChunk * top_chunk;
 };
 
 struct _GumInvocationStackEntry
@@ -101,11 +165,26 @@ struct _GumInvocationStackEntry
   GumFunctionContext * function_ctx;
   gpointer caller_ret_addr;
   GumInvocationContext invocation_context;
-  GumCpuContext cpu_context;
-  guint8 listener_invocation_data[GUM_MAX_LISTENERS_PER_FUNCTION]
-      [GUM_MAX_LISTENER_DATA];
   gboolean calling_replacement;
+  guint64 replacement_start;
   gint original_system_error;
+  guint serial;
+
+  /*
+   * Allocated on first use and kept around for whichever invocation reuses
+   * this slot next, so the common case never touches this memory.
+   */
+  GumCpuContext * cpu_context;
+  ListenerInvocationData ** listener_invocation_data;
+  guint listener_invocation_data_capacity;
+};
+
+struct _GumInvocationStackChunk
+{
+  GumInvocationStackChunk * previous;
+  GumInvocationStackChunk * next;
+  guint offset;
+  GumInvocationStackEntry entries[GUM_INVOCATION_STACK_CHUNK_SIZE];
 };
 
 struct _ListenerDataSlot
@@ -114,12 +193,19 @@ struct _ListenerDataSlot
   guint8 data[GUM_MAX_LISTENER_DATA];
 };
 
+struct _ListenerInvocationData
+{
+  guint serial;
+  guint8 data[GUM_MAX_LISTENER_DATA];
+};
+
 struct _ListenerInvocationState
 {
   GumPointCut point_cut;
   ListenerEntry * entry;
   InterceptorThreadContext * interceptor_ctx;
-  guint8 * invocation_data;
+  GumInvocationStackEntry * stack_entry;
+  guint data_slot;
 };
 
 static void gum_interceptor_dispose (GObject * object);
@@ -128,10 +214,20 @@ static void gum_interceptor_finalize (GObject * object);
 static void the_interceptor_weak_notify (gpointer data,
     GObject * where_the_object_was);
 
+static GumAttachReturn gum_interceptor_attach_single (GumInterceptor * self,
+    gpointer function_address, GumInvocationListener * listener,
+    gpointer listener_function_data, gboolean lite);
+static GumAttachReturn gum_interceptor_attach_unlocked (GumInterceptor * self,
+    gpointer function_address, GumInvocationListener * listener,
+    gpointer listener_function_data, gboolean lite);
+static GumAttachReturn gum_interceptor_attach_probe (GumInterceptor * self,
+    gpointer function_address, GumInlineProbeType type, gpointer data);
 static GumFunctionContext * gum_interceptor_instrument (GumInterceptor * self,
     gpointer function_address);
 static void gum_interceptor_activate (GumInterceptor * self,
     GumFunctionContext * ctx, gpointer prologue);
+static void gum_interceptor_retarget (GumInterceptor * self,
+    GumFunctionContext * ctx, gpointer prologue);
 static void gum_interceptor_deactivate (GumInterceptor * self,
     GumFunctionContext * ctx, gpointer prologue);
 
@@ -145,6 +241,8 @@ static void gum_interceptor_transaction_end (GumInterceptorTransaction * self);
 static void gum_interceptor_transaction_schedule_destroy (
     GumInterceptorTransaction * self, GumFunctionContext * ctx,
     GDestroyNotify notify, gpointer data);
+static void gum_interceptor_transaction_schedule_retire (
+    GumInterceptorTransaction * self, GDestroyNotify notify, gpointer data);
 static void gum_interceptor_transaction_schedule_prologue_write (
     GumInterceptorTransaction * self, GumFunctionContext * ctx,
     GumPrologueWriteFunc func);
@@ -159,36 +257,92 @@ static gboolean gum_function_context_is_empty (
     GumFunctionContext * function_ctx);
 static void gum_function_context_add_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener,
-    gpointer function_data);
+    gpointer function_data, gboolean lite);
+static gboolean gum_function_context_can_enter_lite (
+    GumFunctionContext * function_ctx);
 static void gum_function_context_remove_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener);
+static void gum_function_context_set_thread_filter (
+    GumFunctionContext * function_ctx, GumInvocationListener * listener,
+    GumThreadFilter * filter);
+static gboolean gum_function_context_accepts_thread (
+    GumFunctionContext * function_ctx,
+    InterceptorThreadContext * interceptor_ctx);
+static void gum_function_context_update_has_thread_filter (
+    GumFunctionContext * function_ctx, GPtrArray * listener_entries);
+static guint gum_function_context_claim_listener_data_slot (
+    GumFunctionContext * function_ctx, GPtrArray * listener_entries);
 static void listener_entry_free (ListenerEntry * entry);
+static gboolean listener_entry_accepts_thread (ListenerEntry * entry,
+    InterceptorThreadContext * interceptor_ctx);
+static gint gum_thread_id_compare (gconstpointer a, gconstpointer b);
 static gboolean gum_function_context_has_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener);
 static ListenerEntry ** gum_function_context_find_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener);
 static ListenerEntry ** gum_function_context_find_taken_listener_slot (
     GumFunctionContext * function_ctx);
+static void gum_function_context_set_probes (
+    GumFunctionContext * function_ctx, GArray * probes);
+static void gum_function_context_apply_probes (
+    GumFunctionContext * function_ctx,
+    InterceptorThreadContext * interceptor_ctx, GumCpuContext * cpu_context,
+    gpointer return_address);
+static void gum_function_context_update_redirect (
+    GumFunctionContext * function_ctx);
+static void gum_function_context_retire_slice (
+    GumFunctionContext * function_ctx, GumCodeSlice * slice);
 static void gum_function_context_fixup_cpu_context (
     GumFunctionContext * function_ctx, GumCpuContext * cpu_context);
 
+static void gum_call_recorder_append (GumCallRecorder * self,
+    GumCpuContext * cpu_context, gpointer return_address);
+
+static InterceptorThreadContext * peek_interceptor_thread_context (void);
 static InterceptorThreadContext * get_interceptor_thread_context (void);
 static void release_interceptor_thread_context (
     InterceptorThreadContext * context);
 static InterceptorThreadContext * interceptor_thread_context_new (void);
 static void interceptor_thread_context_destroy (
     InterceptorThreadContext * context);
+static void interceptor_thread_context_enter_epoch (
+    InterceptorThreadContext * self);
+static void interceptor_thread_context_leave_epoch (
+    InterceptorThreadContext * self);
+static guint gum_interceptor_advance_epoch (void);
+static guint gum_interceptor_query_oldest_active_epoch (void);
 static gpointer interceptor_thread_context_get_listener_data (
     InterceptorThreadContext * self, GumInvocationListener * listener,
     gsize required_size);
 static void interceptor_thread_context_forget_listener_data (
     InterceptorThreadContext * self, GumInvocationListener * listener);
+static GumHookStats * interceptor_thread_context_get_hook_stats (
+    InterceptorThreadContext * self, guint slot);
+static void interceptor_thread_context_add_hook_stats (
+    InterceptorThreadContext * self, GumHookStats * stats, guint64 hits,
+    guint64 listener_time, guint64 replacement_time);
+static void interceptor_thread_context_read_hook_stats (
+    InterceptorThreadContext * self, guint slot, GumHookStats * stats);
+static void gum_hook_stats_add (GumHookStats * self,
+    const GumHookStats * other);
+static guint64 gum_interceptor_get_time (void);
+static guint gum_interceptor_claim_stats_slot (void);
+static void gum_interceptor_release_stats_slot (guint slot);
+static GumInvocationStack * gum_invocation_stack_new (void);
+static void gum_invocation_stack_free (GumInvocationStack * stack);
 static GumInvocationStackEntry * gum_invocation_stack_push (
     GumInvocationStack * stack, GumFunctionContext * function_ctx,
     gpointer caller_ret_addr);
 static gpointer gum_invocation_stack_pop (GumInvocationStack * stack);
 static GumInvocationStackEntry * gum_invocation_stack_peek_top (
     GumInvocationStack * stack);
+static GumInvocationStackChunk * gum_invocation_stack_chunk_new (
+    GumInvocationStackChunk * previous);
+static void gum_invocation_stack_chunk_free (GumInvocationStackChunk * chunk);
+static GumCpuContext * gum_invocation_stack_entry_get_cpu_context (
+    GumInvocationStackEntry * entry);
+static gpointer gum_invocation_stack_entry_get_listener_data (
+    GumInvocationStackEntry * entry, guint data_slot);
 
 static gpointer gum_interceptor_resolve (GumInterceptor * self,
     gpointer address);
@@ -208,8 +362,19 @@ static GHashTable * gum_interceptor_thread_contexts;
 static GPrivate gum_interceptor_context_private =
     G_PRIVATE_INIT ((GDestroyNotify) release_interceptor_thread_context);
 static GumTlsKey gum_interceptor_guard_key;
+#ifdef GUM_INTERCEPTOR_THREAD_LOCAL
+static GUM_INTERCEPTOR_THREAD_LOCAL InterceptorThreadContext *
+    gum_interceptor_thread_context = NULL;
+#endif
+
+static volatile gint gum_interceptor_epoch = 1;
+static volatile gint gum_interceptor_n_bootstrapping_threads = 0;
 
-static GumInvocationStack _gum_interceptor_empty_stack = { NULL, 0 };
+static guint gum_interceptor_next_stats_slot = 0;
+static GArray * gum_interceptor_free_stats_slots;
+static GArray * gum_interceptor_exited_thread_stats;
+
+static GumInvocationStack _gum_interceptor_empty_stack = { 0, 0, NULL, NULL };
 
 static void
 gum_interceptor_class_init (GumInterceptorClass * klass)
@@ -225,6 +390,9 @@ _gum_interceptor_init (void)
 {
   gum_interceptor_thread_contexts = g_hash_table_new_full (NULL, NULL,
       (GDestroyNotify) interceptor_thread_context_destroy, NULL);
+  gum_interceptor_free_stats_slots = g_array_new (FALSE, FALSE, sizeof (guint));
+  gum_interceptor_exited_thread_stats =
+      g_array_new (FALSE, TRUE, sizeof (GumHookStats));
 
   gum_interceptor_guard_key = gum_tls_key_new ();
 }
@@ -236,6 +404,16 @@ _gum_interceptor_deinit (void)
 
   g_hash_table_unref (gum_interceptor_thread_contexts);
   gum_interceptor_thread_contexts = NULL;
+
+  g_array_free (gum_interceptor_exited_thread_stats, TRUE);
+  gum_interceptor_exited_thread_stats = NULL;
+  g_array_free (gum_interceptor_free_stats_slots, TRUE);
+  gum_interceptor_free_stats_slots = NULL;
+  gum_interceptor_next_stats_slot = 0;
+
+#ifdef GUM_INTERCEPTOR_THREAD_LOCAL
+  gum_interceptor_thread_context = NULL;
+#endif
 }
 
 static void
@@ -245,6 +423,8 @@ gum_interceptor_init (GumInterceptor * self)
 
   self->function_by_address = g_hash_table_new_full (NULL, NULL, NULL,
       (GDestroyNotify) gum_function_context_destroy);
+  self->thread_filter_by_listener = g_hash_table_new_full (NULL, NULL, NULL,
+      g_free);
 
   gum_code_allocator_init (&self->allocator, GUM_INTERCEPTOR_CODE_SLICE_SIZE);
   self->backend = _gum_interceptor_backend_create (&self->allocator);
@@ -280,6 +460,7 @@ gum_interceptor_finalize (GObject * object)
 
   g_rec_mutex_clear (&self->mutex);
 
+  g_hash_table_unref (self->thread_filter_by_listener);
   g_hash_table_unref (self->function_by_address);
 
   gum_code_allocator_free (&self->allocator);
@@ -329,9 +510,171 @@ gum_interceptor_attach (GumInterceptor * self,
                         gpointer function_address,
                         GumInvocationListener * listener,
                         gpointer listener_function_data)
+{
+  return gum_interceptor_attach_single (self, function_address, listener,
+      listener_function_data, FALSE);
+}
+
+/*
+ * Like gum_interceptor_attach(), but the listener only gets its on_enter
+ * callback. While every listener on the function was attached this way and
+ * there is no replacement, calls go through a thunk that skips saving the
+ * full FPU/vector state and only preserves the registers that may carry
+ * arguments. The GumCpuContext seen by listeners is complete either way.
+ *
+ * Only use this on function entry points, where the calling convention
+ * guarantees that no other vector state is live.
+ */
+GumAttachReturn
+gum_interceptor_attach_lite (GumInterceptor * self,
+                             gpointer function_address,
+                             GumInvocationListener * listener,
+                             gpointer listener_function_data)
+{
+  return gum_interceptor_attach_single (self, function_address, listener,
+      listener_function_data, TRUE);
+}
+
+static GumAttachReturn
+gum_interceptor_attach_single (GumInterceptor * self,
+                               gpointer function_address,
+                               GumInvocationListener * listener,
+                               gpointer listener_function_data,
+                               gboolean lite)
+{
+  GumAttachReturn result;
+
+  if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
+    return GUM_ATTACH_POLICY_VIOLATION;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  result = gum_interceptor_attach_unlocked (self, function_address, listener,
+      listener_function_data, lite);
+
+  gum_interceptor_transaction_end (&self->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK (self);
+  gum_interceptor_unignore_current_thread (self);
+
+  return result;
+}
+
+/*
+ * Attaches @listener to each of the @n_function_addresses functions in one
+ * transaction. Trampolines for neighbouring targets end up sharing code
+ * pages, and all prologues are patched in a single sweep over the affected
+ * pages, sorted by address, once everything has been instrumented.
+ *
+ * If @results is non-NULL it must have room for @n_function_addresses
+ * elements, and receives the outcome for each target.
+ *
+ * Returns the number of functions that were successfully attached to.
+ */
+guint
+gum_interceptor_attach_many (GumInterceptor * self,
+                             const gpointer * function_addresses,
+                             guint n_function_addresses,
+                             GumInvocationListener * listener,
+                             gpointer listener_function_data,
+                             GumAttachReturn * results)
+{
+  guint n_attached, i;
+
+  if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
+  {
+    if (results != NULL)
+    {
+      for (i = 0; i != n_function_addresses; i++)
+        results[i] = GUM_ATTACH_POLICY_VIOLATION;
+    }
+
+    return 0;
+  }
+
+  n_attached = 0;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  for (i = 0; i != n_function_addresses; i++)
+  {
+    GumAttachReturn result;
+
+    result = gum_interceptor_attach_unlocked (self, function_addresses[i],
+        listener, listener_function_data, FALSE);
+    if (result == GUM_ATTACH_OK)
+      n_attached++;
+
+    if (results != NULL)
+      results[i] = result;
+  }
+
+  gum_interceptor_transaction_end (&self->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK (self);
+  gum_interceptor_unignore_current_thread (self);
+
+  return n_attached;
+}
+
+static GumAttachReturn
+gum_interceptor_attach_unlocked (GumInterceptor * self,
+                                 gpointer function_address,
+                                 GumInvocationListener * listener,
+                                 gpointer listener_function_data,
+                                 gboolean lite)
+{
+  GumFunctionContext * function_ctx;
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = gum_interceptor_instrument (self, function_address);
+  if (function_ctx == NULL)
+    return GUM_ATTACH_WRONG_SIGNATURE;
+
+  if (gum_function_context_has_listener (function_ctx, listener))
+    return GUM_ATTACH_ALREADY_ATTACHED;
+
+  gum_function_context_add_listener (function_ctx, listener,
+      listener_function_data, lite);
+  gum_function_context_update_redirect (function_ctx);
+
+  return GUM_ATTACH_OK;
+}
+
+GumAttachReturn
+gum_interceptor_attach_call_counter (GumInterceptor * self,
+                                     gpointer function_address,
+                                     volatile gint * counter)
+{
+  return gum_interceptor_attach_probe (self, function_address,
+      GUM_INLINE_PROBE_COUNT_CALLS, (gpointer) counter);
+}
+
+GumAttachReturn
+gum_interceptor_attach_call_recorder (GumInterceptor * self,
+                                      gpointer function_address,
+                                      GumCallRecorder * recorder)
+{
+  return gum_interceptor_attach_probe (self, function_address,
+      GUM_INLINE_PROBE_RECORD_CALLS, recorder);
+}
+
+static GumAttachReturn
+gum_interceptor_attach_probe (GumInterceptor * self,
+                              gpointer function_address,
+                              GumInlineProbeType type,
+                              gpointer data)
 {
   GumAttachReturn result = GUM_ATTACH_OK;
   GumFunctionContext * function_ctx;
+  GArray * old_probes, * probes;
+  GumInlineProbe probe;
+  guint i;
 
   if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
     goto policy_violation;
@@ -347,11 +690,24 @@ gum_interceptor_attach (GumInterceptor * self,
   if (function_ctx == NULL)
     goto wrong_signature;
 
-  if (gum_function_context_has_listener (function_ctx, listener))
-    goto already_attached;
+  old_probes = (GArray *) g_atomic_pointer_get (&function_ctx->probes);
+  if (old_probes != NULL)
+  {
+    for (i = 0; i != old_probes->len; i++)
+    {
+      if (g_array_index (old_probes, GumInlineProbe, i).type == type)
+        goto already_attached;
+    }
+  }
 
-  gum_function_context_add_listener (function_ctx, listener,
-      listener_function_data);
+  probes = g_array_new (FALSE, FALSE, sizeof (GumInlineProbe));
+  if (old_probes != NULL)
+    g_array_append_vals (probes, old_probes->data, old_probes->len);
+  probe.type = type;
+  probe.data = data;
+  g_array_append_val (probes, probe);
+
+  gum_function_context_set_probes (function_ctx, probes);
 
   goto beach;
 
@@ -379,12 +735,44 @@ beach:
   }
 }
 
+void
+gum_interceptor_detach_probes (GumInterceptor * self,
+                               gpointer function_address)
+{
+  GumFunctionContext * function_ctx;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = (GumFunctionContext *) g_hash_table_lookup (
+      self->function_by_address, function_address);
+  if (function_ctx == NULL || function_ctx->probes == NULL)
+    goto beach;
+
+  gum_function_context_set_probes (function_ctx, NULL);
+
+  if (gum_function_context_is_empty (function_ctx))
+  {
+    g_hash_table_remove (self->function_by_address, function_address);
+  }
+
+beach:
+  gum_interceptor_transaction_end (&self->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK (self);
+  gum_interceptor_unignore_current_thread (self);
+}
+
 void
 gum_interceptor_detach (GumInterceptor * self,
                         GumInvocationListener * listener)
 {
   GHashTableIter iter;
   GumFunctionContext * function_ctx;
+  GumThreadFilter * filter;
   InterceptorThreadContext * thread_ctx;
 
   gum_interceptor_ignore_current_thread (self);
@@ -399,16 +787,28 @@ gum_interceptor_detach (GumInterceptor * self,
     {
       gum_function_context_remove_listener (function_ctx, listener);
 
-      gum_interceptor_transaction_schedule_destroy (&self->current_transaction,
-          function_ctx, g_object_unref, g_object_ref (listener));
+      gum_interceptor_transaction_schedule_retire (&self->current_transaction,
+          g_object_unref, g_object_ref (listener));
 
       if (gum_function_context_is_empty (function_ctx))
       {
         g_hash_table_iter_remove (&iter);
       }
+      else
+      {
+        gum_function_context_update_redirect (function_ctx);
+      }
     }
   }
 
+  filter = g_hash_table_lookup (self->thread_filter_by_listener, listener);
+  if (filter != NULL)
+  {
+    g_hash_table_steal (self->thread_filter_by_listener, listener);
+    gum_interceptor_transaction_schedule_retire (&self->current_transaction,
+        g_free, filter);
+  }
+
   gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
   g_hash_table_iter_init (&iter, gum_interceptor_thread_contexts);
   while (g_hash_table_iter_next (&iter, (gpointer *) &thread_ctx, NULL))
@@ -447,6 +847,74 @@ gum_interceptor_replace (GumInterceptor * self,
 
   function_ctx->replacement_data = replacement_data;
   function_ctx->replacement_function = replacement_function;
+  gum_function_context_update_redirect (function_ctx);
+
+  goto beach;
+
+policy_violation:
+  {
+    return GUM_REPLACE_POLICY_VIOLATION;
+  }
+wrong_signature:
+  {
+    result = GUM_REPLACE_WRONG_SIGNATURE;
+    goto beach;
+  }
+already_replaced:
+  {
+    result = GUM_REPLACE_ALREADY_REPLACED;
+    goto beach;
+  }
+beach:
+  {
+    gum_interceptor_transaction_end (&self->current_transaction);
+    GUM_INTERCEPTOR_UNLOCK (self);
+
+    return result;
+  }
+}
+
+/*
+ * Like gum_interceptor_replace(), but the prologue jumps directly to the
+ * replacement, which calls *original_function to invoke the original. No
+ * per-call bookkeeping happens, so the replacement cannot use
+ * gum_interceptor_get_current_invocation(). If the function also has
+ * listeners or probes, calls take the regular path until those are gone.
+ */
+GumReplaceReturn
+gum_interceptor_replace_fast (GumInterceptor * self,
+                              gpointer function_address,
+                              gpointer replacement_function,
+                              gpointer * original_function)
+{
+  GumReplaceReturn result = GUM_REPLACE_OK;
+  GumFunctionContext * function_ctx;
+
+  if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
+    goto policy_violation;
+
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = gum_interceptor_instrument (self, function_address);
+  if (function_ctx == NULL)
+    goto wrong_signature;
+
+  if (function_ctx->replacement_function != NULL)
+    goto already_replaced;
+
+  function_ctx->replacement_data = NULL;
+  function_ctx->replacement_function = replacement_function;
+  function_ctx->replacement_is_fast = TRUE;
+  _gum_interceptor_backend_create_fast_replacement (self->backend,
+      function_ctx);
+  gum_function_context_update_redirect (function_ctx);
+
+  if (original_function != NULL)
+    *original_function = function_ctx->on_invoke_trampoline;
 
   goto beach;
 
@@ -492,11 +960,23 @@ gum_interceptor_revert (GumInterceptor * self,
 
   function_ctx->replacement_function = NULL;
   function_ctx->replacement_data = NULL;
+  function_ctx->replacement_is_fast = FALSE;
+  function_ctx->on_fast_replacement = NULL;
+  if (function_ctx->replacement_slice != NULL)
+  {
+    gum_function_context_retire_slice (function_ctx,
+        function_ctx->replacement_slice);
+    function_ctx->replacement_slice = NULL;
+  }
 
   if (gum_function_context_is_empty (function_ctx))
   {
     g_hash_table_remove (self->function_by_address, function_address);
   }
+  else
+  {
+    gum_function_context_update_redirect (function_ctx);
+  }
 
 beach:
   gum_interceptor_transaction_end (&self->current_transaction);
@@ -540,6 +1020,76 @@ gum_interceptor_flush (GumInterceptor * self)
   return flushed;
 }
 
+/*
+ * Stats are off by default. Hits, and the time spent in listeners and in
+ * the replacement, are kept in per-thread counters that are only summed up
+ * when queried, so enabling them adds no contention between threads. Times
+ * are monotonic nanoseconds.
+ *
+ * Only calls that go through the interceptor's C dispatch are counted. Calls
+ * handled entirely by generated code, i.e. inline probes running in their
+ * stub and fast replacements, are not.
+ */
+void
+gum_interceptor_set_stats_enabled (GumInterceptor * self,
+                                   gboolean enabled)
+{
+  self->stats_enabled = enabled;
+}
+
+gboolean
+gum_interceptor_query_stats (GumInterceptor * self,
+                             gpointer function_address,
+                             GumHookStats * stats)
+{
+  gboolean found = FALSE;
+  GumFunctionContext * function_ctx;
+  guint slot;
+  GHashTableIter iter;
+  InterceptorThreadContext * thread_ctx;
+
+  memset (stats, 0, sizeof (GumHookStats));
+
+  GUM_INTERCEPTOR_LOCK (self);
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = (GumFunctionContext *) g_hash_table_lookup (
+      self->function_by_address, function_address);
+  if (function_ctx == NULL)
+    goto beach;
+  slot = function_ctx->stats_slot;
+  found = TRUE;
+
+  gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
+
+  g_hash_table_iter_init (&iter, gum_interceptor_thread_contexts);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &thread_ctx, NULL))
+  {
+    if (slot < thread_ctx->n_hook_stats)
+    {
+      GumHookStats thread_stats;
+
+      interceptor_thread_context_read_hook_stats (thread_ctx, slot,
+          &thread_stats);
+      gum_hook_stats_add (stats, &thread_stats);
+    }
+  }
+
+  if (slot < gum_interceptor_exited_thread_stats->len)
+  {
+    gum_hook_stats_add (stats, &g_array_index (
+        gum_interceptor_exited_thread_stats, GumHookStats, slot));
+  }
+
+  gum_spinlock_release (&gum_interceptor_thread_context_lock);
+
+beach:
+  GUM_INTERCEPTOR_UNLOCK (self);
+
+  return found;
+}
+
 GumInvocationContext *
 gum_interceptor_get_current_invocation (void)
 {
@@ -559,7 +1109,7 @@ gum_interceptor_get_current_stack (void)
 {
   InterceptorThreadContext * context;
 
-  context = g_private_get (&gum_interceptor_context_private);
+  context = peek_interceptor_thread_context ();
   if (context == NULL)
     return &_gum_interceptor_empty_stack;
 
@@ -584,7 +1134,67 @@ gum_interceptor_unignore_current_thread (GumInterceptor * self)
   interceptor_ctx->ignore_level--;
 }
 
-void
+/*
+ * Restricts @listener to the given threads, on every function it is or will
+ * be attached to, until it is detached. Passing no thread IDs removes the
+ * filter. Threads that no listener on a function accepts skip listener
+ * dispatch for that function altogether.
+ */
+void
+gum_interceptor_set_thread_filter (GumInterceptor * self,
+                                   GumInvocationListener * listener,
+                                   const GumThreadId * thread_ids,
+                                   guint n_thread_ids)
+{
+  GumThreadFilter * old_filter, * filter;
+  GHashTableIter iter;
+  GumFunctionContext * function_ctx;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  if (n_thread_ids != 0)
+  {
+    filter = g_malloc (G_STRUCT_OFFSET (GumThreadFilter, thread_ids) +
+        n_thread_ids * sizeof (GumThreadId));
+    filter->n_thread_ids = n_thread_ids;
+    memcpy (filter->thread_ids, thread_ids,
+        n_thread_ids * sizeof (GumThreadId));
+    qsort (filter->thread_ids, n_thread_ids, sizeof (GumThreadId),
+        gum_thread_id_compare);
+  }
+  else
+  {
+    filter = NULL;
+  }
+
+  old_filter = g_hash_table_lookup (self->thread_filter_by_listener, listener);
+  if (old_filter != NULL)
+    g_hash_table_steal (self->thread_filter_by_listener, listener);
+  if (filter != NULL)
+    g_hash_table_insert (self->thread_filter_by_listener, listener, filter);
+
+  g_hash_table_iter_init (&iter, self->function_by_address);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &function_ctx))
+  {
+    if (gum_function_context_has_listener (function_ctx, listener))
+      gum_function_context_set_thread_filter (function_ctx, listener, filter);
+  }
+
+  if (old_filter != NULL)
+  {
+    gum_interceptor_transaction_schedule_retire (&self->current_transaction,
+        g_free, old_filter);
+  }
+
+  gum_interceptor_transaction_end (&self->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK (self);
+  gum_interceptor_unignore_current_thread (self);
+}
+
+void
 gum_interceptor_ignore_other_threads (GumInterceptor * self)
 {
   self->selected_thread_id = gum_process_get_current_thread_id ();
@@ -597,17 +1207,27 @@ gum_interceptor_unignore_other_threads (GumInterceptor * self)
   self->selected_thread_id = 0;
 }
 
+guint
+gum_invocation_stack_get_depth (GumInvocationStack * self)
+{
+  return self->len;
+}
+
 gpointer
 gum_invocation_stack_translate (GumInvocationStack * self,
                                 gpointer return_address)
 {
+  GumInvocationStackChunk * chunk;
   guint i;
 
-  for (i = 0; i != self->len; i++)
+  for (chunk = self->first_chunk, i = 0; i != self->len; i++)
   {
     GumInvocationStackEntry * entry;
 
-    entry = &g_array_index (self, GumInvocationStackEntry, i);
+    if (i == chunk->offset + GUM_INVOCATION_STACK_CHUNK_SIZE)
+      chunk = chunk->next;
+
+    entry = &chunk->entries[i - chunk->offset];
     if (entry->function_ctx->on_leave_trampoline == return_address)
       return entry->caller_ret_addr;
   }
@@ -615,6 +1235,49 @@ gum_invocation_stack_translate (GumInvocationStack * self,
   return return_address;
 }
 
+GumCallRecorder *
+gum_call_recorder_new (guint capacity,
+                       guint n_args)
+{
+  GumCallRecorder * recorder;
+
+  g_return_val_if_fail (capacity != 0 && (capacity & (capacity - 1)) == 0,
+      NULL);
+  g_return_val_if_fail (n_args <= GUM_CALL_RECORD_MAX_ARGS, NULL);
+
+  recorder = g_slice_new (GumCallRecorder);
+  recorder->head = 0;
+  recorder->mask = capacity - 1;
+  recorder->n_args = n_args;
+  recorder->records = g_new0 (GumCallRecord, capacity);
+
+  return recorder;
+}
+
+void
+gum_call_recorder_free (GumCallRecorder * recorder)
+{
+  g_free (recorder->records);
+
+  g_slice_free (GumCallRecorder, recorder);
+}
+
+static void
+gum_call_recorder_append (GumCallRecorder * self,
+                          GumCpuContext * cpu_context,
+                          gpointer return_address)
+{
+  GumCallRecord * record;
+  guint i;
+
+  record = &self->records[
+      (guint) g_atomic_int_add ((gint *) &self->head, 1) & self->mask];
+
+  record->return_address = return_address;
+  for (i = 0; i != self->n_args; i++)
+    record->args[i] = gum_cpu_context_get_nth_argument (cpu_context, i);
+}
+
 void
 gum_interceptor_save (GumInvocationState * state)
 {
@@ -625,53 +1288,45 @@ void
 gum_interceptor_restore (GumInvocationState * state)
 {
   GumInvocationStack * stack;
-  guint old_depth, new_depth, i;
+  guint old_depth;
 
   stack = gum_interceptor_get_current_stack ();
 
   old_depth = *state;
-  new_depth = stack->len;
-  if (new_depth == old_depth)
-    return;
 
-  for (i = old_depth; i != new_depth; i++)
+  while (stack->len > old_depth)
   {
     GumInvocationStackEntry * entry;
 
-    entry = &g_array_index (stack, GumInvocationStackEntry, i);
+    entry = gum_invocation_stack_peek_top (stack);
 
     g_atomic_int_dec_and_test (&entry->function_ctx->trampoline_usage_counter);
-  }
 
-  g_array_set_size (stack, old_depth);
+    gum_invocation_stack_pop (stack);
+  }
 }
 
 gpointer
 _gum_interceptor_peek_top_caller_return_address (void)
 {
-  GumInvocationStack * stack;
   GumInvocationStackEntry * entry;
 
-  stack = gum_interceptor_get_current_stack ();
-  if (stack->len == 0)
+  entry = gum_invocation_stack_peek_top (gum_interceptor_get_current_stack ());
+  if (entry == NULL)
     return NULL;
 
-  entry = &g_array_index (stack, GumInvocationStackEntry, stack->len - 1);
-
   return entry->caller_ret_addr;
 }
 
 gpointer
 _gum_interceptor_translate_top_return_address (gpointer return_address)
 {
-  GumInvocationStack * stack;
   GumInvocationStackEntry * entry;
 
-  stack = gum_interceptor_get_current_stack ();
-  if (stack->len == 0)
+  entry = gum_invocation_stack_peek_top (gum_interceptor_get_current_stack ());
+  if (entry == NULL)
     goto fallback;
 
-  entry = &g_array_index (stack, GumInvocationStackEntry, stack->len - 1);
   if (entry->function_ctx->on_leave_trampoline != return_address)
     goto fallback;
 
@@ -725,6 +1380,18 @@ gum_interceptor_activate (GumInterceptor * self,
       prologue);
 }
 
+static void
+gum_interceptor_retarget (GumInterceptor * self,
+                          GumFunctionContext * ctx,
+                          gpointer prologue)
+{
+  if (ctx->destroyed || !ctx->activated)
+    return;
+
+  _gum_interceptor_backend_activate_trampoline (self->backend, ctx,
+      prologue);
+}
+
 static void
 gum_interceptor_deactivate (GumInterceptor * self,
                             GumFunctionContext * ctx,
@@ -782,6 +1449,7 @@ gum_interceptor_transaction_end (GumInterceptorTransaction * self)
   guint page_size;
   gboolean rwx_supported, code_segment_supported;
   GumDestroyTask * task;
+  guint oldest_active_epoch;
 
   self->level--;
   if (self->level > 0)
@@ -874,6 +1542,7 @@ gum_interceptor_transaction_end (GumInterceptorTransaction * self)
 
     num_pages = g_hash_table_size (self->pending_prologue_writes);
     segment = gum_code_segment_new (num_pages * page_size, NULL);
+    g_assert (segment != NULL);
 
     source_page = gum_code_segment_get_address (segment);
 
@@ -930,9 +1599,19 @@ gum_interceptor_transaction_end (GumInterceptorTransaction * self)
 
   g_list_free (addresses);
 
+  oldest_active_epoch = gum_interceptor_query_oldest_active_epoch ();
+
   while ((task = g_queue_pop_head (self->pending_destroy_tasks)) != NULL)
   {
-    if (task->ctx->trampoline_usage_counter == 0)
+    gboolean can_destroy;
+
+    if (task->ctx != NULL)
+      can_destroy = task->ctx->trampoline_usage_counter == 0;
+    else
+      can_destroy = (gint) (oldest_active_epoch - task->epoch) > 0 &&
+          g_atomic_int_get (&gum_interceptor_n_bootstrapping_threads) == 0;
+
+    if (can_destroy)
     {
       GUM_INTERCEPTOR_UNLOCK (interceptor);
       task->notify (task->data);
@@ -964,6 +1643,32 @@ gum_interceptor_transaction_schedule_destroy (GumInterceptorTransaction * self,
 
   task = g_slice_new (GumDestroyTask);
   task->ctx = ctx;
+  task->epoch = 0;
+  task->notify = notify;
+  task->data = data;
+
+  g_queue_push_tail (self->pending_destroy_tasks, task);
+}
+
+/*
+ * Listener arrays and listeners are only dereferenced while a thread is
+ * dispatching to listeners, so instead of waiting for the function to go
+ * idle we wait for every thread that might have seen the old value to leave
+ * its current epoch. This is bounded by the duration of a listener callback
+ * rather than by the call rate of the hooked function. Threads that are still
+ * creating their context have no epoch yet, so nothing is retired while any
+ * of them might be applying probes.
+ */
+static void
+gum_interceptor_transaction_schedule_retire (GumInterceptorTransaction * self,
+                                             GDestroyNotify notify,
+                                             gpointer data)
+{
+  GumDestroyTask * task;
+
+  task = g_slice_new (GumDestroyTask);
+  task->ctx = NULL;
+  task->epoch = gum_interceptor_advance_epoch ();
   task->notify = notify;
   task->data = data;
 
@@ -1021,6 +1726,8 @@ gum_function_context_new (GumInterceptor * interceptor,
   ctx->listener_entries =
       g_ptr_array_new_full (1, (GDestroyNotify) listener_entry_free);
 
+  ctx->stats_slot = gum_interceptor_claim_stats_slot ();
+
   ctx->interceptor = interceptor;
 
   return ctx;
@@ -1034,6 +1741,11 @@ gum_function_context_finalize (GumFunctionContext * function_ctx)
   g_ptr_array_unref (
       (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries));
 
+  if (function_ctx->probes != NULL)
+    g_array_unref ((GArray *) function_ctx->probes);
+
+  gum_interceptor_release_stats_slot (function_ctx->stats_slot);
+
   g_slice_free (GumFunctionContext, function_ctx);
 }
 
@@ -1062,6 +1774,13 @@ gum_function_context_perform_destroy (GumFunctionContext * function_ctx)
   _gum_interceptor_backend_destroy_trampoline (
       function_ctx->interceptor->backend, function_ctx);
 
+  if (function_ctx->probe_slice != NULL)
+    gum_code_slice_free (function_ctx->probe_slice);
+  if (function_ctx->replacement_slice != NULL)
+    gum_code_slice_free (function_ctx->replacement_slice);
+  g_slist_free_full (function_ctx->retired_slices,
+      (GDestroyNotify) gum_code_slice_free);
+
   gum_function_context_finalize (function_ctx);
 }
 
@@ -1071,79 +1790,272 @@ gum_function_context_is_empty (GumFunctionContext * function_ctx)
   if (function_ctx->replacement_function != NULL)
     return FALSE;
 
+  if (function_ctx->probes != NULL)
+    return FALSE;
+
   return gum_function_context_find_taken_listener_slot (function_ctx) == NULL;
 }
 
 static void
 gum_function_context_add_listener (GumFunctionContext * function_ctx,
                                    GumInvocationListener * listener,
-                                   gpointer function_data)
+                                   gpointer function_data,
+                                   gboolean lite)
 {
   ListenerEntry * entry;
   GPtrArray * old_entries, * new_entries;
   guint i;
 
+  old_entries =
+      (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
+
   entry = g_slice_new (ListenerEntry);
   entry->listener_interface = GUM_INVOCATION_LISTENER_GET_IFACE (listener);
   entry->listener_instance = listener;
   entry->function_data = function_data;
+  entry->lite = lite;
+  entry->thread_filter = g_hash_table_lookup (
+      function_ctx->interceptor->thread_filter_by_listener, listener);
+  entry->data_slot =
+      gum_function_context_claim_listener_data_slot (function_ctx, old_entries);
 
-  old_entries =
-      (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
   new_entries = g_ptr_array_new_full (old_entries->len + 1,
       (GDestroyNotify) listener_entry_free);
   for (i = 0; i != old_entries->len; i++)
   {
-    ListenerEntry * old_entry = g_ptr_array_index (old_entries, i);
-    if (old_entry != NULL)
-      g_ptr_array_add (new_entries, g_slice_dup (ListenerEntry, old_entry));
+    g_ptr_array_add (new_entries,
+        g_slice_dup (ListenerEntry, g_ptr_array_index (old_entries, i)));
   }
   g_ptr_array_add (new_entries, entry);
 
+  gum_function_context_update_has_thread_filter (function_ctx, new_entries);
+
   g_atomic_pointer_set (&function_ctx->listener_entries, new_entries);
-  gum_interceptor_transaction_schedule_destroy (
-      &function_ctx->interceptor->current_transaction, function_ctx,
+  gum_interceptor_transaction_schedule_retire (
+      &function_ctx->interceptor->current_transaction,
       (GDestroyNotify) g_ptr_array_unref, old_entries);
 
-  if (entry->listener_interface->on_leave != NULL)
+  if (!lite && entry->listener_interface->on_leave != NULL)
   {
     function_ctx->has_on_leave_listener = TRUE;
   }
 }
 
+/*
+ * Invocation data is indexed by a slot that stays with the listener for as
+ * long as it is attached. The slot of a removed listener may still hold data
+ * for invocations that have yet to leave, so while any are in flight a new
+ * listener gets a slot past the last one handed out. Once the function is
+ * idle the slots are packed again.
+ */
+static guint
+gum_function_context_claim_listener_data_slot (
+    GumFunctionContext * function_ctx,
+    GPtrArray * listener_entries)
+{
+  guint slot, next_slot, i;
+  gboolean taken;
+
+  if (g_atomic_int_get (&function_ctx->trampoline_usage_counter) != 0)
+    return function_ctx->next_listener_data_slot++;
+
+  slot = 0;
+  do
+  {
+    taken = FALSE;
+    for (i = 0; i != listener_entries->len && !taken; i++)
+    {
+      ListenerEntry * entry = g_ptr_array_index (listener_entries, i);
+
+      taken = entry->data_slot == slot;
+    }
+
+    if (taken)
+      slot++;
+  }
+  while (taken);
+
+  next_slot = slot + 1;
+  for (i = 0; i != listener_entries->len; i++)
+  {
+    ListenerEntry * entry = g_ptr_array_index (listener_entries, i);
+
+    next_slot = MAX (next_slot, entry->data_slot + 1);
+  }
+  function_ctx->next_listener_data_slot = next_slot;
+
+  return slot;
+}
+
 static void
 listener_entry_free (ListenerEntry * entry)
 {
   g_slice_free (ListenerEntry, entry);
 }
 
+static gboolean
+listener_entry_accepts_thread (ListenerEntry * entry,
+                               InterceptorThreadContext * interceptor_ctx)
+{
+  GumThreadFilter * filter = entry->thread_filter;
+
+  if (G_LIKELY (filter == NULL))
+    return TRUE;
+
+  return bsearch (&interceptor_ctx->thread_id, filter->thread_ids,
+      filter->n_thread_ids, sizeof (GumThreadId),
+      gum_thread_id_compare) != NULL;
+}
+
+static gint
+gum_thread_id_compare (gconstpointer a,
+                       gconstpointer b)
+{
+  GumThreadId id_a = *((const GumThreadId *) a);
+  GumThreadId id_b = *((const GumThreadId *) b);
+
+  if (id_a == id_b)
+    return 0;
+
+  return (id_a < id_b) ? -1 : 1;
+}
+
 static void
 gum_function_context_remove_listener (GumFunctionContext * function_ctx,
                                       GumInvocationListener * listener)
 {
-  ListenerEntry ** slot;
+  GPtrArray * old_entries, * new_entries;
   gboolean has_on_leave_listener;
-  GPtrArray * listener_entries;
   guint i;
 
-  slot = gum_function_context_find_listener (function_ctx, listener);
-  g_assert (slot != NULL);
-  listener_entry_free (*slot);
-  *slot = NULL;
+  g_assert (gum_function_context_has_listener (function_ctx, listener));
 
   has_on_leave_listener = FALSE;
+
+  old_entries =
+      (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
+  new_entries = g_ptr_array_new_full (old_entries->len,
+      (GDestroyNotify) listener_entry_free);
+  for (i = 0; i != old_entries->len; i++)
+  {
+    ListenerEntry * old_entry = g_ptr_array_index (old_entries, i);
+
+    if (old_entry->listener_instance == listener)
+      continue;
+
+    g_ptr_array_add (new_entries, g_slice_dup (ListenerEntry, old_entry));
+
+    if (!old_entry->lite && old_entry->listener_interface->on_leave != NULL)
+      has_on_leave_listener = TRUE;
+  }
+
+  gum_function_context_update_has_thread_filter (function_ctx, new_entries);
+
+  g_atomic_pointer_set (&function_ctx->listener_entries, new_entries);
+  gum_interceptor_transaction_schedule_retire (
+      &function_ctx->interceptor->current_transaction,
+      (GDestroyNotify) g_ptr_array_unref, old_entries);
+
+  function_ctx->has_on_leave_listener = has_on_leave_listener;
+}
+
+static void
+gum_function_context_set_thread_filter (GumFunctionContext * function_ctx,
+                                        GumInvocationListener * listener,
+                                        GumThreadFilter * filter)
+{
+  GPtrArray * old_entries, * new_entries;
+  guint i;
+
+  old_entries =
+      (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
+  new_entries = g_ptr_array_new_full (old_entries->len,
+      (GDestroyNotify) listener_entry_free);
+  for (i = 0; i != old_entries->len; i++)
+  {
+    ListenerEntry * old_entry, * new_entry;
+
+    old_entry = g_ptr_array_index (old_entries, i);
+
+    new_entry = g_slice_dup (ListenerEntry, old_entry);
+    if (new_entry->listener_instance == listener)
+      new_entry->thread_filter = filter;
+    g_ptr_array_add (new_entries, new_entry);
+  }
+
+  gum_function_context_update_has_thread_filter (function_ctx, new_entries);
+
+  g_atomic_pointer_set (&function_ctx->listener_entries, new_entries);
+  gum_interceptor_transaction_schedule_retire (
+      &function_ctx->interceptor->current_transaction,
+      (GDestroyNotify) g_ptr_array_unref, old_entries);
+}
+
+static gboolean
+gum_function_context_accepts_thread (GumFunctionContext * function_ctx,
+                                     InterceptorThreadContext * interceptor_ctx)
+{
+  gboolean accepted = FALSE;
+  GPtrArray * listener_entries;
+  guint i;
+
+  interceptor_thread_context_enter_epoch (interceptor_ctx);
+
+  listener_entries =
+      (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
+  for (i = 0; i != listener_entries->len && !accepted; i++)
+  {
+    ListenerEntry * entry = g_ptr_array_index (listener_entries, i);
+
+    accepted = listener_entry_accepts_thread (entry, interceptor_ctx);
+  }
+
+  interceptor_thread_context_leave_epoch (interceptor_ctx);
+
+  return accepted;
+}
+
+static void
+gum_function_context_update_has_thread_filter (
+    GumFunctionContext * function_ctx,
+    GPtrArray * listener_entries)
+{
+  gboolean has_thread_filter = FALSE;
+  guint i;
+
+  for (i = 0; i != listener_entries->len && !has_thread_filter; i++)
+  {
+    ListenerEntry * entry = g_ptr_array_index (listener_entries, i);
+
+    has_thread_filter = entry->thread_filter != NULL;
+  }
+
+  function_ctx->has_thread_filter = has_thread_filter;
+}
+
+static gboolean
+gum_function_context_can_enter_lite (GumFunctionContext * function_ctx)
+{
+  GPtrArray * listener_entries;
+  guint i;
+
+  if (function_ctx->on_lite_enter_trampoline == NULL ||
+      function_ctx->replacement_function != NULL)
+  {
+    return FALSE;
+  }
+
   listener_entries =
       (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
   for (i = 0; i != listener_entries->len; i++)
   {
     ListenerEntry * entry = g_ptr_array_index (listener_entries, i);
-    if (entry != NULL && entry->listener_interface->on_leave != NULL)
-    {
-      has_on_leave_listener = TRUE;
-      break;
-    }
+
+    if (!entry->lite)
+      return FALSE;
   }
-  function_ctx->has_on_leave_listener = has_on_leave_listener;
+
+  return TRUE;
 }
 
 static gboolean
@@ -1166,7 +2078,7 @@ gum_function_context_find_listener (GumFunctionContext * function_ctx,
   {
     ListenerEntry ** slot = (ListenerEntry **)
         &g_ptr_array_index (listener_entries, i);
-    if (*slot != NULL && (*slot)->listener_instance == listener)
+    if ((*slot)->listener_instance == listener)
       return slot;
   }
 
@@ -1193,47 +2105,213 @@ gum_function_context_find_taken_listener_slot (
   return NULL;
 }
 
-void
-_gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
-                                        GumCpuContext * cpu_context,
-                                        gpointer * caller_ret_addr,
-                                        gpointer * next_hop)
+static void
+gum_function_context_set_probes (GumFunctionContext * function_ctx,
+                                 GArray * probes)
 {
-  GumInterceptor * interceptor;
-  InterceptorThreadContext * interceptor_ctx;
-  GumInvocationStack * stack;
-  GumInvocationStackEntry * stack_entry;
-  GumInvocationContext * invocation_ctx = NULL;
-  gint system_error;
-  gboolean invoke_listeners = TRUE;
-  gboolean will_trap_on_leave;
+  GumInterceptor * interceptor = function_ctx->interceptor;
+  GArray * old_probes;
+  GumCodeSlice * old_slice;
 
-  g_atomic_int_inc (&function_ctx->trampoline_usage_counter);
-
-  interceptor = function_ctx->interceptor;
+  old_slice = function_ctx->probe_slice;
+  if (old_slice != NULL)
+  {
+    gum_function_context_retire_slice (function_ctx, old_slice);
+    function_ctx->probe_slice = NULL;
+  }
 
-#ifdef HAVE_WINDOWS
-  system_error = gum_thread_get_system_error ();
-#endif
+  if (probes != NULL)
+  {
+    _gum_interceptor_backend_create_probe_trampoline (interceptor->backend,
+        function_ctx, probes);
+  }
 
-  if (gum_tls_key_get_value (gum_interceptor_guard_key) == interceptor)
+  old_probes = (GArray *) g_atomic_pointer_get (&function_ctx->probes);
+  g_atomic_pointer_set (&function_ctx->probes, probes);
+  if (old_probes != NULL)
   {
-    *next_hop = function_ctx->on_invoke_trampoline;
-    goto bypass;
+    gum_interceptor_transaction_schedule_retire (
+        &interceptor->current_transaction, (GDestroyNotify) g_array_unref,
+        old_probes);
   }
-  gum_tls_key_set_value (gum_interceptor_guard_key, interceptor);
 
-  interceptor_ctx = get_interceptor_thread_context ();
-  stack = interceptor_ctx->stack;
+  gum_function_context_update_redirect (function_ctx);
+}
 
-  stack_entry = gum_invocation_stack_peek_top (stack);
+/*
+ * The interceptor_ctx is NULL while the calling thread is still creating it,
+ * in which case gum_interceptor_n_bootstrapping_threads keeps the probes
+ * alive instead of the thread's epoch.
+ */
+static void
+gum_function_context_apply_probes (GumFunctionContext * function_ctx,
+                                   InterceptorThreadContext * interceptor_ctx,
+                                   GumCpuContext * cpu_context,
+                                   gpointer return_address)
+{
+  GArray * probes;
+  guint i;
+
+  if (interceptor_ctx != NULL)
+    interceptor_thread_context_enter_epoch (interceptor_ctx);
+
+  probes = (GArray *) g_atomic_pointer_get (&function_ctx->probes);
+  if (probes != NULL)
+  {
+    for (i = 0; i != probes->len; i++)
+    {
+      GumInlineProbe * probe = &g_array_index (probes, GumInlineProbe, i);
+
+      switch (probe->type)
+      {
+        case GUM_INLINE_PROBE_COUNT_CALLS:
+          g_atomic_int_inc ((gint *) probe->data);
+          break;
+        case GUM_INLINE_PROBE_RECORD_CALLS:
+          gum_call_recorder_append (probe->data, cpu_context, return_address);
+          break;
+        default:
+          g_assert_not_reached ();
+      }
+    }
+  }
+
+  if (interceptor_ctx != NULL)
+    interceptor_thread_context_leave_epoch (interceptor_ctx);
+}
+
+/*
+ * Points the prologue at the fast replacement or the inline probe stub while
+ * nothing else needs the full invocation path, at the lite enter trampoline
+ * while only lite listeners are attached, and back at the regular trampoline
+ * otherwise.
+ */
+static void
+gum_function_context_update_redirect (GumFunctionContext * function_ctx)
+{
+  gpointer target = NULL;
+
+  if (gum_function_context_find_taken_listener_slot (function_ctx) == NULL)
+  {
+    if (function_ctx->replacement_is_fast)
+    {
+      if (function_ctx->probes == NULL)
+        target = function_ctx->on_fast_replacement;
+    }
+    else if (function_ctx->probe_slice != NULL &&
+        function_ctx->replacement_function == NULL)
+    {
+      target = function_ctx->probe_slice->data;
+    }
+  }
+  else if (gum_function_context_can_enter_lite (function_ctx))
+  {
+    target = function_ctx->on_lite_enter_trampoline;
+  }
+
+  if (target == function_ctx->redirect_target)
+    return;
+
+  function_ctx->redirect_target = target;
+
+  if (function_ctx->activated)
+  {
+    gum_interceptor_transaction_schedule_prologue_write (
+        &function_ctx->interceptor->current_transaction, function_ctx,
+        gum_interceptor_retarget);
+  }
+}
+
+/*
+ * Threads may still be running code in the slice until the prologue has been
+ * retargeted, and it is not covered by the usage counter, so we keep it
+ * around for as long as the function stays hooked.
+ */
+static void
+gum_function_context_retire_slice (GumFunctionContext * function_ctx,
+                                   GumCodeSlice * slice)
+{
+  function_ctx->retired_slices =
+      g_slist_prepend (function_ctx->retired_slices, slice);
+}
+
+void
+_gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
+                                        GumCpuContext * cpu_context,
+                                        gpointer * caller_ret_addr,
+                                        gpointer * next_hop)
+{
+  GumInterceptor * interceptor;
+  InterceptorThreadContext * interceptor_ctx;
+  GumInvocationStack * stack;
+  GumInvocationStackEntry * stack_entry;
+  GumInvocationContext * invocation_ctx = NULL;
+  gint system_error;
+  gboolean invoke_listeners = TRUE;
+  gboolean will_trap_on_leave;
+  GumHookStats * hook_stats = NULL;
+
+  g_atomic_int_inc (&function_ctx->trampoline_usage_counter);
+
+  interceptor = function_ctx->interceptor;
+
+#ifdef HAVE_WINDOWS
+  system_error = gum_thread_get_system_error ();
+#endif
+
+  interceptor_ctx = peek_interceptor_thread_context ();
+  if (G_UNLIKELY (interceptor_ctx == NULL))
+  {
+    /*
+     * First hooked call on this thread: creating the context may recurse
+     * into hooked functions, so guard it with the slow TLS key.
+     */
+    if (gum_tls_key_get_value (gum_interceptor_guard_key) == interceptor)
+    {
+      if (function_ctx->probes != NULL)
+      {
+        gum_function_context_apply_probes (function_ctx, NULL, cpu_context,
+            *caller_ret_addr);
+      }
+
+      *next_hop = function_ctx->on_invoke_trampoline;
+      goto bypass;
+    }
+    gum_tls_key_set_value (gum_interceptor_guard_key, interceptor);
+    g_atomic_int_inc (&gum_interceptor_n_bootstrapping_threads);
+
+    interceptor_ctx = get_interceptor_thread_context ();
+
+    g_atomic_int_dec_and_test (&gum_interceptor_n_bootstrapping_threads);
+    gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
+  }
+
+  /*
+   * Probes see every entry, including the ones made by Gum itself and by a
+   * replacement calling the original, just like the inline probe stub does.
+   */
+  if (function_ctx->probes != NULL)
+  {
+    gum_function_context_apply_probes (function_ctx, interceptor_ctx,
+        cpu_context, *caller_ret_addr);
+  }
+
+  if (interceptor_ctx->guard == interceptor)
+  {
+    *next_hop = function_ctx->on_invoke_trampoline;
+    goto bypass;
+  }
+  interceptor_ctx->guard = interceptor;
+  stack = interceptor_ctx->stack;
+
+  stack_entry = gum_invocation_stack_peek_top (stack);
   if (stack_entry != NULL &&
       stack_entry->calling_replacement &&
       gum_strip_code_pointer (GUM_FUNCPTR_TO_POINTER (
           stack_entry->invocation_context.function)) ==
           function_ctx->function_address)
   {
-    gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
+    interceptor_ctx->guard = NULL;
     *next_hop = function_ctx->on_invoke_trampoline;
     goto bypass;
   }
@@ -1242,6 +2320,14 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
   system_error = gum_thread_get_system_error ();
 #endif
 
+  if (interceptor->stats_enabled)
+  {
+    hook_stats = interceptor_thread_context_get_hook_stats (interceptor_ctx,
+        function_ctx->stats_slot);
+    interceptor_thread_context_add_hook_stats (interceptor_ctx, hook_stats,
+        1, 0, 0);
+  }
+
   if (interceptor->selected_thread_id != 0)
   {
     invoke_listeners =
@@ -1253,6 +2339,12 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
     invoke_listeners = (interceptor_ctx->ignore_level <= 0);
   }
 
+  if (invoke_listeners && function_ctx->has_thread_filter)
+  {
+    invoke_listeners =
+        gum_function_context_accepts_thread (function_ctx, interceptor_ctx);
+  }
+
   will_trap_on_leave = function_ctx->replacement_function != NULL ||
       (invoke_listeners && function_ctx->has_on_leave_listener);
   if (will_trap_on_leave)
@@ -1276,35 +2368,50 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
   if (invoke_listeners)
   {
     GPtrArray * listener_entries;
+    ListenerInvocationState state;
+    guint64 start_time = 0;
     guint i;
 
     invocation_ctx->cpu_context = cpu_context;
     invocation_ctx->backend = &interceptor_ctx->listener_backend;
 
+    state.point_cut = GUM_POINT_ENTER;
+    state.interceptor_ctx = interceptor_ctx;
+    state.stack_entry = stack_entry;
+    invocation_ctx->backend->data = &state;
+
+    if (hook_stats != NULL)
+      start_time = gum_interceptor_get_time ();
+
+    interceptor_thread_context_enter_epoch (interceptor_ctx);
+
     listener_entries =
         (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
     for (i = 0; i != listener_entries->len; i++)
     {
       ListenerEntry * listener_entry;
-      ListenerInvocationState state;
 
       listener_entry = g_ptr_array_index (listener_entries, i);
-      if (listener_entry == NULL)
-        continue;
 
-      state.point_cut = GUM_POINT_ENTER;
       state.entry = listener_entry;
-      state.interceptor_ctx = interceptor_ctx;
-      state.invocation_data = stack_entry->listener_invocation_data[i];
-      invocation_ctx->backend->data = &state;
+      state.data_slot = listener_entry->data_slot;
 
-      if (listener_entry->listener_interface->on_enter != NULL)
+      if (listener_entry->listener_interface->on_enter != NULL &&
+          listener_entry_accepts_thread (listener_entry, interceptor_ctx))
       {
         listener_entry->listener_interface->on_enter (
             listener_entry->listener_instance, invocation_ctx);
       }
     }
 
+    interceptor_thread_context_leave_epoch (interceptor_ctx);
+
+    if (hook_stats != NULL)
+    {
+      interceptor_thread_context_add_hook_stats (interceptor_ctx, hook_stats,
+          0, gum_interceptor_get_time () - start_time, 0);
+    }
+
     system_error = invocation_ctx->system_error;
   }
 
@@ -1315,7 +2422,7 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
 
   gum_thread_set_system_error (system_error);
 
-  gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
+  interceptor_ctx->guard = NULL;
 
   if (will_trap_on_leave)
   {
@@ -1325,9 +2432,12 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
   if (function_ctx->replacement_function != NULL)
   {
     stack_entry->calling_replacement = TRUE;
-    stack_entry->cpu_context = *cpu_context;
+    invocation_ctx->cpu_context =
+        gum_invocation_stack_entry_get_cpu_context (stack_entry);
+    *invocation_ctx->cpu_context = *cpu_context;
     stack_entry->original_system_error = system_error;
-    invocation_ctx->cpu_context = &stack_entry->cpu_context;
+    stack_entry->replacement_start =
+        (hook_stats != NULL) ? gum_interceptor_get_time () : 0;
     invocation_ctx->backend = &interceptor_ctx->replacement_backend;
     invocation_ctx->backend->data = function_ctx->replacement_data;
 
@@ -1359,20 +2469,22 @@ _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
   GumInvocationStackEntry * stack_entry;
   GumInvocationContext * invocation_ctx;
   GPtrArray * listener_entries;
+  ListenerInvocationState state;
+  GumHookStats * hook_stats = NULL;
+  guint64 start_time = 0;
   guint i;
 
 #ifdef HAVE_WINDOWS
   system_error = gum_thread_get_system_error ();
 #endif
 
-  gum_tls_key_set_value (gum_interceptor_guard_key, function_ctx->interceptor);
+  interceptor_ctx = get_interceptor_thread_context ();
+  interceptor_ctx->guard = function_ctx->interceptor;
 
 #ifndef HAVE_WINDOWS
   system_error = gum_thread_get_system_error ();
 #endif
 
-  interceptor_ctx = get_interceptor_thread_context ();
-
   stack_entry = gum_invocation_stack_peek_top (interceptor_ctx->stack);
   *next_hop = gum_sign_code_pointer (stack_entry->caller_ret_addr);
 
@@ -1391,35 +2503,59 @@ _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
 
   gum_function_context_fixup_cpu_context (function_ctx, cpu_context);
 
+  state.point_cut = GUM_POINT_LEAVE;
+  state.interceptor_ctx = interceptor_ctx;
+  state.stack_entry = stack_entry;
+  invocation_ctx->backend->data = &state;
+
+  if (function_ctx->interceptor->stats_enabled)
+  {
+    hook_stats = interceptor_thread_context_get_hook_stats (interceptor_ctx,
+        function_ctx->stats_slot);
+    start_time = gum_interceptor_get_time ();
+
+    if (stack_entry->calling_replacement && stack_entry->replacement_start != 0)
+    {
+      interceptor_thread_context_add_hook_stats (interceptor_ctx, hook_stats,
+          0, 0, start_time - stack_entry->replacement_start);
+    }
+  }
+
+  interceptor_thread_context_enter_epoch (interceptor_ctx);
+
   listener_entries =
       (GPtrArray *) g_atomic_pointer_get (&function_ctx->listener_entries);
   for (i = 0; i != listener_entries->len; i++)
   {
     ListenerEntry * listener_entry;
-    ListenerInvocationState state;
 
     listener_entry = g_ptr_array_index (listener_entries, i);
-    if (listener_entry == NULL)
-      continue;
 
-    state.point_cut = GUM_POINT_LEAVE;
     state.entry = listener_entry;
-    state.interceptor_ctx = interceptor_ctx;
-    state.invocation_data = stack_entry->listener_invocation_data[i];
-    invocation_ctx->backend->data = &state;
+    state.data_slot = listener_entry->data_slot;
 
-    if (listener_entry->listener_interface->on_leave != NULL)
+    if (!listener_entry->lite &&
+        listener_entry->listener_interface->on_leave != NULL &&
+        listener_entry_accepts_thread (listener_entry, interceptor_ctx))
     {
       listener_entry->listener_interface->on_leave (
           listener_entry->listener_instance, invocation_ctx);
     }
   }
 
+  interceptor_thread_context_leave_epoch (interceptor_ctx);
+
+  if (hook_stats != NULL)
+  {
+    interceptor_thread_context_add_hook_stats (interceptor_ctx, hook_stats,
+        0, gum_interceptor_get_time () - start_time, 0);
+  }
+
   gum_thread_set_system_error (invocation_ctx->system_error);
 
   gum_invocation_stack_pop (interceptor_ctx->stack);
 
-  gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
+  interceptor_ctx->guard = NULL;
 
   g_atomic_int_dec_and_test (&function_ctx->trampoline_usage_counter);
 }
@@ -1452,12 +2588,22 @@ gum_function_context_fixup_cpu_context (GumFunctionContext * function_ctx,
 #endif
 }
 
+static InterceptorThreadContext *
+peek_interceptor_thread_context (void)
+{
+#ifdef GUM_INTERCEPTOR_THREAD_LOCAL
+  return gum_interceptor_thread_context;
+#else
+  return g_private_get (&gum_interceptor_context_private);
+#endif
+}
+
 static InterceptorThreadContext *
 get_interceptor_thread_context (void)
 {
   InterceptorThreadContext * context;
 
-  context = g_private_get (&gum_interceptor_context_private);
+  context = peek_interceptor_thread_context ();
   if (context == NULL)
   {
     context = interceptor_thread_context_new ();
@@ -1466,7 +2612,11 @@ get_interceptor_thread_context (void)
     g_hash_table_add (gum_interceptor_thread_contexts, context);
     gum_spinlock_release (&gum_interceptor_thread_context_lock);
 
+    /* Still needed for its destructor, even when we have a thread local */
     g_private_set (&gum_interceptor_context_private, context);
+#ifdef GUM_INTERCEPTOR_THREAD_LOCAL
+    gum_interceptor_thread_context = context;
+#endif
   }
 
   return context;
@@ -1475,10 +2625,28 @@ get_interceptor_thread_context (void)
 static void
 release_interceptor_thread_context (InterceptorThreadContext * context)
 {
+#ifdef GUM_INTERCEPTOR_THREAD_LOCAL
+  if (gum_interceptor_thread_context == context)
+    gum_interceptor_thread_context = NULL;
+#endif
+
   if (gum_interceptor_thread_contexts == NULL)
     return;
 
   gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
+  if (context->n_hook_stats != 0)
+  {
+    GArray * exited = gum_interceptor_exited_thread_stats;
+    guint i;
+
+    if (exited->len < context->n_hook_stats)
+      g_array_set_size (exited, context->n_hook_stats);
+    for (i = 0; i != context->n_hook_stats; i++)
+    {
+      gum_hook_stats_add (&g_array_index (exited, GumHookStats, i),
+          &context->hook_stats[i]);
+    }
+  }
   g_hash_table_remove (gum_interceptor_thread_contexts, context);
   gum_spinlock_release (&gum_interceptor_thread_context_lock);
 }
@@ -1544,7 +2712,8 @@ gum_interceptor_invocation_get_listener_invocation_data (
   if (required_size > GUM_MAX_LISTENER_DATA)
     return NULL;
 
-  return data->invocation_data;
+  return gum_invocation_stack_entry_get_listener_data (data->stack_entry,
+      data->data_slot);
 }
 
 static gpointer
@@ -1605,27 +2774,254 @@ interceptor_thread_context_new (void)
   context->listener_backend.state = context;
   context->replacement_backend.state = context;
 
+  context->guard = NULL;
   context->ignore_level = 0;
+  context->thread_id = gum_process_get_current_thread_id ();
+
+  context->epoch = 0;
+  context->epoch_nesting = 0;
 
-  context->stack = g_array_sized_new (FALSE, TRUE,
-      sizeof (GumInvocationStackEntry), GUM_MAX_CALL_DEPTH);
+  context->stack = gum_invocation_stack_new ();
 
   context->listener_data_slots = g_array_sized_new (FALSE, TRUE,
       sizeof (ListenerDataSlot), GUM_MAX_LISTENERS_PER_FUNCTION);
 
+  context->hook_stats = NULL;
+  context->n_hook_stats = 0;
+  context->hook_stats_sequence = 0;
+
   return context;
 }
 
 static void
 interceptor_thread_context_destroy (InterceptorThreadContext * context)
 {
+  g_free (context->hook_stats);
+
   g_array_free (context->listener_data_slots, TRUE);
 
-  g_array_free (context->stack, TRUE);
+  gum_invocation_stack_free (context->stack);
 
   g_slice_free (InterceptorThreadContext, context);
 }
 
+static GumHookStats *
+interceptor_thread_context_get_hook_stats (InterceptorThreadContext * self,
+                                           guint slot)
+{
+  if (G_UNLIKELY (slot >= self->n_hook_stats))
+  {
+    GumHookStats * old_stats, * new_stats;
+    guint n;
+
+    n = MAX (slot + 1, self->n_hook_stats * 2);
+    new_stats = g_new0 (GumHookStats, n);
+
+    gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
+    old_stats = self->hook_stats;
+    memcpy (new_stats, old_stats, self->n_hook_stats * sizeof (GumHookStats));
+    self->hook_stats = new_stats;
+    self->n_hook_stats = n;
+    gum_spinlock_release (&gum_interceptor_thread_context_lock);
+
+    g_free (old_stats);
+  }
+
+  return &self->hook_stats[slot];
+}
+
+static void
+interceptor_thread_context_add_hook_stats (InterceptorThreadContext * self,
+                                           GumHookStats * stats,
+                                           guint64 hits,
+                                           guint64 listener_time,
+                                           guint64 replacement_time)
+{
+  g_atomic_int_inc (&self->hook_stats_sequence);
+
+  stats->hits += hits;
+  stats->listener_time += listener_time;
+  stats->replacement_time += replacement_time;
+
+  g_atomic_int_inc (&self->hook_stats_sequence);
+}
+
+/*
+ * Called with the thread context lock held, so the array cannot be swapped
+ * out from under us. The owner never holds that lock while updating, so an
+ * odd sequence number is only ever a few instructions away from being even.
+ */
+static void
+interceptor_thread_context_read_hook_stats (InterceptorThreadContext * self,
+                                            guint slot,
+                                            GumHookStats * stats)
+{
+  gint sequence;
+
+  do
+  {
+    while (((sequence = g_atomic_int_get (&self->hook_stats_sequence)) & 1)
+        != 0)
+    {
+      g_thread_yield ();
+    }
+
+    *stats = self->hook_stats[slot];
+  }
+  while (g_atomic_int_get (&self->hook_stats_sequence) != sequence);
+}
+
+static void
+gum_hook_stats_add (GumHookStats * self,
+                    const GumHookStats * other)
+{
+  self->hits += other->hits;
+  self->listener_time += other->listener_time;
+  self->replacement_time += other->replacement_time;
+}
+
+static guint64
+gum_interceptor_get_time (void)
+{
+#ifdef HAVE_WINDOWS
+  static LARGE_INTEGER frequency = { 0, };
+  LARGE_INTEGER counter;
+  guint64 ticks, ticks_per_second;
+
+  if (frequency.QuadPart == 0)
+    QueryPerformanceFrequency (&frequency);
+
+  QueryPerformanceCounter (&counter);
+
+  ticks = counter.QuadPart;
+  ticks_per_second = frequency.QuadPart;
+
+  return (ticks / ticks_per_second) * G_GUINT64_CONSTANT (1000000000) +
+      (ticks % ticks_per_second) * G_GUINT64_CONSTANT (1000000000) /
+      ticks_per_second;
+#else
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (guint64) ts.tv_sec * G_GUINT64_CONSTANT (1000000000) + ts.tv_nsec;
+#endif
+}
+
+static guint
+gum_interceptor_claim_stats_slot (void)
+{
+  GArray * free_slots = gum_interceptor_free_stats_slots;
+  guint slot;
+
+  gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
+
+  if (free_slots->len != 0)
+  {
+    slot = g_array_index (free_slots, guint, free_slots->len - 1);
+    g_array_set_size (free_slots, free_slots->len - 1);
+  }
+  else
+  {
+    slot = gum_interceptor_next_stats_slot++;
+  }
+
+  gum_spinlock_release (&gum_interceptor_thread_context_lock);
+
+  return slot;
+}
+
+/*
+ * Only called once the function is gone, so no thread can still be updating
+ * the counters. They are reset here so the next function to claim the slot
+ * starts from zero.
+ */
+static void
+gum_interceptor_release_stats_slot (guint slot)
+{
+  GHashTableIter iter;
+  InterceptorThreadContext * thread_ctx;
+  GArray * exited = gum_interceptor_exited_thread_stats;
+
+  gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
+
+  g_hash_table_iter_init (&iter, gum_interceptor_thread_contexts);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &thread_ctx, NULL))
+  {
+    if (slot < thread_ctx->n_hook_stats)
+      memset (&thread_ctx->hook_stats[slot], 0, sizeof (GumHookStats));
+  }
+
+  if (slot < exited->len)
+  {
+    memset (&g_array_index (exited, GumHookStats, slot), 0,
+        sizeof (GumHookStats));
+  }
+
+  g_array_append_val (gum_interceptor_free_stats_slots, slot);
+
+  gum_spinlock_release (&gum_interceptor_thread_context_lock);
+}
+
+static void
+interceptor_thread_context_enter_epoch (InterceptorThreadContext * self)
+{
+  if (self->epoch_nesting++ != 0)
+    return;
+
+  /*
+   * Callers load the data they want to protect with g_atomic_pointer_get(),
+   * which acts as a full barrier, so our announcement is visible before that.
+   */
+  g_atomic_int_set (&self->epoch, g_atomic_int_get (&gum_interceptor_epoch));
+}
+
+static void
+interceptor_thread_context_leave_epoch (InterceptorThreadContext * self)
+{
+  if (--self->epoch_nesting != 0)
+    return;
+
+  g_atomic_int_set (&self->epoch, 0);
+}
+
+static guint
+gum_interceptor_advance_epoch (void)
+{
+  guint epoch;
+
+  epoch = (guint) g_atomic_int_add (&gum_interceptor_epoch, 1);
+
+  /* Zero means quiescent, so never hand it out */
+  if (epoch + 1 == 0)
+    g_atomic_int_compare_and_exchange (&gum_interceptor_epoch, 0, 1);
+
+  return epoch;
+}
+
+static guint
+gum_interceptor_query_oldest_active_epoch (void)
+{
+  guint oldest;
+  GHashTableIter iter;
+  InterceptorThreadContext * thread_ctx;
+
+  oldest = (guint) g_atomic_int_get (&gum_interceptor_epoch);
+
+  gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
+  g_hash_table_iter_init (&iter, gum_interceptor_thread_contexts);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &thread_ctx, NULL))
+  {
+    guint epoch = (guint) g_atomic_int_get (&thread_ctx->epoch);
+
+    if (epoch != 0 && (gint) (epoch - oldest) < 0)
+      oldest = epoch;
+  }
+  gum_spinlock_release (&gum_interceptor_thread_context_lock);
+
+  return oldest;
+}
+
 static gpointer
 interceptor_thread_context_get_listener_data (InterceptorThreadContext * self,
                                               GumInvocationListener * listener,
@@ -1685,23 +3081,66 @@ interceptor_thread_context_forget_listener_data (
   }
 }
 
+static GumInvocationStack *
+gum_invocation_stack_new (void)
+{
+  GumInvocationStack * stack;
+
+  stack = g_slice_new (GumInvocationStack);
+  stack->len = 0;
+  stack->serial = 0;
+  stack->first_chunk = gum_invocation_stack_chunk_new (NULL);
+  stack->top_chunk = stack->first_chunk;
+
+  return stack;
+}
+
+static void
+gum_invocation_stack_free (GumInvocationStack * stack)
+{
+  GumInvocationStackChunk * chunk, * next;
+
+  for (chunk = stack->first_chunk; chunk != NULL; chunk = next)
+  {
+    next = chunk->next;
+    gum_invocation_stack_chunk_free (chunk);
+  }
+
+  g_slice_free (GumInvocationStack, stack);
+}
+
 static GumInvocationStackEntry *
 gum_invocation_stack_push (GumInvocationStack * stack,
                            GumFunctionContext * function_ctx,
                            gpointer caller_ret_addr)
 {
+  GumInvocationStackChunk * chunk;
   GumInvocationStackEntry * entry;
   GumInvocationContext * ctx;
 
-  g_array_set_size (stack, stack->len + 1);
-  entry = (GumInvocationStackEntry *)
-      &g_array_index (stack, GumInvocationStackEntry, stack->len - 1);
+  chunk = stack->top_chunk;
+  if (stack->len == chunk->offset + GUM_INVOCATION_STACK_CHUNK_SIZE)
+  {
+    if (chunk->next == NULL)
+      chunk->next = gum_invocation_stack_chunk_new (chunk);
+    chunk = chunk->next;
+    stack->top_chunk = chunk;
+  }
+
+  entry = &chunk->entries[stack->len - chunk->offset];
+  stack->len++;
+
   entry->function_ctx = function_ctx;
   entry->caller_ret_addr = caller_ret_addr;
+  entry->calling_replacement = FALSE;
+  entry->original_system_error = 0;
+  entry->serial = ++stack->serial;
 
   ctx = &entry->invocation_context;
   ctx->function = GUM_POINTER_TO_FUNCPTR (GCallback,
       gum_sign_code_pointer (function_ctx->function_address));
+  ctx->cpu_context = NULL;
+  ctx->system_error = 0;
 
   ctx->backend = NULL;
 
@@ -1711,24 +3150,111 @@ gum_invocation_stack_push (GumInvocationStack * stack,
 static gpointer
 gum_invocation_stack_pop (GumInvocationStack * stack)
 {
+  GumInvocationStackChunk * chunk;
   GumInvocationStackEntry * entry;
-  gpointer caller_ret_addr;
 
-  entry = (GumInvocationStackEntry *)
-      &g_array_index (stack, GumInvocationStackEntry, stack->len - 1);
-  caller_ret_addr = entry->caller_ret_addr;
-  g_array_set_size (stack, stack->len - 1);
+  chunk = stack->top_chunk;
+  entry = &chunk->entries[stack->len - 1 - chunk->offset];
 
-  return caller_ret_addr;
+  stack->len--;
+  if (stack->len == chunk->offset && chunk->previous != NULL)
+    stack->top_chunk = chunk->previous;
+
+  return entry->caller_ret_addr;
 }
 
 static GumInvocationStackEntry *
 gum_invocation_stack_peek_top (GumInvocationStack * stack)
 {
+  GumInvocationStackChunk * chunk;
+
   if (stack->len == 0)
     return NULL;
 
-  return &g_array_index (stack, GumInvocationStackEntry, stack->len - 1);
+  chunk = stack->top_chunk;
+
+  return &chunk->entries[stack->len - 1 - chunk->offset];
+}
+
+static GumInvocationStackChunk *
+gum_invocation_stack_chunk_new (GumInvocationStackChunk * previous)
+{
+  GumInvocationStackChunk * chunk;
+
+  chunk = g_slice_new0 (GumInvocationStackChunk);
+  chunk->previous = previous;
+  chunk->next = NULL;
+  chunk->offset = (previous != NULL)
+      ? previous->offset + GUM_INVOCATION_STACK_CHUNK_SIZE
+      : 0;
+
+  return chunk;
+}
+
+static void
+gum_invocation_stack_chunk_free (GumInvocationStackChunk * chunk)
+{
+  guint i, j;
+
+  for (i = 0; i != GUM_INVOCATION_STACK_CHUNK_SIZE; i++)
+  {
+    GumInvocationStackEntry * entry = &chunk->entries[i];
+
+    if (entry->cpu_context != NULL)
+      g_slice_free (GumCpuContext, entry->cpu_context);
+
+    for (j = 0; j != entry->listener_invocation_data_capacity; j++)
+      g_free (entry->listener_invocation_data[j]);
+    g_free (entry->listener_invocation_data);
+  }
+
+  g_slice_free (GumInvocationStackChunk, chunk);
+}
+
+static GumCpuContext *
+gum_invocation_stack_entry_get_cpu_context (GumInvocationStackEntry * entry)
+{
+  if (entry->cpu_context == NULL)
+    entry->cpu_context = g_slice_new (GumCpuContext);
+
+  return entry->cpu_context;
+}
+
+static gpointer
+gum_invocation_stack_entry_get_listener_data (GumInvocationStackEntry * entry,
+                                              guint data_slot)
+{
+  ListenerInvocationData * data;
+
+  if (data_slot >= entry->listener_invocation_data_capacity)
+  {
+    guint old_capacity, new_capacity;
+
+    old_capacity = entry->listener_invocation_data_capacity;
+    new_capacity = MAX (data_slot + 1, old_capacity * 2);
+
+    entry->listener_invocation_data = g_renew (ListenerInvocationData *,
+        entry->listener_invocation_data, new_capacity);
+    gum_memset (entry->listener_invocation_data + old_capacity, 0,
+        (new_capacity - old_capacity) * sizeof (ListenerInvocationData *));
+    entry->listener_invocation_data_capacity = new_capacity;
+  }
+
+  data = entry->listener_invocation_data[data_slot];
+  if (data == NULL)
+  {
+    data = g_new (ListenerInvocationData, 1);
+    data->serial = entry->serial - 1;
+    entry->listener_invocation_data[data_slot] = data;
+  }
+
+  if (data->serial != entry->serial)
+  {
+    gum_memset (data->data, 0, sizeof (data->data));
+    data->serial = entry->serial;
+  }
+
+  return data->data;
 }
 
 static gpointer
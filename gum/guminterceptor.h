@@ -11,6 +11,7 @@
 #include <glib-object.h>
 #include <gum/gumdefs.h>
 #include <gum/guminvocationlistener.h>
+#include <gum/gumprocess.h>
 
 G_BEGIN_DECLS
 
@@ -18,8 +19,18 @@ G_BEGIN_DECLS
 G_DECLARE_FINAL_TYPE (GumInterceptor, gum_interceptor, GUM, INTERCEPTOR,
     GObject)
 
-typedef GArray GumInvocationStack;
+/*
+ * GumInvocationStack used to be a GArray. It is now opaque, which breaks both
+ * API and ABI: code that read its len field must use
+ * gum_invocation_stack_get_depth() instead.
+ */
+typedef struct _GumInvocationStack GumInvocationStack;
 typedef guint GumInvocationState;
+typedef struct _GumHookStats GumHookStats;
+typedef struct _GumCallRecord GumCallRecord;
+typedef struct _GumCallRecorder GumCallRecorder;
+
+#define GUM_CALL_RECORD_MAX_ARGS 7
 
 typedef enum
 {
@@ -37,17 +48,57 @@ typedef enum
   GUM_REPLACE_POLICY_VIOLATION = -3
 } GumReplaceReturn;
 
+/* Times are in nanoseconds, measured with a monotonic clock. */
+struct _GumHookStats
+{
+  guint64 hits;
+  guint64 listener_time;
+  guint64 replacement_time;
+};
+
+struct _GumCallRecord
+{
+  gpointer return_address;
+  gpointer args[GUM_CALL_RECORD_MAX_ARGS];
+};
+
+struct _GumCallRecorder
+{
+  volatile guint head;
+  guint mask;
+  guint n_args;
+  GumCallRecord * records;
+};
+
 GUM_API GumInterceptor * gum_interceptor_obtain (void);
 
 GUM_API GumAttachReturn gum_interceptor_attach (GumInterceptor * self,
     gpointer function_address, GumInvocationListener * listener,
     gpointer listener_function_data);
+GUM_API GumAttachReturn gum_interceptor_attach_lite (GumInterceptor * self,
+    gpointer function_address, GumInvocationListener * listener,
+    gpointer listener_function_data);
+GUM_API guint gum_interceptor_attach_many (GumInterceptor * self,
+    const gpointer * function_addresses, guint n_function_addresses,
+    GumInvocationListener * listener, gpointer listener_function_data,
+    GumAttachReturn * results);
 GUM_API void gum_interceptor_detach (GumInterceptor * self,
     GumInvocationListener * listener);
 
+GUM_API GumAttachReturn gum_interceptor_attach_call_counter (
+    GumInterceptor * self, gpointer function_address, volatile gint * counter);
+GUM_API GumAttachReturn gum_interceptor_attach_call_recorder (
+    GumInterceptor * self, gpointer function_address,
+    GumCallRecorder * recorder);
+GUM_API void gum_interceptor_detach_probes (GumInterceptor * self,
+    gpointer function_address);
+
 GUM_API GumReplaceReturn gum_interceptor_replace (GumInterceptor * self,
     gpointer function_address, gpointer replacement_function,
     gpointer replacement_data);
+GUM_API GumReplaceReturn gum_interceptor_replace_fast (GumInterceptor * self,
+    gpointer function_address, gpointer replacement_function,
+    gpointer * original_function);
 GUM_API void gum_interceptor_revert (GumInterceptor * self,
     gpointer function_address);
 
@@ -55,18 +106,32 @@ GUM_API void gum_interceptor_begin_transaction (GumInterceptor * self);
 GUM_API void gum_interceptor_end_transaction (GumInterceptor * self);
 GUM_API gboolean gum_interceptor_flush (GumInterceptor * self);
 
+GUM_API void gum_interceptor_set_stats_enabled (GumInterceptor * self,
+    gboolean enabled);
+GUM_API gboolean gum_interceptor_query_stats (GumInterceptor * self,
+    gpointer function_address, GumHookStats * stats);
+
 GUM_API GumInvocationContext * gum_interceptor_get_current_invocation (void);
 GUM_API GumInvocationStack * gum_interceptor_get_current_stack (void);
 
 GUM_API void gum_interceptor_ignore_current_thread (GumInterceptor * self);
 GUM_API void gum_interceptor_unignore_current_thread (GumInterceptor * self);
 
+GUM_API void gum_interceptor_set_thread_filter (GumInterceptor * self,
+    GumInvocationListener * listener, const GumThreadId * thread_ids,
+    guint n_thread_ids);
+
 GUM_API void gum_interceptor_ignore_other_threads (GumInterceptor * self);
 GUM_API void gum_interceptor_unignore_other_threads (GumInterceptor * self);
 
+GUM_API guint gum_invocation_stack_get_depth (GumInvocationStack * self);
 GUM_API gpointer gum_invocation_stack_translate (GumInvocationStack * self,
     gpointer return_address);
 
+GUM_API GumCallRecorder * gum_call_recorder_new (guint capacity,
+    guint n_args);
+GUM_API void gum_call_recorder_free (GumCallRecorder * recorder);
+
 GUM_API void gum_interceptor_save (GumInvocationState * state);
 GUM_API void gum_interceptor_restore (GumInvocationState * state);
 
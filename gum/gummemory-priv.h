@@ -40,6 +40,10 @@ G_GNUC_INTERNAL void _gum_memory_backend_deinit (void);
 G_GNUC_INTERNAL guint _gum_memory_backend_query_page_size (void);
 G_GNUC_INTERNAL gint _gum_page_protection_to_posix (
     GumPageProtection page_prot);
+G_GNUC_INTERNAL void _gum_memory_override_rwx_support (gint support);
+G_GNUC_INTERNAL gboolean _gum_memory_try_read_batch_self (
+    const GumMemoryRange * ranges, guint n_ranges, guint8 * buffer,
+    gsize * n_bytes_read);
 
 G_GNUC_INTERNAL gpointer gum_internal_malloc (size_t size);
 G_GNUC_INTERNAL gpointer gum_internal_calloc (size_t count, size_t size);
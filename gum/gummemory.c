@@ -8,14 +8,35 @@
 
 #include "gumcloak-priv.h"
 #include "gumcodesegment.h"
+#include "gumexceptor.h"
 #include "gumlibc.h"
 #include "gummemory-priv.h"
 
 #ifdef HAVE_PTRAUTH
 # include <ptrauth.h>
 #endif
+#include <gio/gio.h>
 #include <string.h>
 
+#if defined (HAVE_I386) && (defined (__SSE2__) || defined (_M_X64) || \
+    (defined (_M_IX86_FP) && _M_IX86_FP >= 2))
+# define GUM_HAVE_SSE2_SCAN 1
+# include <emmintrin.h>
+# if defined (__GNUC__) || defined (__clang__)
+#  define GUM_HAVE_AVX2_SCAN 1
+#  include <immintrin.h>
+#  define GUM_AVX2_FUNC __attribute__ ((target ("avx2")))
+# elif defined (_MSC_VER)
+/*
+ * MSVC accepts AVX2 intrinsics in any function and always emits them as
+ * VEX-encoded instructions, whatever /arch is, so no annotation is needed.
+ */
+#  define GUM_HAVE_AVX2_SCAN 1
+#  include <immintrin.h>
+#  define GUM_AVX2_FUNC
+# endif
+#endif
+
 #if defined (HAVE_IOS) && !defined (HAVE_I386)
 # include "backend-darwin/gumdarwin.h"
 # include <mach/mach.h>
@@ -48,6 +69,125 @@
 # pragma warning (pop)
 #endif
 
+#define GUM_SCAN_CHUNK_SIZE (4 * 1024 * 1024)
+#define GUM_MULTI_SCAN_MAX_KEY_LENGTH 8
+#define GUM_MULTI_SCAN_NONE G_MAXUINT32
+
+typedef struct _GumScanNeedle GumScanNeedle;
+typedef struct _GumScanRangesContext GumScanRangesContext;
+typedef struct _GumScanChunk GumScanChunk;
+typedef struct _GumMultiScanner GumMultiScanner;
+typedef struct _GumMultiScanNode GumMultiScanNode;
+typedef struct _GumMultiScanOutput GumMultiScanOutput;
+typedef struct _GumMultiScanFallback GumMultiScanFallback;
+typedef struct _GumMultiScanMatch GumMultiScanMatch;
+typedef guint8 * (* GumScanFindFunc) (const GumScanNeedle * needle,
+    guint8 * cur, guint8 * end);
+
+struct _GumScanNeedle
+{
+  const guint8 * data;
+  const guint8 * mask;
+  guint len;
+};
+
+struct _GumScanRangesContext
+{
+  const GumMatchPattern * pattern;
+  GumExceptor * exceptor;
+  volatile gint cancelled;
+
+  GMutex mutex;
+  GCond cond;
+};
+
+struct _GumScanChunk
+{
+  guint range_index;
+  GumAddress start;
+  GumAddress end;
+  GumAddress scan_end;
+
+  GArray * matches;
+  gchar * error_message;
+  gboolean done;
+};
+
+struct _GumMultiScanner
+{
+  const GumMatchPattern * const * patterns;
+  guint n_patterns;
+
+  GArray * nodes;
+  GArray * outputs;
+  GArray * fallbacks;
+  guint max_lead;
+
+  GumAddress * next_start;
+  GArray * pending;
+};
+
+struct _GumMultiScanNode
+{
+  guint32 next[256];
+  guint32 fail;
+  guint32 dict;
+  guint32 output;
+};
+
+struct _GumMultiScanOutput
+{
+  guint pattern_index;
+  guint lead;
+  guint32 next;
+};
+
+struct _GumMultiScanFallback
+{
+  guint pattern_index;
+  guint offset;
+  GumScanNeedle needle;
+};
+
+struct _GumMultiScanMatch
+{
+  GumAddress start;
+  guint pattern_index;
+};
+
+static void gum_multi_scanner_init (GumMultiScanner * self,
+    const GumMatchPattern * const * patterns, guint n_patterns);
+static void gum_multi_scanner_finalize (GumMultiScanner * self);
+static guint32 gum_multi_scanner_add_node (GumMultiScanner * self);
+static void gum_multi_scanner_add_key (GumMultiScanner * self,
+    guint pattern_index, const guint8 * key, guint key_len, guint lead);
+static void gum_multi_scanner_link (GumMultiScanner * self);
+static void gum_multi_scanner_consider (GumMultiScanner * self,
+    guint pattern_index, guint8 * start, const GumMemoryRange * range);
+static gboolean gum_multi_scanner_flush (GumMultiScanner * self,
+    GumAddress limit, GumMemoryScanMultiMatchFunc func, gpointer user_data);
+
+static void gum_scan_chunk_process (GumScanChunk * chunk,
+    GumScanRangesContext * ctx);
+static void gum_scan_chunk_scan (GumScanChunk * chunk, GumAddress from,
+    GumScanRangesContext * ctx);
+static gboolean gum_scan_chunk_collect_match (GumAddress address, gsize size,
+    GArray * matches);
+
+static GumScanFindFunc gum_scan_get_find_func (void);
+static guint8 * gum_scan_find_scalar (const GumScanNeedle * needle,
+    guint8 * cur, guint8 * end);
+#ifdef GUM_HAVE_SSE2_SCAN
+static guint8 * gum_scan_find_sse2 (const GumScanNeedle * needle,
+    guint8 * cur, guint8 * end);
+#endif
+#ifdef GUM_HAVE_AVX2_SCAN
+GUM_AVX2_FUNC static guint8 * gum_scan_find_avx2 (const GumScanNeedle * needle,
+    guint8 * cur, guint8 * end);
+#endif
+static gboolean gum_scan_needle_matches_at (const GumScanNeedle * needle,
+    const guint8 * p);
+
 static GumMatchPattern * gum_match_pattern_new (void);
 static void gum_match_pattern_update_computed_size (GumMatchPattern * self);
 static GumMatchToken * gum_match_pattern_get_longest_token (
@@ -70,6 +210,7 @@ static guint gum_heap_ref_count = 0;
 static mspace gum_mspace_main = NULL;
 static mspace gum_mspace_internal = NULL;
 static guint gum_cached_page_size;
+static gint gum_rwx_support_override = -1;
 
 #ifdef HAVE_ANDROID
 G_LOCK_DEFINE_STATIC (gum_softened_code_pages);
@@ -173,6 +314,16 @@ gum_query_page_size (void)
   return gum_cached_page_size;
 }
 
+/*
+ * Lets tests exercise the paths taken on systems that refuse RWX mappings.
+ * Pass -1 to go back to querying the system.
+ */
+void
+_gum_memory_override_rwx_support (gint support)
+{
+  gum_rwx_support_override = support;
+}
+
 gboolean
 gum_query_is_rwx_supported (void)
 {
@@ -182,6 +333,9 @@ gum_query_is_rwx_supported (void)
 GumRwxSupport
 gum_query_rwx_support (void)
 {
+  if (gum_rwx_support_override != -1)
+    return gum_rwx_support_override;
+
 #if defined (HAVE_IOS) && !defined (HAVE_I386)
   static gsize cached_result = 0;
 
@@ -245,6 +399,26 @@ gum_query_rwx_support (void)
   return cached_result - 1;
 #elif defined (HAVE_DARWIN) && !defined (HAVE_I386)
   return GUM_RWX_NONE;
+#elif defined (HAVE_LINUX)
+  static gsize cached_result = 0;
+
+  if (g_once_init_enter (&cached_result))
+  {
+    GumRwxSupport rwx_support = GUM_RWX_NONE;
+    gpointer page;
+
+    /* Hardened kernels (SELinux execmem, PaX MPROTECT) refuse RWX mappings. */
+    page = gum_try_alloc_n_pages (1, GUM_PAGE_RWX);
+    if (page != NULL)
+    {
+      rwx_support = GUM_RWX_FULL;
+      gum_free_pages (page);
+    }
+
+    g_once_init_leave (&cached_result, rwx_support + 1);
+  }
+
+  return cached_result - 1;
 #else
   return GUM_RWX_FULL;
 #endif
@@ -294,6 +468,8 @@ gum_memory_patch_code (gpointer address,
     guint8 * scratch_page;
 
     segment = gum_code_segment_new (range_size, NULL);
+    if (segment == NULL)
+      return FALSE;
     scratch_page = gum_code_segment_get_address (segment);
     memcpy (scratch_page, start_page, range_size);
 
@@ -310,6 +486,58 @@ gum_memory_patch_code (gpointer address,
   return TRUE;
 }
 
+/*
+ * Reads each range into buffer, back to back, so buffer must be large enough
+ * to hold the sum of their sizes. The number of bytes read from each range is
+ * stored in n_bytes_read, and whatever could not be read is zero-filled.
+ * Returns TRUE if every range was read in full.
+ */
+gboolean
+gum_memory_read_batch (const GumMemoryRange * ranges,
+                       guint n_ranges,
+                       guint8 * buffer,
+                       gsize * n_bytes_read)
+{
+  guint i;
+
+#ifdef HAVE_LINUX
+  if (!_gum_memory_try_read_batch_self (ranges, n_ranges, buffer,
+      n_bytes_read))
+#endif
+  {
+    guint8 * cur = buffer;
+
+    for (i = 0; i != n_ranges; i++)
+    {
+      const GumMemoryRange * r = &ranges[i];
+      guint8 * data = NULL;
+      gsize n = 0;
+
+      if (r->size != 0)
+      {
+        data = gum_memory_read (GSIZE_TO_POINTER (r->base_address), r->size,
+            &n);
+      }
+      if (data != NULL)
+        memcpy (cur, data, n);
+      g_free (data);
+
+      memset (cur + n, 0, r->size - n);
+      n_bytes_read[i] = n;
+
+      cur += r->size;
+    }
+  }
+
+  for (i = 0; i != n_ranges; i++)
+  {
+    if (n_bytes_read[i] != ranges[i].size)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
 gboolean
 gum_memory_mark_code (gpointer address,
                       gsize size)
@@ -346,56 +574,713 @@ gum_memory_scan (const GumMemoryRange * range,
                  GumMemoryScanMatchFunc func,
                  gpointer user_data)
 {
-  GumMatchToken * needle;
-  guint8 * needle_data, * mask_data = NULL;
-  guint needle_len;
+  GumMatchToken * token;
+  GumScanNeedle needle;
+  GumScanFindFunc find;
   guint8 * cur, * end_address;
 
-  needle = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_EXACT);
-  if (needle == NULL)
+  if (range->size < pattern->size)
+    return;
+
+  token = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_EXACT);
+  if (token != NULL)
   {
-    needle = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_MASK);
-    mask_data = (guint8 *) needle->masks->data;
+    needle.mask = NULL;
   }
+  else
+  {
+    token = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_MASK);
+    needle.mask = (const guint8 *) token->masks->data;
+  }
+  needle.data = (const guint8 *) token->bytes->data;
+  needle.len = token->bytes->len;
 
-  needle_data = (guint8 *) needle->bytes->data;
-  needle_len = needle->bytes->len;
+  find = gum_scan_get_find_func ();
 
   cur = GSIZE_TO_POINTER (range->base_address);
-  end_address = cur + range->size - (pattern->size - needle->offset) + 1;
+  end_address = cur + range->size - (pattern->size - token->offset) + 1;
+  cur += token->offset;
+
+  while ((cur = find (&needle, cur, end_address)) != NULL)
+  {
+    guint8 * start = cur - token->offset;
+
+    if (gum_match_pattern_try_match_on (pattern, start))
+    {
+      if (!func (GUM_ADDRESS (start), pattern->size, user_data))
+        return;
+
+      cur = start + pattern->size + token->offset;
+    }
+    else
+    {
+      cur++;
+    }
+  }
+}
+
+/*
+ * Splits the ranges into chunks that are scanned in parallel, and reports the
+ * matches on the calling thread in address order. Each chunk also scans
+ * pattern size - 1 bytes into the next one, so it finds all matches that
+ * start inside it. Matches never overlap, just like with gum_memory_scan().
+ * If a chunk's first match overlaps the last match reported before it, the
+ * chunk is rescanned from the end of that match.
+ *
+ * Faults are caught per chunk. When one happens, the matches found before it
+ * are still reported, and then the scan fails with the exception's details.
+ */
+gboolean
+gum_memory_scan_ranges (const GumMemoryRange * ranges,
+                        guint n_ranges,
+                        const GumMatchPattern * pattern,
+                        GumMemoryScanMatchFunc func,
+                        gpointer user_data,
+                        GError ** error)
+{
+  gboolean success = TRUE;
+  GumScanRangesContext ctx;
+  GArray * chunks;
+  GThreadPool * pool;
+  GumAddress resume_address;
+  guint i, j, current_range_index;
+
+  chunks = g_array_new (FALSE, FALSE, sizeof (GumScanChunk));
+
+  for (i = 0; i != n_ranges; i++)
+  {
+    const GumMemoryRange * r = &ranges[i];
+    GumAddress range_end = r->base_address + r->size;
+    gsize offset;
+
+    if (r->size < pattern->size)
+      continue;
+
+    for (offset = 0; offset < r->size; offset += GUM_SCAN_CHUNK_SIZE)
+    {
+      GumScanChunk chunk;
+
+      chunk.range_index = i;
+      chunk.start = r->base_address + offset;
+      chunk.end = chunk.start + MIN (GUM_SCAN_CHUNK_SIZE, r->size - offset);
+      chunk.scan_end = MIN (chunk.end + pattern->size - 1, range_end);
+      chunk.matches = g_array_new (FALSE, FALSE, sizeof (GumAddress));
+      chunk.error_message = NULL;
+      chunk.done = FALSE;
+
+      g_array_append_val (chunks, chunk);
+    }
+  }
+
+  if (chunks->len == 0)
+  {
+    g_array_free (chunks, TRUE);
+    return TRUE;
+  }
+
+  ctx.pattern = pattern;
+  ctx.exceptor = gum_exceptor_obtain ();
+  ctx.cancelled = FALSE;
+  g_mutex_init (&ctx.mutex);
+  g_cond_init (&ctx.cond);
 
-  for (; cur < end_address; cur++)
+  pool = g_thread_pool_new ((GFunc) gum_scan_chunk_process, &ctx,
+      MIN (g_get_num_processors (), chunks->len), FALSE, NULL);
+  for (i = 0; i != chunks->len; i++)
+    g_thread_pool_push (pool, &g_array_index (chunks, GumScanChunk, i), NULL);
+
+  resume_address = 0;
+  current_range_index = G_MAXUINT;
+
+  for (i = 0; i != chunks->len && success; i++)
   {
-    guint8 * start;
+    GumScanChunk * chunk = &g_array_index (chunks, GumScanChunk, i);
+
+    g_mutex_lock (&ctx.mutex);
+    while (!chunk->done)
+      g_cond_wait (&ctx.cond, &ctx.mutex);
+    g_mutex_unlock (&ctx.mutex);
+
+    if (chunk->range_index != current_range_index)
+    {
+      current_range_index = chunk->range_index;
+      resume_address = 0;
+    }
 
-    if (mask_data == NULL)
+    if (chunk->matches->len != 0 &&
+        g_array_index (chunk->matches, GumAddress, 0) < resume_address)
     {
-      if (cur[0] != needle_data[0] ||
-          memcmp (cur, needle_data, needle_len) != 0)
+      g_array_set_size (chunk->matches, 0);
+      g_clear_pointer (&chunk->error_message, g_free);
+
+      if (resume_address < chunk->scan_end)
+        gum_scan_chunk_scan (chunk, resume_address, &ctx);
+    }
+
+    for (j = 0; j != chunk->matches->len; j++)
+    {
+      GumAddress address = g_array_index (chunk->matches, GumAddress, j);
+
+      if (!func (address, pattern->size, user_data))
+        goto beach;
+
+      resume_address = address + pattern->size;
+    }
+
+    if (chunk->error_message != NULL)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+          chunk->error_message);
+      success = FALSE;
+    }
+  }
+
+beach:
+  g_atomic_int_set (&ctx.cancelled, TRUE);
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  for (i = 0; i != chunks->len; i++)
+  {
+    GumScanChunk * chunk = &g_array_index (chunks, GumScanChunk, i);
+
+    g_array_free (chunk->matches, TRUE);
+    g_free (chunk->error_message);
+  }
+  g_array_free (chunks, TRUE);
+
+  g_cond_clear (&ctx.cond);
+  g_mutex_clear (&ctx.mutex);
+  g_object_unref (ctx.exceptor);
+
+  return success;
+}
+
+static void
+gum_scan_chunk_process (GumScanChunk * chunk,
+                        GumScanRangesContext * ctx)
+{
+  if (!g_atomic_int_get (&ctx->cancelled))
+    gum_scan_chunk_scan (chunk, chunk->start, ctx);
+
+  g_mutex_lock (&ctx->mutex);
+  chunk->done = TRUE;
+  g_cond_broadcast (&ctx->cond);
+  g_mutex_unlock (&ctx->mutex);
+}
+
+static void
+gum_scan_chunk_scan (GumScanChunk * chunk,
+                     GumAddress from,
+                     GumScanRangesContext * ctx)
+{
+  GumMemoryRange range;
+  GumExceptorScope scope;
+
+  range.base_address = from;
+  range.size = chunk->scan_end - from;
+
+  if (gum_exceptor_try (ctx->exceptor, &scope))
+  {
+    gum_memory_scan (&range, ctx->pattern,
+        (GumMemoryScanMatchFunc) gum_scan_chunk_collect_match,
+        chunk->matches);
+  }
+
+  if (gum_exceptor_catch (ctx->exceptor, &scope))
+  {
+    chunk->error_message =
+        gum_exception_details_to_string (&scope.exception);
+  }
+}
+
+static gboolean
+gum_scan_chunk_collect_match (GumAddress address,
+                              gsize size,
+                              GArray * matches)
+{
+  g_array_append_val (matches, address);
+
+  return TRUE;
+}
+
+/*
+ * Scans for several patterns in a single pass. The longest exact token of
+ * each pattern, capped to a few bytes, is fed to an Aho-Corasick automaton,
+ * and every hit is confirmed with the full pattern. Patterns without exact
+ * tokens are checked at each position using their longest masked token.
+ *
+ * Each pattern behaves as if it was scanned on its own with
+ * gum_memory_scan(), i.e. its matches never overlap each other. Matches of
+ * different patterns are reported in address order, and those at the same
+ * address in pattern order.
+ */
+void
+gum_memory_scan_multi (const GumMemoryRange * range,
+                       const GumMatchPattern * const * patterns,
+                       guint n_patterns,
+                       GumMemoryScanMultiMatchFunc func,
+                       gpointer user_data)
+{
+  GumMultiScanner scanner;
+  GumMultiScanNode * nodes;
+  guint8 * base, * cur, * end;
+  guint32 state;
+
+  if (n_patterns == 0)
+    return;
+
+  gum_multi_scanner_init (&scanner, patterns, n_patterns);
+  nodes = (GumMultiScanNode *) scanner.nodes->data;
+
+  base = GSIZE_TO_POINTER (range->base_address);
+  end = base + range->size;
+  state = 0;
+
+  for (cur = base; cur != end; cur++)
+  {
+    guint32 node;
+    guint i;
+
+    state = nodes[state].next[*cur];
+
+    for (node = (nodes[state].output != GUM_MULTI_SCAN_NONE)
+            ? state
+            : nodes[state].dict;
+        node != GUM_MULTI_SCAN_NONE;
+        node = nodes[node].dict)
+    {
+      guint32 o;
+
+      for (o = nodes[node].output; o != GUM_MULTI_SCAN_NONE; )
       {
-        continue;
+        GumMultiScanOutput * output =
+            &g_array_index (scanner.outputs, GumMultiScanOutput, o);
+
+        gum_multi_scanner_consider (&scanner, output->pattern_index,
+            cur - output->lead, range);
+
+        o = output->next;
       }
     }
+
+    for (i = 0; i != scanner.fallbacks->len; i++)
+    {
+      GumMultiScanFallback * fallback =
+          &g_array_index (scanner.fallbacks, GumMultiScanFallback, i);
+
+      if ((gsize) (end - cur) >= fallback->needle.len &&
+          gum_scan_needle_matches_at (&fallback->needle, cur))
+      {
+        gum_multi_scanner_consider (&scanner, fallback->pattern_index,
+            cur - fallback->offset, range);
+      }
+    }
+
+    if (scanner.pending->len != 0 &&
+        !gum_multi_scanner_flush (&scanner,
+            GUM_ADDRESS (cur) + 1 - scanner.max_lead, func, user_data))
+    {
+      goto beach;
+    }
+  }
+
+  gum_multi_scanner_flush (&scanner, G_MAXUINT64, func, user_data);
+
+beach:
+  gum_multi_scanner_finalize (&scanner);
+}
+
+static void
+gum_multi_scanner_init (GumMultiScanner * self,
+                        const GumMatchPattern * const * patterns,
+                        guint n_patterns)
+{
+  guint i;
+
+  self->patterns = patterns;
+  self->n_patterns = n_patterns;
+
+  self->nodes = g_array_new (FALSE, FALSE, sizeof (GumMultiScanNode));
+  self->outputs = g_array_new (FALSE, FALSE, sizeof (GumMultiScanOutput));
+  self->fallbacks = g_array_new (FALSE, FALSE, sizeof (GumMultiScanFallback));
+  self->max_lead = 0;
+
+  self->next_start = g_new0 (GumAddress, n_patterns);
+  self->pending = g_array_new (FALSE, FALSE, sizeof (GumMultiScanMatch));
+
+  gum_multi_scanner_add_node (self);
+
+  for (i = 0; i != n_patterns; i++)
+  {
+    const GumMatchPattern * pattern = patterns[i];
+    GumMatchToken * token;
+
+    token = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_EXACT);
+    if (token != NULL)
+    {
+      guint key_len = MIN (token->bytes->len, GUM_MULTI_SCAN_MAX_KEY_LENGTH);
+
+      gum_multi_scanner_add_key (self, i, (const guint8 *) token->bytes->data,
+          key_len, token->offset + key_len - 1);
+    }
     else
     {
-      if ((cur[0] & mask_data[0]) != (needle_data[0] & mask_data[0]) ||
-          gum_memcmp_mask ((guint8 *) cur, (guint8 *) needle_data,
-              (guint8 *) mask_data, needle_len) != 0)
+      GumMultiScanFallback fallback;
+
+      token = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_MASK);
+
+      fallback.pattern_index = i;
+      fallback.offset = token->offset;
+      fallback.needle.data = (const guint8 *) token->bytes->data;
+      fallback.needle.mask = (const guint8 *) token->masks->data;
+      fallback.needle.len = token->bytes->len;
+      g_array_append_val (self->fallbacks, fallback);
+
+      self->max_lead = MAX (self->max_lead, token->offset);
+    }
+  }
+
+  gum_multi_scanner_link (self);
+}
+
+static void
+gum_multi_scanner_finalize (GumMultiScanner * self)
+{
+  g_array_free (self->pending, TRUE);
+  g_free (self->next_start);
+
+  g_array_free (self->fallbacks, TRUE);
+  g_array_free (self->outputs, TRUE);
+  g_array_free (self->nodes, TRUE);
+}
+
+static guint32
+gum_multi_scanner_add_node (GumMultiScanner * self)
+{
+  GumMultiScanNode node;
+
+  memset (node.next, 0, sizeof (node.next));
+  node.fail = 0;
+  node.dict = GUM_MULTI_SCAN_NONE;
+  node.output = GUM_MULTI_SCAN_NONE;
+  g_array_append_val (self->nodes, node);
+
+  return self->nodes->len - 1;
+}
+
+static void
+gum_multi_scanner_add_key (GumMultiScanner * self,
+                           guint pattern_index,
+                           const guint8 * key,
+                           guint key_len,
+                           guint lead)
+{
+  guint32 state = 0;
+  guint i;
+  GumMultiScanNode * node;
+  GumMultiScanOutput output;
+
+  for (i = 0; i != key_len; i++)
+  {
+    guint32 next;
+
+    next = g_array_index (self->nodes, GumMultiScanNode, state).next[key[i]];
+    if (next == 0)
+    {
+      next = gum_multi_scanner_add_node (self);
+      g_array_index (self->nodes, GumMultiScanNode, state).next[key[i]] = next;
+    }
+
+    state = next;
+  }
+
+  node = &g_array_index (self->nodes, GumMultiScanNode, state);
+
+  output.pattern_index = pattern_index;
+  output.lead = lead;
+  output.next = node->output;
+  g_array_append_val (self->outputs, output);
+  node->output = self->outputs->len - 1;
+
+  self->max_lead = MAX (self->max_lead, lead);
+}
+
+static void
+gum_multi_scanner_link (GumMultiScanner * self)
+{
+  GumMultiScanNode * nodes = (GumMultiScanNode *) self->nodes->data;
+  guint32 * queue;
+  guint head, tail, b;
+
+  queue = g_new (guint32, self->nodes->len);
+  head = 0;
+  tail = 0;
+
+  for (b = 0; b != 256; b++)
+  {
+    guint32 child = nodes[0].next[b];
+
+    if (child != 0)
+      queue[tail++] = child;
+  }
+
+  while (head != tail)
+  {
+    guint32 u = queue[head++];
+    GumMultiScanNode * node = &nodes[u];
+
+    for (b = 0; b != 256; b++)
+    {
+      guint32 v = node->next[b];
+
+      if (v != 0)
+      {
+        guint32 fail = nodes[node->fail].next[b];
+
+        nodes[v].fail = fail;
+        nodes[v].dict = (nodes[fail].output != GUM_MULTI_SCAN_NONE)
+            ? fail
+            : nodes[fail].dict;
+
+        queue[tail++] = v;
+      }
+      else
       {
-        continue;
+        node->next[b] = nodes[node->fail].next[b];
       }
     }
+  }
 
-    start = cur - needle->offset;
+  g_free (queue);
+}
 
-    if (gum_match_pattern_try_match_on (pattern, start))
+static void
+gum_multi_scanner_consider (GumMultiScanner * self,
+                            guint pattern_index,
+                            guint8 * start,
+                            const GumMemoryRange * range)
+{
+  const GumMatchPattern * pattern = self->patterns[pattern_index];
+  GumAddress address = GUM_ADDRESS (start);
+  GumMultiScanMatch match;
+  guint i;
+
+  if (address < range->base_address ||
+      address + pattern->size > range->base_address + range->size)
+    return;
+
+  if (address < self->next_start[pattern_index])
+    return;
+
+  if (!gum_match_pattern_try_match_on (pattern, start))
+    return;
+
+  self->next_start[pattern_index] = address + pattern->size;
+
+  match.start = address;
+  match.pattern_index = pattern_index;
+
+  for (i = self->pending->len; i != 0; i--)
+  {
+    GumMultiScanMatch * other =
+        &g_array_index (self->pending, GumMultiScanMatch, i - 1);
+
+    if (other->start < match.start ||
+        (other->start == match.start &&
+         other->pattern_index < match.pattern_index))
+      break;
+  }
+  g_array_insert_val (self->pending, i, match);
+}
+
+static gboolean
+gum_multi_scanner_flush (GumMultiScanner * self,
+                         GumAddress limit,
+                         GumMemoryScanMultiMatchFunc func,
+                         gpointer user_data)
+{
+  guint n, i;
+
+  for (n = 0; n != self->pending->len; n++)
+  {
+    if (g_array_index (self->pending, GumMultiScanMatch, n).start >= limit)
+      break;
+  }
+
+  for (i = 0; i != n; i++)
+  {
+    GumMultiScanMatch * match =
+        &g_array_index (self->pending, GumMultiScanMatch, i);
+
+    if (!func (match->start, self->patterns[match->pattern_index]->size,
+        match->pattern_index, user_data))
     {
-      if (!func (GUM_ADDRESS (start), pattern->size, user_data))
-        return;
+      return FALSE;
+    }
+  }
+
+  g_array_remove_range (self->pending, 0, n);
+
+  return TRUE;
+}
+
+/*
+ * The wide kernels only use the first and last needle bytes to find
+ * candidates, and leave the full comparison to gum_scan_needle_matches_at().
+ * Every candidate they report is therefore one the scalar loop would also
+ * have stopped at, so all of them find the exact same matches.
+ */
+static GumScanFindFunc
+gum_scan_get_find_func (void)
+{
+  static gsize cached_impl = 0;
+
+  if (g_once_init_enter (&cached_impl))
+  {
+    GumScanFindFunc impl = gum_scan_find_scalar;
+
+#ifdef GUM_HAVE_SSE2_SCAN
+    impl = gum_scan_find_sse2;
+#endif
+#ifdef GUM_HAVE_AVX2_SCAN
+    if ((gum_query_cpu_features () & GUM_CPU_AVX2) != 0)
+      impl = gum_scan_find_avx2;
+#endif
+
+    g_once_init_leave (&cached_impl, GPOINTER_TO_SIZE (impl));
+  }
+
+  return GSIZE_TO_POINTER (cached_impl);
+}
+
+static guint8 *
+gum_scan_find_scalar (const GumScanNeedle * needle,
+                      guint8 * cur,
+                      guint8 * end)
+{
+  for (; cur < end; cur++)
+  {
+    if (gum_scan_needle_matches_at (needle, cur))
+      return cur;
+  }
+
+  return NULL;
+}
+
+#ifdef GUM_HAVE_SSE2_SCAN
+
+static guint8 *
+gum_scan_find_sse2 (const GumScanNeedle * needle,
+                    guint8 * cur,
+                    guint8 * end)
+{
+  const guint last = needle->len - 1;
+  guint8 first_mask, last_mask;
+  __m128i first_mask_vec, first_value_vec, last_mask_vec, last_value_vec;
+
+  first_mask = (needle->mask != NULL) ? needle->mask[0] : 0xff;
+  last_mask = (needle->mask != NULL) ? needle->mask[last] : 0xff;
+
+  first_mask_vec = _mm_set1_epi8 ((char) first_mask);
+  first_value_vec = _mm_set1_epi8 ((char) (needle->data[0] & first_mask));
+  last_mask_vec = _mm_set1_epi8 ((char) last_mask);
+  last_value_vec = _mm_set1_epi8 ((char) (needle->data[last] & last_mask));
 
-      cur = start + pattern->size - 1;
+  while (end - cur >= 16)
+  {
+    __m128i first_block, last_block;
+    guint bits;
+
+    first_block = _mm_and_si128 (
+        _mm_loadu_si128 ((const __m128i *) cur), first_mask_vec);
+    last_block = _mm_and_si128 (
+        _mm_loadu_si128 ((const __m128i *) (cur + last)), last_mask_vec);
+
+    bits = _mm_movemask_epi8 (_mm_and_si128 (
+        _mm_cmpeq_epi8 (first_block, first_value_vec),
+        _mm_cmpeq_epi8 (last_block, last_value_vec)));
+
+    while (bits != 0)
+    {
+      guint8 * candidate = cur + g_bit_nth_lsf (bits, -1);
+
+      if (gum_scan_needle_matches_at (needle, candidate))
+        return candidate;
+
+      bits &= bits - 1;
     }
+
+    cur += 16;
   }
+
+  return gum_scan_find_scalar (needle, cur, end);
+}
+
+#endif
+
+#ifdef GUM_HAVE_AVX2_SCAN
+
+GUM_AVX2_FUNC static guint8 *
+gum_scan_find_avx2 (const GumScanNeedle * needle,
+                    guint8 * cur,
+                    guint8 * end)
+{
+  const guint last = needle->len - 1;
+  guint8 first_mask, last_mask;
+  __m256i first_mask_vec, first_value_vec, last_mask_vec, last_value_vec;
+
+  first_mask = (needle->mask != NULL) ? needle->mask[0] : 0xff;
+  last_mask = (needle->mask != NULL) ? needle->mask[last] : 0xff;
+
+  first_mask_vec = _mm256_set1_epi8 ((char) first_mask);
+  first_value_vec = _mm256_set1_epi8 ((char) (needle->data[0] & first_mask));
+  last_mask_vec = _mm256_set1_epi8 ((char) last_mask);
+  last_value_vec = _mm256_set1_epi8 ((char) (needle->data[last] & last_mask));
+
+  while (end - cur >= 32)
+  {
+    __m256i first_block, last_block;
+    guint32 bits;
+
+    first_block = _mm256_and_si256 (
+        _mm256_loadu_si256 ((const __m256i *) cur), first_mask_vec);
+    last_block = _mm256_and_si256 (
+        _mm256_loadu_si256 ((const __m256i *) (cur + last)), last_mask_vec);
+
+    bits = (guint32) _mm256_movemask_epi8 (_mm256_and_si256 (
+        _mm256_cmpeq_epi8 (first_block, first_value_vec),
+        _mm256_cmpeq_epi8 (last_block, last_value_vec)));
+
+    while (bits != 0)
+    {
+      guint8 * candidate = cur + g_bit_nth_lsf (bits, -1);
+
+      if (gum_scan_needle_matches_at (needle, candidate))
+        return candidate;
+
+      bits &= bits - 1;
+    }
+
+    cur += 32;
+  }
+
+  return gum_scan_find_scalar (needle, cur, end);
+}
+
+#endif
+
+static gboolean
+gum_scan_needle_matches_at (const GumScanNeedle * needle,
+                            const guint8 * p)
+{
+  if (needle->mask == NULL)
+  {
+    return p[0] == needle->data[0] &&
+        memcmp (p, needle->data, needle->len) == 0;
+  }
+
+  return (p[0] & needle->mask[0]) == (needle->data[0] & needle->mask[0]) &&
+      gum_memcmp_mask (p, needle->data, needle->mask, needle->len) == 0;
 }
 
 GumMatchPattern *
@@ -623,9 +1508,24 @@ gum_memcmp_mask (const guint8 * haystack,
                  const guint8 * mask,
                  guint len)
 {
-  guint i;
+  guint i = 0;
+
+#ifdef GUM_HAVE_SSE2_SCAN
+  for (; len - i >= 16; i += 16)
+  {
+    __m128i m, h, n;
+
+    m = _mm_loadu_si128 ((const __m128i *) (mask + i));
+    h = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *) (haystack + i)), m);
+    n = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *) (needle + i)), m);
+
+    if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (h, n)) != 0xffff)
+      break;
+  }
+  haystack += i;
+#endif
 
-  for (i = 0; i != len; i++)
+  for (; i != len; i++)
   {
     guint8 value = *(haystack++) & mask[i];
     guint8 test_value = needle[i] & mask[i];
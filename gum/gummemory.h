@@ -77,6 +77,8 @@ struct _GumMemoryRange
 typedef void (* GumMemoryPatchApplyFunc) (gpointer mem, gpointer user_data);
 typedef gboolean (* GumMemoryScanMatchFunc) (GumAddress address, gsize size,
     gpointer user_data);
+typedef gboolean (* GumMemoryScanMultiMatchFunc) (GumAddress address,
+    gsize size, guint pattern_index, gpointer user_data);
 
 GUM_API void gum_internal_heap_ref (void);
 GUM_API void gum_internal_heap_unref (void);
@@ -92,6 +94,8 @@ GUM_API GumRwxSupport gum_query_rwx_support (void);
 GUM_API gboolean gum_memory_is_readable (gconstpointer address, gsize len);
 GUM_API guint8 * gum_memory_read (gconstpointer address, gsize len,
     gsize * n_bytes_read);
+GUM_API gboolean gum_memory_read_batch (const GumMemoryRange * ranges,
+    guint n_ranges, guint8 * buffer, gsize * n_bytes_read);
 GUM_API gboolean gum_memory_write (gpointer address, const guint8 * bytes,
     gsize len);
 GUM_API gboolean gum_memory_patch_code (gpointer address, gsize size,
@@ -101,6 +105,12 @@ GUM_API gboolean gum_memory_mark_code (gpointer address, gsize size);
 GUM_API void gum_memory_scan (const GumMemoryRange * range,
     const GumMatchPattern * pattern, GumMemoryScanMatchFunc func,
     gpointer user_data);
+GUM_API gboolean gum_memory_scan_ranges (const GumMemoryRange * ranges,
+    guint n_ranges, const GumMatchPattern * pattern,
+    GumMemoryScanMatchFunc func, gpointer user_data, GError ** error);
+GUM_API void gum_memory_scan_multi (const GumMemoryRange * range,
+    const GumMatchPattern * const * patterns, guint n_patterns,
+    GumMemoryScanMultiMatchFunc func, gpointer user_data);
 
 GUM_API GumMatchPattern * gum_match_pattern_new_from_string (
     const gchar * match_combined_str);
@@ -8,8 +8,6 @@
 
 #include "gumprocess-priv.h"
 
-typedef struct _GumUpdateMemoryRangesContext GumUpdateMemoryRangesContext;
-
 struct _GumMemoryMap
 {
   GObject parent;
@@ -18,18 +16,19 @@ struct _GumMemoryMap
   GArray * ranges;
   gsize ranges_min;
   gsize ranges_max;
-};
-
-struct _GumUpdateMemoryRangesContext
-{
-  GArray * ranges;
-  gint prev_range_index;
+  volatile gint last_hit;
 };
 
 static void gum_memory_map_finalize (GObject * object);
 
 static gboolean gum_memory_map_add_range (const GumRangeDetails * details,
     gpointer user_data);
+static void gum_memory_map_coalesce_ranges (GArray * ranges);
+
+static gint gum_memory_range_compare_base (const GumMemoryRange * lhs,
+    const GumMemoryRange * rhs);
+static gboolean gum_memory_range_contains (const GumMemoryRange * self,
+    GumAddress start, GumAddress end);
 
 G_DEFINE_TYPE (GumMemoryMap, gum_memory_map, G_TYPE_OBJECT)
 
@@ -76,35 +75,59 @@ gum_memory_map_contains (GumMemoryMap * self,
 {
   const GumAddress start = range->base_address;
   const GumAddress end = range->base_address + range->size;
-  guint i;
+  const GumMemoryRange * ranges;
+  guint last_hit, lo, hi;
 
   if (start < self->ranges_min)
     return FALSE;
   else if (end > self->ranges_max)
     return FALSE;
 
-  for (i = 0; i < self->ranges->len; i++)
+  ranges = (const GumMemoryRange *) self->ranges->data;
+
+  /*
+   * Callers such as the fuzzy backtracer tend to probe the same range many
+   * times in a row, so try the previous hit before searching.
+   */
+  last_hit = (guint) g_atomic_int_get (&self->last_hit);
+  if (last_hit < self->ranges->len &&
+      gum_memory_range_contains (&ranges[last_hit], start, end))
+    return TRUE;
+
+  /* Find the last range starting at or before start. */
+  lo = 0;
+  hi = self->ranges->len;
+  while (lo < hi)
   {
-    GumMemoryRange * r = &g_array_index (self->ranges, GumMemoryRange, i);
-    if (start >= r->base_address && end <= r->base_address + r->size)
-      return TRUE;
+    guint mid = lo + ((hi - lo) / 2);
+
+    if (ranges[mid].base_address <= start)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
+  if (lo == 0)
+    return FALSE;
+
+  if (!gum_memory_range_contains (&ranges[lo - 1], start, end))
+    return FALSE;
 
-  return FALSE;
+  g_atomic_int_set (&self->last_hit, lo - 1);
+
+  return TRUE;
 }
 
 void
 gum_memory_map_update (GumMemoryMap * self)
 {
-  GumUpdateMemoryRangesContext ctx;
-
-  ctx.ranges = self->ranges;
-  ctx.prev_range_index = -1;
-
   g_array_set_size (self->ranges, 0);
 
   _gum_process_enumerate_ranges (self->protection, gum_memory_map_add_range,
-      &ctx);
+      self->ranges);
+
+  gum_memory_map_coalesce_ranges (self->ranges);
+
+  g_atomic_int_set (&self->last_hit, 0);
 
   if (self->ranges->len > 0)
   {
@@ -128,24 +151,68 @@ static gboolean
 gum_memory_map_add_range (const GumRangeDetails * details,
                           gpointer user_data)
 {
-  GumUpdateMemoryRangesContext * ctx =
-      (GumUpdateMemoryRangesContext *) user_data;
-  GArray * ranges = ctx->ranges;
-  const GumMemoryRange * cur = details->range;
-  GumMemoryRange * prev;
-
-  if (ctx->prev_range_index >= 0)
-    prev = &g_array_index (ranges, GumMemoryRange, ctx->prev_range_index);
-  else
-    prev = NULL;
-
-  if (prev != NULL && cur->base_address == prev->base_address + prev->size)
-    prev->size += cur->size;
-  else
-    g_array_append_val (ranges, *cur);
+  GArray * ranges = user_data;
 
-  ctx->prev_range_index = ranges->len - 1;
+  g_array_append_val (ranges, *details->range);
 
   return TRUE;
 }
 
+static void
+gum_memory_map_coalesce_ranges (GArray * ranges)
+{
+  GumMemoryRange * elements;
+  guint i, n;
+
+  if (ranges->len == 0)
+    return;
+
+  g_array_sort (ranges, (GCompareFunc) gum_memory_range_compare_base);
+
+  elements = (GumMemoryRange *) ranges->data;
+
+  n = 1;
+  for (i = 1; i != ranges->len; i++)
+  {
+    GumMemoryRange * prev = &elements[n - 1];
+    const GumMemoryRange * cur = &elements[i];
+    GumAddress prev_end, cur_end;
+
+    prev_end = prev->base_address + prev->size;
+    cur_end = cur->base_address + cur->size;
+
+    if (cur->base_address <= prev_end)
+    {
+      if (cur_end > prev_end)
+        prev->size = cur_end - prev->base_address;
+    }
+    else
+    {
+      elements[n++] = *cur;
+    }
+  }
+
+  g_array_set_size (ranges, n);
+}
+
+static gint
+gum_memory_range_compare_base (const GumMemoryRange * lhs,
+                               const GumMemoryRange * rhs)
+{
+  if (lhs->base_address < rhs->base_address)
+    return -1;
+  else if (lhs->base_address > rhs->base_address)
+    return 1;
+  else
+    return 0;
+}
+
+static gboolean
+gum_memory_range_contains (const GumMemoryRange * self,
+                           GumAddress start,
+                           GumAddress end)
+{
+  return start >= self->base_address &&
+      end <= self->base_address + self->size;
+}
+
@@ -0,0 +1,21 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_STALKER_PRIV_H__
+#define __GUM_STALKER_PRIV_H__
+
+#include "gumstalker.h"
+
+G_BEGIN_DECLS
+
+G_GNUC_INTERNAL gboolean _gum_stalker_query_ic_stats (
+    gconstpointer real_address, gsize * hits, gsize * misses,
+    gboolean * is_megamorphic);
+G_GNUC_INTERNAL guint _gum_stalker_query_ret_slow_path_count (void);
+
+G_END_DECLS
+
+#endif
@@ -20,6 +20,31 @@ struct _GumCallbackStalkerTransformer
   GDestroyNotify data_destroy;
 };
 
+struct _GumRuleStalkerTransformer
+{
+  GObject parent;
+
+  GHashTable * callouts;
+  GArray * drops;
+  GArray * counters;
+};
+
+typedef struct _GumCalloutRule GumCalloutRule;
+typedef struct _GumBlockCounterRule GumBlockCounterRule;
+
+struct _GumCalloutRule
+{
+  GumStalkerCallout callout;
+  gpointer data;
+  GDestroyNotify data_destroy;
+};
+
+struct _GumBlockCounterRule
+{
+  GumMemoryRange range;
+  gsize * counter;
+};
+
 static void gum_default_stalker_transformer_iface_init (gpointer g_iface,
     gpointer iface_data);
 static void gum_default_stalker_transformer_transform_block (
@@ -33,6 +58,18 @@ static void gum_callback_stalker_transformer_transform_block (
     GumStalkerTransformer * transformer, GumStalkerIterator * iterator,
     GumStalkerOutput * output);
 
+static void gum_rule_stalker_transformer_iface_init (gpointer g_iface,
+    gpointer iface_data);
+static void gum_rule_stalker_transformer_finalize (GObject * object);
+static void gum_rule_stalker_transformer_transform_block (
+    GumStalkerTransformer * transformer, GumStalkerIterator * iterator,
+    GumStalkerOutput * output);
+static gboolean gum_rule_stalker_transformer_is_dropped (
+    GumRuleStalkerTransformer * self, const cs_insn * insn);
+static void gum_callout_rule_array_free (GArray * rules);
+static void gum_increment_block_counter (GumCpuContext * cpu_context,
+    gpointer user_data);
+
 G_DEFINE_INTERFACE (GumStalkerTransformer, gum_stalker_transformer,
     G_TYPE_OBJECT)
 
@@ -50,6 +87,13 @@ G_DEFINE_TYPE_EXTENDED (GumCallbackStalkerTransformer,
                         G_IMPLEMENT_INTERFACE (GUM_TYPE_STALKER_TRANSFORMER,
                             gum_callback_stalker_transformer_iface_init))
 
+G_DEFINE_TYPE_EXTENDED (GumRuleStalkerTransformer,
+                        gum_rule_stalker_transformer,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (GUM_TYPE_STALKER_TRANSFORMER,
+                            gum_rule_stalker_transformer_iface_init))
+
 static void
 gum_stalker_transformer_default_init (GumStalkerTransformerInterface * iface)
 {
@@ -77,6 +121,62 @@ gum_stalker_transformer_make_from_callback (
   return GUM_STALKER_TRANSFORMER (transformer);
 }
 
+GumRuleStalkerTransformer *
+gum_rule_stalker_transformer_new (void)
+{
+  return g_object_new (GUM_TYPE_RULE_STALKER_TRANSFORMER, NULL);
+}
+
+void
+gum_rule_stalker_transformer_add_callout (GumRuleStalkerTransformer * self,
+                                          const gchar * mnemonic,
+                                          GumStalkerCallout callout,
+                                          gpointer data,
+                                          GDestroyNotify data_destroy)
+{
+  gchar * key;
+  GArray * rules;
+  GumCalloutRule rule;
+
+  key = g_ascii_strdown (mnemonic, -1);
+
+  rules = g_hash_table_lookup (self->callouts, key);
+  if (rules == NULL)
+  {
+    rules = g_array_new (FALSE, FALSE, sizeof (GumCalloutRule));
+    g_hash_table_insert (self->callouts, key, rules);
+  }
+  else
+  {
+    g_free (key);
+  }
+
+  rule.callout = callout;
+  rule.data = data;
+  rule.data_destroy = data_destroy;
+  g_array_append_val (rules, rule);
+}
+
+void
+gum_rule_stalker_transformer_add_drop (GumRuleStalkerTransformer * self,
+                                       const GumMemoryRange * range)
+{
+  g_array_append_val (self->drops, *range);
+}
+
+void
+gum_rule_stalker_transformer_add_block_counter (
+    GumRuleStalkerTransformer * self,
+    const GumMemoryRange * range,
+    gsize * counter)
+{
+  GumBlockCounterRule rule;
+
+  rule.range = *range;
+  rule.counter = counter;
+  g_array_append_val (self->counters, rule);
+}
+
 void
 gum_stalker_transformer_transform_block (GumStalkerTransformer * self,
                                          GumStalkerIterator * iterator,
@@ -171,3 +271,177 @@ gum_callback_stalker_transformer_transform_block (
 
   self->callback (iterator, output, self->data);
 }
+
+static void
+gum_rule_stalker_transformer_class_init (
+    GumRuleStalkerTransformerClass * klass)
+{
+  GObjectClass * object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = gum_rule_stalker_transformer_finalize;
+}
+
+static void
+gum_rule_stalker_transformer_iface_init (gpointer g_iface,
+                                         gpointer iface_data)
+{
+  GumStalkerTransformerInterface * iface =
+      (GumStalkerTransformerInterface *) g_iface;
+
+  iface->transform_block = gum_rule_stalker_transformer_transform_block;
+}
+
+static void
+gum_rule_stalker_transformer_init (GumRuleStalkerTransformer * self)
+{
+  self->callouts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) gum_callout_rule_array_free);
+  self->drops = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
+  self->counters = g_array_new (FALSE, FALSE, sizeof (GumBlockCounterRule));
+}
+
+static void
+gum_rule_stalker_transformer_finalize (GObject * object)
+{
+  GumRuleStalkerTransformer * self = GUM_RULE_STALKER_TRANSFORMER (object);
+
+  g_hash_table_unref (self->callouts);
+  g_array_free (self->drops, TRUE);
+  g_array_free (self->counters, TRUE);
+
+  G_OBJECT_CLASS (gum_rule_stalker_transformer_parent_class)->finalize (
+      object);
+}
+
+static void
+gum_rule_stalker_transformer_transform_block (
+    GumStalkerTransformer * transformer,
+    GumStalkerIterator * iterator,
+    GumStalkerOutput * output)
+{
+  GumRuleStalkerTransformer * self =
+      (GumRuleStalkerTransformer *) transformer;
+  gboolean has_callouts;
+  const cs_insn * insn;
+  gboolean is_first;
+
+  has_callouts = g_hash_table_size (self->callouts) != 0;
+
+  is_first = TRUE;
+
+  while (gum_stalker_iterator_next (iterator, &insn))
+  {
+    if (is_first)
+    {
+      guint i;
+
+      for (i = 0; i != self->counters->len; i++)
+      {
+        GumBlockCounterRule * rule =
+            &g_array_index (self->counters, GumBlockCounterRule, i);
+
+        if (GUM_MEMORY_RANGE_INCLUDES (&rule->range, insn->address))
+        {
+          gum_stalker_iterator_put_gpr_callout (iterator,
+              gum_increment_block_counter, rule->counter, NULL);
+        }
+      }
+
+      is_first = FALSE;
+    }
+
+    if (gum_rule_stalker_transformer_is_dropped (self, insn))
+      continue;
+
+    if (has_callouts)
+    {
+      GArray * rules;
+
+      rules = g_hash_table_lookup (self->callouts, insn->mnemonic);
+      if (rules != NULL)
+      {
+        guint i;
+
+        for (i = 0; i != rules->len; i++)
+        {
+          GumCalloutRule * rule = &g_array_index (rules, GumCalloutRule, i);
+
+          gum_stalker_iterator_put_callout (iterator, rule->callout,
+              rule->data, NULL);
+        }
+      }
+    }
+
+    gum_stalker_iterator_keep (iterator);
+  }
+}
+
+static gboolean
+gum_rule_stalker_transformer_is_dropped (GumRuleStalkerTransformer * self,
+                                         const cs_insn * insn)
+{
+  guint i;
+  gboolean is_in_dropped_range;
+
+  is_in_dropped_range = FALSE;
+  for (i = 0; i != self->drops->len && !is_in_dropped_range; i++)
+  {
+    GumMemoryRange * range = &g_array_index (self->drops, GumMemoryRange, i);
+
+    is_in_dropped_range = GUM_MEMORY_RANGE_INCLUDES (range, insn->address);
+  }
+  if (!is_in_dropped_range)
+    return FALSE;
+
+  /*
+   * Control-flow instructions are always kept, as the block would otherwise
+   * be left without a way out.
+   */
+  if (insn->detail != NULL)
+  {
+    const cs_detail * detail = insn->detail;
+    guint8 j;
+
+    for (j = 0; j != detail->groups_count; j++)
+    {
+      switch (detail->groups[j])
+      {
+        case CS_GRP_JUMP:
+        case CS_GRP_CALL:
+        case CS_GRP_RET:
+        case CS_GRP_INT:
+        case CS_GRP_IRET:
+          return FALSE;
+        default:
+          break;
+      }
+    }
+  }
+
+  return TRUE;
+}
+
+static void
+gum_callout_rule_array_free (GArray * rules)
+{
+  guint i;
+
+  for (i = 0; i != rules->len; i++)
+  {
+    GumCalloutRule * rule = &g_array_index (rules, GumCalloutRule, i);
+
+    if (rule->data_destroy != NULL)
+      rule->data_destroy (rule->data);
+  }
+
+  g_array_free (rules, TRUE);
+}
+
+static void
+gum_increment_block_counter (GumCpuContext * cpu_context,
+                             gpointer user_data)
+{
+  gsize * counter = user_data;
+
+  g_atomic_pointer_add (counter, 1);
+}
@@ -40,6 +40,12 @@ G_DECLARE_FINAL_TYPE (GumCallbackStalkerTransformer,
     gum_callback_stalker_transformer, GUM, CALLBACK_STALKER_TRANSFORMER,
     GObject)
 
+#define GUM_TYPE_RULE_STALKER_TRANSFORMER \
+    (gum_rule_stalker_transformer_get_type ())
+G_DECLARE_FINAL_TYPE (GumRuleStalkerTransformer,
+    gum_rule_stalker_transformer, GUM, RULE_STALKER_TRANSFORMER,
+    GObject)
+
 typedef struct _GumStalkerIterator GumStalkerIterator;
 typedef struct _GumStalkerOutput GumStalkerOutput;
 typedef union _GumStalkerWriter GumStalkerWriter;
@@ -93,6 +99,8 @@ GUM_API void gum_stalker_exclude (GumStalker * self,
 GUM_API gint gum_stalker_get_trust_threshold (GumStalker * self);
 GUM_API void gum_stalker_set_trust_threshold (GumStalker * self,
     gint trust_threshold);
+GUM_API guint gum_stalker_get_ic_entries (GumStalker * self);
+GUM_API void gum_stalker_set_ic_entries (GumStalker * self, guint ic_entries);
 
 GUM_API void gum_stalker_flush (GumStalker * self);
 GUM_API void gum_stalker_stop (GumStalker * self);
@@ -126,6 +134,16 @@ GUM_API GumStalkerTransformer * gum_stalker_transformer_make_from_callback (
     GumStalkerTransformerCallback callback, gpointer data,
     GDestroyNotify data_destroy);
 
+GUM_API GumRuleStalkerTransformer * gum_rule_stalker_transformer_new (void);
+GUM_API void gum_rule_stalker_transformer_add_callout (
+    GumRuleStalkerTransformer * self, const gchar * mnemonic,
+    GumStalkerCallout callout, gpointer data, GDestroyNotify data_destroy);
+GUM_API void gum_rule_stalker_transformer_add_drop (
+    GumRuleStalkerTransformer * self, const GumMemoryRange * range);
+GUM_API void gum_rule_stalker_transformer_add_block_counter (
+    GumRuleStalkerTransformer * self, const GumMemoryRange * range,
+    gsize * counter);
+
 GUM_API void gum_stalker_transformer_transform_block (
     GumStalkerTransformer * self, GumStalkerIterator * iterator,
     GumStalkerOutput * output);
@@ -135,6 +153,8 @@ GUM_API gboolean gum_stalker_iterator_next (GumStalkerIterator * self,
 GUM_API void gum_stalker_iterator_keep (GumStalkerIterator * self);
 GUM_API void gum_stalker_iterator_put_callout (GumStalkerIterator * self,
     GumStalkerCallout callout, gpointer data, GDestroyNotify data_destroy);
+GUM_API void gum_stalker_iterator_put_gpr_callout (GumStalkerIterator * self,
+    GumStalkerCallout callout, gpointer data, GDestroyNotify data_destroy);
 
 GUM_API void gum_stalker_set_counters_enabled (gboolean enabled);
 GUM_API void gum_stalker_dump_counters (void);
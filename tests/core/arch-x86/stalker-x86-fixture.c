@@ -5,7 +5,7 @@
  * Licence: wxWindows Library Licence, Version 3.1
  */
 
-#include "gumstalker.h"
+#include "gumstalker-priv.h"
 
 #include "fakeeventsink.h"
 #include "gumx86writer.h"
@@ -16,9 +16,15 @@ TESTLIST_BEGIN (stalker)
   TESTENTRY (call)
   TESTENTRY (ret)
   TESTENTRY (exec)
+  TESTENTRY (memory)
+  TESTENTRY (memory_with_absolute_and_segment_operands)
   TESTENTRY (call_depth)
   TESTENTRY (call_probe)
   TESTENTRY (custom_transformer)
+  TESTENTRY (gpr_callout)
+  TESTENTRY (gpr_callout_should_preserve_vector_registers)
+  TESTENTRY (xsavec_prolog_should_preserve_vector_registers)
+  TESTENTRY (rule_transformer)
   TESTENTRY (unfollow_should_be_allowed_before_first_transform)
   TESTENTRY (unfollow_should_be_allowed_mid_first_transform)
   TESTENTRY (unfollow_should_be_allowed_after_first_transform)
@@ -34,6 +40,7 @@ TESTLIST_BEGIN (stalker)
   TESTENTRY (short_conditional_jcxz_false)
   TESTENTRY (long_conditional_jump)
   TESTENTRY (follow_return)
+  TESTENTRY (unwind_past_known_frames)
   TESTENTRY (follow_stdcall)
   TESTENTRY (follow_repne_ret)
   TESTENTRY (follow_repne_jb)
@@ -52,6 +59,7 @@ TESTLIST_BEGIN (stalker)
   TESTENTRY (indirect_call_with_esp_and_dword_immediate)
   TESTENTRY (indirect_jump_with_immediate)
   TESTENTRY (indirect_jump_with_immediate_and_scaled_register)
+  TESTENTRY (megamorphic_indirect_call)
   TESTENTRY (direct_call_with_register)
 #if GLIB_SIZEOF_VOID_P == 8
   TESTENTRY (direct_call_with_extended_register)
@@ -90,7 +98,20 @@ static void pretend_workload (GumMemoryRange * runner_range);
 #endif
 static void insert_extra_increment_after_xor (GumStalkerIterator * iterator,
     GumStalkerOutput * output, gpointer user_data);
+static void insert_gpr_callout_before_leaf_ret (GumStalkerIterator * iterator,
+    GumStalkerOutput * output, gpointer user_data);
+static void test_vector_registers_across_callout (TestStalkerFixture * fixture,
+    gboolean gpr_only);
+static void put_vector_register_fill (GumX86Writer * cw, guint index,
+    guint32 value);
+static void put_vector_register_check (GumX86Writer * cw, guint index,
+    guint32 value, gconstpointer fail_label);
+static void insert_callout_at_marker (GumStalkerIterator * iterator,
+    GumStalkerOutput * output, gpointer user_data);
+static void clobber_vector_registers (GumCpuContext * cpu_context,
+    gpointer user_data);
 static void store_xax (GumCpuContext * cpu_context, gpointer user_data);
+static void count_callout (GumCpuContext * cpu_context, gpointer user_data);
 static void unfollow_during_transform (GumStalkerIterator * iterator,
     GumStalkerOutput * output, gpointer user_data);
 static void invoke_follow_return_code (TestStalkerFixture * fixture);
@@ -427,6 +448,173 @@ TESTCASE (exec)
   GUM_ASSERT_CMPADDR (ev->location, ==, func);
 }
 
+TESTCASE (memory)
+{
+  const guint8 code[] =
+  {
+    0x51,             /* push xcx        */
+    0x8b, 0x04, 0x24, /* mov eax, [xsp]  */
+    0x89, 0x04, 0x24, /* mov [xsp], eax  */
+    0x59,             /* pop xcx         */
+    0xc3,             /* ret             */
+  };
+  StalkerTestFunc func;
+  GArray * accesses;
+  guint i;
+  const GumMemoryEvent * load, * store;
+
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      test_stalker_fixture_dup_code (fixture, code, sizeof (code)));
+
+  fixture->sink->mask = GUM_MEMORY;
+  g_assert_cmpint (test_stalker_fixture_follow_and_invoke (fixture, func, 42),
+      ==, 42);
+
+  accesses = g_array_new (FALSE, FALSE, sizeof (GumMemoryEvent));
+  for (i = 0; i != fixture->sink->events->len; i++)
+  {
+    const GumEvent * ev = &g_array_index (fixture->sink->events, GumEvent, i);
+
+    g_assert_cmpint (ev->type, ==, GUM_MEMORY);
+
+    if ((guint8 *) ev->memory.location >= fixture->code &&
+        (guint8 *) ev->memory.location < fixture->code + sizeof (code))
+    {
+      g_array_append_val (accesses, ev->memory);
+    }
+  }
+
+  g_assert_cmpuint (accesses->len, ==, 2);
+
+  load = &g_array_index (accesses, GumMemoryEvent, 0);
+  GUM_ASSERT_CMPADDR (load->location, ==, fixture->code + 1);
+  g_assert_cmpuint (load->operation, ==, GUM_MEMOP_READ);
+  g_assert_cmpuint (load->size, ==, 4);
+
+  store = &g_array_index (accesses, GumMemoryEvent, 1);
+  GUM_ASSERT_CMPADDR (store->location, ==, fixture->code + 4);
+  g_assert_cmpuint (store->operation, ==, GUM_MEMOP_WRITE);
+  g_assert_cmpuint (store->size, ==, 4);
+
+  g_assert_nonnull (load->address);
+  GUM_ASSERT_CMPADDR (store->address, ==, load->address);
+
+  g_array_free (accesses, TRUE);
+}
+
+static gpointer get_tls_segment_base (void);
+
+static gsize memory_test_variable = 1337;
+
+TESTCASE (memory_with_absolute_and_segment_operands)
+{
+#if GLIB_SIZEOF_VOID_P == 8
+  guint8 code[] =
+  {
+    0x48, 0xa1, 0, 0, 0, 0, 0, 0, 0, 0,      /* movabs rax, [moffs64] */
+# ifdef HAVE_WINDOWS
+    0x65, 0x48, 0x8b, 0x04, 0x25, 0x30, 0x00, 0x00, 0x00,
+                                             /* mov rax, gs:[0x30]    */
+# else
+    0x64, 0x48, 0x8b, 0x04, 0x25, 0x00, 0x00, 0x00, 0x00,
+                                             /* mov rax, fs:[0]       */
+# endif
+    0xc3,                                    /* ret                   */
+  };
+  const guint segment_insn_offset = 10;
+#else
+  guint8 code[] =
+  {
+    0xa1, 0, 0, 0, 0,                        /* mov eax, [moffs32]    */
+# ifdef HAVE_WINDOWS
+    0x64, 0xa1, 0x18, 0x00, 0x00, 0x00,      /* mov eax, fs:[0x18]    */
+# else
+    0x65, 0xa1, 0x00, 0x00, 0x00, 0x00,      /* mov eax, gs:[0]       */
+# endif
+    0xc3,                                    /* ret                   */
+  };
+  const guint segment_insn_offset = 5;
+#endif
+  gpointer variable_address = &memory_test_variable;
+  StalkerTestFunc func;
+  GArray * accesses;
+  guint i;
+  const GumMemoryEvent * ev;
+
+  memcpy (code + segment_insn_offset - sizeof (gpointer), &variable_address,
+      sizeof (gpointer));
+
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      test_stalker_fixture_dup_code (fixture, code, sizeof (code)));
+
+  fixture->sink->mask = GUM_MEMORY;
+  test_stalker_fixture_follow_and_invoke (fixture, func, 0);
+
+  accesses = g_array_new (FALSE, FALSE, sizeof (GumMemoryEvent));
+  for (i = 0; i != fixture->sink->events->len; i++)
+  {
+    const GumEvent * e = &g_array_index (fixture->sink->events, GumEvent, i);
+
+    if ((guint8 *) e->memory.location >= fixture->code &&
+        (guint8 *) e->memory.location < fixture->code + sizeof (code))
+    {
+      g_array_append_val (accesses, e->memory);
+    }
+  }
+
+#ifdef HAVE_DARWIN
+  g_assert_cmpuint (accesses->len, ==, 1);
+#else
+  g_assert_cmpuint (accesses->len, ==, 2);
+#endif
+
+  ev = &g_array_index (accesses, GumMemoryEvent, 0);
+  GUM_ASSERT_CMPADDR (ev->location, ==, fixture->code);
+  GUM_ASSERT_CMPADDR (ev->address, ==, &memory_test_variable);
+  g_assert_cmpuint (ev->operation, ==, GUM_MEMOP_READ);
+  g_assert_cmpuint (ev->size, ==, sizeof (gpointer));
+
+#ifndef HAVE_DARWIN
+  ev = &g_array_index (accesses, GumMemoryEvent, 1);
+  GUM_ASSERT_CMPADDR (ev->location, ==, fixture->code + segment_insn_offset);
+# ifdef HAVE_WINDOWS
+  GUM_ASSERT_CMPADDR (ev->address, ==,
+      (guint8 *) get_tls_segment_base () + ((sizeof (gpointer) == 8)
+          ? 0x30 : 0x18));
+# else
+  GUM_ASSERT_CMPADDR (ev->address, ==, get_tls_segment_base ());
+# endif
+  g_assert_cmpuint (ev->operation, ==, GUM_MEMOP_READ);
+  g_assert_cmpuint (ev->size, ==, sizeof (gpointer));
+#endif
+
+  g_array_free (accesses, TRUE);
+}
+
+static gpointer
+get_tls_segment_base (void)
+{
+#if defined (HAVE_WINDOWS)
+# if GLIB_SIZEOF_VOID_P == 8
+  return (gpointer) __readgsqword (0x30);
+# else
+  return (gpointer) __readfsdword (0x18);
+# endif
+#elif defined (HAVE_DARWIN)
+  return NULL;
+#else
+  gpointer base;
+
+# if GLIB_SIZEOF_VOID_P == 8
+  asm volatile ("movq %%fs:0, %0" : "=r" (base));
+# else
+  asm volatile ("movl %%gs:0, %0" : "=r" (base));
+# endif
+
+  return base;
+#endif
+}
+
 TESTCASE (call_depth)
 {
   const guint8 code[] =
@@ -643,6 +831,280 @@ insert_extra_increment_after_xor (GumStalkerIterator * iterator,
   }
 }
 
+TESTCASE (gpr_callout)
+{
+  gsize last_xax = 0;
+
+  fixture->transformer = gum_stalker_transformer_make_from_callback (
+      insert_gpr_callout_before_leaf_ret, &last_xax, NULL);
+
+  invoke_flat_expecting_return_value (fixture, GUM_NOTHING, 2);
+
+  g_assert_cmpuint (last_xax, ==, 2);
+}
+
+static void
+insert_gpr_callout_before_leaf_ret (GumStalkerIterator * iterator,
+                                    GumStalkerOutput * output,
+                                    gpointer user_data)
+{
+  gsize * last_xax = user_data;
+  const cs_insn * insn;
+  gboolean in_leaf_func;
+
+  in_leaf_func = FALSE;
+
+  while (gum_stalker_iterator_next (iterator, &insn))
+  {
+    if (in_leaf_func && insn->id == X86_INS_RET)
+    {
+      gum_stalker_iterator_put_gpr_callout (iterator, store_xax, last_xax,
+          NULL);
+    }
+
+    gum_stalker_iterator_keep (iterator);
+
+    if (insn->id == X86_INS_XOR)
+      in_leaf_func = TRUE;
+  }
+}
+
+typedef struct _VectorCalloutContext VectorCalloutContext;
+
+struct _VectorCalloutContext
+{
+  gboolean gpr_only;
+  gconstpointer marker;
+  guint num_calls;
+};
+
+#define VECTOR_LOWER_VALUE(i) (0x01010101U * ((i) + 1))
+#define VECTOR_UPPER_VALUE(i) (0x10101010U * ((i) + 1))
+
+TESTCASE (gpr_callout_should_preserve_vector_registers)
+{
+  test_vector_registers_across_callout (fixture, TRUE);
+}
+
+TESTCASE (xsavec_prolog_should_preserve_vector_registers)
+{
+#ifdef __GNUC__
+  if (gum_query_cpu_xsave_area_size () == 0)
+  {
+    g_print ("<skipping, XSAVEC not supported> ");
+    return;
+  }
+
+  test_vector_registers_across_callout (fixture, FALSE);
+#else
+  g_print ("<skipping, not supported by this compiler> ");
+#endif
+}
+
+/*
+ * Fills xmm0-7, and the upper halves of ymm0-7 when AVX2 is available, with
+ * known values, inserts a callout, and checks every lane afterwards. A GPR
+ * callout must leave them alone, and a regular callout that clobbers them
+ * must see them restored by the XSAVEC prolog.
+ */
+static void
+test_vector_registers_across_callout (TestStalkerFixture * fixture,
+                                      gboolean gpr_only)
+{
+  const gchar * fail_lbl = "fail";
+  const gchar * done_lbl = "done";
+  const guint8 vinsertf128_template[] = {
+    0xc4, 0xe3, 0x00, 0x18, 0xc0, 0x01 /* vinsertf128 ymmN, ymmN, xmmN, 1 */
+  };
+  const guint8 vextractf128_template[] = {
+    0xc4, 0xe3, 0x7d, 0x19, 0xc0, 0x01 /* vextractf128 xmmN, ymmN, 1 */
+  };
+  const guint8 vzeroupper[] = { 0xc5, 0xf8, 0x77 };
+  guint8 * code;
+  GumX86Writer cw;
+  gboolean use_ymm;
+  VectorCalloutContext ctx;
+  StalkerTestFunc func;
+  guint i;
+  gint ret;
+
+  use_ymm = (gum_query_cpu_features () & GUM_CPU_AVX2) != 0;
+
+  code = gum_alloc_n_pages (1, GUM_PAGE_RWX);
+  gum_x86_writer_init (&cw, code);
+
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc, code);
+
+  for (i = 0; i != 8; i++)
+  {
+    if (use_ymm)
+    {
+      guint8 insn[sizeof (vinsertf128_template)];
+
+      put_vector_register_fill (&cw, i, VECTOR_UPPER_VALUE (i));
+
+      memcpy (insn, vinsertf128_template, sizeof (insn));
+      insn[2] = ((~i & 0xf) << 3) | 0x05;
+      insn[4] |= (i << 3) | i;
+      gum_x86_writer_put_bytes (&cw, insn, sizeof (insn));
+    }
+
+    /* Legacy SSE writes leave the upper halves alone. */
+    put_vector_register_fill (&cw, i, VECTOR_LOWER_VALUE (i));
+  }
+
+  ctx.gpr_only = gpr_only;
+  ctx.marker = gum_x86_writer_cur (&cw);
+  ctx.num_calls = 0;
+  gum_x86_writer_put_nop (&cw);
+
+  for (i = 0; i != 8; i++)
+  {
+    put_vector_register_check (&cw, i, VECTOR_LOWER_VALUE (i), fail_lbl);
+
+    if (use_ymm)
+    {
+      guint8 insn[sizeof (vextractf128_template)];
+
+      memcpy (insn, vextractf128_template, sizeof (insn));
+      insn[4] |= (i << 3) | i;
+      gum_x86_writer_put_bytes (&cw, insn, sizeof (insn));
+
+      put_vector_register_check (&cw, i, VECTOR_UPPER_VALUE (i), fail_lbl);
+    }
+  }
+
+  gum_x86_writer_put_mov_reg_u32 (&cw, GUM_REG_EAX, 1);
+  gum_x86_writer_put_jmp_near_label (&cw, done_lbl);
+
+  gum_x86_writer_put_label (&cw, fail_lbl);
+  gum_x86_writer_put_xor_reg_reg (&cw, GUM_REG_EAX, GUM_REG_EAX);
+
+  gum_x86_writer_put_label (&cw, done_lbl);
+  if (use_ymm)
+    gum_x86_writer_put_bytes (&cw, vzeroupper, sizeof (vzeroupper));
+  gum_x86_writer_put_ret (&cw);
+
+  gum_x86_writer_clear (&cw);
+
+  fixture->transformer = gum_stalker_transformer_make_from_callback (
+      insert_callout_at_marker, &ctx, NULL);
+
+  fixture->sink->mask = GUM_NOTHING;
+  ret = test_stalker_fixture_follow_and_invoke (fixture, func, 0);
+  g_assert_cmpuint (ctx.num_calls, ==, 1);
+  g_assert_cmpint (ret, ==, 1);
+
+  gum_free_pages (code);
+}
+
+static void
+put_vector_register_fill (GumX86Writer * cw,
+                          guint index,
+                          guint32 value)
+{
+  guint8 movd[] = {
+    0x66, 0x0f, 0x6e, 0xc0 /* movd xmmN, eax */
+  };
+  guint8 pshufd[] = {
+    0x66, 0x0f, 0x70, 0xc0, 0x00 /* pshufd xmmN, xmmN, 0 */
+  };
+
+  movd[3] |= index << 3;
+  pshufd[3] |= (index << 3) | index;
+
+  gum_x86_writer_put_mov_reg_u32 (cw, GUM_REG_EAX, value);
+  gum_x86_writer_put_bytes (cw, movd, sizeof (movd));
+  gum_x86_writer_put_bytes (cw, pshufd, sizeof (pshufd));
+}
+
+static void
+put_vector_register_check (GumX86Writer * cw,
+                           guint index,
+                           guint32 value,
+                           gconstpointer fail_label)
+{
+  guint8 movd[] = {
+    0x66, 0x0f, 0x7e, 0xc1 /* movd ecx, xmmN */
+  };
+  guint8 pshufd[] = {
+    0x66, 0x0f, 0x70, 0xc0, 0x39 /* pshufd xmmN, xmmN, 0x39 */
+  };
+  guint lane;
+
+  movd[3] |= index << 3;
+  pshufd[3] |= (index << 3) | index;
+
+  for (lane = 0; lane != 4; lane++)
+  {
+    gum_x86_writer_put_bytes (cw, movd, sizeof (movd));
+    gum_x86_writer_put_cmp_reg_i32 (cw, GUM_REG_ECX, (gint32) value);
+    gum_x86_writer_put_jcc_near_label (cw, X86_INS_JNE, fail_label,
+        GUM_NO_HINT);
+    gum_x86_writer_put_bytes (cw, pshufd, sizeof (pshufd));
+  }
+}
+
+static void
+insert_callout_at_marker (GumStalkerIterator * iterator,
+                          GumStalkerOutput * output,
+                          gpointer user_data)
+{
+  VectorCalloutContext * ctx = user_data;
+  const cs_insn * insn;
+
+  while (gum_stalker_iterator_next (iterator, &insn))
+  {
+    if (insn->address == GUM_ADDRESS (ctx->marker))
+    {
+      if (ctx->gpr_only)
+      {
+        gum_stalker_iterator_put_gpr_callout (iterator, count_callout,
+            &ctx->num_calls, NULL);
+      }
+      else
+      {
+        gum_stalker_iterator_put_callout (iterator, clobber_vector_registers,
+            ctx, NULL);
+      }
+    }
+
+    gum_stalker_iterator_keep (iterator);
+  }
+}
+
+static void
+clobber_vector_registers (GumCpuContext * cpu_context,
+                          gpointer user_data)
+{
+  VectorCalloutContext * ctx = user_data;
+
+  ctx->num_calls++;
+
+#ifdef __GNUC__
+  asm volatile (
+      "pxor %%xmm0, %%xmm0\n\t"
+      "pxor %%xmm1, %%xmm1\n\t"
+      "pxor %%xmm2, %%xmm2\n\t"
+      "pxor %%xmm3, %%xmm3\n\t"
+      "pxor %%xmm4, %%xmm4\n\t"
+      "pxor %%xmm5, %%xmm5\n\t"
+      "pxor %%xmm6, %%xmm6\n\t"
+      "pxor %%xmm7, %%xmm7\n\t"
+      : : : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7");
+
+  if ((gum_query_cpu_features () & GUM_CPU_AVX2) != 0)
+  {
+    asm volatile ("vzeroall"
+        : : : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7"
+# if GLIB_SIZEOF_VOID_P == 8
+        , "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15"
+# endif
+        );
+  }
+#endif
+}
+
 static void
 store_xax (GumCpuContext * cpu_context,
            gpointer user_data)
@@ -652,6 +1114,51 @@ store_xax (GumCpuContext * cpu_context,
   *last_xax = GUM_CPU_CONTEXT_XAX (cpu_context);
 }
 
+TESTCASE (rule_transformer)
+{
+  GumRuleStalkerTransformer * transformer;
+  guint8 * code;
+  GumMemoryRange code_range, second_inc_range;
+  gsize num_blocks = 0;
+  guint num_incs = 0;
+  StalkerTestFunc func;
+  gint ret;
+
+  code = test_stalker_fixture_dup_code (fixture, flat_code, sizeof (flat_code));
+
+  code_range.base_address = GUM_ADDRESS (code);
+  code_range.size = sizeof (flat_code);
+
+  second_inc_range.base_address = GUM_ADDRESS (code + 4);
+  second_inc_range.size = 2;
+
+  transformer = gum_rule_stalker_transformer_new ();
+  gum_rule_stalker_transformer_add_callout (transformer, "inc", count_callout,
+      &num_incs, NULL);
+  gum_rule_stalker_transformer_add_drop (transformer, &second_inc_range);
+  gum_rule_stalker_transformer_add_block_counter (transformer, &code_range,
+      &num_blocks);
+  fixture->transformer = GUM_STALKER_TRANSFORMER (transformer);
+
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc, code);
+
+  fixture->sink->mask = GUM_NOTHING;
+  ret = test_stalker_fixture_follow_and_invoke (fixture, func, -1);
+  g_assert_cmpint (ret, ==, 1);
+
+  g_assert_cmpuint (num_incs, ==, 1);
+  g_assert_cmpuint (num_blocks, ==, 1);
+}
+
+static void
+count_callout (GumCpuContext * cpu_context,
+               gpointer user_data)
+{
+  guint * count = user_data;
+
+  (*count)++;
+}
+
 TESTCASE (unfollow_should_be_allowed_before_first_transform)
 {
   UnfollowTransformContext ctx;
@@ -1004,6 +1511,71 @@ TESTCASE (follow_return)
       ==, 5 + FOLLOW_RETURN_EXTRA_INSN_COUNT);
 }
 
+TESTCASE (unwind_past_known_frames)
+{
+  const guint8 code[] = {
+      /* Reference: every frame returns normally. */
+      0xe8, 0x03, 0x00, 0x00, 0x00, /* call middle    */
+      0xff, 0xc0,                   /* inc eax        */
+      0xc3,                         /* ret            */
+
+      0xe8, 0x04, 0x00, 0x00, 0x00, /* middle:        */
+                                    /* call inner     */
+      0x83, 0xc0, 0x64,             /* add eax, 100   */
+      0xc3,                         /* ret            */
+
+      0xb8, 0x29, 0x00, 0x00, 0x00, /* inner:         */
+                                    /* mov eax, 41    */
+      0x90,                         /* nop            */
+      0xc3,                         /* ret            */
+
+      /* Same, except inner returns straight past middle. */
+      0xe8, 0x03, 0x00, 0x00, 0x00, /* call middle    */
+      0xff, 0xc0,                   /* inc eax        */
+      0xc3,                         /* ret            */
+
+      0xe8, 0x04, 0x00, 0x00, 0x00, /* middle:        */
+                                    /* call inner     */
+      0x83, 0xc0, 0x64,             /* add eax, 100   */
+      0xc3,                         /* ret            */
+
+      0xb8, 0x29, 0x00, 0x00, 0x00, /* inner:         */
+                                    /* mov eax, 41    */
+      0x5a,                         /* pop xdx        */
+      0xc3,                         /* ret            */
+  };
+  guint8 * start;
+  StalkerTestFunc reference_func, unwinding_func;
+  guint count_before, reference_misses, unwinding_misses;
+  gint ret;
+
+  start = test_stalker_fixture_dup_code (fixture, code, sizeof (code));
+  reference_func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc, start);
+  unwinding_func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      start + sizeof (code) / 2);
+
+  fixture->sink->mask = GUM_NOTHING;
+  gum_stalker_set_counters_enabled (TRUE);
+
+  count_before = _gum_stalker_query_ret_slow_path_count ();
+  ret = test_stalker_fixture_follow_and_invoke (fixture, reference_func, 0);
+  g_assert_cmpint (ret, ==, 142);
+  reference_misses = _gum_stalker_query_ret_slow_path_count () - count_before;
+
+  count_before = _gum_stalker_query_ret_slow_path_count ();
+  ret = test_stalker_fixture_follow_and_invoke (fixture, unwinding_func, 0);
+  g_assert_cmpint (ret, ==, 42);
+  unwinding_misses = _gum_stalker_query_ret_slow_path_count () - count_before;
+
+  gum_stalker_set_counters_enabled (FALSE);
+
+  /*
+   * The return that skips middle's frame must still be resolved through the
+   * shadow stack, so it costs no more slow paths than the reference.
+   */
+  g_assert_cmpuint (unwinding_misses, ==, reference_misses);
+}
+
 static void
 invoke_follow_return_code (TestStalkerFixture * fixture)
 {
@@ -1361,6 +1933,88 @@ TESTCASE (indirect_call_with_immediate)
   invoke_call_from_template (fixture, &call_template);
 }
 
+TESTCASE (megamorphic_indirect_call)
+{
+  guint8 * code;
+  GumX86Writer cw;
+  const gchar * loop_lbl = "loop";
+  gpointer targets[4] = { NULL, };
+  gpointer * table;
+  gpointer call_site;
+  StalkerTestFunc func;
+  guint i;
+  gint ret;
+  gsize hits_before = 0, misses_before = 0, hits, misses;
+  gboolean is_megamorphic;
+
+  code = gum_alloc_n_pages (1, GUM_PAGE_RWX);
+  gum_x86_writer_init (&cw, code);
+
+  table = (gpointer *) code;
+  gum_x86_writer_put_bytes (&cw, (guint8 *) targets, sizeof (targets));
+
+  for (i = 0; i != G_N_ELEMENTS (targets); i++)
+  {
+    targets[i] = gum_x86_writer_cur (&cw);
+    gum_x86_writer_put_mov_reg_u32 (&cw, GUM_REG_EAX, i + 1);
+    gum_x86_writer_put_ret (&cw);
+
+    /* Keep the targets in distinct megamorphic table slots. */
+    gum_x86_writer_put_nop_padding (&cw, 16 - 6);
+  }
+  memcpy (table, targets, sizeof (targets));
+
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc, gum_x86_writer_cur (&cw));
+  gum_x86_writer_put_push_reg (&cw, GUM_REG_XBX);
+  gum_x86_writer_put_push_reg (&cw, GUM_REG_XSI);
+  gum_x86_writer_put_xor_reg_reg (&cw, GUM_REG_ESI, GUM_REG_ESI);
+  gum_x86_writer_put_mov_reg_u32 (&cw, GUM_REG_EBX, 12);
+
+  gum_x86_writer_put_label (&cw, loop_lbl);
+  gum_x86_writer_put_mov_reg_reg (&cw, GUM_REG_EAX, GUM_REG_EBX);
+  gum_x86_writer_put_and_reg_u32 (&cw, GUM_REG_EAX, 3);
+  gum_x86_writer_put_mov_reg_address (&cw, GUM_REG_XDX, GUM_ADDRESS (table));
+  gum_x86_writer_put_mov_reg_base_index_scale_offset_ptr (&cw, GUM_REG_XAX,
+      GUM_REG_XDX, GUM_REG_XAX, sizeof (gpointer), 0);
+  call_site = gum_x86_writer_cur (&cw);
+  gum_x86_writer_put_call_reg (&cw, GUM_REG_XAX);
+  gum_x86_writer_put_add_reg_reg (&cw, GUM_REG_ESI, GUM_REG_EAX);
+  gum_x86_writer_put_dec_reg (&cw, GUM_REG_EBX);
+  gum_x86_writer_put_jcc_short_label (&cw, X86_INS_JNE, loop_lbl,
+      GUM_NO_HINT);
+
+  gum_x86_writer_put_mov_reg_reg (&cw, GUM_REG_EAX, GUM_REG_ESI);
+  gum_x86_writer_put_pop_reg (&cw, GUM_REG_XSI);
+  gum_x86_writer_put_pop_reg (&cw, GUM_REG_XBX);
+  gum_x86_writer_put_ret (&cw);
+
+  gum_x86_writer_clear (&cw);
+
+  gum_stalker_set_trust_threshold (fixture->stalker, 0);
+  gum_stalker_set_ic_entries (fixture->stalker, 2);
+  g_assert_cmpuint (gum_stalker_get_ic_entries (fixture->stalker), ==, 2);
+
+  _gum_stalker_query_ic_stats (call_site, &hits_before, &misses_before,
+      &is_megamorphic);
+
+  fixture->sink->mask = GUM_NOTHING;
+  gum_stalker_set_counters_enabled (TRUE);
+  ret = test_stalker_fixture_follow_and_invoke (fixture, func, 0);
+  gum_stalker_set_counters_enabled (FALSE);
+  g_assert_cmpint (ret, ==, 30);
+
+  g_assert_true (_gum_stalker_query_ic_stats (call_site, &hits, &misses,
+      &is_megamorphic));
+  g_assert_true (is_megamorphic);
+  hits -= hits_before;
+  misses -= misses_before;
+  g_assert_cmpuint (hits + misses, ==, 12);
+  /* The two inline entries can account for at most four of the hits. */
+  g_assert_cmpuint (hits, >, 4);
+
+  gum_free_pages (code);
+}
+
 TESTCASE (indirect_call_with_register_and_no_immediate)
 {
   const guint8 code[] = {
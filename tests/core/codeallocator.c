@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumcodeallocator.h"
+#include "gumcodesegment.h"
+#include "gummemory-priv.h"
+
+#include "testutil.h"
+
+#define TESTCASE(NAME) \
+    void test_code_allocator_ ## NAME (void)
+#define TESTENTRY(NAME) \
+    TESTENTRY_SIMPLE ("Core/CodeAllocator", test_code_allocator, NAME)
+
+TESTLIST_BEGIN (codeallocator)
+  TESTENTRY (batches_should_be_carved_out_of_an_arena)
+  TESTENTRY (near_arena_should_not_be_used_without_spec)
+  TESTENTRY (unusable_arena_should_not_be_kept)
+  TESTENTRY (code_written_through_rw_view_should_run_without_rwx)
+TESTLIST_END ()
+
+typedef gint (* ReturnIntFunc) (void);
+
+static gboolean arenas_are_used (void);
+static void alloc_slices (GumCodeAllocator * allocator,
+    const GumAddressSpec * spec, GumCodeSlice ** slices, guint n);
+static void free_slices (GumCodeSlice ** slices, guint n);
+#if defined (HAVE_LINUX) && (defined (HAVE_I386) || defined (HAVE_ARM64))
+static void put_return_constant (gpointer code, guint16 value);
+#endif
+
+TESTCASE (batches_should_be_carved_out_of_an_arena)
+{
+  GumCodeAllocator allocator;
+  GumCodeSlice * slices[16];
+  gsize n, batch_size;
+
+  if (!arenas_are_used ())
+  {
+    g_print ("<skipping, not using arenas> ");
+    return;
+  }
+
+  gum_code_allocator_init (&allocator, gum_query_page_size ());
+  n = allocator.slices_per_batch;
+  batch_size = allocator.pages_per_batch * gum_query_page_size ();
+  g_assert_cmpuint (2 * n, <=, G_N_ELEMENTS (slices));
+
+  alloc_slices (&allocator, NULL, slices, 2 * n);
+  g_assert_true (slices[n]->data ==
+      (guint8 *) slices[0]->data + batch_size);
+
+  free_slices (slices, 2 * n);
+  gum_code_allocator_free (&allocator);
+}
+
+TESTCASE (near_arena_should_not_be_used_without_spec)
+{
+  GumCodeAllocator allocator;
+  GumAddressSpec spec;
+  GumCodeSlice * near_slices[16], * other_slices[16];
+  gsize n, batch_size;
+  guint8 * near_batch;
+
+  if (!arenas_are_used ())
+  {
+    g_print ("<skipping, not using arenas> ");
+    return;
+  }
+
+  gum_code_allocator_init (&allocator, gum_query_page_size ());
+  n = allocator.slices_per_batch;
+  batch_size = allocator.pages_per_batch * gum_query_page_size ();
+  g_assert_cmpuint (2 * n, <=, G_N_ELEMENTS (other_slices));
+
+  spec.near_address = GUM_FUNCPTR_TO_POINTER (gum_code_allocator_init);
+  spec.max_distance = G_MAXINT32;
+
+  alloc_slices (&allocator, &spec, near_slices, n + 1);
+  near_batch = near_slices[0]->data;
+  g_assert_true (near_slices[n]->data == near_batch + batch_size);
+
+  /*
+   * The first n - 1 slices are what is left of the second near batch, and
+   * the ones after that must come from a batch of their own.
+   */
+  alloc_slices (&allocator, NULL, other_slices, 2 * n);
+  g_assert_true (other_slices[n - 1]->data != near_batch + 2 * batch_size);
+  g_assert_true (other_slices[2 * n - 1]->data ==
+      (guint8 *) other_slices[n - 1]->data + batch_size);
+
+  free_slices (other_slices, 2 * n);
+  free_slices (near_slices, n + 1);
+  gum_code_allocator_free (&allocator);
+}
+
+TESTCASE (unusable_arena_should_not_be_kept)
+{
+  GumCodeAllocator allocator;
+  gpointer hole;
+  GumMemoryRange range;
+  GumAddressSpec spec;
+  guint i;
+
+  if (!arenas_are_used ())
+  {
+    g_print ("<skipping, not using arenas> ");
+    return;
+  }
+
+  gum_code_allocator_init (&allocator, gum_query_page_size ());
+
+  /*
+   * Leave a hole big enough for an arena right at the near address. The
+   * arena can then be reserved there, but with a max distance of zero none
+   * of its batches, which start a guard page further in, are near enough.
+   */
+  hole = gum_alloc_n_pages (512, GUM_PAGE_RW);
+  gum_query_page_allocation_range (hole, 512 * gum_query_page_size (),
+      &range);
+  gum_free_pages (hole);
+
+  spec.near_address = GSIZE_TO_POINTER (range.base_address);
+  spec.max_distance = 0;
+
+  for (i = 0; i != 16; i++)
+  {
+    GumCodeSlice * slice;
+
+    slice = gum_code_allocator_try_alloc_slice_near (&allocator, &spec, 0);
+    gum_code_slice_free (slice);
+  }
+
+  g_assert_cmpuint (g_slist_length (allocator.arenas), ==, 0);
+
+  gum_code_allocator_free (&allocator);
+}
+
+TESTCASE (code_written_through_rw_view_should_run_without_rwx)
+{
+#if defined (HAVE_LINUX) && (defined (HAVE_I386) || defined (HAVE_ARM64))
+  gsize page_size;
+  GumCodeAllocator allocator;
+  GumCodeSlice * slice;
+  GumCodeSegment * segment;
+  gpointer target;
+  ReturnIntFunc func;
+
+  if (!gum_code_segment_is_supported ())
+  {
+    g_print ("<skipping, no memfd support> ");
+    return;
+  }
+
+  page_size = gum_query_page_size ();
+
+  _gum_memory_override_rwx_support (GUM_RWX_NONE);
+
+  gum_code_allocator_init (&allocator, page_size);
+  slice = gum_code_allocator_alloc_slice (&allocator);
+  put_return_constant (slice->data, 42);
+  gum_code_allocator_commit (&allocator);
+  func = GUM_POINTER_TO_FUNCPTR (ReturnIntFunc, slice->data);
+  g_assert_cmpint (func (), ==, 42);
+  gum_code_slice_free (slice);
+  gum_code_allocator_free (&allocator);
+
+  /* The RX alias must keep following what is written through the RW view. */
+  segment = gum_code_segment_new (page_size, NULL);
+  g_assert_nonnull (segment);
+  target = gum_alloc_n_pages (1, GUM_PAGE_RW);
+  put_return_constant (gum_code_segment_get_address (segment), 1337);
+  gum_code_segment_realize (segment);
+  gum_code_segment_map (segment, 0, page_size, target);
+  gum_clear_cache (target, page_size);
+  func = GUM_POINTER_TO_FUNCPTR (ReturnIntFunc, target);
+  g_assert_cmpint (func (), ==, 1337);
+
+  put_return_constant (gum_code_segment_get_address (segment), 7);
+  gum_clear_cache (target, page_size);
+  g_assert_cmpint (func (), ==, 7);
+
+  gum_code_segment_free (segment);
+  gum_free_pages (target);
+
+  _gum_memory_override_rwx_support (-1);
+#else
+  g_print ("<skipping, not supported on this platform> ");
+#endif
+}
+
+static gboolean
+arenas_are_used (void)
+{
+  return gum_query_is_rwx_supported () || !gum_code_segment_is_supported ();
+}
+
+static void
+alloc_slices (GumCodeAllocator * allocator,
+              const GumAddressSpec * spec,
+              GumCodeSlice ** slices,
+              guint n)
+{
+  guint i;
+
+  for (i = 0; i != n; i++)
+  {
+    slices[i] = gum_code_allocator_try_alloc_slice_near (allocator, spec, 0);
+    g_assert_nonnull (slices[i]);
+  }
+}
+
+static void
+free_slices (GumCodeSlice ** slices,
+             guint n)
+{
+  guint i;
+
+  for (i = 0; i != n; i++)
+    gum_code_slice_free (slices[i]);
+}
+
+#if defined (HAVE_LINUX) && (defined (HAVE_I386) || defined (HAVE_ARM64))
+
+static void
+put_return_constant (gpointer code,
+                     guint16 value)
+{
+#ifdef HAVE_I386
+  guint8 * p = code;
+
+  /* mov eax, value; ret */
+  p[0] = 0xb8;
+  p[1] = value & 0xff;
+  p[2] = value >> 8;
+  p[3] = 0x00;
+  p[4] = 0x00;
+  p[5] = 0xc3;
+#else
+  guint32 * p = code;
+
+  /* mov w0, #value; ret */
+  p[0] = GUINT32_TO_LE (0x52800000 | ((guint32) value << 5));
+  p[1] = GUINT32_TO_LE (0xd65f03c0);
+#endif
+}
+
+#endif
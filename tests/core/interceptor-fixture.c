@@ -107,7 +107,7 @@ struct _TestInterceptorFixture
 {
   GumInterceptor * interceptor;
   GString * result;
-  ListenerContext * listener_context[2];
+  ListenerContext * listener_context[4];
 };
 
 static void listener_context_free (ListenerContext * ctx);
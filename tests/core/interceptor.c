@@ -24,13 +24,24 @@ TESTLIST_BEGIN (interceptor)
 
   TESTENTRY (attach_one)
   TESTENTRY (attach_two)
+  TESTENTRY (attach_four)
+  TESTENTRY (attach_after_detach_during_invocation)
+  TESTENTRY (attach_many)
+  TESTENTRY (attach_lite)
+  TESTENTRY (attach_lite_preserves_vector_arguments)
+#if defined (HAVE_I386) && defined (__GNUC__) && !defined (HAVE_WINDOWS)
+  TESTENTRY (attach_lite_preserves_avx_arguments_and_mxcsr)
+#endif
+  TESTENTRY (stats)
   TESTENTRY (attach_to_recursive_function)
+  TESTENTRY (attach_to_deeply_recursive_function)
   TESTENTRY (attach_to_special_function)
 #ifdef G_OS_UNIX
   TESTENTRY (attach_to_pthread_key_create)
 #endif
 #if !defined (HAVE_QNX) && !(defined (HAVE_ANDROID) && defined (HAVE_ARM64))
   TESTENTRY (attach_to_heap_api)
+  TESTENTRY (attach_to_heap_api_on_new_thread)
 #endif
   TESTENTRY (attach_to_own_api)
 #ifdef HAVE_WINDOWS
@@ -41,6 +52,9 @@ TESTLIST_BEGIN (interceptor)
   TESTENTRY (intercepted_free_in_thread_exit)
 #endif
   TESTENTRY (function_arguments)
+  TESTENTRY (call_counter)
+  TESTENTRY (call_counter_should_count_every_entry)
+  TESTENTRY (call_recorder)
   TESTENTRY (function_return_value)
 #ifdef HAVE_I386
   TESTENTRY (function_cpu_context_on_enter)
@@ -48,6 +62,7 @@ TESTLIST_BEGIN (interceptor)
   TESTENTRY (ignore_current_thread)
   TESTENTRY (ignore_current_thread_nested)
   TESTENTRY (ignore_other_threads)
+  TESTENTRY (thread_filter)
   TESTENTRY (detach)
   TESTENTRY (listener_ref_count)
   TESTENTRY (function_data)
@@ -59,12 +74,41 @@ TESTLIST_BEGIN (interceptor)
   TESTENTRY (replace_two)
 # endif
   TESTENTRY (replace_then_attach)
+  TESTENTRY (replace_fast)
 
 #ifdef HAVE_QNX
   TESTENTRY (intercept_malloc_and_create_thread)
 #endif
 TESTLIST_END ()
 
+typedef struct _InvocationDataListenerContext InvocationDataListenerContext;
+
+struct _InvocationDataListenerContext
+{
+  GString * result;
+  gchar enter_char;
+};
+
+typedef struct _BlockingCallContext BlockingCallContext;
+
+struct _BlockingCallContext
+{
+  GMutex mutex;
+  GCond cond;
+  gboolean entered;
+  gboolean released;
+};
+
+typedef struct _HeapThreadContext HeapThreadContext;
+
+struct _HeapThreadContext
+{
+  gpointer (* malloc_impl) (gsize size);
+  void (* free_impl) (gpointer mem);
+  volatile GumThreadId thread_id;
+  volatile gint malloc_calls;
+};
+
 #ifdef HAVE_QNX
 static gpointer thread_doing_nothing (gpointer data);
 static gpointer thread_calling_pthread_setspecific (gpointer data);
@@ -72,8 +116,48 @@ static gpointer thread_calling_pthread_setspecific (gpointer data);
 #ifdef HAVE_WINDOWS
 static gpointer hit_target_function_repeatedly (gpointer data);
 #endif
+static gpointer thread_calling_malloc (HeapThreadContext * ctx);
+static void count_malloc_on_heap_thread (HeapThreadContext * ctx,
+    GumInvocationContext * context);
+static void sleep_in_listener (gpointer user_data,
+    GumInvocationContext * context);
+static void record_max_stack_depth (guint * max_depth,
+    GumInvocationContext * context);
+static gpointer call_block_until_released (BlockingCallContext * ctx);
+static TestCallbackListener * attach_invocation_data_listener (
+    TestInterceptorFixture * fixture, gpointer function,
+    InvocationDataListenerContext * ctx, gchar enter_char);
+static void invocation_data_listener_on_enter (
+    InvocationDataListenerContext * self, GumInvocationContext * context);
+static void invocation_data_listener_on_leave (
+    InvocationDataListenerContext * self, GumInvocationContext * context);
+static void lite_listener_on_enter (GString * str,
+    GumInvocationContext * context);
+static void clobbering_lite_listener_on_enter (GString * str,
+    GumInvocationContext * context);
+static void lite_listener_on_leave (GString * str,
+    GumInvocationContext * context);
 static gpointer replacement_malloc (gsize size);
 static gpointer replacement_target_function (GString * str);
+static gpointer replacement_target_function_fast (GString * str);
+
+static gpointer (* target_function_original) (GString * str) = NULL;
+
+typedef gdouble (* TestVectorArgsFunc) (gdouble a, gdouble b, gdouble c,
+    gdouble d, gdouble e, gdouble f, gdouble g, gdouble h);
+
+#if defined (HAVE_I386) && defined (__GNUC__) && !defined (HAVE_WINDOWS)
+# include <immintrin.h>
+
+# define TEST_AVX_FUNC __attribute__ ((target ("avx")))
+
+typedef __m256d (* TestAvxArgsFunc) (__m256d a, __m256d b);
+
+static void call_avx_args_function (gdouble * result, guint * mxcsr_before,
+    guint * mxcsr_after);
+static void avx_clobbering_lite_listener_on_enter (GString * str,
+    GumInvocationContext * context);
+#endif
 
 TESTCASE (attach_one)
 {
@@ -90,6 +174,437 @@ TESTCASE (attach_two)
   g_assert_cmpstr (fixture->result->str, ==, "ac|bd");
 }
 
+TESTCASE (attach_four)
+{
+  const gchar enter_chars[4] = { 'a', 'c', 'e', 'g' };
+  InvocationDataListenerContext contexts[4];
+  TestCallbackListener * listeners[4];
+  guint i;
+
+  for (i = 0; i != G_N_ELEMENTS (listeners); i++)
+  {
+    listeners[i] = attach_invocation_data_listener (fixture, target_function,
+        &contexts[i], enter_chars[i]);
+  }
+
+  /* Each leave char is derived from the listener's own invocation data. */
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "aceg|bdfh");
+
+  for (i = 0; i != G_N_ELEMENTS (listeners); i++)
+  {
+    gum_interceptor_detach (fixture->interceptor,
+        GUM_INVOCATION_LISTENER (listeners[i]));
+    g_object_unref (listeners[i]);
+  }
+}
+
+TESTCASE (attach_many)
+{
+  TestFunctionDataListener * fd_listener;
+  GumInvocationListener * listener;
+  gpointer targets[3];
+  GumAttachReturn results[G_N_ELEMENTS (targets)];
+
+  fd_listener = g_object_new (TEST_TYPE_FUNCTION_DATA_LISTENER, NULL);
+  listener = GUM_INVOCATION_LISTENER (fd_listener);
+
+  targets[0] = target_nop_function_a;
+  targets[1] = target_nop_function_b;
+  targets[2] = target_nop_function_a;
+  g_assert_cmpuint (gum_interceptor_attach_many (fixture->interceptor,
+      targets, G_N_ELEMENTS (targets), listener, NULL, results), ==, 2);
+  g_assert_cmpint (results[0], ==, GUM_ATTACH_OK);
+  g_assert_cmpint (results[1], ==, GUM_ATTACH_OK);
+  g_assert_cmpint (results[2], ==, GUM_ATTACH_ALREADY_ATTACHED);
+
+  target_nop_function_a ("badger");
+  target_nop_function_b ("snake");
+  target_nop_function_c ("mushroom");
+  g_assert_cmpuint (fd_listener->on_enter_call_count, ==, 2);
+  g_assert_cmpuint (fd_listener->on_leave_call_count, ==, 2);
+
+  gum_interceptor_detach (fixture->interceptor, listener);
+  g_object_unref (fd_listener);
+}
+
+TESTCASE (attach_lite)
+{
+  TestCallbackListener * listener;
+
+  listener = test_callback_listener_new ();
+  listener->on_enter = (TestCallbackListenerFunc) lite_listener_on_enter;
+  listener->on_leave = (TestCallbackListenerFunc) lite_listener_on_leave;
+  listener->user_data = fixture->result;
+
+  g_assert_cmpint (gum_interceptor_attach_lite (fixture->interceptor,
+      target_function, GUM_INVOCATION_LISTENER (listener), NULL),
+      ==, GUM_ATTACH_OK);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, ">|");
+
+  g_string_truncate (fixture->result, 0);
+  interceptor_fixture_attach (fixture, 0, target_function, 'a', 'b');
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, ">a|b");
+
+  gum_interceptor_detach (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+}
+
+gdouble GUM_NOINLINE
+target_function_with_vector_args (gdouble a,
+                                  gdouble b,
+                                  gdouble c,
+                                  gdouble d,
+                                  gdouble e,
+                                  gdouble f,
+                                  gdouble g,
+                                  gdouble h)
+{
+  return a + 2 * b + 3 * c + 4 * d + 5 * e + 6 * f + 7 * g + 8 * h;
+}
+
+static gdouble GUM_NOINLINE
+sum_vector_args (gdouble a,
+                 gdouble b,
+                 gdouble c,
+                 gdouble d,
+                 gdouble e,
+                 gdouble f,
+                 gdouble g,
+                 gdouble h)
+{
+  return a + b + c + d + e + f + g + h;
+}
+
+static volatile TestVectorArgsFunc vector_args_func =
+    target_function_with_vector_args;
+static volatile TestVectorArgsFunc vector_args_clobber_func = sum_vector_args;
+static volatile gdouble vector_args_sink;
+
+TESTCASE (attach_lite_preserves_vector_arguments)
+{
+  TestCallbackListener * listener;
+  gdouble result;
+
+  listener = test_callback_listener_new ();
+  listener->on_enter =
+      (TestCallbackListenerFunc) clobbering_lite_listener_on_enter;
+  listener->user_data = fixture->result;
+
+  g_assert_cmpint (gum_interceptor_attach_lite (fixture->interceptor,
+      target_function_with_vector_args, GUM_INVOCATION_LISTENER (listener),
+      NULL), ==, GUM_ATTACH_OK);
+
+  /*
+   * The arguments travel in xmm0-7 on SysV x86-64 and xmm0-3 on Win64, and
+   * the listener clobbers all of them by making a call of its own.
+   */
+  result = vector_args_func (1, 2, 3, 4, 5, 6, 7, 8);
+  g_assert_cmpstr (fixture->result->str, ==, ">");
+  g_assert_cmpfloat (result, ==, 204);
+
+  gum_interceptor_detach (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+}
+
+#if defined (HAVE_I386) && defined (__GNUC__) && !defined (HAVE_WINDOWS)
+
+static __m256d GUM_NOINLINE TEST_AVX_FUNC
+target_function_with_avx_args (__m256d a,
+                               __m256d b)
+{
+  return _mm256_add_pd (a, _mm256_mul_pd (b, _mm256_set1_pd (2)));
+}
+
+static volatile TestAvxArgsFunc avx_args_func = target_function_with_avx_args;
+
+TESTCASE (attach_lite_preserves_avx_arguments_and_mxcsr)
+{
+  TestCallbackListener * listener;
+  gdouble result[4];
+  guint mxcsr_before, mxcsr_after;
+
+  if ((gum_query_cpu_features () & GUM_CPU_AVX2) == 0)
+  {
+    g_print ("<skipping, no AVX2 support> ");
+    return;
+  }
+
+  listener = test_callback_listener_new ();
+  listener->on_enter =
+      (TestCallbackListenerFunc) avx_clobbering_lite_listener_on_enter;
+  listener->user_data = fixture->result;
+
+  g_assert_cmpint (gum_interceptor_attach_lite (fixture->interceptor,
+      target_function_with_avx_args, GUM_INVOCATION_LISTENER (listener),
+      NULL), ==, GUM_ATTACH_OK);
+
+  /*
+   * The listener zeroes the upper halves of ymm0 and ymm1, which carry the
+   * arguments, and flips the rounding mode.
+   */
+  call_avx_args_function (result, &mxcsr_before, &mxcsr_after);
+  g_assert_cmpstr (fixture->result->str, ==, ">");
+  g_assert_cmpfloat (result[0], ==, 21);
+  g_assert_cmpfloat (result[1], ==, 42);
+  g_assert_cmpfloat (result[2], ==, 63);
+  g_assert_cmpfloat (result[3], ==, 84);
+  g_assert_cmphex (mxcsr_after, ==, mxcsr_before);
+
+  gum_interceptor_detach (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+}
+
+static void GUM_NOINLINE TEST_AVX_FUNC
+call_avx_args_function (gdouble * result,
+                        guint * mxcsr_before,
+                        guint * mxcsr_after)
+{
+  __m256d a, b, r;
+
+  a = _mm256_set_pd (4, 3, 2, 1);
+  b = _mm256_set_pd (40, 30, 20, 10);
+
+  *mxcsr_before = _mm_getcsr ();
+  r = avx_args_func (a, b);
+  *mxcsr_after = _mm_getcsr ();
+
+  _mm256_storeu_pd (result, r);
+}
+
+static void TEST_AVX_FUNC
+avx_clobbering_lite_listener_on_enter (GString * str,
+                                       GumInvocationContext * context)
+{
+  g_string_append_c (str, '>');
+
+  _mm256_zeroupper ();
+  _mm_setcsr (_mm_getcsr () ^ _MM_ROUND_MASK);
+}
+
+#endif
+
+TESTCASE (stats)
+{
+  GumHookStats stats;
+  TestCallbackListener * listener;
+
+  g_assert_false (gum_interceptor_query_stats (fixture->interceptor,
+      target_function, &stats));
+
+  gum_interceptor_set_stats_enabled (fixture->interceptor, TRUE);
+
+  /* Times are in nanoseconds, and each call sleeps for at least 100 us. */
+  listener = test_callback_listener_new ();
+  listener->on_enter = sleep_in_listener;
+  g_assert_cmpint (gum_interceptor_attach (fixture->interceptor,
+      target_function, GUM_INVOCATION_LISTENER (listener), NULL), ==,
+      GUM_ATTACH_OK);
+  target_function (fixture->result);
+  target_function (fixture->result);
+
+  g_assert_true (gum_interceptor_query_stats (fixture->interceptor,
+      target_function, &stats));
+  g_assert_cmpuint (stats.hits, ==, 2);
+  g_assert_cmpuint (stats.listener_time, >=, 2 * 100 * 1000);
+  g_assert_cmpuint (stats.replacement_time, ==, 0);
+
+  gum_interceptor_set_stats_enabled (fixture->interceptor, FALSE);
+  target_function (fixture->result);
+  g_assert_true (gum_interceptor_query_stats (fixture->interceptor,
+      target_function, &stats));
+  g_assert_cmpuint (stats.hits, ==, 2);
+
+  /* A freshly attached function must not inherit a released slot's counts. */
+  gum_interceptor_detach (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_assert_false (gum_interceptor_query_stats (fixture->interceptor,
+      target_function, &stats));
+  g_assert_cmpint (gum_interceptor_attach (fixture->interceptor,
+      target_function, GUM_INVOCATION_LISTENER (listener), NULL), ==,
+      GUM_ATTACH_OK);
+  g_assert_true (gum_interceptor_query_stats (fixture->interceptor,
+      target_function, &stats));
+  g_assert_cmpuint (stats.hits, ==, 0);
+
+  gum_interceptor_detach (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+}
+
+static void
+sleep_in_listener (gpointer user_data,
+                   GumInvocationContext * context)
+{
+  g_usleep (100);
+}
+
+static void
+record_max_stack_depth (guint * max_depth,
+                        GumInvocationContext * context)
+{
+  *max_depth = MAX (*max_depth, gum_invocation_stack_get_depth (
+      gum_interceptor_get_current_stack ()));
+}
+
+void GUM_NOINLINE
+block_until_released (BlockingCallContext * ctx)
+{
+  g_mutex_lock (&ctx->mutex);
+  ctx->entered = TRUE;
+  g_cond_signal (&ctx->cond);
+  while (!ctx->released)
+    g_cond_wait (&ctx->cond, &ctx->mutex);
+  g_mutex_unlock (&ctx->mutex);
+}
+
+TESTCASE (attach_after_detach_during_invocation)
+{
+  BlockingCallContext call;
+  InvocationDataListenerContext contexts[4];
+  TestCallbackListener * a, * b, * c, * d;
+  GThread * thread;
+
+  g_mutex_init (&call.mutex);
+  g_cond_init (&call.cond);
+  call.entered = FALSE;
+  call.released = FALSE;
+
+  a = attach_invocation_data_listener (fixture, block_until_released,
+      &contexts[0], 'a');
+  b = attach_invocation_data_listener (fixture, block_until_released,
+      &contexts[1], 'c');
+  c = attach_invocation_data_listener (fixture, block_until_released,
+      &contexts[2], 'e');
+
+  thread = g_thread_new ("interceptor-test-blocking",
+      (GThreadFunc) call_block_until_released, &call);
+
+  g_mutex_lock (&call.mutex);
+  while (!call.entered)
+    g_cond_wait (&call.cond, &call.mutex);
+  g_mutex_unlock (&call.mutex);
+
+  /*
+   * The invocation above entered with b's data in its slot, so d must not
+   * be handed that slot while the invocation is still in flight.
+   */
+  gum_interceptor_detach (fixture->interceptor, GUM_INVOCATION_LISTENER (b));
+  d = attach_invocation_data_listener (fixture, block_until_released,
+      &contexts[3], 'g');
+
+  g_mutex_lock (&call.mutex);
+  call.released = TRUE;
+  g_cond_signal (&call.cond);
+  g_mutex_unlock (&call.mutex);
+
+  g_thread_join (thread);
+
+  g_assert_cmpstr (fixture->result->str, ==, "acebf-");
+
+  gum_interceptor_detach (fixture->interceptor, GUM_INVOCATION_LISTENER (a));
+  gum_interceptor_detach (fixture->interceptor, GUM_INVOCATION_LISTENER (c));
+  gum_interceptor_detach (fixture->interceptor, GUM_INVOCATION_LISTENER (d));
+  g_object_unref (a);
+  g_object_unref (b);
+  g_object_unref (c);
+  g_object_unref (d);
+
+  g_cond_clear (&call.cond);
+  g_mutex_clear (&call.mutex);
+}
+
+static gpointer
+call_block_until_released (BlockingCallContext * ctx)
+{
+  block_until_released (ctx);
+
+  return NULL;
+}
+
+static TestCallbackListener *
+attach_invocation_data_listener (TestInterceptorFixture * fixture,
+                                 gpointer function,
+                                 InvocationDataListenerContext * ctx,
+                                 gchar enter_char)
+{
+  TestCallbackListener * listener;
+
+  ctx->result = fixture->result;
+  ctx->enter_char = enter_char;
+
+  listener = test_callback_listener_new ();
+  listener->on_enter =
+      (TestCallbackListenerFunc) invocation_data_listener_on_enter;
+  listener->on_leave =
+      (TestCallbackListenerFunc) invocation_data_listener_on_leave;
+  listener->user_data = ctx;
+
+  g_assert_cmpint (gum_interceptor_attach (fixture->interceptor, function,
+      GUM_INVOCATION_LISTENER (listener), NULL), ==, GUM_ATTACH_OK);
+
+  return listener;
+}
+
+static void
+invocation_data_listener_on_enter (InvocationDataListenerContext * self,
+                                   GumInvocationContext * context)
+{
+  gchar * data = GUM_IC_GET_INVOCATION_DATA (context, gchar);
+
+  g_assert_cmpint (*data, ==, 0);
+  *data = self->enter_char;
+
+  g_string_append_c (self->result, self->enter_char);
+}
+
+static void
+invocation_data_listener_on_leave (InvocationDataListenerContext * self,
+                                   GumInvocationContext * context)
+{
+  gchar * data = GUM_IC_GET_INVOCATION_DATA (context, gchar);
+
+  /* Attached after the invocation entered, so there should be no data */
+  if (*data == 0)
+  {
+    g_string_append_c (self->result, '-');
+    return;
+  }
+
+  g_assert_cmpint (*data, ==, self->enter_char);
+
+  g_string_append_c (self->result, *data + 1);
+}
+
+static void
+lite_listener_on_enter (GString * str,
+                        GumInvocationContext * context)
+{
+  g_string_append_c (str, '>');
+}
+
+static void
+clobbering_lite_listener_on_enter (GString * str,
+                                   GumInvocationContext * context)
+{
+  g_string_append_c (str, '>');
+
+  vector_args_sink =
+      vector_args_clobber_func (-1, -2, -3, -4, -5, -6, -7, -8);
+}
+
+static void
+lite_listener_on_leave (GString * str,
+                        GumInvocationContext * context)
+{
+  g_string_append_c (str, '<');
+}
+
 void GUM_NOINLINE
 recursive_function (GString * str,
                     gint count)
@@ -107,6 +622,44 @@ TESTCASE (attach_to_recursive_function)
   g_assert_cmpstr (fixture->result->str, ==, ">>>>>0<1<2<3<4<");
 }
 
+TESTCASE (attach_to_deeply_recursive_function)
+{
+  const gint depth = 3 * GUM_MAX_CALL_DEPTH;
+  TestCallbackListener * listener;
+  guint max_depth = 0;
+  GString * expected;
+  gint i;
+
+  interceptor_fixture_attach (fixture, 0, recursive_function, '>', '<');
+
+  listener = test_callback_listener_new ();
+  listener->on_enter = (TestCallbackListenerFunc) record_max_stack_depth;
+  listener->user_data = &max_depth;
+  g_assert_cmpint (gum_interceptor_attach (fixture->interceptor,
+      recursive_function, GUM_INVOCATION_LISTENER (listener), NULL), ==,
+      GUM_ATTACH_OK);
+
+  recursive_function (fixture->result, depth);
+
+  g_assert_cmpuint (max_depth, ==, depth + 1);
+  g_assert_cmpuint (gum_invocation_stack_get_depth (
+      gum_interceptor_get_current_stack ()), ==, 0);
+
+  expected = g_string_new ("");
+  for (i = 0; i <= depth; i++)
+    g_string_append_c (expected, '>');
+  for (i = 0; i <= depth; i++)
+    g_string_append_printf (expected, "%d<", i);
+
+  g_assert_cmpstr (fixture->result->str, ==, expected->str);
+
+  g_string_free (expected, TRUE);
+
+  gum_interceptor_detach (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+}
+
 TESTCASE (attach_to_special_function)
 {
   interceptor_fixture_attach (fixture, 0, special_function, '>', '<');
@@ -162,6 +715,67 @@ TESTCASE (attach_to_heap_api)
   g_assert_cmpstr (fixture->result->str, ==, "><ab");
 }
 
+TESTCASE (attach_to_heap_api_on_new_thread)
+{
+  HeapThreadContext ctx;
+  TestCallbackListener * listener;
+  GThread * thread;
+
+  if (RUNNING_ON_VALGRIND)
+  {
+    g_print ("<skipping, not compatible with Valgrind> ");
+    return;
+  }
+
+  ctx.malloc_impl = interceptor_fixture_get_libc_malloc ();
+  ctx.free_impl = interceptor_fixture_get_libc_free ();
+  ctx.thread_id = 0;
+  ctx.malloc_calls = 0;
+
+  listener = test_callback_listener_new ();
+  listener->on_enter = (TestCallbackListenerFunc) count_malloc_on_heap_thread;
+  listener->user_data = &ctx;
+
+  /*
+   * The new thread's first hooked call is into malloc(), so setting up its
+   * interceptor state must not recurse back into the hook.
+   */
+  g_assert_cmpint (gum_interceptor_attach (fixture->interceptor,
+      ctx.malloc_impl, GUM_INVOCATION_LISTENER (listener), NULL),
+      ==, GUM_ATTACH_OK);
+
+  thread = g_thread_new ("interceptor-test-heap",
+      (GThreadFunc) thread_calling_malloc, &ctx);
+  g_thread_join (thread);
+
+  gum_interceptor_detach (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+
+  g_assert_cmpint (ctx.malloc_calls, >=, 1);
+}
+
+static gpointer
+thread_calling_malloc (HeapThreadContext * ctx)
+{
+  volatile gpointer p;
+
+  ctx->thread_id = gum_process_get_current_thread_id ();
+
+  p = ctx->malloc_impl (42);
+  ctx->free_impl (p);
+
+  return NULL;
+}
+
+static void
+count_malloc_on_heap_thread (HeapThreadContext * ctx,
+                             GumInvocationContext * context)
+{
+  if (gum_invocation_context_get_thread_id (context) == ctx->thread_id)
+    g_atomic_int_inc (&ctx->malloc_calls);
+}
+
 TESTCASE (attach_to_own_api)
 {
   TestCallbackListener * listener;
@@ -249,6 +863,103 @@ TESTCASE (function_arguments)
       ==, 0x12349876);
 }
 
+TESTCASE (call_counter)
+{
+  volatile gint counter = 0;
+
+  g_assert_cmpint (gum_interceptor_attach_call_counter (fixture->interceptor,
+      target_nop_function_a, &counter), ==, GUM_ATTACH_OK);
+  g_assert_cmpint (gum_interceptor_attach_call_counter (fixture->interceptor,
+      target_nop_function_a, &counter), ==, GUM_ATTACH_ALREADY_ATTACHED);
+
+  target_nop_function_a (NULL);
+  target_nop_function_a (NULL);
+  g_assert_cmpint (counter, ==, 2);
+
+  interceptor_fixture_attach (fixture, 0, target_nop_function_a, 'a', 'b');
+  target_nop_function_a (NULL);
+  g_assert_cmpint (counter, ==, 3);
+  g_assert_cmpstr (fixture->result->str, ==, "ab");
+
+  interceptor_fixture_detach (fixture, 0);
+  target_nop_function_a (NULL);
+  g_assert_cmpint (counter, ==, 4);
+
+  gum_interceptor_detach_probes (fixture->interceptor, target_nop_function_a);
+  target_nop_function_a (NULL);
+  g_assert_cmpint (counter, ==, 4);
+}
+
+static void call_target_function_on_enter (GString * str,
+    GumInvocationContext * ctx);
+
+TESTCASE (call_counter_should_count_every_entry)
+{
+  volatile gint counter = 0;
+  TestCallbackListener * listener;
+
+  g_assert_cmpint (gum_interceptor_attach_call_counter (fixture->interceptor,
+      target_function, &counter), ==, GUM_ATTACH_OK);
+  target_function (fixture->result);
+  g_assert_cmpint (counter, ==, 1);
+
+  g_string_truncate (fixture->result, 0);
+  g_assert_cmpint (gum_interceptor_replace (fixture->interceptor,
+      target_function, replacement_target_function, NULL),
+      ==, GUM_REPLACE_OK);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "/|\\");
+  g_assert_cmpint (counter, ==, 3);
+  gum_interceptor_revert (fixture->interceptor, target_function);
+
+  g_string_truncate (fixture->result, 0);
+  listener = test_callback_listener_new ();
+  listener->on_enter = (TestCallbackListenerFunc) call_target_function_on_enter;
+  listener->user_data = fixture->result;
+  g_assert_cmpint (gum_interceptor_attach (fixture->interceptor,
+      target_nop_function_a, GUM_INVOCATION_LISTENER (listener), NULL),
+      ==, GUM_ATTACH_OK);
+  target_nop_function_a (NULL);
+  g_assert_cmpstr (fixture->result->str, ==, "|");
+  g_assert_cmpint (counter, ==, 4);
+
+  gum_interceptor_detach (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+  gum_interceptor_detach_probes (fixture->interceptor, target_function);
+}
+
+static void
+call_target_function_on_enter (GString * str,
+                               GumInvocationContext * ctx)
+{
+  target_function (str);
+}
+
+TESTCASE (call_recorder)
+{
+  GumCallRecorder * recorder;
+
+  recorder = gum_call_recorder_new (2, 1);
+
+  g_assert_cmpint (gum_interceptor_attach_call_recorder (fixture->interceptor,
+      target_nop_function_a, recorder), ==, GUM_ATTACH_OK);
+
+  target_nop_function_a (GSIZE_TO_POINTER (0x1234));
+  target_nop_function_a (GSIZE_TO_POINTER (0x5678));
+  target_nop_function_a (GSIZE_TO_POINTER (0x9abc));
+
+  g_assert_cmpuint (recorder->head, ==, 3);
+  g_assert_cmphex (GPOINTER_TO_SIZE (recorder->records[0].args[0]),
+      ==, 0x9abc);
+  g_assert_cmphex (GPOINTER_TO_SIZE (recorder->records[1].args[0]),
+      ==, 0x5678);
+  g_assert_nonnull (recorder->records[0].return_address);
+
+  gum_interceptor_detach_probes (fixture->interceptor, target_nop_function_a);
+  gum_call_recorder_free (recorder);
+}
+
 TESTCASE (function_return_value)
 {
   gpointer return_value;
@@ -329,6 +1040,40 @@ TESTCASE (ignore_other_threads)
   g_assert_cmpstr (fixture->result->str, ==, ">|<|>|<");
 }
 
+TESTCASE (thread_filter)
+{
+  GumInvocationListener * listener;
+  GumThreadId self_id, other_id;
+
+  interceptor_fixture_attach (fixture, 0, target_function, '>', '<');
+  interceptor_fixture_attach (fixture, 1, target_function, 'a', 'b');
+  listener = GUM_INVOCATION_LISTENER (fixture->listener_context[0]->listener);
+
+  self_id = gum_process_get_current_thread_id ();
+  other_id = self_id + 1;
+
+  gum_interceptor_set_thread_filter (fixture->interceptor, listener,
+      &other_id, 1);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "a|b");
+  g_string_truncate (fixture->result, 0);
+
+  gum_interceptor_set_thread_filter (fixture->interceptor, listener,
+      &self_id, 1);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, ">a|<b");
+  g_string_truncate (fixture->result, 0);
+
+  g_thread_join (g_thread_new ("interceptor-test-thread-filter",
+      (GThreadFunc) target_function, fixture->result));
+  g_assert_cmpstr (fixture->result->str, ==, "a|b");
+  g_string_truncate (fixture->result, 0);
+
+  gum_interceptor_set_thread_filter (fixture->interceptor, listener, NULL, 0);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, ">a|<b");
+}
+
 TESTCASE (detach)
 {
   interceptor_fixture_attach (fixture, 0, target_function, 'a', 'b');
@@ -672,6 +1417,40 @@ replacement_target_function (GString * str)
   return result;
 }
 
+TESTCASE (replace_fast)
+{
+  g_assert_cmpint (gum_interceptor_replace_fast (fixture->interceptor,
+      target_function, replacement_target_function_fast,
+      (gpointer *) &target_function_original), ==, GUM_REPLACE_OK);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "/|\\");
+
+  g_string_truncate (fixture->result, 0);
+  interceptor_fixture_attach (fixture, 0, target_function, '>', '<');
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, ">/|\\<");
+
+  g_string_truncate (fixture->result, 0);
+  interceptor_fixture_detach (fixture, 0);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "/|\\");
+
+  gum_interceptor_revert (fixture->interceptor, target_function);
+  target_function_original = NULL;
+}
+
+static gpointer
+replacement_target_function_fast (GString * str)
+{
+  gpointer result;
+
+  g_string_append_c (str, '/');
+  result = target_function_original (str);
+  g_string_append_c (str, '\\');
+
+  return result;
+}
+
 TESTCASE (i_can_has_replaceability)
 {
   UnsupportedFunction * unsupported_functions;
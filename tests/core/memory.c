@@ -8,6 +8,8 @@
 
 #include "gummemory-priv.h"
 
+#include <string.h>
+
 #define TESTCASE(NAME) \
     void test_memory_ ## NAME (void)
 #define TESTENTRY(NAME) \
@@ -16,19 +18,29 @@
 TESTLIST_BEGIN (memory)
   TESTENTRY (read_from_valid_address_should_succeed)
   TESTENTRY (read_from_invalid_address_should_fail)
+#ifdef HAVE_LINUX
+  TESTENTRY (read_from_unmapped_address_with_huge_length_should_fail)
+#endif
   TESTENTRY (read_from_unaligned_address_should_succeed)
   TESTENTRY (read_across_two_pages_should_return_correct_data)
   TESTENTRY (read_beyond_page_should_return_partial_data)
+  TESTENTRY (read_batch_reports_each_range)
   TESTENTRY (write_to_valid_address_should_succeed)
   TESTENTRY (write_to_invalid_address_should_fail)
   TESTENTRY (match_pattern_from_string_does_proper_validation)
   TESTENTRY (scan_range_finds_three_exact_matches)
   TESTENTRY (scan_range_finds_three_wildcarded_matches)
   TESTENTRY (scan_range_finds_three_masked_matches)
+  TESTENTRY (scan_range_finds_matches_across_vector_blocks)
+  TESTENTRY (scan_ranges_reports_matches_in_address_order)
+  TESTENTRY (scan_ranges_reports_unreadable_memory)
+  TESTENTRY (scan_multi_reports_matches_in_address_order)
   TESTENTRY (is_memory_readable_handles_mixed_page_protections)
   TESTENTRY (alloc_n_pages_returns_aligned_rw_address)
   TESTENTRY (alloc_n_pages_near_returns_aligned_rw_address_within_range)
+  TESTENTRY (alloc_n_pages_near_handles_repeated_allocations)
   TESTENTRY (mprotect_handles_page_boundaries)
+  TESTENTRY (memory_map_contains_only_mapped_ranges)
 TESTLIST_END ()
 
 typedef struct _TestForEachContext {
@@ -39,8 +51,15 @@ typedef struct _TestForEachContext {
   guint expected_size;
 } TestForEachContext;
 
+typedef struct _TestMultiScanContext {
+  GumAddress base_address;
+  GString * result;
+} TestMultiScanContext;
+
 static gboolean match_found_cb (GumAddress address, gsize size,
     gpointer user_data);
+static gboolean multi_match_found_cb (GumAddress address, gsize size,
+    guint pattern_index, gpointer user_data);
 
 TESTCASE (read_from_valid_address_should_succeed)
 {
@@ -65,6 +84,22 @@ TESTCASE (read_from_invalid_address_should_fail)
   g_assert_null (gum_memory_read (invalid_address, 1, NULL));
 }
 
+#ifdef HAVE_LINUX
+
+TESTCASE (read_from_unmapped_address_with_huge_length_should_fail)
+{
+  gpointer page;
+  gsize n_bytes_read = 1;
+
+  page = gum_alloc_n_pages (1, GUM_PAGE_RW);
+  gum_free_pages (page);
+
+  g_assert_null (gum_memory_read (page, G_MAXSSIZE, &n_bytes_read));
+  g_assert_cmpuint (n_bytes_read, ==, 0);
+}
+
+#endif
+
 TESTCASE (read_from_unaligned_address_should_succeed)
 {
   gpointer page;
@@ -146,6 +181,54 @@ TESTCASE (read_beyond_page_should_return_partial_data)
   gum_free_pages (page);
 }
 
+TESTCASE (read_batch_reports_each_range)
+{
+  guint8 * page;
+  guint page_size;
+  GumMemoryRange ranges[4];
+  guint8 buffer[2 + 4 + 0 + 3];
+  gsize n_bytes_read[G_N_ELEMENTS (ranges)];
+
+  page = gum_alloc_n_pages (2, GUM_PAGE_RW);
+  page_size = gum_query_page_size ();
+  page[0] = 0x13;
+  page[1] = 0x37;
+  page[page_size - 2] = 0xca;
+  page[page_size - 1] = 0xfe;
+  page[42] = 0x42;
+  gum_mprotect (page + page_size, page_size, GUM_PAGE_NO_ACCESS);
+
+  ranges[0].base_address = GUM_ADDRESS (page);
+  ranges[0].size = 2;
+  ranges[1].base_address = GUM_ADDRESS (page + page_size - 2);
+  ranges[1].size = 4;
+  ranges[2].base_address = GUM_ADDRESS (page + page_size);
+  ranges[2].size = 0;
+  ranges[3].base_address = GUM_ADDRESS (page + 41);
+  ranges[3].size = 3;
+
+  memset (buffer, 0xff, sizeof (buffer));
+  g_assert_false (gum_memory_read_batch (ranges, G_N_ELEMENTS (ranges),
+      buffer, n_bytes_read));
+
+  g_assert_cmpuint (n_bytes_read[0], ==, 2);
+  g_assert_cmpuint (n_bytes_read[1], ==, 2);
+  g_assert_cmpuint (n_bytes_read[2], ==, 0);
+  g_assert_cmpuint (n_bytes_read[3], ==, 3);
+
+  g_assert_cmphex (buffer[0], ==, 0x13);
+  g_assert_cmphex (buffer[1], ==, 0x37);
+  g_assert_cmphex (buffer[2], ==, 0xca);
+  g_assert_cmphex (buffer[3], ==, 0xfe);
+  g_assert_cmphex (buffer[4], ==, 0x00);
+  g_assert_cmphex (buffer[5], ==, 0x00);
+  g_assert_cmphex (buffer[6], ==, 0x00);
+  g_assert_cmphex (buffer[7], ==, 0x42);
+  g_assert_cmphex (buffer[8], ==, 0x00);
+
+  gum_free_pages (page);
+}
+
 TESTCASE (write_to_valid_address_should_succeed)
 {
   guint8 bytes[3] = { 0x00, 0x00, 0x12 };
@@ -374,6 +457,169 @@ TESTCASE (scan_range_finds_three_masked_matches)
   gum_match_pattern_free (pattern);
 }
 
+TESTCASE (scan_range_finds_matches_across_vector_blocks)
+{
+  const gchar * patterns[] = {
+    "12 34 56 78",
+    "12 34 56 78 : fe f4 fe 7f",
+  };
+  guint8 buf[300];
+  GumMemoryRange range;
+  guint i;
+
+  for (i = 0; i != sizeof (buf); i += 4)
+  {
+    buf[i + 0] = 0x12;
+    buf[i + 1] = 0x00;
+    buf[i + 2] = 0x00;
+    buf[i + 3] = 0x78;
+  }
+  memcpy (buf + 5, "\x12\x34\x56\x78", 4);
+  memcpy (buf + 97, "\x12\x34\x56\x78", 4);
+  memcpy (buf + sizeof (buf) - 4, "\x12\x34\x56\x78", 4);
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = sizeof (buf);
+
+  for (i = 0; i != G_N_ELEMENTS (patterns); i++)
+  {
+    GumMatchPattern * pattern;
+    TestForEachContext ctx;
+
+    pattern = gum_match_pattern_new_from_string (patterns[i]);
+    g_assert_nonnull (pattern);
+
+    ctx.expected_address[0] = buf + 5;
+    ctx.expected_address[1] = buf + 97;
+    ctx.expected_address[2] = buf + sizeof (buf) - 4;
+    ctx.expected_size = 4;
+
+    ctx.number_of_calls = 0;
+    ctx.value_to_return = TRUE;
+    gum_memory_scan (&range, pattern, match_found_cb, &ctx);
+    g_assert_cmpuint (ctx.number_of_calls, ==, 3);
+
+    gum_match_pattern_free (pattern);
+  }
+}
+
+TESTCASE (scan_ranges_reports_matches_in_address_order)
+{
+  const gsize chunk_size = 4 * 1024 * 1024;
+  const gsize buf_size = (2 * chunk_size) + 4096;
+  guint8 * buf;
+  GumMemoryRange ranges[2];
+  GumMatchPattern * pattern;
+  TestForEachContext ctx;
+  GError * error = NULL;
+
+  buf = g_malloc0 (buf_size);
+  memcpy (buf + 100, "\x13\x37\xca\xfe", 4);
+  memcpy (buf + chunk_size - 2, "\x13\x37\xca\xfe", 4);
+  memcpy (buf + buf_size - 4, "\x13\x37\xca\xfe", 4);
+
+  ranges[0].base_address = GUM_ADDRESS (buf);
+  ranges[0].size = chunk_size + 64;
+  ranges[1].base_address = GUM_ADDRESS (buf + chunk_size + 64);
+  ranges[1].size = buf_size - (chunk_size + 64);
+
+  pattern = gum_match_pattern_new_from_string ("13 37 ?? fe");
+  g_assert_nonnull (pattern);
+
+  ctx.expected_address[0] = buf + 100;
+  ctx.expected_address[1] = buf + chunk_size - 2;
+  ctx.expected_address[2] = buf + buf_size - 4;
+  ctx.expected_size = 4;
+
+  ctx.number_of_calls = 0;
+  ctx.value_to_return = TRUE;
+  g_assert_true (gum_memory_scan_ranges (ranges, G_N_ELEMENTS (ranges),
+      pattern, match_found_cb, &ctx, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (ctx.number_of_calls, ==, 3);
+
+  ctx.number_of_calls = 0;
+  ctx.value_to_return = FALSE;
+  g_assert_true (gum_memory_scan_ranges (ranges, G_N_ELEMENTS (ranges),
+      pattern, match_found_cb, &ctx, &error));
+  g_assert_cmpuint (ctx.number_of_calls, ==, 1);
+
+  gum_match_pattern_free (pattern);
+  g_free (buf);
+}
+
+TESTCASE (scan_ranges_reports_unreadable_memory)
+{
+  guint8 * pages;
+  guint page_size;
+  GumMemoryRange range;
+  GumMatchPattern * pattern;
+  TestForEachContext ctx;
+  GError * error = NULL;
+
+  pages = gum_alloc_n_pages (2, GUM_PAGE_RW);
+  page_size = gum_query_page_size ();
+  pages[16] = 0x13;
+  pages[17] = 0x37;
+  gum_mprotect (pages + page_size, page_size, GUM_PAGE_NO_ACCESS);
+
+  range.base_address = GUM_ADDRESS (pages);
+  range.size = 2 * page_size;
+
+  pattern = gum_match_pattern_new_from_string ("13 37");
+
+  ctx.expected_address[0] = pages + 16;
+  ctx.expected_size = 2;
+  ctx.number_of_calls = 0;
+  ctx.value_to_return = TRUE;
+  g_assert_false (gum_memory_scan_ranges (&range, 1, pattern, match_found_cb,
+      &ctx, &error));
+  g_assert_nonnull (error);
+  g_assert_cmpuint (ctx.number_of_calls, ==, 1);
+  g_error_free (error);
+
+  gum_match_pattern_free (pattern);
+  gum_free_pages (pages);
+}
+
+TESTCASE (scan_multi_reports_matches_in_address_order)
+{
+  guint8 buf[] = {
+    0xca, 0xfe, 0x00, 0xba, 0xbe,
+    0x13, 0x37,
+    0x2f, 0x3f,
+    0x13, 0x37
+  };
+  const gchar * pattern_strs[] = {
+    "13 37",
+    "ca fe ?? ba be",
+    "22 34 : f0 f0",
+  };
+  GumMatchPattern * patterns[G_N_ELEMENTS (pattern_strs)];
+  GumMemoryRange range;
+  TestMultiScanContext ctx;
+  guint i;
+
+  for (i = 0; i != G_N_ELEMENTS (pattern_strs); i++)
+  {
+    patterns[i] = gum_match_pattern_new_from_string (pattern_strs[i]);
+    g_assert_nonnull (patterns[i]);
+  }
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = sizeof (buf);
+
+  ctx.base_address = range.base_address;
+  ctx.result = g_string_new ("");
+  gum_memory_scan_multi (&range, (const GumMatchPattern * const *) patterns,
+      G_N_ELEMENTS (patterns), multi_match_found_cb, &ctx);
+  g_assert_cmpstr (ctx.result->str, ==, "1@0/5 0@5/2 2@7/2 0@9/2 ");
+
+  for (i = 0; i != G_N_ELEMENTS (patterns); i++)
+    gum_match_pattern_free (patterns[i]);
+  g_string_free (ctx.result, TRUE);
+}
+
 TESTCASE (is_memory_readable_handles_mixed_page_protections)
 {
   guint8 * pages;
@@ -459,6 +705,42 @@ TESTCASE (alloc_n_pages_near_returns_aligned_rw_address_within_range)
   gum_free_pages (page);
 }
 
+TESTCASE (alloc_n_pages_near_handles_repeated_allocations)
+{
+  GumAddressSpec as;
+  guint variable_on_stack;
+  gpointer pages[32];
+  guint round, i, j;
+
+  as.near_address = &variable_on_stack;
+  as.max_distance = G_MAXINT32;
+
+  for (round = 0; round != 2; round++)
+  {
+    for (i = 0; i != G_N_ELEMENTS (pages); i++)
+    {
+      gsize actual_distance;
+
+      pages[i] = gum_alloc_n_pages_near (1 + (i % 3), GUM_PAGE_RW, &as);
+      g_assert_nonnull (pages[i]);
+
+      actual_distance = ABS ((guint8 *) pages[i] - (guint8 *) as.near_address);
+      g_assert_cmpuint (actual_distance, <=, as.max_distance);
+
+      for (j = 0; j != i; j++)
+        g_assert_true (pages[j] != pages[i]);
+
+      *((gsize *) pages[i]) = i;
+    }
+
+    for (i = 0; i != G_N_ELEMENTS (pages); i++)
+    {
+      g_assert_cmpuint (*((gsize *) pages[i]), ==, i);
+      gum_free_pages (pages[i]);
+    }
+  }
+}
+
 TESTCASE (mprotect_handles_page_boundaries)
 {
   guint8 * pages;
@@ -474,6 +756,43 @@ TESTCASE (mprotect_handles_page_boundaries)
   gum_free_pages (pages);
 }
 
+TESTCASE (memory_map_contains_only_mapped_ranges)
+{
+  GumMemoryMap * map;
+  guint8 * pages;
+  guint page_size;
+  GumMemoryRange r;
+
+  page_size = gum_query_page_size ();
+  pages = gum_alloc_n_pages (3, GUM_PAGE_RW);
+  gum_mprotect (pages + page_size, page_size, GUM_PAGE_NO_ACCESS);
+
+  map = gum_memory_map_new (GUM_PAGE_RW);
+
+  r.base_address = GUM_ADDRESS (pages);
+  r.size = page_size;
+  g_assert_true (gum_memory_map_contains (map, &r));
+  g_assert_true (gum_memory_map_contains (map, &r));
+
+  r.base_address = GUM_ADDRESS (pages + (2 * page_size));
+  g_assert_true (gum_memory_map_contains (map, &r));
+
+  r.base_address = GUM_ADDRESS (pages + page_size);
+  g_assert_false (gum_memory_map_contains (map, &r));
+
+  r.base_address = GUM_ADDRESS (pages);
+  r.size = 2 * page_size;
+  g_assert_false (gum_memory_map_contains (map, &r));
+
+  r.base_address = 0;
+  r.size = 1;
+  g_assert_false (gum_memory_map_contains (map, &r));
+
+  g_object_unref (map);
+
+  gum_free_pages (pages);
+}
+
 static gboolean
 match_found_cb (GumAddress address,
                 gsize size,
@@ -491,3 +810,17 @@ match_found_cb (GumAddress address,
 
   return ctx->value_to_return;
 }
+
+static gboolean
+multi_match_found_cb (GumAddress address,
+                      gsize size,
+                      guint pattern_index,
+                      gpointer user_data)
+{
+  TestMultiScanContext * ctx = user_data;
+
+  g_string_append_printf (ctx->result, "%u@%u/%u ", pattern_index,
+      (guint) (address - ctx->base_address), (guint) size);
+
+  return TRUE;
+}
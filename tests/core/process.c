@@ -24,6 +24,9 @@
 
 #if defined (HAVE_LINUX)
 # include "backend-linux/gumlinux.h"
+# include "backend-linux/gumlinux-priv.h"
+# include <glib/gstdio.h>
+# include <unistd.h>
 #endif
 
 #define TESTCASE(NAME) \
@@ -68,6 +71,9 @@ TESTLIST_BEGIN (process)
 #if defined (HAVE_LINUX) && !defined (HAVE_ANDROID)
   TESTENTRY (linux_process_modules)
 #endif
+#ifdef HAVE_LINUX
+  TESTENTRY (linux_ranges_should_handle_unusual_maps_lines)
+#endif
 #if defined (HAVE_LINUX) && defined (HAVE_SYS_AUXV_H)
   TESTENTRY (linux_get_cpu_from_auxv_null_32bit)
   TESTENTRY (linux_get_cpu_from_auxv_null_64bit)
@@ -352,6 +358,120 @@ verify_module_bounds (const GumModuleDetails * details,
 
 #endif
 
+#ifdef HAVE_LINUX
+
+typedef struct _CollectedRange CollectedRange;
+
+struct _CollectedRange
+{
+  GumMemoryRange range;
+  GumPageProtection protection;
+  gchar * path;
+  guint64 offset;
+};
+
+static gboolean collect_range (const GumRangeDetails * details,
+    gpointer user_data);
+static void collected_range_clear (CollectedRange * r);
+
+TESTCASE (linux_ranges_should_handle_unusual_maps_lines)
+{
+  gchar * long_path, * contents, * maps_path;
+  gint fd;
+  GArray * ranges;
+  const CollectedRange * r;
+
+  /* Longer than the 64 KiB that the parser starts out with. */
+  long_path = g_strnfill (70000, 'a');
+  long_path[0] = '/';
+
+  contents = g_strconcat (
+      "00400000-00401000 r-xp 00000000 08:01 1234 ",
+          "/tmp/with space (deleted)\n",
+      "00500000-00501000 rw-p 00001000 08:01 5678 ", long_path, "\n",
+      "00600000-00602000 ---p 00000000 00:00 0 \n",
+      "00700000-00703000 r--p 00002000 08:01 9012 /usr/lib/last.so",
+      NULL);
+
+  fd = g_file_open_tmp ("gum-maps-XXXXXX", &maps_path, NULL);
+  g_assert_cmpint (fd, !=, -1);
+  close (fd);
+  g_assert_true (g_file_set_contents (maps_path, contents, -1, NULL));
+
+  ranges = g_array_new (FALSE, FALSE, sizeof (CollectedRange));
+  g_array_set_clear_func (ranges, (GDestroyNotify) collected_range_clear);
+
+  _gum_linux_override_proc_maps_path (maps_path);
+  gum_linux_enumerate_ranges (getpid (), GUM_PAGE_NO_ACCESS, collect_range,
+      ranges);
+  _gum_linux_override_proc_maps_path (NULL);
+
+  g_assert_cmpuint (ranges->len, ==, 4);
+
+  r = &g_array_index (ranges, CollectedRange, 0);
+  g_assert_cmphex (r->range.base_address, ==, 0x400000);
+  g_assert_cmpuint (r->range.size, ==, 0x1000);
+  g_assert_cmpint (r->protection, ==, GUM_PAGE_RX);
+  g_assert_cmpstr (r->path, ==, "/tmp/with space (deleted)");
+
+  r = &g_array_index (ranges, CollectedRange, 1);
+  g_assert_cmphex (r->range.base_address, ==, 0x500000);
+  g_assert_cmpint (r->protection, ==, GUM_PAGE_RW);
+  g_assert_cmpstr (r->path, ==, long_path);
+  g_assert_cmphex (r->offset, ==, 0x1000);
+
+  r = &g_array_index (ranges, CollectedRange, 2);
+  g_assert_cmphex (r->range.base_address, ==, 0x600000);
+  g_assert_cmpint (r->protection, ==, GUM_PAGE_NO_ACCESS);
+  g_assert_null (r->path);
+
+  r = &g_array_index (ranges, CollectedRange, 3);
+  g_assert_cmphex (r->range.base_address, ==, 0x700000);
+  g_assert_cmpuint (r->range.size, ==, 0x3000);
+  g_assert_cmpint (r->protection, ==, GUM_PAGE_READ);
+  g_assert_cmpstr (r->path, ==, "/usr/lib/last.so");
+  g_assert_cmphex (r->offset, ==, 0x2000);
+
+  g_array_free (ranges, TRUE);
+  g_unlink (maps_path);
+  g_free (maps_path);
+  g_free (contents);
+  g_free (long_path);
+}
+
+static gboolean
+collect_range (const GumRangeDetails * details,
+               gpointer user_data)
+{
+  GArray * ranges = user_data;
+  CollectedRange r;
+
+  r.range = *details->range;
+  r.protection = details->protection;
+  if (details->file != NULL)
+  {
+    r.path = g_strdup (details->file->path);
+    r.offset = details->file->offset;
+  }
+  else
+  {
+    r.path = NULL;
+    r.offset = 0;
+  }
+
+  g_array_append_val (ranges, r);
+
+  return TRUE;
+}
+
+static void
+collected_range_clear (CollectedRange * r)
+{
+  g_free (r->path);
+}
+
+#endif
+
 #if defined (HAVE_LINUX) && defined (HAVE_SYS_AUXV_H)
 
 TESTCASE (linux_get_cpu_from_auxv_null_32bit)
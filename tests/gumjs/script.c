@@ -75,6 +75,7 @@ TESTLIST_BEGIN (script)
     TESTENTRY (instructions_can_be_probed)
     TESTENTRY (interceptor_should_support_native_pointer_values)
     TESTENTRY (interceptor_handles_invalid_arguments)
+    TESTENTRY (interceptor_stats_can_be_queried)
   TESTGROUP_END ()
   TESTGROUP_BEGIN ("Interceptor/Performance")
     TESTENTRY (interceptor_on_enter_performance)
@@ -148,6 +149,9 @@ TESTLIST_BEGIN (script)
     TESTENTRY (memory_can_be_scanned_synchronously)
     TESTENTRY (memory_scan_should_be_interruptible)
     TESTENTRY (memory_scan_handles_unreadable_memory)
+    TESTENTRY (memory_ranges_can_be_scanned)
+    TESTENTRY (memory_can_be_read_in_batches)
+    TESTENTRY (memory_can_be_scanned_for_multiple_patterns)
     TESTENTRY (memory_access_can_be_monitored)
     TESTENTRY (memory_access_can_be_monitored_one_range)
   TESTGROUP_END ()
@@ -341,6 +345,10 @@ TESTLIST_BEGIN (script)
 #endif
 #if defined (HAVE_I386) || defined (HAVE_ARM64)
     TESTENTRY (call_can_be_probed)
+    TESTENTRY (execution_can_be_transformed_with_callout_rules)
+    TESTENTRY (execution_can_be_transformed_with_drop_rules)
+    TESTENTRY (execution_can_be_transformed_with_block_counter_rules)
+    TESTENTRY (invalid_transform_rules_should_be_rejected)
 #endif
     TESTENTRY (stalker_events_can_be_parsed)
   TESTGROUP_END ()
@@ -409,6 +417,11 @@ static void on_read_ready (GObject * source_object, GAsyncResult * res,
 static gpointer run_stalked_through_hooked_function (gpointer data);
 static gpointer run_stalked_through_target_function (gpointer data);
 #endif
+#if defined (HAVE_I386) || defined (HAVE_ARM64)
+static gpointer transform_rules_code_new (void);
+static void count_transform_rules_callout (GumCpuContext * cpu_context,
+    gpointer user_data);
+#endif
 
 static gpointer sleeping_dummy (gpointer data);
 
@@ -3095,6 +3108,225 @@ run_stalked_through_target_function (gpointer data)
   return NULL;
 }
 
+/*
+ * Returns 3 by setting a register to 1 and then incrementing it twice, the
+ * second increment being TRANSFORM_RULES_STEP_SIZE bytes at
+ * TRANSFORM_RULES_SECOND_STEP_OFFSET.
+ */
+#if defined (HAVE_I386)
+# define TRANSFORM_RULES_STEP_MNEMONIC "inc"
+# define TRANSFORM_RULES_SECOND_STEP_OFFSET 7
+# define TRANSFORM_RULES_STEP_SIZE 2
+static const guint8 transform_rules_code[] = {
+  0xb8, 0x01, 0x00, 0x00, 0x00, /* mov eax, 1 */
+  0xff, 0xc0,                   /* inc eax    */
+  0xff, 0xc0,                   /* inc eax    */
+  0xc3,                         /* ret        */
+};
+#else
+# define TRANSFORM_RULES_STEP_MNEMONIC "add"
+# define TRANSFORM_RULES_SECOND_STEP_OFFSET 8
+# define TRANSFORM_RULES_STEP_SIZE 4
+static const guint32 transform_rules_code[] = {
+  GUINT32_TO_LE (0x52800020), /* mov w0, #1     */
+  GUINT32_TO_LE (0x11000400), /* add w0, w0, #1 */
+  GUINT32_TO_LE (0x11000400), /* add w0, w0, #1 */
+  GUINT32_TO_LE (0xd65f03c0), /* ret            */
+};
+#endif
+
+static GumMemoryRange transform_rules_code_range;
+
+TESTCASE (execution_can_be_transformed_with_callout_rules)
+{
+  gpointer code;
+  guint num_steps = 0;
+
+  code = transform_rules_code_new ();
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "const testsRange = Process.getModuleByName('%s');"
+      "Stalker.exclude(testsRange);"
+
+      "const f = new NativeFunction(" GUM_PTR_CONST ", 'int', [], "
+          "{ traps: 'all' });"
+
+      "Stalker.follow({"
+      "  transform: {"
+      "    callouts: [{"
+      "      mnemonic: '%s',"
+      "      callout: " GUM_PTR_CONST ","
+      "      data: " GUM_PTR_CONST
+      "    }]"
+      "  }"
+      "});"
+
+      "send(f());"
+      "send(f());"
+
+      "Stalker.unfollow();"
+      "Stalker.flush();",
+
+      GUM_TESTS_MODULE_NAME,
+      code,
+      TRANSFORM_RULES_STEP_MNEMONIC,
+      count_transform_rules_callout,
+      &num_steps);
+  EXPECT_SEND_MESSAGE_WITH ("3");
+  EXPECT_SEND_MESSAGE_WITH ("3");
+  EXPECT_NO_MESSAGES ();
+
+  g_assert_cmpuint (num_steps, ==, 2 * 2);
+
+  gum_free_pages (code);
+}
+
+TESTCASE (execution_can_be_transformed_with_drop_rules)
+{
+  gpointer code;
+
+  code = transform_rules_code_new ();
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "const testsRange = Process.getModuleByName('%s');"
+      "Stalker.exclude(testsRange);"
+
+      "const code = " GUM_PTR_CONST ";"
+      "const f = new NativeFunction(code, 'int', [], { traps: 'all' });"
+
+      "Stalker.follow({"
+      "  transform: {"
+      "    drop: [{ base: code.add(%u), size: %u }]"
+      "  }"
+      "});"
+
+      "send(f());"
+
+      "Stalker.unfollow();"
+      "Stalker.flush();"
+
+      "send(f());",
+
+      GUM_TESTS_MODULE_NAME,
+      code,
+      TRANSFORM_RULES_SECOND_STEP_OFFSET,
+      TRANSFORM_RULES_STEP_SIZE);
+  EXPECT_SEND_MESSAGE_WITH ("2");
+  EXPECT_SEND_MESSAGE_WITH ("3");
+  EXPECT_NO_MESSAGES ();
+
+  gum_free_pages (code);
+}
+
+TESTCASE (execution_can_be_transformed_with_block_counter_rules)
+{
+  gpointer code;
+  gsize num_blocks = 0;
+
+  code = transform_rules_code_new ();
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "const testsRange = Process.getModuleByName('%s');"
+      "Stalker.exclude(testsRange);"
+
+      "const code = " GUM_PTR_CONST ";"
+      "const f = new NativeFunction(code, 'int', [], { traps: 'all' });"
+
+      "Stalker.follow({"
+      "  transform: {"
+      "    blockCounters: [{"
+      "      base: code,"
+      "      size: %u,"
+      "      counter: " GUM_PTR_CONST
+      "    }]"
+      "  }"
+      "});"
+
+      "f();"
+      "f();"
+      "f();"
+
+      "Stalker.unfollow();"
+      "Stalker.flush();",
+
+      GUM_TESTS_MODULE_NAME,
+      code,
+      (guint) sizeof (transform_rules_code),
+      &num_blocks);
+  EXPECT_NO_MESSAGES ();
+
+  g_assert_cmpuint (num_blocks, ==, 3);
+
+  gum_free_pages (code);
+}
+
+TESTCASE (invalid_transform_rules_should_be_rejected)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "function tryFollow(transform) {"
+      "  try {"
+      "    Stalker.follow({ transform });"
+      "    send('followed');"
+      "  } catch (e) {"
+      "    send(e.message);"
+      "  }"
+      "}"
+
+      "tryFollow({ callout: [] });"
+      "tryFollow({ drop: {} });"
+      "tryFollow({ callouts: [{ callout: ptr(1) }] });"
+      "tryFollow({ callouts: [{ mnemonic: 'nop', callout: 'nope' }] });"
+      "tryFollow({ drop: [42] });"
+      "tryFollow({ blockCounters: [{ base: ptr(1), size: 1 }] });");
+  EXPECT_SEND_MESSAGE_WITH ("\"unknown transform rule kind: callout\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"transform rules must be specified as arrays\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"callout mnemonic must be a string\"");
+  EXPECT_SEND_MESSAGE_WITH_PREFIX ("\"expected a");
+  EXPECT_SEND_MESSAGE_WITH ("\"expected a range object\"");
+  EXPECT_SEND_MESSAGE_WITH_PREFIX ("\"expected a");
+  EXPECT_NO_MESSAGES ();
+
+  g_assert_false (
+      gum_stalker_is_following_me (gum_script_get_stalker (fixture->script)));
+}
+
+static gpointer
+transform_rules_code_new (void)
+{
+  gpointer code;
+
+  code = gum_alloc_n_pages (1, GUM_PAGE_RW);
+  memcpy (code, transform_rules_code, sizeof (transform_rules_code));
+  gum_mprotect (code, gum_query_page_size (), GUM_PAGE_RX);
+  gum_clear_cache (code, sizeof (transform_rules_code));
+
+  transform_rules_code_range.base_address = GUM_ADDRESS (code);
+  transform_rules_code_range.size = sizeof (transform_rules_code);
+
+  return code;
+}
+
+/*
+ * Everything else the thread runs while followed is transformed too, so only
+ * count the steps in our own code.
+ */
+static void
+count_transform_rules_callout (GumCpuContext * cpu_context,
+                               gpointer user_data)
+{
+  guint * num_steps = user_data;
+  GumAddress pc;
+
+#ifdef HAVE_I386
+  pc = GUM_CPU_CONTEXT_XIP (cpu_context);
+#else
+  pc = cpu_context->pc;
+#endif
+
+  if (GUM_MEMORY_RANGE_INCLUDES (&transform_rules_code_range, pc))
+    (*num_steps)++;
+}
+
 #endif
 
 TESTCASE (stalker_events_can_be_parsed)
@@ -5271,6 +5503,30 @@ TESTCASE (interceptor_should_support_native_pointer_values)
   EXPECT_NO_MESSAGES ();
 }
 
+TESTCASE (interceptor_stats_can_be_queried)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "const target = " GUM_PTR_CONST ";"
+      "Interceptor.setStatsEnabled(true);"
+      "Interceptor.attach(target, {"
+      "  onEnter(args) {}"
+      "});"
+      "recv('query', () => {"
+      "  const stats = Interceptor.getStats(target);"
+      "  send([stats.hits, stats.listenerTime > 0]);"
+      "  send(Interceptor.getStats(ptr(1)));"
+      "});", target_function_int);
+  EXPECT_NO_MESSAGES ();
+
+  target_function_int (1);
+  target_function_int (2);
+  EXPECT_NO_MESSAGES ();
+
+  POST_MESSAGE ("{\"type\":\"query\"}");
+  EXPECT_SEND_MESSAGE_WITH ("[2,true]");
+  EXPECT_SEND_MESSAGE_WITH ("null");
+}
+
 TESTCASE (interceptor_handles_invalid_arguments)
 {
   if (!check_exception_handling_testable ())
@@ -5474,6 +5730,82 @@ TESTCASE (memory_scan_should_be_interruptible)
   EXPECT_SEND_MESSAGE_WITH ("\"onComplete\"");
 }
 
+TESTCASE (memory_ranges_can_be_scanned)
+{
+  guint8 haystack[] = { 0x01, 0x02, 0x13, 0x37, 0x03, 0x13, 0x37 };
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "const base = " GUM_PTR_CONST ";"
+      "const ranges = ["
+        "{ base: base, size: 4 },"
+        "{ base: base.add(4), size: 3 }"
+      "];"
+      "Memory.scanRanges(ranges, '13 37', {"
+        "onMatch(address, size) {"
+        "  send('onMatch offset=' + address.sub(base).toInt32() + "
+              "' size=' + size);"
+        "},"
+        "onComplete() {"
+        "  send('onComplete');"
+        "}"
+      "});"
+      "for (const match of Memory.scanRangesSync(ranges, '13 37')) {"
+      "  send(`match offset=${match.address.sub(base).toInt32()} "
+          "size=${match.size}`);"
+      "}",
+      haystack);
+  EXPECT_SEND_MESSAGE_WITH ("\"match offset=2 size=2\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"match offset=5 size=2\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"onMatch offset=2 size=2\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"onMatch offset=5 size=2\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"onComplete\"");
+}
+
+TESTCASE (memory_can_be_read_in_batches)
+{
+  guint8 data[] = { 0x01, 0x02, 0x13, 0x37, 0x03, 0xca, 0xfe };
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "const base = " GUM_PTR_CONST ";"
+      "const buffer = Memory.readBatch(["
+        "{ base: base.add(2), size: 2 },"
+        "{ base: base.add(5), size: 2 },"
+        "{ base: ptr('0x1'), size: 1 }"
+      "]);"
+      "send(Array.from(new Uint8Array(buffer)).join(','));"
+      "send(buffer.bytesRead.join(','));",
+      data);
+  EXPECT_SEND_MESSAGE_WITH ("\"19,55,202,254,0\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"2,2,0\"");
+}
+
+TESTCASE (memory_can_be_scanned_for_multiple_patterns)
+{
+  guint8 haystack[] = { 0x01, 0x02, 0x13, 0x37, 0x03, 0xca, 0xfe };
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "const base = " GUM_PTR_CONST ";"
+      "Memory.scan(base, 7, ['ca fe', '13 37'], {"
+        "onMatch(address, size, patternIndex) {"
+        "  send(`onMatch offset=${address.sub(base).toInt32()} "
+              "size=${size} pattern=${patternIndex}`);"
+        "},"
+        "onComplete() {"
+        "  send('onComplete');"
+        "}"
+      "});"
+      "for (const match of Memory.scanSync(base, 7, ['ca fe', '13 37'])) {"
+      "  send(`match offset=${match.address.sub(base).toInt32()} "
+          "pattern=${match.pattern}`);"
+      "}",
+      haystack);
+  EXPECT_SEND_MESSAGE_WITH ("\"match offset=2 pattern=1\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"match offset=5 pattern=0\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"onMatch offset=2 size=2 pattern=1\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"onMatch offset=5 size=2 pattern=0\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"onComplete\"");
+}
+
 TESTCASE (memory_scan_handles_unreadable_memory)
 {
   if (!check_exception_handling_testable ())
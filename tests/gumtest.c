@@ -174,6 +174,7 @@ main (gint argc, gchar * argv[])
   TESTLIST_REGISTER (tls);
   TESTLIST_REGISTER (cloak);
   TESTLIST_REGISTER (memory);
+  TESTLIST_REGISTER (codeallocator);
   TESTLIST_REGISTER (process);
 #if !defined (HAVE_QNX) && !(defined (HAVE_ANDROID) && defined (HAVE_ARM64))
   TESTLIST_REGISTER (symbolutil);
@@ -128,6 +128,11 @@ gum_fake_event_sink_dump (GumFakeEventSink * self)
         g_print ("GUM_RET at %p, target=%p\n", ev->ret.location,
             ev->ret.target);
         break;
+      case GUM_MEMORY:
+        g_print ("GUM_MEMORY at %p, address=%p, size=%u, operation=%s\n",
+            ev->memory.location, ev->memory.address, ev->memory.size,
+            (ev->memory.operation == GUM_MEMOP_WRITE) ? "write" : "read");
+        break;
       default:
         g_print ("UNKNOWN EVENT\n");
         break;